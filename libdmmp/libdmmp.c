@@ -19,6 +19,7 @@
  */
 
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
 #include <sys/time.h>
@@ -32,6 +33,7 @@
 #include <json.h>
 #include <time.h>
 #include <mpath_cmd.h>
+#include <mpath_tlv.h>
 
 #include "libdmmp/libdmmp.h"
 #include "libdmmp_private.h"
@@ -42,6 +44,7 @@
  */
 
 #define _DMMP_IPC_SHOW_JSON_CMD			"show maps json"
+#define _DMMP_IPC_SHOW_BINARY_CMD		"show maps binary"
 #define _DMMP_JSON_MAJOR_KEY			"major_version"
 #define _DMMP_JSON_MAJOR_VERSION		0
 #define _DMMP_JSON_MAPS_KEY			"maps"
@@ -57,6 +60,7 @@ struct dmmp_context {
 	int log_priority;
 	void *userdata;
 	unsigned int tmo;
+	int ipc_format;
 	char last_err_msg[_LAST_ERR_MSG_BUFF_SIZE];
 };
 
@@ -67,9 +71,11 @@ struct dmmp_context {
  * will keep retry mpath_process_cmd() tile meet the time of
  * dmmp_context_timeout_get().
  * Need to free `*output` string manually.
+ * If `output_len` is not NULL, it is set to the size of `*output`, which
+ * is not necessarily a string.
  */
 static int _process_cmd(struct dmmp_context *ctx, int fd, const char *cmd,
-			char **output);
+			char **output, size_t *output_len);
 
 static int _ipc_connect(struct dmmp_context *ctx, int *fd);
 
@@ -83,6 +89,9 @@ _dmmp_getter_func_gen(dmmp_context_userdata_get, struct dmmp_context, ctx,
 _dmmp_getter_func_gen(dmmp_context_timeout_get, struct dmmp_context, ctx, tmo,
 		      unsigned int);
 
+_dmmp_getter_func_gen(dmmp_context_ipc_format_get, struct dmmp_context, ctx,
+		      ipc_format, int);
+
 _dmmp_getter_func_gen(dmmp_last_error_msg, struct dmmp_context, ctx,
 		      last_err_msg, const char *);
 
@@ -118,6 +127,7 @@ struct dmmp_context *dmmp_context_new(void)
 	ctx->log_priority = DMMP_LOG_PRIORITY_DEFAULT;
 	ctx->userdata = NULL;
 	ctx->tmo = _DEFAULT_UXSOCK_TIMEOUT;
+	ctx->ipc_format = DMMP_IPC_FORMAT_DEFAULT;
 	memset(ctx->last_err_msg, 0, _LAST_ERR_MSG_BUFF_SIZE);
 
 	return ctx;
@@ -140,6 +150,12 @@ void dmmp_context_timeout_set(struct dmmp_context *ctx, unsigned int tmo)
 	ctx->tmo = tmo;
 }
 
+void dmmp_context_ipc_format_set(struct dmmp_context *ctx, int ipc_format)
+{
+	assert(ctx != NULL);
+	ctx->ipc_format = ipc_format;
+}
+
 void dmmp_context_log_func_set
 	(struct dmmp_context *ctx,
 	 void (*log_func)(struct dmmp_context *ctx, int priority,
@@ -156,8 +172,9 @@ void dmmp_context_userdata_set(struct dmmp_context *ctx, void *userdata)
 	ctx->userdata = userdata;
 }
 
-int dmmp_mpath_array_get(struct dmmp_context *ctx,
-			 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count)
+static int _mpath_array_get_json(struct dmmp_context *ctx, int ipc_fd,
+				 struct dmmp_mpath ***dmmp_mps,
+				 uint32_t *dmmp_mp_count)
 {
 	struct dmmp_mpath *dmmp_mp = NULL;
 	int rc = DMMP_OK;
@@ -170,18 +187,8 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 	uint32_t i = 0;
 	int cur_json_major_version = -1;
 	int ar_maps_len = -1;
-	int ipc_fd = -1;
-
-	assert(ctx != NULL);
-	assert(dmmp_mps != NULL);
-	assert(dmmp_mp_count != NULL);
 
-	*dmmp_mps = NULL;
-	*dmmp_mp_count = 0;
-
-	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-
-	_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_JSON_CMD, &j_str),
+	_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_JSON_CMD, &j_str, NULL),
 	      rc, out);
 
 	_debug(ctx, "Got json output from multipathd: '%s'", j_str);
@@ -258,8 +265,6 @@ int dmmp_mpath_array_get(struct dmmp_context *ctx,
 	}
 
 out:
-	if (ipc_fd >= 0)
-		mpath_disconnect(ipc_fd);
 	free(j_str);
 	if (j_token != NULL)
 		json_tokener_free(j_token);
@@ -275,8 +280,154 @@ out:
 	return rc;
 }
 
+static int _mpath_array_get_binary(struct dmmp_context *ctx, int ipc_fd,
+				   struct dmmp_mpath ***dmmp_mps,
+				   uint32_t *dmmp_mp_count)
+{
+	struct dmmp_mpath *dmmp_mp = NULL;
+	int rc = DMMP_OK;
+	char *output = NULL;
+	size_t output_len = 0;
+	struct mpath_tlv_header hdr;
+	struct _dmmp_tlv tlv;
+	const char *buf = NULL;
+	size_t len = 0;
+	uint32_t i = 0;
+
+	_good(_process_cmd(ctx, ipc_fd, _DMMP_IPC_SHOW_BINARY_CMD, &output,
+			   &output_len),
+	      rc, out);
+
+	/* Older multipathd replies with the command help instead */
+	if ((output_len < sizeof(hdr) + 1) ||
+	    (memcmp(output, MPATH_TLV_MAGIC, MPATH_TLV_MAGIC_LEN) != 0)) {
+		rc = DMMP_ERR_INCOMPATIBLE;
+		_debug(ctx, "multipathd does not support binary output");
+		goto out;
+	}
+	memcpy(&hdr, output, sizeof(hdr));
+	if (hdr.major != MPATH_TLV_MAJOR_VERSION) {
+		rc = DMMP_ERR_INCOMPATIBLE;
+		_debug(ctx, "Incompatible multipathd binary major version %"
+		       PRIu16 ", should be %d", hdr.major,
+		       MPATH_TLV_MAJOR_VERSION);
+		goto out;
+	}
+	if (hdr.len > output_len - sizeof(hdr) - 1) {
+		rc = DMMP_ERR_IPC_ERROR;
+		_error(ctx, "Invalid binary output from multipathd IPC: "
+		       "got %zu bytes, expected %zu", output_len,
+		       sizeof(hdr) + hdr.len + 1);
+		goto out;
+	}
+	_debug(ctx, "Got %zu bytes binary output from multipathd, "
+	       "version %" PRIu16 ".%" PRIu16, output_len, hdr.major,
+	       hdr.minor);
+
+	buf = output + sizeof(hdr);
+	len = hdr.len;
+
+	*dmmp_mp_count = _dmmp_tlv_count(buf, len, MPATH_TLV_MAP);
+	if (*dmmp_mp_count == 0)
+		goto out;
+
+	*dmmp_mps = (struct dmmp_mpath **)
+		calloc(*dmmp_mp_count, sizeof(struct dmmp_mpath *));
+	_dmmp_alloc_null_check(ctx, *dmmp_mps, rc, out);
+
+	while (len > 0) {
+		_good(_dmmp_tlv_next(ctx, &buf, &len, &tlv), rc, out);
+		if (tlv.tag != MPATH_TLV_MAP)
+			continue;
+		if (i >= *dmmp_mp_count) {
+			rc = DMMP_ERR_BUG;
+			_error(ctx, "BUG: more mpaths than counted");
+			goto out;
+		}
+		dmmp_mp = _dmmp_mpath_new();
+		_dmmp_alloc_null_check(ctx, dmmp_mp, rc, out);
+		(*dmmp_mps)[i++] = dmmp_mp;
+		_good(_dmmp_mpath_update_tlv(ctx, dmmp_mp, tlv.value, tlv.len),
+		      rc, out);
+	}
+
+out:
+	free(output);
+
+	if (rc != DMMP_OK) {
+		dmmp_mpath_array_free(*dmmp_mps, *dmmp_mp_count);
+		*dmmp_mps = NULL;
+		*dmmp_mp_count = 0;
+	}
+
+	return rc;
+}
+
+int dmmp_mpath_array_get(struct dmmp_context *ctx,
+			 struct dmmp_mpath ***dmmp_mps, uint32_t *dmmp_mp_count)
+{
+	int rc = DMMP_OK;
+	int ipc_fd = -1;
+
+	assert(ctx != NULL);
+	assert(dmmp_mps != NULL);
+	assert(dmmp_mp_count != NULL);
+
+	*dmmp_mps = NULL;
+	*dmmp_mp_count = 0;
+
+	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
+
+	if (ctx->ipc_format != DMMP_IPC_FORMAT_JSON) {
+		rc = _mpath_array_get_binary(ctx, ipc_fd, dmmp_mps,
+					     dmmp_mp_count);
+		if (rc != DMMP_ERR_INCOMPATIBLE)
+			goto out;
+		if (ctx->ipc_format == DMMP_IPC_FORMAT_BINARY) {
+			_error(ctx, "multipathd does not support the binary "
+			       "IPC format");
+			goto out;
+		}
+		_debug(ctx, "Falling back to JSON");
+	}
+	rc = _mpath_array_get_json(ctx, ipc_fd, dmmp_mps, dmmp_mp_count);
+
+out:
+	if (ipc_fd >= 0)
+		mpath_disconnect(ipc_fd);
+	return rc;
+}
+
+/*
+ * Like mpath_process_cmd(), but also return the size of the reply.
+ */
+static int _mpath_process_cmd(int fd, const char *cmd, char **output,
+			      size_t *output_len, unsigned int tmo)
+{
+	ssize_t len = 0;
+
+	*output = NULL;
+	*output_len = 0;
+
+	if (mpath_send_cmd(fd, cmd) != 0)
+		return -1;
+	len = mpath_recv_reply_len(fd, tmo);
+	if (len <= 0)
+		return len;
+	*output = (char *) malloc(len);
+	if (*output == NULL)
+		return -1;
+	if (mpath_recv_reply_data(fd, *output, len, tmo) != 0) {
+		free(*output);
+		*output = NULL;
+		return -1;
+	}
+	*output_len = len;
+	return 0;
+}
+
 static int _process_cmd(struct dmmp_context *ctx, int fd, const char *cmd,
-			char **output)
+			char **output, size_t *output_len)
 {
 	int errno_save = 0;
 	int rc = DMMP_OK;
@@ -286,6 +437,7 @@ static int _process_cmd(struct dmmp_context *ctx, int fd, const char *cmd,
 	unsigned int ipc_tmo = 0;
 	bool flag_check_tmo = false;
 	unsigned int elapsed = 0;
+	size_t len = 0;
 
 	assert(output != NULL);
 	assert(ctx != NULL);
@@ -307,7 +459,7 @@ invoke:
 	_debug(ctx, "Invoking IPC command '%s' with IPC tmo %u milliseconds",
 	       cmd, ipc_tmo);
 	flag_check_tmo = false;
-	if (mpath_process_cmd(fd, cmd, output, ipc_tmo) != 0) {
+	if (_mpath_process_cmd(fd, cmd, output, &len, ipc_tmo) != 0) {
 		errno_save = errno;
 		memset(errno_str_buff, 0, _ERRNO_STR_BUFF_SIZE);
 		strerror_r(errno_save, errno_str_buff, _ERRNO_STR_BUFF_SIZE);
@@ -376,7 +528,10 @@ out:
 	if (rc != DMMP_OK) {
 		free(*output);
 		*output = NULL;
+		len = 0;
 	}
+	if (output_len != NULL)
+		*output_len = len;
 	return rc;
 }
 
@@ -431,7 +586,7 @@ int dmmp_flush_mpath(struct dmmp_context *ctx, const char *mpath_name)
 	}
 
 	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-	_good(_process_cmd(ctx, ipc_fd, cmd, &output), rc, out);
+	_good(_process_cmd(ctx, ipc_fd, cmd, &output, NULL), rc, out);
 
 	/* _process_cmd() already make sure output is not NULL */
 
@@ -480,7 +635,7 @@ int dmmp_reconfig(struct dmmp_context *ctx)
 	snprintf(cmd, _IPC_MAX_CMD_LEN, "%s", "reconfigure");
 
 	_good(_ipc_connect(ctx, &ipc_fd), rc, out);
-	_good(_process_cmd(ctx, ipc_fd, cmd, &output), rc, out);
+	_good(_process_cmd(ctx, ipc_fd, cmd, &output, NULL), rc, out);
 
 out:
 	if (ipc_fd >= 0)
@@ -54,6 +54,12 @@ extern "C" {
 
 #define DMMP_LOG_PRIORITY_DEFAULT	DMMP_LOG_PRIORITY_WARNING
 
+#define DMMP_IPC_FORMAT_AUTO		0
+#define DMMP_IPC_FORMAT_JSON		1
+#define DMMP_IPC_FORMAT_BINARY		2
+
+#define DMMP_IPC_FORMAT_DEFAULT		DMMP_IPC_FORMAT_AUTO
+
 /**
  * dmmp_log_priority_str() - Convert log priority to string.
  *
@@ -197,6 +203,53 @@ DMMP_DLL_EXPORT void dmmp_context_timeout_set(struct dmmp_context *ctx,
  */
 DMMP_DLL_EXPORT unsigned int dmmp_context_timeout_get(struct dmmp_context *ctx);
 
+/**
+ * dmmp_context_ipc_format_set() - Set IPC format of multipathd replies.
+ *
+ * Choose how dmmp_mpath_array_get() queries multipathd. The compact binary
+ * format is much cheaper to produce and to parse than JSON, but only
+ * supported by newer multipathd daemons.
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * @ipc_format:
+ *	int, valid values are:
+ *
+ *	* DMMP_IPC_FORMAT_AUTO
+ *		-- Use the binary format, and fall back to JSON if multipathd
+ *		   does not support it. This is the default.
+ *
+ *	* DMMP_IPC_FORMAT_JSON
+ *		-- Always use JSON.
+ *
+ *	* DMMP_IPC_FORMAT_BINARY
+ *		-- Always use the binary format. dmmp_mpath_array_get() will
+ *		   fail with DMMP_ERR_INCOMPATIBLE if multipathd does not
+ *		   support it.
+ *
+ * Return:
+ *	void
+ */
+DMMP_DLL_EXPORT void dmmp_context_ipc_format_set(struct dmmp_context *ctx,
+						 int ipc_format);
+
+/**
+ * dmmp_context_ipc_format_get() - Get IPC format of multipathd replies.
+ *
+ * Retrieve the IPC format set by dmmp_context_ipc_format_set(), or
+ * DMMP_IPC_FORMAT_DEFAULT.
+ *
+ * @ctx:
+ *	Pointer of 'struct dmmp_context'.
+ *	If this pointer is NULL, your program will be terminated by assert.
+ *
+ * Return:
+ *	int, IPC format.
+ */
+DMMP_DLL_EXPORT int dmmp_context_ipc_format_get(struct dmmp_context *ctx);
+
 /**
  * dmmp_context_log_priority_set() - Set log priority.
  *
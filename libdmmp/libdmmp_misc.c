@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <assert.h>
+#include <inttypes.h>
 #include <json.h>
 
 #include "libdmmp/libdmmp.h"
@@ -89,3 +90,91 @@ void _dmmp_log_stderr(struct dmmp_context *ctx, int priority,
 		fprintf(stderr, " # %s:%s():%d\n", file, func_name, line);
 	}
 }
+
+int _dmmp_tlv_next(struct dmmp_context *ctx, const char **buf, size_t *len,
+		   struct _dmmp_tlv *tlv)
+{
+	struct mpath_tlv hdr;
+
+	assert(buf != NULL);
+	assert(len != NULL);
+	assert(tlv != NULL);
+
+	if (*len < sizeof(hdr))
+		goto truncated;
+	memcpy(&hdr, *buf, sizeof(hdr));
+	if (hdr.len > *len - sizeof(hdr))
+		goto truncated;
+
+	tlv->tag = hdr.tag;
+	tlv->len = hdr.len;
+	tlv->value = *buf + sizeof(hdr);
+	*buf += sizeof(hdr) + hdr.len;
+	*len -= sizeof(hdr) + hdr.len;
+	return DMMP_OK;
+
+truncated:
+	_error(ctx, "Invalid binary output from multipathd IPC: "
+	       "truncated record");
+	return DMMP_ERR_IPC_ERROR;
+}
+
+uint32_t _dmmp_tlv_count(const char *buf, size_t len, uint16_t tag)
+{
+	struct mpath_tlv hdr;
+	uint32_t count = 0;
+
+	while (len >= sizeof(hdr)) {
+		memcpy(&hdr, buf, sizeof(hdr));
+		if (hdr.len > len - sizeof(hdr))
+			break;
+		if (hdr.tag == tag)
+			++count;
+		buf += sizeof(hdr) + hdr.len;
+		len -= sizeof(hdr) + hdr.len;
+	}
+	return count;
+}
+
+int _dmmp_tlv_u32_get(struct dmmp_context *ctx, const struct _dmmp_tlv *tlv,
+		      uint32_t *value)
+{
+	assert(tlv != NULL);
+	assert(value != NULL);
+
+	if (tlv->len != sizeof(uint32_t)) {
+		_error(ctx, "Invalid binary output from multipathd IPC: "
+		       "tag %" PRIu16 " has length %" PRIu32 ", should be %zu",
+		       tlv->tag, tlv->len, sizeof(uint32_t));
+		return DMMP_ERR_IPC_ERROR;
+	}
+	memcpy(value, tlv->value, sizeof(uint32_t));
+	return DMMP_OK;
+}
+
+int _dmmp_tlv_str_get(struct dmmp_context *ctx, const struct _dmmp_tlv *tlv,
+		      char **value)
+{
+	int rc = DMMP_OK;
+
+	assert(tlv != NULL);
+	assert(value != NULL);
+
+	free(*value);
+	*value = strndup(tlv->value, tlv->len);
+	_dmmp_alloc_null_check(ctx, *value, rc, out);
+out:
+	return rc;
+}
+
+void _dmmp_tlv_str_copy(const struct _dmmp_tlv *tlv, char *buf, size_t size)
+{
+	size_t len = tlv->len;
+
+	assert(size > 0);
+
+	if (len >= size)
+		len = size - 1;
+	memcpy(buf, tlv->value, len);
+	buf[len] = '\0';
+}
@@ -55,6 +55,7 @@ struct dmmp_mpath *_dmmp_mpath_new(void)
 		dmmp_mp->alias = NULL;
 		dmmp_mp->dmmp_pg_count = 0;
 		dmmp_mp->dmmp_pgs = NULL;
+		dmmp_mp->kdev_name = NULL;
 	}
 	return dmmp_mp;
 }
@@ -130,6 +131,80 @@ out:
 	return rc;
 }
 
+int _dmmp_mpath_update_tlv(struct dmmp_context *ctx,
+			   struct dmmp_mpath *dmmp_mp,
+			   const char *buf, size_t len)
+{
+	int rc = DMMP_OK;
+	struct _dmmp_tlv tlv;
+	uint32_t i = 0;
+	struct dmmp_path_group *dmmp_pg = NULL;
+
+	assert(ctx != NULL);
+	assert(dmmp_mp != NULL);
+	assert(buf != NULL);
+
+	dmmp_mp->dmmp_pg_count = _dmmp_tlv_count(buf, len,
+						 MPATH_TLV_PATHGROUP);
+	if (dmmp_mp->dmmp_pg_count > 0) {
+		dmmp_mp->dmmp_pgs = (struct dmmp_path_group **)
+			calloc(dmmp_mp->dmmp_pg_count,
+			       sizeof(struct dmmp_path_group *));
+		_dmmp_alloc_null_check(ctx, dmmp_mp->dmmp_pgs, rc, out);
+	}
+
+	while (len > 0) {
+		_good(_dmmp_tlv_next(ctx, &buf, &len, &tlv), rc, out);
+		switch (tlv.tag) {
+		case MPATH_TLV_MAP_UUID:
+			_good(_dmmp_tlv_str_get(ctx, &tlv, &dmmp_mp->wwid),
+			      rc, out);
+			break;
+		case MPATH_TLV_MAP_NAME:
+			_good(_dmmp_tlv_str_get(ctx, &tlv, &dmmp_mp->alias),
+			      rc, out);
+			break;
+		case MPATH_TLV_MAP_SYSFS:
+			_good(_dmmp_tlv_str_get(ctx, &tlv,
+						&dmmp_mp->kdev_name),
+			      rc, out);
+			break;
+		case MPATH_TLV_PATHGROUP:
+			if (i >= dmmp_mp->dmmp_pg_count) {
+				rc = DMMP_ERR_BUG;
+				_error(ctx, "BUG: more path groups than "
+				       "counted");
+				goto out;
+			}
+			dmmp_pg = _dmmp_path_group_new();
+			_dmmp_alloc_null_check(ctx, dmmp_pg, rc, out);
+			dmmp_mp->dmmp_pgs[i++] = dmmp_pg;
+			_good(_dmmp_path_group_update_tlv(ctx, dmmp_pg,
+							  tlv.value, tlv.len),
+			      rc, out);
+			break;
+		default:
+			/* not used by libdmmp, or newer than us */
+			break;
+		}
+	}
+
+	_dmmp_null_or_empty_str_check(ctx, dmmp_mp->wwid, rc, out);
+	_dmmp_null_or_empty_str_check(ctx, dmmp_mp->alias, rc, out);
+	if (dmmp_mp->kdev_name == NULL) {
+		rc = DMMP_ERR_IPC_ERROR;
+		_error(ctx, "Invalid binary output from multipathd IPC: "
+		       "no sysfs name for mpath %s", dmmp_mp->alias);
+		goto out;
+	}
+
+	_debug(ctx, "Got mpath wwid: '%s', alias: '%s'", dmmp_mp->wwid,
+	       dmmp_mp->alias);
+
+out:
+	return rc;
+}
+
 void _dmmp_mpath_free(struct dmmp_mpath *dmmp_mp)
 {
 	if (dmmp_mp == NULL)
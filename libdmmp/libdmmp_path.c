@@ -106,6 +106,51 @@ out:
 	return rc;
 }
 
+int _dmmp_path_update_tlv(struct dmmp_context *ctx, struct dmmp_path *dmmp_p,
+			  const char *buf, size_t len)
+{
+	int rc = DMMP_OK;
+	struct _dmmp_tlv tlv;
+	char status_str[_DMMP_TLV_STATUS_STR_LEN] = "";
+
+	assert(ctx != NULL);
+	assert(dmmp_p != NULL);
+	assert(buf != NULL);
+
+	while (len > 0) {
+		_good(_dmmp_tlv_next(ctx, &buf, &len, &tlv), rc, out);
+		switch (tlv.tag) {
+		case MPATH_TLV_PATH_DEV:
+			_good(_dmmp_tlv_str_get(ctx, &tlv, &dmmp_p->blk_name),
+			      rc, out);
+			break;
+		case MPATH_TLV_PATH_CHK_ST:
+			_dmmp_tlv_str_copy(&tlv, status_str,
+					   sizeof(status_str));
+			break;
+		default:
+			/* not used by libdmmp, or newer than us */
+			break;
+		}
+	}
+
+	_dmmp_null_or_empty_str_check(ctx, dmmp_p->blk_name, rc, out);
+	if (status_str[0] == '\0') {
+		rc = DMMP_ERR_BUG;
+		_error(ctx, "BUG: Got empty path status");
+		goto out;
+	}
+
+	dmmp_p->status = _dmmp_path_status_str_conv(ctx, status_str);
+
+	_debug(ctx, "Got path blk_name: '%s'", dmmp_p->blk_name);
+	_debug(ctx, "Got path status: %s(%" PRIu32 ")",
+	       dmmp_path_status_str(dmmp_p->status), dmmp_p->status);
+
+out:
+	return rc;
+}
+
 void _dmmp_path_free(struct dmmp_path *dmmp_p)
 {
 	if (dmmp_p == NULL)
@@ -177,6 +177,95 @@ out:
 	return rc;
 }
 
+int _dmmp_path_group_update_tlv(struct dmmp_context *ctx,
+				struct dmmp_path_group *dmmp_pg,
+				const char *buf, size_t len)
+{
+	int rc = DMMP_OK;
+	struct _dmmp_tlv tlv;
+	char status_str[_DMMP_TLV_STATUS_STR_LEN] = "";
+	uint32_t priority = 0;
+	uint32_t i = 0;
+	struct dmmp_path *dmmp_p = NULL;
+
+	assert(ctx != NULL);
+	assert(dmmp_pg != NULL);
+	assert(buf != NULL);
+
+	dmmp_pg->dmmp_p_count = _dmmp_tlv_count(buf, len, MPATH_TLV_PATH);
+	if (dmmp_pg->dmmp_p_count > 0) {
+		dmmp_pg->dmmp_ps = (struct dmmp_path **)
+			calloc(dmmp_pg->dmmp_p_count,
+			       sizeof(struct dmmp_path *));
+		_dmmp_alloc_null_check(ctx, dmmp_pg->dmmp_ps, rc, out);
+	}
+
+	while (len > 0) {
+		_good(_dmmp_tlv_next(ctx, &buf, &len, &tlv), rc, out);
+		switch (tlv.tag) {
+		case MPATH_TLV_PG_SELECTOR:
+			_good(_dmmp_tlv_str_get(ctx, &tlv, &dmmp_pg->selector),
+			      rc, out);
+			break;
+		case MPATH_TLV_PG_DM_ST:
+			_dmmp_tlv_str_copy(&tlv, status_str,
+					   sizeof(status_str));
+			break;
+		case MPATH_TLV_PG_PRI:
+			_good(_dmmp_tlv_u32_get(ctx, &tlv, &priority),
+			      rc, out);
+			break;
+		case MPATH_TLV_PG_GROUP:
+			_good(_dmmp_tlv_u32_get(ctx, &tlv, &dmmp_pg->id),
+			      rc, out);
+			break;
+		case MPATH_TLV_PATH:
+			if (i >= dmmp_pg->dmmp_p_count) {
+				rc = DMMP_ERR_BUG;
+				_error(ctx, "BUG: more paths than counted");
+				goto out;
+			}
+			dmmp_p = _dmmp_path_new();
+			_dmmp_alloc_null_check(ctx, dmmp_p, rc, out);
+			dmmp_pg->dmmp_ps[i++] = dmmp_p;
+			_good(_dmmp_path_update_tlv(ctx, dmmp_p, tlv.value,
+						    tlv.len),
+			      rc, out);
+			break;
+		default:
+			/* not used by libdmmp, or newer than us */
+			break;
+		}
+	}
+
+	/* same as the JSON "pri", which is signed */
+	dmmp_pg->priority = ((int32_t) priority <= 0) ? 0 : priority;
+
+	_dmmp_null_or_empty_str_check(ctx, dmmp_pg->selector, rc, out);
+	if (status_str[0] == '\0') {
+		rc = DMMP_ERR_BUG;
+		_error(ctx, "BUG: Got empty path group status");
+		goto out;
+	}
+	if (dmmp_pg->id == _DMMP_PATH_GROUP_ID_UNKNOWN) {
+		rc = DMMP_ERR_BUG;
+		_error(ctx, "BUG: Got unknown(%d) path group ID",
+		       _DMMP_PATH_GROUP_ID_UNKNOWN);
+		goto out;
+	}
+
+	dmmp_pg->status = _dmmp_path_group_status_str_conv(ctx, status_str);
+
+	_debug(ctx, "Got path group id: %" PRIu32 "", dmmp_pg->id);
+	_debug(ctx, "Got path group priority: %" PRIu32 "", dmmp_pg->priority);
+	_debug(ctx, "Got path group status: %s(%" PRIu32 ")",
+	       dmmp_path_group_status_str(dmmp_pg->status), dmmp_pg->status);
+	_debug(ctx, "Got path group selector: '%s'", dmmp_pg->selector);
+
+out:
+	return rc;
+}
+
 void _dmmp_path_group_free(struct dmmp_path_group *dmmp_pg)
 {
 	uint32_t i = 0;
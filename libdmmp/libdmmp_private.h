@@ -31,6 +31,7 @@
 #include <string.h>
 #include <assert.h>
 #include <json.h>
+#include <mpath_tlv.h>
 
 #include "libdmmp/libdmmp.h"
 
@@ -46,6 +47,18 @@ extern "C" {
 	} while(0)
 
 #define _DMMP_PATH_GROUP_ID_UNKNOWN	0
+#define _DMMP_TLV_STATUS_STR_LEN	32
+
+/*
+ * A record of the binary output of multipathd, see mpath_tlv.h.
+ * The value points into the IPC output, it is not NULL terminated.
+ */
+struct DMMP_DLL_LOCAL _dmmp_tlv;
+struct _dmmp_tlv {
+	uint16_t tag;
+	uint32_t len;
+	const char *value;
+};
 
 struct DMMP_DLL_LOCAL _num_str_conv;
 struct _num_str_conv {
@@ -123,6 +136,46 @@ DMMP_DLL_LOCAL int _dmmp_path_update(struct dmmp_context *ctx,
 				     struct dmmp_path *dmmp_p,
 				     json_object *j_obj_p);
 
+/*
+ * Like the functions above, but for the binary output. The records in
+ * 'buf' are the value of a MPATH_TLV_MAP, MPATH_TLV_PATHGROUP or
+ * MPATH_TLV_PATH record. On error, the caller has to free the object.
+ */
+DMMP_DLL_LOCAL int _dmmp_mpath_update_tlv(struct dmmp_context *ctx,
+					  struct dmmp_mpath *dmmp_mp,
+					  const char *buf, size_t len);
+DMMP_DLL_LOCAL int _dmmp_path_group_update_tlv(struct dmmp_context *ctx,
+					       struct dmmp_path_group *dmmp_pg,
+					       const char *buf, size_t len);
+DMMP_DLL_LOCAL int _dmmp_path_update_tlv(struct dmmp_context *ctx,
+					 struct dmmp_path *dmmp_p,
+					 const char *buf, size_t len);
+
+/*
+ * Get the next record from 'buf' and advance 'buf' and 'len' past it.
+ */
+DMMP_DLL_LOCAL int _dmmp_tlv_next(struct dmmp_context *ctx, const char **buf,
+				  size_t *len, struct _dmmp_tlv *tlv);
+/*
+ * Count the records with the given tag, to size the arrays up front.
+ */
+DMMP_DLL_LOCAL uint32_t _dmmp_tlv_count(const char *buf, size_t len,
+					uint16_t tag);
+DMMP_DLL_LOCAL int _dmmp_tlv_u32_get(struct dmmp_context *ctx,
+				     const struct _dmmp_tlv *tlv,
+				     uint32_t *value);
+/*
+ * Replace '*value' by a copy of the string value of the record.
+ */
+DMMP_DLL_LOCAL int _dmmp_tlv_str_get(struct dmmp_context *ctx,
+				     const struct _dmmp_tlv *tlv,
+				     char **value);
+/*
+ * Copy the string value of the record into 'buf', truncating it if needed.
+ */
+DMMP_DLL_LOCAL void _dmmp_tlv_str_copy(const struct _dmmp_tlv *tlv,
+				       char *buf, size_t size);
+
 DMMP_DLL_LOCAL void _dmmp_mpath_free(struct dmmp_mpath *dmmp_mp);
 DMMP_DLL_LOCAL void _dmmp_path_group_free(struct dmmp_path_group *dmmp_pg);
 DMMP_DLL_LOCAL void _dmmp_path_group_array_free
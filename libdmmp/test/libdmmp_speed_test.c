@@ -24,26 +24,76 @@
 #include <string.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <time.h>
 
 #include <libdmmp/libdmmp.h>
 
+#define _DEFAULT_LOOPS		10
+
+/*
+ * Query all mpaths 'loops' times with given IPC format, and return the
+ * average time in seconds, or a negative value on error.
+ */
+static double _speed_test(struct dmmp_context *ctx, int ipc_format,
+			  unsigned int loops, uint32_t *dmmp_mp_count)
+{
+	struct dmmp_mpath **dmmp_mps = NULL;
+	struct timespec start_ts;
+	struct timespec end_ts;
+	unsigned int i = 0;
+
+	dmmp_context_ipc_format_set(ctx, ipc_format);
+	clock_gettime(CLOCK_MONOTONIC, &start_ts);
+	for (; i < loops; ++i) {
+		if (dmmp_mpath_array_get(ctx, &dmmp_mps, dmmp_mp_count) != 0)
+			return -1;
+		dmmp_mpath_array_free(dmmp_mps, *dmmp_mp_count);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end_ts);
+
+	return ((end_ts.tv_sec - start_ts.tv_sec) +
+		(end_ts.tv_nsec - start_ts.tv_nsec) / 1e9) / loops;
+}
+
 int main(int argc, char *argv[])
 {
 	struct dmmp_context *ctx = NULL;
-	struct dmmp_mpath **dmmp_mps = NULL;
-	uint32_t dmmp_mp_count = 0;
+	uint32_t json_mp_count = 0;
+	uint32_t binary_mp_count = 0;
+	unsigned int loops = _DEFAULT_LOOPS;
+	double json_time = 0;
+	double binary_time = 0;
 	int rc = EXIT_SUCCESS;
 
+	if (argc > 1)
+		loops = strtoul(argv[1], NULL, 10);
+	if (loops == 0)
+		loops = _DEFAULT_LOOPS;
+
 	ctx = dmmp_context_new();
 	dmmp_context_log_priority_set(ctx, DMMP_LOG_PRIORITY_WARNING);
 
-	if (dmmp_mpath_array_get(ctx, &dmmp_mps, &dmmp_mp_count) != 0) {
+	json_time = _speed_test(ctx, DMMP_IPC_FORMAT_JSON, loops,
+				&json_mp_count);
+	binary_time = _speed_test(ctx, DMMP_IPC_FORMAT_BINARY, loops,
+				  &binary_mp_count);
+
+	if ((json_time < 0) || (binary_time < 0)) {
 		printf("FAILED\n");
 		rc = EXIT_FAILURE;
-	} else {
-		printf("Got %" PRIu32 " mpath\n", dmmp_mp_count);
-		dmmp_mpath_array_free(dmmp_mps, dmmp_mp_count);
+		goto out;
+	}
+	if (json_mp_count != binary_mp_count) {
+		printf("FAILED: got %" PRIu32 " mpath via JSON, but %" PRIu32
+		       " via binary format\n", json_mp_count, binary_mp_count);
+		rc = EXIT_FAILURE;
+		goto out;
 	}
+	printf("Got %" PRIu32 " mpath\n", json_mp_count);
+	printf("JSON:   %.6f seconds per query\n", json_time);
+	printf("binary: %.6f seconds per query\n", binary_time);
+
+out:
 	dmmp_context_free(ctx);
 	exit(rc);
 }
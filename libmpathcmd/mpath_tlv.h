@@ -0,0 +1,76 @@
+#ifndef MPATH_TLV_H_INCLUDED
+#define MPATH_TLV_H_INCLUDED
+
+/*
+ * Wire format of the "show maps binary" reply.
+ *
+ * The reply starts with struct mpath_tlv_header, followed by hdr.len
+ * bytes of records and a terminating '\0' byte, like every other
+ * multipathd reply. A record is a struct mpath_tlv followed by len
+ * bytes of value. MPATH_TLV_MAP, MPATH_TLV_PATHGROUP and MPATH_TLV_PATH
+ * records contain the records of their attributes and children;
+ * all other values are either strings (not '\0' terminated) or
+ * uint32_t. All numbers are in host byte order, as the socket is
+ * local. Records aren't aligned.
+ *
+ * Readers must skip records with unknown tags. New tags may be added
+ * with a new minor version; the major version changes only if the
+ * meaning of existing tags changes.
+ */
+
+#include <stdint.h>
+
+#define MPATH_TLV_MAGIC			"MPTL"
+#define MPATH_TLV_MAGIC_LEN		4
+#define MPATH_TLV_MAJOR_VERSION		1
+#define MPATH_TLV_MINOR_VERSION		0
+
+struct mpath_tlv_header {
+	char magic[MPATH_TLV_MAGIC_LEN];
+	uint16_t major;
+	uint16_t minor;
+	uint32_t len;
+};
+
+struct mpath_tlv {
+	uint16_t tag;
+	uint16_t flags;		/* reserved, 0 */
+	uint32_t len;
+};
+
+enum mpath_tlv_tag {
+	MPATH_TLV_MAP = 1,
+	MPATH_TLV_PATHGROUP,
+	MPATH_TLV_PATH,
+
+	/* strings, as in "show maps json" */
+	MPATH_TLV_MAP_NAME = 0x100,
+	MPATH_TLV_MAP_UUID,
+	MPATH_TLV_MAP_SYSFS,
+	MPATH_TLV_MAP_FAILBACK,
+	MPATH_TLV_MAP_QUEUEING,
+	MPATH_TLV_MAP_DM_ST,
+	MPATH_TLV_MAP_FEATURES,
+	MPATH_TLV_MAP_HWHANDLER,
+	MPATH_TLV_MAP_ACTION,
+	MPATH_TLV_MAP_WRITE_PROT,
+	MPATH_TLV_MAP_VEND,
+	MPATH_TLV_MAP_PROD,
+	MPATH_TLV_MAP_REV,
+
+	MPATH_TLV_PG_SELECTOR = 0x200,	/* string */
+	MPATH_TLV_PG_DM_ST,		/* string */
+	MPATH_TLV_PG_PRI,		/* uint32_t */
+	MPATH_TLV_PG_GROUP,		/* uint32_t, starting at 1 */
+
+	/* strings */
+	MPATH_TLV_PATH_DEV = 0x300,
+	MPATH_TLV_PATH_DEV_T,
+	MPATH_TLV_PATH_DM_ST,
+	MPATH_TLV_PATH_DEV_ST,
+	MPATH_TLV_PATH_CHK_ST,
+	MPATH_TLV_PATH_CHECKER,
+	MPATH_TLV_PATH_PRI,
+};
+
+#endif /* MPATH_TLV_H_INCLUDED */
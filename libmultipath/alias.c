@@ -8,6 +8,7 @@
 #include <string.h>
 #include <limits.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "debug.h"
 #include "uxsock.h"
@@ -16,6 +17,8 @@
 #include "vector.h"
 #include "checkers.h"
 #include "structs.h"
+#include "memory.h"
+#include "util.h"
 
 
 /*
@@ -96,103 +99,316 @@ scan_devname(char *alias, char *prefix)
 	return n;
 }
 
+/*
+ * In-memory copy of the bindings file.
+ *
+ * The file is read once, and looked up through hash indexes on the
+ * aliases and the wwids. New bindings are appended to the file and added
+ * to the copy. Modifications by other processes are noticed by the change
+ * of the file size or modification time, and trigger a reload.
+ */
+struct binding {
+	char *alias;
+	char *wwid;
+};
+
+/* the next id of a prefix that might be free */
+struct id_cursor {
+	char *prefix;
+	int id;
+};
+
+struct bindings_db {
+	pthread_mutex_t lock;
+	char file[PATH_MAX];
+	int valid;
+	struct file_stamp stamp;
+	vector bindings;	/* all aliases in the file */
+	vector by_alias;	/* first valid binding of each alias */
+	vector by_wwid;		/* first binding of each wwid */
+	vector cursors;
+};
+
+static struct bindings_db bindings_db = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const char *
+binding_alias(const void *elem, char *buf, size_t len)
+{
+	return ((const struct binding *)elem)->alias;
+}
+
+static const char *
+binding_wwid(const void *elem, char *buf, size_t len)
+{
+	return ((const struct binding *)elem)->wwid;
+}
+
+static struct binding *
+find_binding(vector v, vector_key_fn *key, const char *str)
+{
+	void *elem;
+
+	if (vector_index_find(v, key, str, &elem))
+		return NULL;
+	return elem;
+}
+
+static void
+free_bindings(struct bindings_db *db)
+{
+	struct binding *b;
+	struct id_cursor *c;
+	int i;
+
+	vector_foreach_slot(db->bindings, b, i) {
+		FREE(b->alias);
+		FREE_PTR(b->wwid);
+		FREE(b);
+	}
+	vector_foreach_slot(db->cursors, c, i) {
+		FREE(c->prefix);
+		FREE(c);
+	}
+	vector_free(db->bindings);
+	vector_free(db->by_alias);
+	vector_free(db->by_wwid);
+	vector_free(db->cursors);
+	db->bindings = db->by_alias = db->by_wwid = db->cursors = NULL;
+}
+
 static int
-lookup_binding(FILE *f, char *map_wwid, char **map_alias, char *prefix)
+store_binding(vector v, struct binding *b)
 {
-	char buf[LINE_MAX];
-	unsigned int line_nr = 0;
-	int id = 1;
-	int biggest_id = 1;
-	int smallest_bigger_id = INT_MAX;
+	if (!vector_alloc_slot(v))
+		return -1;
+	vector_set_slot(v, b);
+	return 0;
+}
 
-	*map_alias = NULL;
+static int
+add_binding(struct bindings_db *db, const char *alias, const char *wwid)
+{
+	struct binding *b;
 
-	rewind(f);
-	while (fgets(buf, LINE_MAX, f)) {
-		char *c, *alias, *wwid;
-		int curr_id;
+	b = MALLOC(sizeof(struct binding));
+	if (!b)
+		return -1;
+	b->alias = STRDUP(alias);
+	if (!b->alias)
+		goto out_free;
+	if (wwid) {
+		b->wwid = STRDUP(wwid);
+		if (!b->wwid)
+			goto out_alias;
+	}
+	if (store_binding(db->bindings, b))
+		goto out_wwid;
+
+	if (wwid && strlen(wwid) < WWID_SIZE &&
+	    !find_binding(db->by_alias, binding_alias, alias))
+		store_binding(db->by_alias, b);
+	if (wwid && !find_binding(db->by_wwid, binding_wwid, wwid))
+		store_binding(db->by_wwid, b);
+	return 0;
+
+out_wwid:
+	FREE_PTR(b->wwid);
+out_alias:
+	FREE(b->alias);
+out_free:
+	FREE(b);
+	return -1;
+}
+
+static int
+alloc_bindings(struct bindings_db *db)
+{
+	db->bindings = vector_alloc();
+	db->by_alias = vector_alloc();
+	db->by_wwid = vector_alloc();
+	db->cursors = vector_alloc();
+	if (!db->bindings || !db->by_alias || !db->by_wwid || !db->cursors ||
+	    vector_add_index(db->bindings, binding_alias) ||
+	    vector_add_index(db->by_alias, binding_alias) ||
+	    vector_add_index(db->by_wwid, binding_wwid)) {
+		free_bindings(db);
+		return -1;
+	}
+	return 0;
+}
 
+static int
+load_bindings(int fd, const char *file)
+{
+	struct bindings_db db;
+	char *buf, *line, *next, *c, *alias, *wwid, *saveptr;
+	unsigned int line_nr = 0;
+	int ret = -1;
+
+	buf = read_file_contents(fd);
+	if (!buf)
+		return -1;
+	memset(&db, 0, sizeof(db));
+	if (alloc_bindings(&db))
+		goto out;
+
+	for (line = buf; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
 		line_nr++;
-		c = strpbrk(buf, "#\n\r");
+		c = strpbrk(line, "#\r");
 		if (c)
 			*c = '\0';
-		alias = strtok(buf, " \t");
+		alias = strtok_r(line, " \t", &saveptr);
 		if (!alias) /* blank line */
 			continue;
-		curr_id = scan_devname(alias, prefix);
-		if (curr_id == id)
-			id++;
-		if (curr_id > biggest_id)
-			biggest_id = curr_id;
-		if (curr_id > id && curr_id < smallest_bigger_id)
-			smallest_bigger_id = curr_id;
-		wwid = strtok(NULL, " \t");
-		if (!wwid){
+		wwid = strtok_r(NULL, " \t", &saveptr);
+		if (!wwid)
 			condlog(3,
 				"Ignoring malformed line %u in bindings file",
 				line_nr);
-			continue;
-		}
-		if (strcmp(wwid, map_wwid) == 0){
-			condlog(3, "Found matching wwid [%s] in bindings file."
-				" Setting alias to %s", wwid, alias);
-			*map_alias = strdup(alias);
-			if (*map_alias == NULL)
-				condlog(0, "Cannot copy alias from bindings "
-					"file : %s", strerror(errno));
-			return 0;
-		}
+		else if (strlen(wwid) > WWID_SIZE - 1)
+			condlog(3,
+				"Ignoring too large wwid at %u in bindings file", line_nr);
+		if (add_binding(&db, alias, wwid))
+			goto out;
 	}
-	condlog(3, "No matching wwid [%s] in bindings file.", map_wwid);
-	if (id < 0) {
-		condlog(0, "no more available user_friendly_names");
+	if (get_file_stamp(fd, &bindings_db.stamp))
+		goto out;
+
+	free_bindings(&bindings_db);
+	bindings_db.bindings = db.bindings;
+	bindings_db.by_alias = db.by_alias;
+	bindings_db.by_wwid = db.by_wwid;
+	bindings_db.cursors = db.cursors;
+	db.bindings = NULL;
+	strlcpy(bindings_db.file, file, sizeof(bindings_db.file));
+	bindings_db.valid = 1;
+	condlog(4, "loaded %d bindings from %s",
+		VECTOR_SIZE(bindings_db.bindings), file);
+	ret = 0;
+out:
+	if (db.bindings)
+		free_bindings(&db);
+	free(buf);
+	return ret;
+}
+
+/*
+ * Make sure the in-memory copy matches @file, which is open as @fd if
+ * @fd >= 0. Returns 1 if the file was (re)loaded, 0 if the copy was up
+ * to date, and -1 on error. Caller must hold bindings_db.lock.
+ */
+static int
+refresh_bindings(char *file, int fd)
+{
+	int can_write, ret;
+
+	if (bindings_db.valid && !strcmp(bindings_db.file, file) &&
+	    !file_stamp_changed(fd, file, &bindings_db.stamp))
 		return 0;
+	if (fd >= 0)
+		return load_bindings(fd, file) ? -1 : 1;
+
+	fd = open_file(file, &can_write, BINDINGS_FILE_HEADER);
+	if (fd < 0)
+		return -1;
+	ret = load_bindings(fd, file);
+	close(fd);
+	return ret ? -1 : 1;
+}
+
+static void
+unlock_bindings(void *unused)
+{
+	pthread_mutex_unlock(&bindings_db.lock);
+}
+
+/* Record a binding we appended to the file open as @fd */
+static void
+remember_binding(int fd, const char *alias, const char *wwid)
+{
+	if (add_binding(&bindings_db, alias, wwid) ||
+	    get_file_stamp(fd, &bindings_db.stamp))
+		bindings_db.valid = 0;
+}
+
+static char *
+lookup_binding(char *map_wwid)
+{
+	struct binding *b;
+	char *alias;
+
+	b = find_binding(bindings_db.by_wwid, binding_wwid, map_wwid);
+	if (!b) {
+		condlog(3, "No matching wwid [%s] in bindings file.", map_wwid);
+		return NULL;
 	}
-	if (id < smallest_bigger_id)
-		return id;
-	return biggest_id + 1;
+	condlog(3, "Found matching wwid [%s] in bindings file."
+		" Setting alias to %s", map_wwid, b->alias);
+	alias = strdup(b->alias);
+	if (alias == NULL)
+		condlog(0, "Cannot copy alias from bindings "
+			"file : %s", strerror(errno));
+	return alias;
 }
 
 static int
-rlookup_binding(FILE *f, char *buff, char *map_alias, char *prefix)
+rlookup_binding(char *buff, char *map_alias)
 {
-	char line[LINE_MAX];
-	unsigned int line_nr = 0;
+	struct binding *b;
 
 	buff[0] = '\0';
+	b = find_binding(bindings_db.by_alias, binding_alias, map_alias);
+	if (!b) {
+		condlog(3, "No matching alias [%s] in bindings file.",
+			map_alias);
+		return -1;
+	}
+	condlog(3, "Found matching alias [%s] in bindings file."
+		"\nSetting wwid to %s", map_alias, b->wwid);
+	strlcpy(buff, b->wwid, WWID_SIZE);
+	return 0;
+}
 
-	while (fgets(line, LINE_MAX, f)) {
-		char *c, *alias, *wwid;
+/*
+ * Return the smallest id of @prefix which isn't used by an alias, or -1
+ * if there's none left. Bindings are only ever added, so the cursor of
+ * the prefix only has to move forward.
+ */
+static int
+next_free_id(char *prefix)
+{
+	struct id_cursor *c;
+	char buf[LINE_MAX];
+	int i;
 
-		line_nr++;
-		c = strpbrk(line, "#\n\r");
-		if (c)
-			*c = '\0';
-		alias = strtok(line, " \t");
-		if (!alias) /* blank line */
-			continue;
-		wwid = strtok(NULL, " \t");
-		if (!wwid){
-			condlog(3,
-				"Ignoring malformed line %u in bindings file",
-				line_nr);
-			continue;
-		}
-		if (strlen(wwid) > WWID_SIZE - 1) {
-			condlog(3,
-				"Ignoring too large wwid at %u in bindings file", line_nr);
-			continue;
-		}
-		if (strcmp(alias, map_alias) == 0){
-			condlog(3, "Found matching alias [%s] in bindings file."
-				"\nSetting wwid to %s", alias, wwid);
-			strncpy(buff, wwid, WWID_SIZE);
-			buff[WWID_SIZE - 1] = '\0';
-			return 0;
+	if (!prefix)
+		return -1;
+	vector_foreach_slot(bindings_db.cursors, c, i)
+		if (!strcmp(c->prefix, prefix))
+			break;
+	if (i == VECTOR_SIZE(bindings_db.cursors)) {
+		c = MALLOC(sizeof(struct id_cursor));
+		if (!c)
+			return -1;
+		c->prefix = STRDUP(prefix);
+		if (!c->prefix || !vector_alloc_slot(bindings_db.cursors)) {
+			FREE_PTR(c->prefix);
+			FREE(c);
+			return -1;
 		}
+		c->id = 1;
+		vector_set_slot(bindings_db.cursors, c);
 	}
-	condlog(3, "No matching alias [%s] in bindings file.", map_alias);
-
+	while (c->id > 0) {
+		format_devname(buf, c->id, LINE_MAX, prefix);
+		if (!find_binding(bindings_db.bindings, binding_alias, buf))
+			return c->id;
+		c->id++;
+	}
+	condlog(0, "no more available user_friendly_names");
 	return -1;
 }
 
@@ -248,24 +464,18 @@ use_existing_alias (char *wwid, char *file, char *alias_old,
 {
 	char *alias = NULL;
 	int id = 0;
-	int fd, can_write;
+	int fd = -1, can_write, reloaded = 0;
 	char buff[WWID_SIZE];
-	FILE *f;
-
-	fd = open_file(file, &can_write, BINDINGS_FILE_HEADER);
-	if (fd < 0)
-		return NULL;
 
-	f = fdopen(fd, "r");
-	if (!f) {
-		condlog(0, "cannot fdopen on bindings file descriptor");
-		close(fd);
-		return NULL;
-	}
+	pthread_mutex_lock(&bindings_db.lock);
+	pthread_cleanup_push(unlock_bindings, NULL);
+	if (refresh_bindings(file, -1) < 0)
+		goto out;
+again:
 	/* lookup the binding. if it exsists, the wwid will be in buff
 	 * either way, id contains the id for the alias
 	 */
-	rlookup_binding(f, buff, alias_old, prefix);
+	rlookup_binding(buff, alias_old);
 
 	if (strlen(buff) > 0) {
 		/* if buff is our wwid, it's already
@@ -281,7 +491,7 @@ use_existing_alias (char *wwid, char *file, char *alias_old,
 		goto out;
 	}
 
-	id = lookup_binding(f, wwid, &alias, NULL);
+	alias = lookup_binding(wwid);
 	if (alias) {
 		condlog(3, "Use existing binding [%s] for WWID [%s]",
 			alias, wwid);
@@ -290,23 +500,33 @@ use_existing_alias (char *wwid, char *file, char *alias_old,
 
 	/* allocate the existing alias in the bindings file */
 	id = scan_devname(alias_old, prefix);
-	if (id <= 0)
+	if (id <= 0 || bindings_read_only)
 		goto out;
 
-	if (fflush(f) != 0) {
-		condlog(0, "cannot fflush bindings file stream : %s",
-			strerror(errno));
-		goto out;
+	if (fd < 0) {
+		fd = open_file(file, &can_write, BINDINGS_FILE_HEADER);
+		if (fd < 0)
+			goto out;
+		/* another process may have added bindings since */
+		reloaded = refresh_bindings(file, fd);
+		if (reloaded < 0)
+			goto out;
+		if (reloaded)
+			goto again;
 	}
 
-	if (can_write && !bindings_read_only) {
+	if (can_write) {
 		alias = allocate_binding(fd, wwid, id, prefix);
 		condlog(0, "Allocated existing binding [%s] for WWID [%s]",
 			alias, wwid);
+		if (alias)
+			remember_binding(fd, alias, wwid);
 	}
 
 out:
-	fclose(f);
+	if (fd >= 0)
+		close(fd);
+	pthread_cleanup_pop(1);
 	return alias;
 }
 
@@ -314,78 +534,67 @@ char *
 get_user_friendly_alias(char *wwid, char *file, char *prefix,
 			int bindings_read_only)
 {
-	char *alias;
-	int fd, id;
-	FILE *f;
-	int can_write;
+	char *alias = NULL;
+	int fd = -1, id, can_write;
 
 	if (!wwid || *wwid == '\0') {
 		condlog(3, "Cannot find binding for empty WWID");
 		return NULL;
 	}
 
-	fd = open_file(file, &can_write, BINDINGS_FILE_HEADER);
-	if (fd < 0)
-		return NULL;
-
-	f = fdopen(fd, "r");
-	if (!f) {
-		condlog(0, "cannot fdopen on bindings file descriptor : %s",
-			strerror(errno));
-		close(fd);
-		return NULL;
-	}
+	pthread_mutex_lock(&bindings_db.lock);
+	pthread_cleanup_push(unlock_bindings, NULL);
+	if (refresh_bindings(file, -1) < 0)
+		goto out;
 
-	id = lookup_binding(f, wwid, &alias, prefix);
-	if (id < 0) {
-		fclose(f);
-		return NULL;
-	}
+	alias = lookup_binding(wwid);
+	if (alias || bindings_read_only)
+		goto out;
 
-	if (fflush(f) != 0) {
-		condlog(0, "cannot fflush bindings file stream : %s",
-			strerror(errno));
-		free(alias);
-		fclose(f);
-		return NULL;
+	fd = open_file(file, &can_write, BINDINGS_FILE_HEADER);
+	if (fd < 0)
+		goto out;
+	/* another process may have added bindings since */
+	switch (refresh_bindings(file, fd)) {
+	case 1:
+		alias = lookup_binding(wwid);
+		if (alias)
+			goto out;
+		break;
+	case -1:
+		goto out;
 	}
+	if (!can_write)
+		goto out;
 
-	if (!alias && can_write && !bindings_read_only && id)
+	id = next_free_id(prefix);
+	if (id > 0) {
 		alias = allocate_binding(fd, wwid, id, prefix);
-
-	fclose(f);
+		if (alias)
+			remember_binding(fd, alias, wwid);
+	}
+out:
+	if (fd >= 0)
+		close(fd);
+	pthread_cleanup_pop(1);
 	return alias;
 }
 
 int
 get_user_friendly_wwid(char *alias, char *buff, char *file)
 {
-	int fd, unused;
-	FILE *f;
+	int ret = -1;
 
+	buff[0] = '\0';
 	if (!alias || *alias == '\0') {
 		condlog(3, "Cannot find binding for empty alias");
 		return -1;
 	}
 
-	fd = open_file(file, &unused, BINDINGS_FILE_HEADER);
-	if (fd < 0)
-		return -1;
-
-	f = fdopen(fd, "r");
-	if (!f) {
-		condlog(0, "cannot fdopen on bindings file descriptor : %s",
-			strerror(errno));
-		close(fd);
-		return -1;
-	}
-
-	rlookup_binding(f, buff, alias, NULL);
-	if (!strlen(buff)) {
-		fclose(f);
-		return -1;
-	}
-
-	fclose(f);
-	return 0;
+	pthread_mutex_lock(&bindings_db.lock);
+	pthread_cleanup_push(unlock_bindings, NULL);
+	if (refresh_bindings(file, -1) >= 0)
+		ret = rlookup_binding(buff, alias);
+	pthread_cleanup_pop(1);
+	return ret;
 }
@@ -3,6 +3,7 @@
  */
 #include <stdio.h>
 #include <libudev.h>
+#include <pthread.h>
 
 #include "checkers.h"
 #include "memory.h"
@@ -12,6 +13,7 @@
 #include "structs.h"
 #include "config.h"
 #include "blacklist.h"
+#include "strbuf.h"
 
 int store_ble(vector blist, char * str, int origin)
 {
@@ -209,6 +211,298 @@ setup_default_blist (struct config * conf)
 	return 0;
 }
 
+/*
+ * Compiled blacklists.
+ *
+ * Patterns without regex metacharacters are matched with strstr(), and
+ * "^literal" patterns with strncmp(). All other patterns of a list are
+ * merged into one alternation "(re1)|(re2)|...", so that a single
+ * regexec() decides the list. Patterns with back-references can't be
+ * merged, as the group numbers would change; they are kept aside and
+ * matched one by one.
+ */
+#define BLIST_META "\\^$.[]|()*+?{}"
+
+struct blist_literal {
+	const char *str;
+	size_t len;
+	int prefix;
+};
+
+struct blist_matcher {
+	int nr_literals;
+	struct blist_literal *literals;
+	int merged;
+	regex_t regex;
+	vector others;
+};
+
+static int
+has_backref (const char *str)
+{
+	const char *p;
+
+	for (p = strchr(str, '\\'); p; p = strchr(p + 2, '\\')) {
+		if (p[1] >= '1' && p[1] <= '9')
+			return 1;
+		if (!p[1])
+			break;
+	}
+	return 0;
+}
+
+static void
+free_blist_matcher (struct blist_matcher *bm)
+{
+	if (!bm)
+		return;
+	if (bm->merged)
+		regfree(&bm->regex);
+	if (bm->literals)
+		FREE(bm->literals);
+	vector_free(bm->others);
+	FREE(bm);
+}
+
+static struct blist_matcher *
+compile_blist_matcher (vector blist)
+{
+	struct blist_matcher *bm;
+	struct blentry *ble;
+	struct strbuf re = STRBUF_INIT;
+	int i;
+
+	bm = MALLOC(sizeof(struct blist_matcher));
+	if (!bm)
+		return NULL;
+	bm->others = vector_alloc();
+	if (!bm->others)
+		goto out;
+	if (VECTOR_SIZE(blist) > 0) {
+		bm->literals = MALLOC(VECTOR_SIZE(blist) *
+				      sizeof(struct blist_literal));
+		if (!bm->literals)
+			goto out;
+	}
+
+	vector_foreach_slot (blist, ble, i) {
+		struct blist_literal *lit = &bm->literals[bm->nr_literals];
+
+		if (!strpbrk(ble->str, BLIST_META)) {
+			lit->str = ble->str;
+			lit->prefix = 0;
+		} else if (ble->str[0] == '^' &&
+			   !strpbrk(ble->str + 1, BLIST_META)) {
+			lit->str = ble->str + 1;
+			lit->prefix = 1;
+		} else if (has_backref(ble->str)) {
+			if (!vector_alloc_slot(bm->others))
+				goto out;
+			vector_set_slot(bm->others, ble);
+			continue;
+		} else {
+			if ((get_strbuf_len(&re) > 0 &&
+			     append_strbuf_str(&re, "|") < 0) ||
+			    append_strbuf_str(&re, "(") < 0 ||
+			    append_strbuf_str(&re, ble->str) < 0 ||
+			    append_strbuf_str(&re, ")") < 0)
+				goto out;
+			continue;
+		}
+		lit->len = strlen(lit->str);
+		bm->nr_literals++;
+	}
+
+	if (get_strbuf_len(&re) > 0) {
+		if (!regcomp(&bm->regex, get_strbuf_str(&re),
+			     REG_EXTENDED|REG_NOSUB))
+			bm->merged = 1;
+		else {
+			/* shouldn't happen; match them one by one */
+			condlog(2, "failed to merge blacklist regexes");
+			vector_foreach_slot (blist, ble, i) {
+				if (!strpbrk(ble->str, BLIST_META) ||
+				    (ble->str[0] == '^' &&
+				     !strpbrk(ble->str + 1, BLIST_META)) ||
+				    has_backref(ble->str))
+					continue;
+				if (!vector_alloc_slot(bm->others))
+					goto out;
+				vector_set_slot(bm->others, ble);
+			}
+		}
+	}
+	reset_strbuf(&re);
+	return bm;
+out:
+	reset_strbuf(&re);
+	free_blist_matcher(bm);
+	return NULL;
+}
+
+static int
+blist_match (const struct blist_matcher *bm, const char * str)
+{
+	int i;
+
+	for (i = 0; i < bm->nr_literals; i++) {
+		const struct blist_literal *lit = &bm->literals[i];
+
+		if (lit->prefix ? !strncmp(str, lit->str, lit->len) :
+		    strstr(str, lit->str) != NULL)
+			return 1;
+	}
+	if (bm->merged && !regexec(&bm->regex, str, 0, NULL, 0))
+		return 1;
+	return _blacklist(bm->others, str);
+}
+
+/*
+ * Direct mapped cache of filter verdicts. A colliding entry simply
+ * replaces the old one, which bounds the memory use.
+ */
+#define BLIST_VERDICT_SLOTS 8192
+
+struct blist_verdict {
+	char *key;
+	int r;
+};
+
+struct blist_verdicts {
+	pthread_mutex_t lock;
+	struct blist_verdict slots[BLIST_VERDICT_SLOTS];
+};
+
+static struct blist_verdicts *
+alloc_blist_verdicts (void)
+{
+	struct blist_verdicts *bv = MALLOC(sizeof(struct blist_verdicts));
+
+	if (bv)
+		pthread_mutex_init(&bv->lock, NULL);
+	return bv;
+}
+
+static void
+free_blist_verdicts (struct blist_verdicts *bv)
+{
+	int i;
+
+	if (!bv)
+		return;
+	for (i = 0; i < BLIST_VERDICT_SLOTS; i++)
+		if (bv->slots[i].key)
+			FREE(bv->slots[i].key);
+	pthread_mutex_destroy(&bv->lock);
+	FREE(bv);
+}
+
+static unsigned int
+blist_verdict_slot (const char *key)
+{
+	unsigned int h = 2166136261U;
+
+	while (*key) {
+		h ^= (unsigned char)*key++;
+		h *= 16777619U;
+	}
+	return h % BLIST_VERDICT_SLOTS;
+}
+
+static int
+get_blist_verdict (struct blist_verdicts *bv, const char *key, int *r)
+{
+	struct blist_verdict *v = &bv->slots[blist_verdict_slot(key)];
+	int found = 0;
+
+	pthread_mutex_lock(&bv->lock);
+	if (v->key && !strcmp(v->key, key)) {
+		*r = v->r;
+		found = 1;
+	}
+	pthread_mutex_unlock(&bv->lock);
+	return found;
+}
+
+static void
+set_blist_verdict (struct blist_verdicts *bv, const char *key, int r)
+{
+	struct blist_verdict *v = &bv->slots[blist_verdict_slot(key)];
+	char *k = STRDUP(key);
+
+	if (!k)
+		return;
+	pthread_mutex_lock(&bv->lock);
+	if (v->key)
+		FREE(v->key);
+	v->key = k;
+	v->r = r;
+	pthread_mutex_unlock(&bv->lock);
+}
+
+void
+free_blacklist_matchers (struct blacklist_matchers *bm)
+{
+	if (!bm)
+		return;
+	free_blist_matcher(bm->blist_devnode);
+	free_blist_matcher(bm->elist_devnode);
+	free_blist_matcher(bm->blist_wwid);
+	free_blist_matcher(bm->elist_wwid);
+	free_blist_matcher(bm->blist_property);
+	free_blist_matcher(bm->elist_property);
+	free_blist_verdicts(bm->devnode_verdicts);
+	free_blist_verdicts(bm->wwid_verdicts);
+	FREE(bm);
+}
+
+/*
+ * Must be called once the blacklists of @conf are complete. On failure,
+ * the filters fall back to matching the lists entry by entry.
+ */
+int
+compile_blacklists (struct config *conf)
+{
+	struct blacklist_matchers *bm;
+
+	bm = MALLOC(sizeof(struct blacklist_matchers));
+	if (!bm)
+		return 1;
+
+	if (!(bm->blist_devnode = compile_blist_matcher(conf->blist_devnode)) ||
+	    !(bm->elist_devnode = compile_blist_matcher(conf->elist_devnode)) ||
+	    !(bm->blist_wwid = compile_blist_matcher(conf->blist_wwid)) ||
+	    !(bm->elist_wwid = compile_blist_matcher(conf->elist_wwid)) ||
+	    !(bm->blist_property =
+	      compile_blist_matcher(conf->blist_property)) ||
+	    !(bm->elist_property =
+	      compile_blist_matcher(conf->elist_property)) ||
+	    !(bm->devnode_verdicts = alloc_blist_verdicts()) ||
+	    !(bm->wwid_verdicts = alloc_blist_verdicts())) {
+		condlog(0, "failed to compile blacklists");
+		free_blacklist_matchers(bm);
+		return 1;
+	}
+	conf->blist_match = bm;
+	return 0;
+}
+
+static int
+match_blist (const struct blist_matcher *bm, vector blist, const char * str)
+{
+	if (bm)
+		return blist_match(bm, str);
+	return _blacklist(blist, str);
+}
+
+static int
+match_elist (const struct blist_matcher *bm, vector elist, const char * str)
+{
+	if (bm)
+		return blist_match(bm, str);
+	return _blacklist_exceptions(elist, str);
+}
+
 #define LOG_BLIST(M,S)							\
 	if (vendor && product)						\
 		condlog(3, "%s: (%s:%s) %s %s",				\
@@ -275,49 +569,75 @@ _filter_device (vector blist, vector elist, char * vendor, char * product)
 }
 
 int
-filter_device (vector blist, vector elist, char * vendor, char * product)
+filter_device (struct config * conf, char * vendor, char * product)
 {
-	int r = _filter_device(blist, elist, vendor, product);
+	int r = _filter_device(conf->blist_device, conf->elist_device,
+			       vendor, product);
 	log_filter(NULL, vendor, product, NULL, NULL, r);
 	return r;
 }
 
-int
-_filter_devnode (vector blist, vector elist, char * dev)
+static int
+_filter_devnode (struct config * conf, const char * dev)
 {
+	struct blacklist_matchers *bm = conf->blist_match;
+	int r;
+
 	if (!dev)
 		return 0;
-	if (_blacklist_exceptions(elist, dev))
-		return MATCH_DEVNODE_BLIST_EXCEPT;
-	if (_blacklist(blist, dev))
-		return MATCH_DEVNODE_BLIST;
-	return 0;
+	if (bm && get_blist_verdict(bm->devnode_verdicts, dev, &r))
+		return r;
+
+	if (match_elist(bm ? bm->elist_devnode : NULL,
+			conf->elist_devnode, dev))
+		r = MATCH_DEVNODE_BLIST_EXCEPT;
+	else if (match_blist(bm ? bm->blist_devnode : NULL,
+			     conf->blist_devnode, dev))
+		r = MATCH_DEVNODE_BLIST;
+	else
+		r = 0;
+
+	if (bm)
+		set_blist_verdict(bm->devnode_verdicts, dev, r);
+	return r;
 }
 
 int
-filter_devnode (vector blist, vector elist, char * dev)
+filter_devnode (struct config * conf, char * dev)
 {
-	int r = _filter_devnode(blist, elist, dev);
+	int r = _filter_devnode(conf, dev);
 	log_filter(dev, NULL, NULL, NULL, NULL, r);
 	return r;
 }
 
-int
-_filter_wwid (vector blist, vector elist, char * wwid)
+static int
+_filter_wwid (struct config * conf, const char * wwid)
 {
+	struct blacklist_matchers *bm = conf->blist_match;
+	int r;
+
 	if (!wwid)
 		return 0;
-	if (_blacklist_exceptions(elist, wwid))
-		return MATCH_WWID_BLIST_EXCEPT;
-	if (_blacklist(blist, wwid))
-		return MATCH_WWID_BLIST;
-	return 0;
+	if (bm && get_blist_verdict(bm->wwid_verdicts, wwid, &r))
+		return r;
+
+	if (match_elist(bm ? bm->elist_wwid : NULL, conf->elist_wwid, wwid))
+		r = MATCH_WWID_BLIST_EXCEPT;
+	else if (match_blist(bm ? bm->blist_wwid : NULL,
+			     conf->blist_wwid, wwid))
+		r = MATCH_WWID_BLIST;
+	else
+		r = 0;
+
+	if (bm)
+		set_blist_verdict(bm->wwid_verdicts, wwid, r);
+	return r;
 }
 
 int
-filter_wwid (vector blist, vector elist, char * wwid, char * dev)
+filter_wwid (struct config * conf, char * wwid, char * dev)
 {
-	int r = _filter_wwid(blist, elist, wwid);
+	int r = _filter_wwid(conf, wwid);
 	log_filter(dev, NULL, NULL, wwid, NULL, r);
 	return r;
 }
@@ -331,14 +651,14 @@ _filter_path (struct config * conf, struct path * pp)
 	if (r > 0)
 		return r;
 
-	r = _filter_devnode(conf->blist_devnode, conf->elist_devnode,pp->dev);
+	r = _filter_devnode(conf, pp->dev);
 	if (r > 0)
 		return r;
 	r = _filter_device(conf->blist_device, conf->elist_device,
 			   pp->vendor_id, pp->product_id);
 	if (r > 0)
 		return r;
-	r = _filter_wwid(conf->blist_wwid, conf->elist_wwid, pp->wwid);
+	r = _filter_wwid(conf, pp->wwid);
 	return r;
 }
 
@@ -353,9 +673,13 @@ filter_path (struct config * conf, struct path * pp)
 int
 _filter_property (struct config *conf, const char *env)
 {
-	if (_blacklist_exceptions(conf->elist_property, env))
+	struct blacklist_matchers *bm = conf->blist_match;
+
+	if (match_elist(bm ? bm->elist_property : NULL,
+			conf->elist_property, env))
 		return MATCH_PROPERTY_BLIST_EXCEPT;
-	if (_blacklist(conf->blist_property, env))
+	if (match_blist(bm ? bm->blist_property : NULL,
+			conf->blist_property, env))
 		return MATCH_PROPERTY_BLIST;
 
 	return 0;
@@ -29,11 +29,34 @@ struct blentry_device {
 	int origin;
 };
 
+struct blist_matcher;
+struct blist_verdicts;
+
+/*
+ * The blacklists and exceptions of a config, compiled by
+ * compile_blacklists(): literal patterns are matched with string
+ * compares, and the remaining regexes of each list are merged into one.
+ * The devnode and wwid verdicts are cached; the cache goes away with
+ * the config, i.e. on reconfigure.
+ */
+struct blacklist_matchers {
+	struct blist_matcher *blist_devnode;
+	struct blist_matcher *elist_devnode;
+	struct blist_matcher *blist_wwid;
+	struct blist_matcher *elist_wwid;
+	struct blist_matcher *blist_property;
+	struct blist_matcher *elist_property;
+	struct blist_verdicts *devnode_verdicts;
+	struct blist_verdicts *wwid_verdicts;
+};
+
 int setup_default_blist (struct config *);
+int compile_blacklists (struct config *);
+void free_blacklist_matchers (struct blacklist_matchers *);
 int alloc_ble_device (vector);
-int filter_devnode (vector, vector, char *);
-int filter_wwid (vector, vector, char *, char *);
-int filter_device (vector, vector, char *, char *);
+int filter_devnode (struct config *, char *);
+int filter_wwid (struct config *, char *, char *);
+int filter_device (struct config *, char *, char *);
 int filter_path (struct config *, struct path *);
 int filter_property(struct config *, struct udev_device *);
 int store_ble (vector, char *, int);
@@ -2,11 +2,13 @@
 #include <string.h>
 #include <stddef.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "debug.h"
 #include "checkers.h"
 #include "vector.h"
+#include "uring.h"
 
 char *checker_state_names[] = {
 	"wild",
@@ -22,6 +24,8 @@ char *checker_state_names[] = {
 };
 
 static LIST_HEAD(checkers);
+/* paths may be set up by several threads during parallel discovery */
+static pthread_mutex_t checkers_lock = PTHREAD_MUTEX_INITIALIZER;
 
 char * checker_state_name (int i)
 {
@@ -77,6 +81,7 @@ void cleanup_checkers (void)
 	list_for_each_entry_safe(checker_loop, checker_temp, &checkers, node) {
 		free_checker(checker_loop);
 	}
+	cleanup_uring_engine();
 }
 
 struct checker * checker_lookup (char * name)
@@ -215,11 +220,13 @@ void checker_put (struct checker * dst)
 
 	if (!dst || !strlen(dst->name))
 		return;
-	src = checker_lookup(dst->name);
 	if (dst->free)
 		dst->free(dst);
-	checker_clear(dst);
+	pthread_mutex_lock(&checkers_lock);
+	src = checker_lookup(dst->name);
 	free_checker(src);
+	pthread_mutex_unlock(&checkers_lock);
+	checker_clear(dst);
 }
 
 void checker_repair (struct checker * c)
@@ -244,6 +251,7 @@ int checker_check (struct checker * c, int path_state)
 		return PATH_WILD;
 
 	c->message[0] = '\0';
+	c->has_latency = 0;
 	if (c->disable) {
 		MSG(c, "checker disabled");
 		return PATH_UNCHECKED;
@@ -297,12 +305,14 @@ void checker_get (char *multipath_dir, struct checker * dst, char * name)
 	if (!dst)
 		return;
 
+	pthread_mutex_lock(&checkers_lock);
 	if (name && strlen(name)) {
 		src = checker_lookup(name);
 		if (!src)
 			src = add_checker(multipath_dir, name);
 	}
 	if (!src) {
+		pthread_mutex_unlock(&checkers_lock);
 		dst->check = NULL;
 		return;
 	}
@@ -316,4 +326,5 @@ void checker_get (char *multipath_dir, struct checker * dst, char * name)
 	dst->free = src->free;
 	dst->handle = NULL;
 	src->refcount++;
+	pthread_mutex_unlock(&checkers_lock);
 }
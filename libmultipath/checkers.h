@@ -1,6 +1,7 @@
 #ifndef _CHECKERS_H
 #define _CHECKERS_H
 
+#include <time.h>
 #include "list.h"
 #include "memory.h"
 #include "defaults.h"
@@ -108,6 +109,11 @@ struct checker {
 	int disable;
 	char name[CHECKER_NAME_LEN];
 	char message[CHECKER_MSG_LEN];       /* comm with callers */
+	struct timespec latency;             /* of the I/O of the completed
+						check, if has_latency is set.
+						Set by async checkers, whose
+						result is only collected later */
+	int has_latency;
 	void * context;                      /* store for persistent data */
 	void ** mpcontext;                   /* store for persistent data shared
 						multipath-wide. Use MALLOC if
@@ -17,6 +17,7 @@
 
 #include "checkers.h"
 #include "../libmultipath/debug.h"
+#include "../libmultipath/uring.h"
 
 #define MSG_DIRECTIO_UNKNOWN	"directio checker is not available"
 #define MSG_DIRECTIO_UP		"directio checker reports path is up"
@@ -25,6 +26,9 @@
 
 #define LOG(prio, fmt, args...) condlog(prio, "directio: " fmt, ##args)
 
+/* how long an async check waits for its read, like the tur checker */
+#define ASYNC_WAIT_MSEC		1
+
 struct directio_context {
 	int		running;
 	int		reset_flags;
@@ -33,6 +37,7 @@ struct directio_context {
 	unsigned char * ptr;
 	io_context_t	ioctx;
 	struct iocb	io;
+	struct uring_req *req;
 };
 
 
@@ -47,12 +52,6 @@ int libcheck_init (struct checker * c)
 		return 1;
 	memset(ct, 0, sizeof(struct directio_context));
 
-	if (io_setup(1, &ct->ioctx) != 0) {
-		condlog(1, "io_setup failed");
-		free(ct);
-		return 1;
-	}
-
 	if (ioctl(c->fd, BLKBSZGET, &ct->blksize) < 0) {
 		MSG(c, "cannot get blocksize, set default");
 		ct->blksize = 512;
@@ -65,9 +64,24 @@ int libcheck_init (struct checker * c)
 	}
 	if (!ct->blksize)
 		goto out;
-	ct->buf = (unsigned char *)malloc(ct->blksize + pgsize);
-	if (!ct->buf)
-		goto out;
+
+	/*
+	 * Use the shared io_uring engine if the kernel supports it,
+	 * and a private aio context otherwise.
+	 */
+	ct->req = uring_req_alloc(ct->blksize);
+	if (!ct->req) {
+		if (io_setup(1, &ct->ioctx) != 0) {
+			condlog(1, "io_setup failed");
+			free(ct);
+			return 1;
+		}
+		ct->buf = (unsigned char *)malloc(ct->blksize + pgsize);
+		if (!ct->buf)
+			goto out;
+		ct->ptr = (unsigned char *) (((unsigned long)ct->buf +
+					      pgsize - 1) & (~(pgsize - 1)));
+	}
 
 	flags = fcntl(c->fd, F_GETFL);
 	if (flags < 0)
@@ -79,17 +93,19 @@ int libcheck_init (struct checker * c)
 		ct->reset_flags = 1;
 	}
 
-	ct->ptr = (unsigned char *) (((unsigned long)ct->buf + pgsize - 1) &
-		  (~(pgsize - 1)));
-
 	/* Successfully initialized, return the context. */
 	c->context = (void *) ct;
 	return 0;
 
 out:
-	if (ct->buf)
-		free(ct->buf);
-	io_destroy(ct->ioctx);
+	if (ct->req)
+		uring_req_free(ct->req);
+	else {
+		if (ct->buf)
+			free(ct->buf);
+		if (ct->ioctx)
+			io_destroy(ct->ioctx);
+	}
 	free(ct);
 	return 1;
 }
@@ -112,9 +128,13 @@ void libcheck_free (struct checker * c)
 		}
 	}
 
-	if (ct->buf)
-		free(ct->buf);
-	io_destroy(ct->ioctx);
+	if (ct->req)
+		uring_req_free(ct->req);
+	else {
+		if (ct->buf)
+			free(ct->buf);
+		io_destroy(ct->ioctx);
+	}
 	free(ct);
 }
 
@@ -190,6 +210,58 @@ check_state(int fd, struct directio_context *ct, int sync, int timeout_secs)
 	return rc;
 }
 
+/*
+ * The latency of a completed read is recorded in @c, as its result may
+ * only be collected by a later call.
+ */
+static int
+check_uring_state(struct checker *c, struct directio_context *ct)
+{
+	int fd = c->fd, sync = c->sync, timeout_secs = c->timeout;
+	int state, res = 0, r;
+
+	if (sync > 0)
+		LOG(4, "called in synchronous mode");
+
+	state = uring_req_result_time(ct->req, &res, &c->latency);
+	if (state == URING_REQ_IDLE) {
+		LOG(3, "starting new request");
+		r = uring_submit_read(ct->req, fd, timeout_secs);
+		if (r == -EBUSY) {
+			LOG(3, "io_uring engine busy");
+			return PATH_PENDING;
+		} else if (r) {
+			LOG(3, "io_uring submit error %i", -r);
+			return PATH_UNCHECKED;
+		}
+		ct->running = 0;
+		/* submit right away, a fast path is done in no time */
+		if (sync > 0)
+			uring_wait(ct->req, timeout_secs + 1);
+		else
+			uring_wait_ms(ct->req, ASYNC_WAIT_MSEC);
+		state = uring_req_result_time(ct->req, &res, &c->latency);
+	}
+	if (state == URING_REQ_DONE) {
+		c->has_latency = 1;
+		LOG(3, "io finished %i", res);
+		ct->running = 0;
+		return (res == ct->blksize) ? PATH_UP : PATH_DOWN;
+	}
+
+	/*
+	 * The linked timeout should have cancelled the read by now.
+	 * The request stays in flight until the kernel completes it.
+	 */
+	ct->running++;
+	if (ct->running > timeout_secs || sync) {
+		LOG(3, "abort check on timeout");
+		return PATH_DOWN;
+	}
+	LOG(3, "io_uring request pending");
+	return PATH_PENDING;
+}
+
 int libcheck_check (struct checker * c)
 {
 	int ret;
@@ -198,7 +270,10 @@ int libcheck_check (struct checker * c)
 	if (!ct)
 		return PATH_UNCHECKED;
 
-	ret = check_state(c->fd, ct, c->sync, c->timeout);
+	if (ct->req)
+		ret = check_uring_state(c, ct);
+	else
+		ret = check_state(c->fd, ct, c->sync, c->timeout);
 
 	switch (ret)
 	{
@@ -46,6 +46,7 @@ struct tur_checker_context {
 	pthread_mutex_t lock;
 	pthread_cond_t active;
 	int holders;
+	struct timespec latency; /* of the last check by the thread */
 	char message[CHECKER_MSG_LEN];
 };
 
@@ -234,6 +235,7 @@ static void copy_msg_to_tcc(void *ct_p, const char *msg)
 static void *tur_thread(void *ctx)
 {
 	struct tur_checker_context *ct = ctx;
+	struct timespec start, end, latency;
 	int state, running;
 	char devt[32];
 
@@ -249,12 +251,16 @@ static void *tur_thread(void *ctx)
 	ct->message[0] = '\0';
 	pthread_mutex_unlock(&ct->lock);
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	state = tur_check(ct->fd, ct->timeout, copy_msg_to_tcc, ct->message);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	timespecsub(&end, &start, &latency);
 	pthread_testcancel();
 
 	/* TUR checker done */
 	pthread_mutex_lock(&ct->lock);
 	ct->state = state;
+	ct->latency = latency;
 	pthread_cond_signal(&ct->active);
 	pthread_mutex_unlock(&ct->lock);
 
@@ -354,6 +360,8 @@ int libcheck_check(struct checker * c)
 			ct->thread = 0;
 			tur_status = ct->state;
 			strlcpy(c->message, ct->message, sizeof(c->message));
+			c->latency = ct->latency;
+			c->has_latency = 1;
 		}
 		pthread_mutex_unlock(&ct->lock);
 	} else {
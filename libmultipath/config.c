@@ -9,6 +9,7 @@
 #include <dirent.h>
 #include <limits.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "checkers.h"
 #include "memory.h"
@@ -64,10 +65,37 @@ find_hwe_strmatch (vector hwtable, struct hwentry *hwe)
 }
 
 static int
-hwe_regmatch (struct hwentry *hwe1, struct hwentry *hwe2)
+hwe_field_match (const char *pat, const regex_t *re, const char *str)
+{
+	if (re)
+		return !regexec(re, str, 0, NULL, 0);
+	return strstr(str, pat) != NULL;
+}
+
+static int
+hwe_regmatch (const struct hwentry *hwe1, const char *vendor,
+	      const char *product, const char *revision)
 {
 	regex_t vre, pre, rre;
 	int retval = 1;
+	int state = __atomic_load_n(&hwe1->regex_state, __ATOMIC_ACQUIRE);
+
+	if (state == HWE_REGEX_INVALID)
+		return 1;
+
+	if (state == HWE_REGEX_COMPILED) {
+		if ((vendor || product || revision) &&
+		    (!hwe1->vendor || !vendor ||
+		     hwe_field_match(hwe1->vendor, hwe1->vendor_re, vendor)) &&
+		    (!hwe1->product || !product ||
+		     hwe_field_match(hwe1->product, hwe1->product_re,
+				     product)) &&
+		    (!hwe1->revision || !revision ||
+		     hwe_field_match(hwe1->revision, hwe1->revision_re,
+				     revision)))
+			return 0;
+		return 1;
+	}
 
 	if (hwe1->vendor &&
 	    regcomp(&vre, hwe1->vendor, REG_EXTENDED|REG_NOSUB))
@@ -81,13 +109,13 @@ hwe_regmatch (struct hwentry *hwe1, struct hwentry *hwe2)
 	    regcomp(&rre, hwe1->revision, REG_EXTENDED|REG_NOSUB))
 		goto out_pre;
 
-	if ((hwe2->vendor || hwe2->product || hwe2->revision) &&
-	    (!hwe1->vendor || !hwe2->vendor ||
-	     !regexec(&vre, hwe2->vendor, 0, NULL, 0)) &&
-	    (!hwe1->product || !hwe2->product ||
-	     !regexec(&pre, hwe2->product, 0, NULL, 0)) &&
-	    (!hwe1->revision || !hwe2->revision ||
-	     !regexec(&rre, hwe2->revision, 0, NULL, 0)))
+	if ((vendor || product || revision) &&
+	    (!hwe1->vendor || !vendor ||
+	     !regexec(&vre, vendor, 0, NULL, 0)) &&
+	    (!hwe1->product || !product ||
+	     !regexec(&pre, product, 0, NULL, 0)) &&
+	    (!hwe1->revision || !revision ||
+	     !regexec(&rre, revision, 0, NULL, 0)))
 		retval = 0;
 
 	if (hwe1->revision)
@@ -102,27 +130,290 @@ out:
 	return retval;
 }
 
+/*
+ * Compile one hwentry pattern. Patterns without regex metacharacters
+ * are matched with strstr(), which is what regexec() would do for them.
+ * Returns 0 on success, 1 if the pattern is invalid, -1 on ENOMEM.
+ */
+static int
+compile_hwe_pattern (const char *pat, regex_t **re)
+{
+	*re = NULL;
+	if (!pat || !strpbrk(pat, "\\^$.[]|()*+?{}"))
+		return 0;
+
+	*re = (regex_t *)MALLOC(sizeof(regex_t));
+	if (!*re)
+		return -1;
+	if (regcomp(*re, pat, REG_EXTENDED|REG_NOSUB)) {
+		FREE(*re);
+		return 1;
+	}
+	return 0;
+}
+
+static void
+free_hwe_regex (struct hwentry *hwe)
+{
+	if (hwe->vendor_re) {
+		regfree(hwe->vendor_re);
+		FREE(hwe->vendor_re);
+	}
+	if (hwe->product_re) {
+		regfree(hwe->product_re);
+		FREE(hwe->product_re);
+	}
+	if (hwe->revision_re) {
+		regfree(hwe->revision_re);
+		FREE(hwe->revision_re);
+	}
+	hwe->regex_state = HWE_REGEX_NONE;
+}
+
+static void
+compile_hwe_regex (struct hwentry *hwe)
+{
+	int r;
+
+	free_hwe_regex(hwe);
+	if ((r = compile_hwe_pattern(hwe->vendor, &hwe->vendor_re)) == 0 &&
+	    (r = compile_hwe_pattern(hwe->product, &hwe->product_re)) == 0)
+		r = compile_hwe_pattern(hwe->revision, &hwe->revision_re);
+
+	if (r) {
+		free_hwe_regex(hwe);
+		/* on ENOMEM, fall back to compiling at match time */
+		if (r > 0) {
+			condlog(1, "invalid regex in device %s:%s:%s",
+				hwe->vendor, hwe->product,
+				hwe->revision ? hwe->revision : "");
+			hwe->regex_state = HWE_REGEX_INVALID;
+		}
+		return;
+	}
+	/* the patterns are complete before lockless readers see them */
+	__atomic_store_n(&hwe->regex_state, HWE_REGEX_COMPILED,
+			 __ATOMIC_RELEASE);
+}
+
+/*
+ * Most of the built-in hwtable never matches any device, so the
+ * patterns are only compiled on first use. That keeps loading the
+ * config, and "multipath -u" in particular, cheap.
+ */
+static pthread_mutex_t hwe_regex_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+compile_hwtable (vector hwtable)
+{
+	struct hwentry *hwe;
+	int i;
+
+	vector_foreach_slot (hwtable, hwe, i) {
+		free_hwe_regex(hwe);
+		hwe->regex_state = HWE_REGEX_LAZY;
+	}
+}
+
+static void
+compile_hwe_regex_once (struct hwentry *hwe)
+{
+	if (__atomic_load_n(&hwe->regex_state, __ATOMIC_ACQUIRE) !=
+	    HWE_REGEX_LAZY)
+		return;
+	pthread_mutex_lock(&hwe_regex_lock);
+	/*
+	 * compile_hwe_regex() sets the state to HWE_REGEX_NONE while
+	 * it runs, for which hwe_regmatch() compiles at match time.
+	 */
+	if (hwe->regex_state == HWE_REGEX_LAZY)
+		compile_hwe_regex(hwe);
+	pthread_mutex_unlock(&hwe_regex_lock);
+}
+
+/*
+ * Cache of find_hwe() results, keyed on (vendor, product, revision).
+ * The hwtable doesn't change once the config is loaded, so entries are
+ * valid for the lifetime of the config. Misses are cached too.
+ */
+#define HWE_CACHE_BUCKETS	64
+#define HWE_CACHE_MAX		1024
+
+struct hwe_cache_entry {
+	struct hwe_cache_entry *next;
+	unsigned int hash;
+	struct hwentry *hwe;
+	char *vendor;
+	char *product;
+	char *revision;
+};
+
+struct hwe_cache {
+	pthread_mutex_t lock;
+	unsigned int nr;
+	struct hwe_cache_entry *buckets[HWE_CACHE_BUCKETS];
+};
+
+static struct hwe_cache *
+alloc_hwe_cache (void)
+{
+	struct hwe_cache *hc;
+
+	hc = (struct hwe_cache *)MALLOC(sizeof(struct hwe_cache));
+	if (hc)
+		pthread_mutex_init(&hc->lock, NULL);
+	return hc;
+}
+
+static void
+free_hwe_cache (struct hwe_cache *hc)
+{
+	struct hwe_cache_entry *ce, *next;
+	int i;
+
+	if (!hc)
+		return;
+	for (i = 0; i < HWE_CACHE_BUCKETS; i++) {
+		for (ce = hc->buckets[i]; ce; ce = next) {
+			next = ce->next;
+			FREE(ce);
+		}
+	}
+	pthread_mutex_destroy(&hc->lock);
+	FREE(hc);
+}
+
+static unsigned int
+hwe_cache_hash (const char *vendor, const char *product,
+		const char *revision)
+{
+	const char *strs[3] = { vendor, product, revision };
+	unsigned int h = 2166136261U;
+	const char *p;
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		for (p = strs[i]; p && *p; p++) {
+			h ^= (unsigned char)*p;
+			h *= 16777619U;
+		}
+		/* separate the fields, and NULL from "" */
+		h ^= p ? 0x1f : 0x1e;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static int
+hwe_cache_streq (const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return !strcmp(a, b);
+}
+
+static int
+hwe_cache_lookup (struct hwe_cache *hc, unsigned int hash,
+		  const char *vendor, const char *product,
+		  const char *revision, struct hwentry **hwe)
+{
+	struct hwe_cache_entry *ce;
+	int found = 0;
+
+	pthread_mutex_lock(&hc->lock);
+	for (ce = hc->buckets[hash % HWE_CACHE_BUCKETS]; ce; ce = ce->next) {
+		if (ce->hash == hash &&
+		    hwe_cache_streq(ce->vendor, vendor) &&
+		    hwe_cache_streq(ce->product, product) &&
+		    hwe_cache_streq(ce->revision, revision)) {
+			*hwe = ce->hwe;
+			found = 1;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&hc->lock);
+	return found;
+}
+
+static char *
+hwe_cache_copy (char **buf, const char *src)
+{
+	char *dst = *buf;
+	size_t len;
+
+	if (!src)
+		return NULL;
+	len = strlen(src) + 1;
+	memcpy(dst, src, len);
+	*buf += len;
+	return dst;
+}
+
+static void
+hwe_cache_insert (struct hwe_cache *hc, unsigned int hash,
+		  const char *vendor, const char *product,
+		  const char *revision, struct hwentry *hwe)
+{
+	struct hwe_cache_entry *ce;
+	size_t len = sizeof(*ce);
+	char *p;
+
+	len += vendor ? strlen(vendor) + 1 : 0;
+	len += product ? strlen(product) + 1 : 0;
+	len += revision ? strlen(revision) + 1 : 0;
+
+	ce = (struct hwe_cache_entry *)MALLOC(len);
+	if (!ce)
+		return;
+	p = (char *)(ce + 1);
+	ce->vendor = hwe_cache_copy(&p, vendor);
+	ce->product = hwe_cache_copy(&p, product);
+	ce->revision = hwe_cache_copy(&p, revision);
+	ce->hash = hash;
+	ce->hwe = hwe;
+
+	pthread_mutex_lock(&hc->lock);
+	if (hc->nr >= HWE_CACHE_MAX) {
+		pthread_mutex_unlock(&hc->lock);
+		FREE(ce);
+		return;
+	}
+	ce->next = hc->buckets[hash % HWE_CACHE_BUCKETS];
+	hc->buckets[hash % HWE_CACHE_BUCKETS] = ce;
+	hc->nr++;
+	pthread_mutex_unlock(&hc->lock);
+}
+
 struct hwentry *
-find_hwe (vector hwtable, char * vendor, char * product, char * revision)
+find_hwe (const struct config *conf, const char * vendor,
+	  const char * product, const char * revision)
 {
 	int i;
-	struct hwentry hwe, *tmp, *ret = NULL;
+	unsigned int hash = 0;
+	struct hwentry *tmp, *ret = NULL;
 
-	hwe.vendor = vendor;
-	hwe.product = product;
-	hwe.revision = revision;
+	if (conf->hwe_cache) {
+		hash = hwe_cache_hash(vendor, product, revision);
+		if (hwe_cache_lookup(conf->hwe_cache, hash, vendor, product,
+				     revision, &ret))
+			return ret;
+	}
 	/*
 	 * Search backwards here.
 	 * User modified entries are attached at the end of
 	 * the list, so we have to check them first before
 	 * continuing to the generic entries
 	 */
-	vector_foreach_slot_backwards (hwtable, tmp, i) {
-		if (hwe_regmatch(tmp, &hwe))
+	vector_foreach_slot_backwards (conf->hwtable, tmp, i) {
+		compile_hwe_regex_once(tmp);
+		if (hwe_regmatch(tmp, vendor, product, revision))
 			continue;
 		ret = tmp;
 		break;
 	}
+	if (conf->hwe_cache)
+		hwe_cache_insert(conf->hwe_cache, hash, vendor, product,
+				 revision, ret);
 	return ret;
 }
 
@@ -201,6 +492,7 @@ free_hwe (struct hwentry * hwe)
 	if (hwe->bl_product)
 		FREE(hwe->bl_product);
 
+	free_hwe_regex(hwe);
 	FREE(hwe);
 }
 
@@ -454,7 +746,8 @@ restart:
 				free_hwe(hwe2);
 				continue;
 			}
-			if (hwe_regmatch(hwe1, hwe2))
+			if (hwe_regmatch(hwe1, hwe2->vendor, hwe2->product,
+					 hwe2->revision))
 				continue;
 			/* dup */
 			merge_hwe(hwe2, hwe1);
@@ -543,14 +836,32 @@ free_config (struct config * conf)
 	free_blacklist(conf->elist_wwid);
 	free_blacklist(conf->elist_property);
 	free_blacklist_device(conf->elist_device);
+	free_blacklist_matchers(conf->blist_match);
 
 	free_mptable(conf->mptable);
 	free_hwtable(conf->hwtable);
+	free_hwe_cache(conf->hwe_cache);
 	free_hwe(conf->overrides);
 	free_keywords(conf->keywords);
 	FREE(conf);
 }
 
+/*
+ * Prepare the lookups of a config whose tables are complete. Failures
+ * are non-fatal, they only make the lookups slower.
+ */
+void
+compile_config (struct config *conf)
+{
+	compile_blacklists(conf);
+	/*
+	 * compile the hwtable patterns once, on first use, instead of on
+	 * every find_hwe() call.
+	 */
+	compile_hwtable(conf->hwtable);
+	conf->hwe_cache = alloc_hwe_cache();
+}
+
 /* if multipath fails to process the config directory, it should continue,
  * with just a warning message */
 static void
@@ -622,6 +933,8 @@ load_config (char * file)
 	conf->disable_changed_wwids = DEFAULT_DISABLE_CHANGED_WWIDS;
 	conf->remove_retries = 0;
 	conf->ghost_delay = DEFAULT_GHOST_DELAY;
+	conf->checker_threads = DEFAULT_CHECKER_THREADS;
+	conf->discovery_threads = DEFAULT_DISCOVERY_THREADS;
 
 	/*
 	 * preload default hwtable
@@ -735,6 +1048,7 @@ load_config (char * file)
 	    !conf->wwids_file || !conf->prkeys_file)
 		goto out;
 
+	compile_config(conf);
 	return conf;
 out:
 	free_config(conf);
@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <urcu.h>
 #include <inttypes.h>
+#include <regex.h>
 #include "byteorder.h"
 
 #define ORIGIN_DEFAULT 0
@@ -45,6 +46,7 @@ enum force_reload_types {
 	FORCE_RELOAD_WEAK,
 };
 
+/* pointer members must be handled in config_snapshot.c, too */
 struct hwentry {
 	char * vendor;
 	char * product;
@@ -83,8 +85,25 @@ struct hwentry {
 	int max_sectors_kb;
 	int ghost_delay;
 	char * bl_product;
+
+	/*
+	 * vendor, product and revision compiled by find_hwe() when the
+	 * entry is first matched against. Patterns without regex
+	 * metacharacters are matched as plain substrings and have no
+	 * regex_t.
+	 */
+	int regex_state;
+	regex_t *vendor_re;
+	regex_t *product_re;
+	regex_t *revision_re;
 };
 
+#define HWE_REGEX_NONE		0
+#define HWE_REGEX_COMPILED	1
+#define HWE_REGEX_INVALID	2
+#define HWE_REGEX_LAZY		3
+
+/* pointer members must be handled in config_snapshot.c, too */
 struct mpentry {
 	char * wwid;
 	char * alias;
@@ -121,6 +140,7 @@ struct mpentry {
 	mode_t mode;
 };
 
+/* pointer members must be handled in config_snapshot.c, too */
 struct config {
 	struct rcu_head rcu;
 	int verbosity;
@@ -176,6 +196,8 @@ struct config {
 	int remove_retries;
 	int max_sectors_kb;
 	int ghost_delay;
+	int checker_threads;
+	int discovery_threads;
 	unsigned int version[3];
 
 	char * multipath_dir;
@@ -200,6 +222,7 @@ struct config {
 	vector keywords;
 	vector mptable;
 	vector hwtable;
+	struct hwe_cache *hwe_cache;
 	struct hwentry *overrides;
 
 	vector blist_devnode;
@@ -210,11 +233,13 @@ struct config {
 	vector elist_wwid;
 	vector elist_device;
 	vector elist_property;
+	struct blacklist_matchers *blist_match;
 };
 
 extern struct udev * udev;
 
-struct hwentry * find_hwe (vector hwtable, char * vendor, char * product, char *revision);
+struct hwentry * find_hwe (const struct config *conf, const char * vendor,
+			   const char * product, const char * revision);
 struct mpentry * find_mpe (vector mptable, char * wwid);
 char * get_mpe_wwid (vector mptable, char * alias);
 
@@ -231,6 +256,7 @@ int store_hwe (vector hwtable, struct hwentry *);
 struct config *load_config (char * file);
 struct config * alloc_config (void);
 void free_config (struct config * conf);
+void compile_config (struct config * conf);
 extern struct config *get_multipath_config(void);
 extern void put_multipath_config(struct config *);
 
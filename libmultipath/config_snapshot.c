@@ -0,0 +1,812 @@
+/*
+ * Binary config snapshots, see config_snapshot.h.
+ *
+ * Layout of the snapshot file, all in host byte order:
+ *
+ *	struct snap_header
+ *	struct snap_source	[nr_sources]	config files and their stat
+ *	struct snap_ble		[nr_ble]	blacklist and exception entries
+ *	struct config				with its tables detached
+ *	struct hwentry		[has_overrides]
+ *	struct hwentry		[nr_hwe]	the hwtable
+ *	struct mpentry		[nr_mpe]	the mptable
+ *	string table		[strtab_len]
+ *
+ * The string members of the copied structures hold string table offsets
+ * plus one (zero for NULL) instead of pointers, and their other pointer
+ * members are cleared. The blacklist regexes are compiled again after
+ * loading, the hwtable ones when find_hwe() first tries an entry.
+ *
+ * This file is released under the GPL version 2, or any later version.
+ */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vector.h"
+#include "memory.h"
+#include "structs.h"
+#include "config.h"
+#include "blacklist.h"
+#include "dict.h"
+#include "debug.h"
+#include "version.h"
+#include "hwtable.h"
+#include "config_snapshot.h"
+
+static const char snap_magic[8] = "MPCSNAP";
+
+#define SNAP_VERSION	2
+
+struct snap_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t code_version;
+	/* catch snapshots from builds with another built-in hwtable */
+	uint32_t build_id;
+	/* or with other structure layouts */
+	uint32_t conf_size;
+	uint32_t hwe_size;
+	uint32_t mpe_size;
+	uint32_t size;
+	uint32_t csum;
+	uint32_t nr_sources;
+	uint32_t nr_ble;
+	uint32_t has_overrides;
+	uint32_t nr_hwe;
+	uint32_t nr_mpe;
+	uint32_t strtab_len;
+};
+
+struct snap_source {
+	uint64_t dev;
+	uint64_t ino;
+	int64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t name;
+	uint32_t exists;
+};
+
+enum {
+	SNAP_BLIST_DEVNODE,
+	SNAP_BLIST_WWID,
+	SNAP_BLIST_DEVICE,
+	SNAP_BLIST_PROPERTY,
+	SNAP_ELIST_DEVNODE,
+	SNAP_ELIST_WWID,
+	SNAP_ELIST_DEVICE,
+	SNAP_ELIST_PROPERTY,
+	__SNAP_LISTS,
+};
+
+struct snap_ble {
+	uint32_t list;
+	uint32_t origin;
+	/* vendor and product for device lists */
+	uint32_t str;
+	uint32_t str2;
+};
+
+static const size_t conf_strs[] = {
+	offsetof(struct config, multipath_dir),
+	offsetof(struct config, selector),
+	offsetof(struct config, uid_attrs),
+	offsetof(struct config, uid_attribute),
+	offsetof(struct config, getuid),
+	offsetof(struct config, features),
+	offsetof(struct config, hwhandler),
+	offsetof(struct config, bindings_file),
+	offsetof(struct config, wwids_file),
+	offsetof(struct config, prkeys_file),
+	offsetof(struct config, prio_name),
+	offsetof(struct config, prio_args),
+	offsetof(struct config, checker_name),
+	offsetof(struct config, alias_prefix),
+	offsetof(struct config, partition_delim),
+	offsetof(struct config, config_dir),
+};
+
+static const size_t hwe_strs[] = {
+	offsetof(struct hwentry, vendor),
+	offsetof(struct hwentry, product),
+	offsetof(struct hwentry, revision),
+	offsetof(struct hwentry, uid_attribute),
+	offsetof(struct hwentry, getuid),
+	offsetof(struct hwentry, features),
+	offsetof(struct hwentry, hwhandler),
+	offsetof(struct hwentry, selector),
+	offsetof(struct hwentry, checker_name),
+	offsetof(struct hwentry, prio_name),
+	offsetof(struct hwentry, prio_args),
+	offsetof(struct hwentry, alias_prefix),
+	offsetof(struct hwentry, bl_product),
+};
+
+static const size_t mpe_strs[] = {
+	offsetof(struct mpentry, wwid),
+	offsetof(struct mpentry, alias),
+	offsetof(struct mpentry, uid_attribute),
+	offsetof(struct mpentry, getuid),
+	offsetof(struct mpentry, selector),
+	offsetof(struct mpentry, features),
+	offsetof(struct mpentry, prio_name),
+	offsetof(struct mpentry, prio_args),
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+#define STR_MEMBER(obj, off) (*(char **)((char *)(obj) + (off)))
+
+static void
+clear_conf_ptrs (struct config *conf)
+{
+	memset(&conf->rcu, 0, sizeof(conf->rcu));
+	conf->keywords = NULL;
+	conf->mptable = NULL;
+	conf->hwtable = NULL;
+	conf->hwe_cache = NULL;
+	conf->overrides = NULL;
+	conf->blist_devnode = NULL;
+	conf->blist_wwid = NULL;
+	conf->blist_device = NULL;
+	conf->blist_property = NULL;
+	conf->elist_devnode = NULL;
+	conf->elist_wwid = NULL;
+	conf->elist_device = NULL;
+	conf->elist_property = NULL;
+	conf->blist_match = NULL;
+}
+
+static void
+clear_hwe_ptrs (struct hwentry *hwe)
+{
+	hwe->regex_state = HWE_REGEX_NONE;
+	hwe->vendor_re = NULL;
+	hwe->product_re = NULL;
+	hwe->revision_re = NULL;
+}
+
+static uint32_t
+snap_csum (uint32_t h, const void *data, size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * A checksum of the built-in hwtable. A package rebuilt with changes to
+ * hwtable.c usually keeps its version, and must not be served the
+ * hwtable of the daemon which is still running.
+ */
+static uint32_t
+snap_build_id (void)
+{
+	const struct hwentry *hwe;
+	struct hwentry img;
+	const char *str;
+	uint32_t h = 2166136261U;
+	size_t i;
+
+	for (hwe = default_hwtable(); hwe->vendor; hwe++) {
+		memcpy(&img, hwe, sizeof(img));
+		for (i = 0; i < ARRAY_SIZE(hwe_strs); i++) {
+			str = STR_MEMBER(&img, hwe_strs[i]);
+			/* with the member number, NULL differs from "" */
+			h = snap_csum(h, &i, 1);
+			if (str)
+				h = snap_csum(h, str, strlen(str) + 1);
+			STR_MEMBER(&img, hwe_strs[i]) = NULL;
+		}
+		h = snap_csum(h, &img, sizeof(img));
+	}
+	return h;
+}
+
+/* Growable byte buffer for building the snapshot sections */
+struct snap_buf {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static int
+snap_append (struct snap_buf *sb, const void *data, size_t len)
+{
+	if (sb->len + len > sb->size) {
+		size_t size = sb->size ? sb->size : 4096;
+		char *buf;
+
+		while (size < sb->len + len)
+			size *= 2;
+		buf = REALLOC(sb->buf, size);
+		if (!buf)
+			return 1;
+		sb->buf = buf;
+		sb->size = size;
+	}
+	memcpy(sb->buf + sb->len, data, len);
+	sb->len += len;
+	return 0;
+}
+
+struct snap_writer {
+	struct snap_buf sources;
+	struct snap_buf bles;
+	struct snap_buf objs;
+	struct snap_buf strtab;
+	uint32_t nr_sources;
+	uint32_t nr_ble;
+	int err;
+};
+
+/* Returns the string table reference for @str, 0 for NULL */
+static uint32_t
+snap_add_str (struct snap_writer *sw, const char *str)
+{
+	size_t off = sw->strtab.len;
+
+	if (!str)
+		return 0;
+	if (snap_append(&sw->strtab, str, strlen(str) + 1)) {
+		sw->err = 1;
+		return 0;
+	}
+	return off + 1;
+}
+
+static void
+snap_add_strs (struct snap_writer *sw, void *img, const size_t *offs,
+	       int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		STR_MEMBER(img, offs[i]) = (char *)(uintptr_t)
+			snap_add_str(sw, STR_MEMBER(img, offs[i]));
+}
+
+static void
+snap_add_obj (struct snap_writer *sw, const void *img, size_t len)
+{
+	if (snap_append(&sw->objs, img, len))
+		sw->err = 1;
+}
+
+static void
+snap_add_hwe (struct snap_writer *sw, const struct hwentry *hwe)
+{
+	struct hwentry img = *hwe;
+
+	clear_hwe_ptrs(&img);
+	snap_add_strs(sw, &img, hwe_strs, ARRAY_SIZE(hwe_strs));
+	snap_add_obj(sw, &img, sizeof(img));
+}
+
+static void
+snap_add_blist (struct snap_writer *sw, vector blist, int list)
+{
+	struct snap_ble sble;
+	struct blentry *ble;
+	int i;
+
+	vector_foreach_slot (blist, ble, i) {
+		memset(&sble, 0, sizeof(sble));
+		sble.list = list;
+		sble.origin = ble->origin;
+		sble.str = snap_add_str(sw, ble->str);
+		if (snap_append(&sw->bles, &sble, sizeof(sble)))
+			sw->err = 1;
+		sw->nr_ble++;
+	}
+}
+
+static void
+snap_add_blist_device (struct snap_writer *sw, vector blist, int list)
+{
+	struct snap_ble sble;
+	struct blentry_device *ble;
+	int i;
+
+	vector_foreach_slot (blist, ble, i) {
+		memset(&sble, 0, sizeof(sble));
+		sble.list = list;
+		sble.origin = ble->origin;
+		sble.str = snap_add_str(sw, ble->vendor);
+		sble.str2 = snap_add_str(sw, ble->product);
+		if (snap_append(&sw->bles, &sble, sizeof(sble)))
+			sw->err = 1;
+		sw->nr_ble++;
+	}
+}
+
+/*
+ * Record the stat data of @name. Returns 1 if the file was modified
+ * too recently to tell it apart from a modification after @loaded.
+ */
+static int
+snap_add_source (struct snap_writer *sw, const char *name, time_t loaded)
+{
+	struct snap_source src;
+	struct stat st;
+
+	memset(&src, 0, sizeof(src));
+	if (stat(name, &st) == 0) {
+		if (st.st_mtim.tv_sec >= loaded - 1)
+			return 1;
+		src.exists = 1;
+		src.dev = st.st_dev;
+		src.ino = st.st_ino;
+		src.size = st.st_size;
+		src.mtime_sec = st.st_mtim.tv_sec;
+		src.mtime_nsec = st.st_mtim.tv_nsec;
+	} else if (errno != ENOENT)
+		sw->err = 1;
+	src.name = snap_add_str(sw, name);
+	if (snap_append(&sw->sources, &src, sizeof(src)))
+		sw->err = 1;
+	sw->nr_sources++;
+	return 0;
+}
+
+/* The files load_config() reads, see process_config_dir() */
+static int
+snap_add_sources (struct snap_writer *sw, const char *file,
+		  const char *dir, time_t loaded)
+{
+	struct dirent **namelist;
+	char path[PATH_MAX];
+	int i, n, racy = 0;
+
+	if (snap_add_source(sw, file, loaded))
+		return 1;
+	if (!dir || dir[0] != '/')
+		return 0;
+	/* the directory mtime changes with files added or removed */
+	if (snap_add_source(sw, dir, loaded))
+		return 1;
+	n = scandir(dir, &namelist, NULL, alphasort);
+	if (n < 0)
+		return 0;
+	for (i = 0; i < n; i++) {
+		if (!racy && strstr(namelist[i]->d_name, ".conf")) {
+			snprintf(path, sizeof(path), "%s/%s", dir,
+				 namelist[i]->d_name);
+			racy = snap_add_source(sw, path, loaded);
+		}
+		free(namelist[i]);
+	}
+	free(namelist);
+	return racy;
+}
+
+static void
+free_snap_writer (struct snap_writer *sw)
+{
+	FREE(sw->sources.buf);
+	FREE(sw->bles.buf);
+	FREE(sw->objs.buf);
+	FREE(sw->strtab.buf);
+}
+
+static int
+write_all (int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int
+write_config_snapshot (const struct config *conf, const char *file,
+		       const char *snapshot, time_t loaded)
+{
+	struct snap_writer sw;
+	struct snap_header hdr;
+	struct config cimg;
+	struct hwentry *hwe;
+	struct mpentry *mpe, mimg;
+	char tmp[PATH_MAX];
+	int i, fd, r = 1;
+
+	memset(&sw, 0, sizeof(sw));
+	if (snap_add_sources(&sw, file, conf->config_dir, loaded)) {
+		condlog(3, "config changed while loading, not writing %s",
+			snapshot);
+		unlink(snapshot);
+		goto out;
+	}
+
+	cimg = *conf;
+	clear_conf_ptrs(&cimg);
+	snap_add_strs(&sw, &cimg, conf_strs, ARRAY_SIZE(conf_strs));
+	snap_add_obj(&sw, &cimg, sizeof(cimg));
+	if (conf->overrides)
+		snap_add_hwe(&sw, conf->overrides);
+	vector_foreach_slot (conf->hwtable, hwe, i)
+		snap_add_hwe(&sw, hwe);
+	vector_foreach_slot (conf->mptable, mpe, i) {
+		mimg = *mpe;
+		snap_add_strs(&sw, &mimg, mpe_strs, ARRAY_SIZE(mpe_strs));
+		snap_add_obj(&sw, &mimg, sizeof(mimg));
+	}
+
+	snap_add_blist(&sw, conf->blist_devnode, SNAP_BLIST_DEVNODE);
+	snap_add_blist(&sw, conf->blist_wwid, SNAP_BLIST_WWID);
+	snap_add_blist_device(&sw, conf->blist_device, SNAP_BLIST_DEVICE);
+	snap_add_blist(&sw, conf->blist_property, SNAP_BLIST_PROPERTY);
+	snap_add_blist(&sw, conf->elist_devnode, SNAP_ELIST_DEVNODE);
+	snap_add_blist(&sw, conf->elist_wwid, SNAP_ELIST_WWID);
+	snap_add_blist_device(&sw, conf->elist_device, SNAP_ELIST_DEVICE);
+	snap_add_blist(&sw, conf->elist_property, SNAP_ELIST_PROPERTY);
+	if (sw.err)
+		goto out;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, snap_magic, sizeof(hdr.magic));
+	hdr.version = SNAP_VERSION;
+	hdr.code_version = VERSION_CODE;
+	hdr.build_id = snap_build_id();
+	hdr.conf_size = sizeof(struct config);
+	hdr.hwe_size = sizeof(struct hwentry);
+	hdr.mpe_size = sizeof(struct mpentry);
+	hdr.nr_sources = sw.nr_sources;
+	hdr.nr_ble = sw.nr_ble;
+	hdr.has_overrides = !!conf->overrides;
+	hdr.nr_hwe = VECTOR_SIZE(conf->hwtable);
+	hdr.nr_mpe = VECTOR_SIZE(conf->mptable);
+	hdr.strtab_len = sw.strtab.len;
+	hdr.size = sizeof(hdr) + sw.sources.len + sw.bles.len +
+		sw.objs.len + sw.strtab.len;
+	hdr.csum = snap_csum(2166136261U, sw.sources.buf, sw.sources.len);
+	hdr.csum = snap_csum(hdr.csum, sw.bles.buf, sw.bles.len);
+	hdr.csum = snap_csum(hdr.csum, sw.objs.buf, sw.objs.len);
+	hdr.csum = snap_csum(hdr.csum, sw.strtab.buf, sw.strtab.len);
+
+	/* write a new file and rename it, readers never see partial data */
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", snapshot);
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		condlog(2, "failed to create %s: %s", tmp, strerror(errno));
+		goto out;
+	}
+	if (write_all(fd, &hdr, sizeof(hdr)) ||
+	    write_all(fd, sw.sources.buf, sw.sources.len) ||
+	    write_all(fd, sw.bles.buf, sw.bles.len) ||
+	    write_all(fd, sw.objs.buf, sw.objs.len) ||
+	    write_all(fd, sw.strtab.buf, sw.strtab.len)) {
+		condlog(2, "failed to write %s: %s", tmp, strerror(errno));
+		close(fd);
+		unlink(tmp);
+		goto out;
+	}
+	close(fd);
+	if (rename(tmp, snapshot)) {
+		condlog(2, "failed to rename %s: %s", tmp, strerror(errno));
+		unlink(tmp);
+		goto out;
+	}
+	condlog(3, "wrote config snapshot %s (%u bytes)", snapshot, hdr.size);
+	r = 0;
+out:
+	free_snap_writer(&sw);
+	return r;
+}
+
+struct snap_reader {
+	const struct snap_header *hdr;
+	const struct snap_source *sources;
+	const struct snap_ble *bles;
+	const char *objs;
+	const char *strtab;
+};
+
+static const char *
+snap_str (const struct snap_reader *sr, uintptr_t ref)
+{
+	if (!ref || ref > sr->hdr->strtab_len)
+		return NULL;
+	return sr->strtab + ref - 1;
+}
+
+/*
+ * Replace the string table references in the string members of @obj
+ * with copies of the strings. On failure, the remaining members are
+ * NULL, so that @obj can be freed.
+ */
+static int
+snap_get_strs (const struct snap_reader *sr, void *obj, const size_t *offs,
+	       int nr)
+{
+	const char *str;
+	int i, r = 0;
+
+	for (i = 0; i < nr; i++) {
+		uintptr_t ref = (uintptr_t)STR_MEMBER(obj, offs[i]);
+
+		STR_MEMBER(obj, offs[i]) = NULL;
+		if (r || !ref)
+			continue;
+		str = snap_str(sr, ref);
+		if (!str || !(STR_MEMBER(obj, offs[i]) = STRDUP(str)))
+			r = 1;
+	}
+	return r;
+}
+
+static struct hwentry *
+snap_get_hwe (const struct snap_reader *sr, const char **objs)
+{
+	struct hwentry *hwe = alloc_hwe();
+
+	if (!hwe)
+		return NULL;
+	memcpy(hwe, *objs, sizeof(*hwe));
+	*objs += sizeof(*hwe);
+	clear_hwe_ptrs(hwe);
+	if (snap_get_strs(sr, hwe, hwe_strs, ARRAY_SIZE(hwe_strs))) {
+		free_hwe(hwe);
+		return NULL;
+	}
+	return hwe;
+}
+
+static vector
+snap_blist (struct config *conf, int list)
+{
+	switch (list) {
+	case SNAP_BLIST_DEVNODE:
+		return conf->blist_devnode;
+	case SNAP_BLIST_WWID:
+		return conf->blist_wwid;
+	case SNAP_BLIST_DEVICE:
+		return conf->blist_device;
+	case SNAP_BLIST_PROPERTY:
+		return conf->blist_property;
+	case SNAP_ELIST_DEVNODE:
+		return conf->elist_devnode;
+	case SNAP_ELIST_WWID:
+		return conf->elist_wwid;
+	case SNAP_ELIST_DEVICE:
+		return conf->elist_device;
+	case SNAP_ELIST_PROPERTY:
+		return conf->elist_property;
+	}
+	return NULL;
+}
+
+static int
+snap_get_ble (const struct snap_reader *sr, struct config *conf,
+	      const struct snap_ble *sble)
+{
+	vector blist = snap_blist(conf, sble->list);
+	const char *str = snap_str(sr, sble->str);
+	const char *str2 = snap_str(sr, sble->str2);
+	char *vendor = NULL, *product = NULL;
+
+	if (!blist)
+		return 1;
+	if (sble->list != SNAP_BLIST_DEVICE &&
+	    sble->list != SNAP_ELIST_DEVICE) {
+		/* store_ble() ignores NULL, don't lose the entry silently */
+		if (!str || !(vendor = STRDUP(str)))
+			return 1;
+		return store_ble(blist, vendor, sble->origin);
+	}
+
+	if (alloc_ble_device(blist))
+		return 1;
+	if ((str && !(vendor = STRDUP(str))) ||
+	    (str2 && !(product = STRDUP(str2)))) {
+		if (vendor)
+			FREE(vendor);
+		return 1;
+	}
+	return set_ble_device(blist, vendor, product, sble->origin);
+}
+
+static int
+snap_sources_valid (const struct snap_reader *sr, const char *file)
+{
+	const struct snap_source *src;
+	const char *name;
+	struct stat st;
+	uint32_t i;
+
+	/* the first source is the config file itself */
+	if (!sr->hdr->nr_sources ||
+	    !(name = snap_str(sr, sr->sources[0].name)) || strcmp(name, file))
+		return 0;
+
+	for (i = 0; i < sr->hdr->nr_sources; i++) {
+		src = &sr->sources[i];
+		name = snap_str(sr, src->name);
+		if (!name)
+			return 0;
+		if (stat(name, &st) != 0) {
+			if (errno != ENOENT || src->exists)
+				return 0;
+			continue;
+		}
+		if (!src->exists || src->dev != (uint64_t)st.st_dev ||
+		    src->ino != (uint64_t)st.st_ino ||
+		    src->size != (int64_t)st.st_size ||
+		    src->mtime_sec != (int64_t)st.st_mtim.tv_sec ||
+		    src->mtime_nsec != (int64_t)st.st_mtim.tv_nsec) {
+			condlog(4, "%s changed since the config snapshot",
+				name);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+snap_header_valid (const struct snap_header *hdr, size_t len)
+{
+	uint64_t size;
+
+	if (len < sizeof(*hdr) ||
+	    memcmp(hdr->magic, snap_magic, sizeof(hdr->magic)) ||
+	    hdr->version != SNAP_VERSION ||
+	    hdr->code_version != VERSION_CODE ||
+	    hdr->conf_size != sizeof(struct config) ||
+	    hdr->hwe_size != sizeof(struct hwentry) ||
+	    hdr->mpe_size != sizeof(struct mpentry) ||
+	    hdr->size != len)
+		return 0;
+	if (hdr->build_id != snap_build_id()) {
+		condlog(3, "config snapshot is from another build");
+		return 0;
+	}
+
+	size = sizeof(*hdr) +
+		(uint64_t)hdr->nr_sources * sizeof(struct snap_source) +
+		(uint64_t)hdr->nr_ble * sizeof(struct snap_ble) +
+		sizeof(struct config) +
+		(hdr->has_overrides ? sizeof(struct hwentry) : 0) +
+		(uint64_t)hdr->nr_hwe * sizeof(struct hwentry) +
+		(uint64_t)hdr->nr_mpe * sizeof(struct mpentry) +
+		hdr->strtab_len;
+	if (size != len)
+		return 0;
+	/* all strings end within the string table */
+	if (hdr->strtab_len && ((const char *)hdr)[len - 1] != '\0')
+		return 0;
+	return snap_csum(2166136261U, hdr + 1, len - sizeof(*hdr)) ==
+		hdr->csum;
+}
+
+static struct config *
+snap_restore (const void *map, size_t len, const char *file)
+{
+	struct snap_reader sr;
+	struct config *conf;
+	struct hwentry *hwe;
+	struct mpentry *mpe;
+	const char *objs;
+	uint32_t i;
+
+	if (!snap_header_valid(map, len)) {
+		condlog(3, "invalid config snapshot");
+		return NULL;
+	}
+	sr.hdr = map;
+	sr.sources = (const struct snap_source *)(sr.hdr + 1);
+	sr.bles = (const struct snap_ble *)(sr.sources + sr.hdr->nr_sources);
+	sr.objs = (const char *)(sr.bles + sr.hdr->nr_ble);
+	sr.strtab = (const char *)map + len - sr.hdr->strtab_len;
+	if (!snap_sources_valid(&sr, file))
+		return NULL;
+
+	conf = alloc_config();
+	if (!conf)
+		return NULL;
+	objs = sr.objs;
+	memcpy(conf, objs, sizeof(*conf));
+	objs += sizeof(*conf);
+	clear_conf_ptrs(conf);
+	if (snap_get_strs(&sr, conf, conf_strs, ARRAY_SIZE(conf_strs)))
+		goto out;
+
+	if (sr.hdr->has_overrides &&
+	    !(conf->overrides = snap_get_hwe(&sr, &objs)))
+		goto out;
+	if (!(conf->hwtable = vector_alloc()))
+		goto out;
+	for (i = 0; i < sr.hdr->nr_hwe; i++) {
+		if (!(hwe = snap_get_hwe(&sr, &objs)))
+			goto out;
+		if (!vector_alloc_slot(conf->hwtable)) {
+			free_hwe(hwe);
+			goto out;
+		}
+		vector_set_slot(conf->hwtable, hwe);
+	}
+	if (!(conf->mptable = vector_alloc()))
+		goto out;
+	for (i = 0; i < sr.hdr->nr_mpe; i++) {
+		if (!(mpe = alloc_mpe()))
+			goto out;
+		memcpy(mpe, objs, sizeof(*mpe));
+		objs += sizeof(*mpe);
+		if (snap_get_strs(&sr, mpe, mpe_strs, ARRAY_SIZE(mpe_strs)) ||
+		    !vector_alloc_slot(conf->mptable)) {
+			free_mpe(mpe);
+			goto out;
+		}
+		vector_set_slot(conf->mptable, mpe);
+	}
+
+	if (!(conf->blist_devnode = vector_alloc()) ||
+	    !(conf->blist_wwid = vector_alloc()) ||
+	    !(conf->blist_device = vector_alloc()) ||
+	    !(conf->blist_property = vector_alloc()) ||
+	    !(conf->elist_devnode = vector_alloc()) ||
+	    !(conf->elist_wwid = vector_alloc()) ||
+	    !(conf->elist_device = vector_alloc()) ||
+	    !(conf->elist_property = vector_alloc()))
+		goto out;
+	for (i = 0; i < sr.hdr->nr_ble; i++)
+		if (snap_get_ble(&sr, conf, &sr.bles[i]))
+			goto out;
+
+	if (!(conf->keywords = vector_alloc()))
+		goto out;
+	init_keywords(conf->keywords);
+	compile_config(conf);
+	return conf;
+out:
+	condlog(2, "failed to restore config snapshot");
+	free_config(conf);
+	return NULL;
+}
+
+struct config *
+load_config_snapshot (const char *file, const char *snapshot)
+{
+	struct config *conf;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(snapshot, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct snap_header)) {
+		close(fd);
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+	conf = snap_restore(map, st.st_size, file);
+	munmap(map, st.st_size);
+	return conf;
+}
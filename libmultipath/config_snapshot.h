@@ -0,0 +1,33 @@
+#ifndef _CONFIG_SNAPSHOT_H
+#define _CONFIG_SNAPSHOT_H
+
+#include <time.h>
+
+struct config;
+
+/*
+ * Binary snapshot of a loaded config.
+ *
+ * multipathd writes the config it loaded from the config file and
+ * config_dir into a snapshot file, together with the stat data of these
+ * files. "multipath -u" and "-c" run for every uevent of every path
+ * device, and can load the snapshot with one mmap() instead of parsing
+ * the config and building the hwtable. A snapshot whose files have
+ * changed since, or which comes from another build, is ignored.
+ */
+
+/*
+ * @loaded is the time load_config() was called for @conf. If one of
+ * the config files was modified since, the snapshot isn't written, and
+ * any old snapshot is removed. Returns 0 on success.
+ */
+int write_config_snapshot(const struct config *conf, const char *file,
+			  const char *snapshot, time_t loaded);
+
+/*
+ * Returns the config load_config(@file) would return, or NULL if the
+ * snapshot is missing, invalid or stale.
+ */
+struct config *load_config_snapshot(const char *file, const char *snapshot);
+
+#endif /* _CONFIG_SNAPSHOT_H */
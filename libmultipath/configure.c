@@ -535,6 +535,7 @@ select_action (struct multipath * mpp, vector curmp, int force_reload)
 		condlog(2, "%s: remove (wwid changed)", mpp->alias);
 		dm_flush_map(mpp->alias);
 		strncpy(cmpp_by_name->wwid, mpp->wwid, WWID_SIZE - 1);
+		vector_index_rekey(curmp, cmpp_by_name);
 		drop_multipath(curmp, cmpp_by_name->wwid, KEEP_PATHS);
 		mpp->action = ACT_CREATE;
 		condlog(3, "%s: set ACT_CREATE (map wwid change)",
@@ -729,15 +730,6 @@ fail:
 	return 1;
 }
 
-/*
- * Return value:
- */
-#define DOMAP_RETRY	-1
-#define DOMAP_FAIL	0
-#define DOMAP_OK	1
-#define DOMAP_EXIST	2
-#define DOMAP_DRY	3
-
 int domap(struct multipath *mpp, char *params, int is_daemon)
 {
 	int r = DOMAP_FAIL;
@@ -927,6 +919,121 @@ out:
  * FORCE_RELOAD_WEAK: existing maps are compared to the current conf and only
  * reloaded in DM if there's a difference. This is useful during startup.
  */
+/* The paths of the pathvec with one WWID, in pathvec order */
+struct wwid_group {
+	char wwid[WWID_SIZE];
+	int nr;
+	struct path *paths[];
+};
+
+struct wwid_sort_ent {
+	struct path *pp;
+	int pos;
+};
+
+static int
+wwid_sort_cmp (const void *a, const void *b)
+{
+	const struct wwid_sort_ent *e1 = a, *e2 = b;
+	int r = strcmp(e1->pp->wwid, e2->pp->wwid);
+
+	return r ? r : e1->pos - e2->pos;
+}
+
+static const char *
+wwid_group_key (const void *elem, char *buf, size_t len)
+{
+	return ((const struct wwid_group *)elem)->wwid;
+}
+
+static void
+free_wwid_groups (vector groups)
+{
+	struct wwid_group *grp;
+	int i;
+
+	vector_foreach_slot (groups, grp, i)
+		FREE(grp);
+	vector_free(groups);
+}
+
+/*
+ * Group the paths of @pathvec by WWID in one sort, instead of
+ * scanning the pathvec for the other paths of every new map.
+ * Returns NULL on failure; callers then scan the pathvec.
+ */
+static vector
+group_paths_by_wwid (vector pathvec)
+{
+	struct wwid_sort_ent *ents;
+	struct wwid_group *grp;
+	struct path *pp;
+	vector groups;
+	int i, j, n = 0;
+
+	ents = MALLOC(VECTOR_SIZE(pathvec) * sizeof(*ents) + 1);
+	if (!ents)
+		return NULL;
+	vector_foreach_slot (pathvec, pp, i) {
+		if (!strlen(pp->wwid))
+			continue;
+		ents[n].pp = pp;
+		ents[n].pos = i;
+		n++;
+	}
+	qsort(ents, n, sizeof(*ents), wwid_sort_cmp);
+
+	groups = vector_alloc();
+	if (!groups || vector_add_index(groups, wwid_group_key))
+		goto fail;
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n; j++)
+			if (strcmp(ents[i].pp->wwid, ents[j].pp->wwid))
+				break;
+		grp = MALLOC(sizeof(*grp) + (j - i) * sizeof(grp->paths[0]));
+		if (!grp)
+			goto fail;
+		strlcpy(grp->wwid, ents[i].pp->wwid, WWID_SIZE);
+		for (grp->nr = 0; grp->nr < j - i; grp->nr++)
+			grp->paths[grp->nr] = ents[i + grp->nr].pp;
+		if (!vector_alloc_slot(groups)) {
+			FREE(grp);
+			goto fail;
+		}
+		vector_set_slot(groups, grp);
+	}
+	FREE(ents);
+	return groups;
+fail:
+	condlog(2, "failed to group paths by wwid");
+	if (groups)
+		free_wwid_groups(groups);
+	FREE(ents);
+	return NULL;
+}
+
+static struct wwid_group *
+find_wwid_group (vector groups, const char *wwid)
+{
+	void *grp;
+
+	if (!groups || vector_index_find(groups, wwid_group_key, wwid, &grp))
+		return NULL;
+	return grp;
+}
+
+/* Drop the paths which verify_paths() removed from the map */
+static void
+prune_wwid_group (struct wwid_group *grp, struct multipath *mpp)
+{
+	int i, n = 0;
+
+	for (i = 0; i < grp->nr; i++)
+		if (find_slot(mpp->paths, grp->paths[i]) != -1)
+			grp->paths[n++] = grp->paths[i];
+	grp->nr = n;
+}
+
 int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 		    int force_reload, enum mpath_cmds cmd)
 {
@@ -939,6 +1046,10 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 	struct path * pp2;
 	vector curmp = vecs->mpvec;
 	vector pathvec = vecs->pathvec;
+	vector groups;
+	struct wwid_group *grp;
+	struct path **cand;
+	int nr_cand, self;
 	struct config *conf;
 	int allow_queueing;
 
@@ -951,6 +1062,12 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 			pp1->mpp = NULL;
 		}
 	}
+	groups = group_paths_by_wwid(pathvec);
+	/*
+	 * Don't wait for udev after every map, but once for all of them
+	 * before returning.
+	 */
+	libmp_udev_batch_start();
 	vector_foreach_slot (pathvec, pp1, k) {
 		/* skip this path for some reason */
 
@@ -978,8 +1095,26 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 		if (refwwid && strncmp(pp1->wwid, refwwid, WWID_SIZE - 1))
 			continue;
 
+		/*
+		 * The candidate paths for the map: the WWID group of pp1,
+		 * or the whole pathvec if grouping failed.
+		 */
+		grp = find_wwid_group(groups, pp1->wwid);
+		if (grp) {
+			cand = grp->paths;
+			nr_cand = grp->nr;
+			for (self = 0; self < nr_cand; self++)
+				if (cand[self] == pp1)
+					break;
+		} else {
+			cand = (struct path **)pathvec->slot;
+			nr_cand = VECTOR_SIZE(pathvec);
+			self = k;
+		}
+
 		/* If find_multipaths was selected check if the path is valid */
-		if (!refwwid && !should_multipath(pp1, pathvec)) {
+		if (!refwwid && !(grp ? should_multipath_nr(pp1, grp->nr) :
+				  should_multipath(pp1, pathvec))) {
 			orphan_path(pp1, "only one path");
 			continue;
 		}
@@ -987,7 +1122,7 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 		/*
 		 * at this point, we know we really got a new mp
 		 */
-		mpp = add_map_with_path(vecs, pp1, 0);
+		mpp = add_map_with_path_group(vecs, pp1, 0, cand, nr_cand);
 		if (!mpp) {
 			orphan_path(pp1, "failed to create multipath device");
 			continue;
@@ -1002,8 +1137,8 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 			continue;
 		}
 
-		for (i = k + 1; i < VECTOR_SIZE(pathvec); i++) {
-			pp2 = VECTOR_SLOT(pathvec, i);
+		for (i = self + 1; i < nr_cand; i++) {
+			pp2 = cand[i];
 
 			if (strcmp(pp1->wwid, pp2->wwid))
 				continue;
@@ -1024,7 +1159,8 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 			if (pp2->priority == PRIO_UNDEF)
 				mpp->action = ACT_REJECT;
 		}
-		verify_paths(mpp, vecs);
+		if (verify_paths(mpp, vecs) && grp)
+			prune_wwid_group(grp, mpp);
 
 		params[0] = '\0';
 		if (setup_map(mpp, params, PARAMS_SIZE, vecs)) {
@@ -1050,8 +1186,11 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 					"ignoring" : "removing");
 				remove_map(mpp, vecs, 0);
 				continue;
-			} else /* if (r == DOMAP_RETRY) */
+			} else { /* if (r == DOMAP_RETRY) */
+				free_wwid_groups(groups);
+				libmp_udev_batch_wait();
 				return r;
+			}
 		}
 		if (r == DOMAP_DRY)
 			continue;
@@ -1089,14 +1228,19 @@ int coalesce_paths (struct vectors * vecs, vector newmp, char * refwwid,
 
 		if (newmp) {
 			if (mpp->action != ACT_REJECT) {
-				if (!vector_alloc_slot(newmp))
+				if (!vector_alloc_slot(newmp)) {
+					free_wwid_groups(groups);
+					libmp_udev_batch_wait();
 					return 1;
+				}
 				vector_set_slot(newmp, mpp);
 			}
 			else
 				remove_map(mpp, vecs, 0);
 		}
 	}
+	free_wwid_groups(groups);
+	libmp_udev_batch_wait();
 	/*
 	 * Flush maps with only dead paths (ie not in sysfs)
 	 * Keep maps with only failed paths
@@ -1319,8 +1463,7 @@ int get_refwwid(enum mpath_cmds cmd, char *dev, enum devtypes dev_type,
 
 check:
 		if (refwwid && strlen(refwwid)) {
-			if (filter_wwid(conf->blist_wwid, conf->elist_wwid,
-					refwwid, NULL) > 0) {
+			if (filter_wwid(conf, refwwid, NULL) > 0) {
 				put_multipath_config(conf);
 				return 2;
 			}
@@ -26,6 +26,15 @@ enum actions {
 #define FLUSH_ONE 1
 #define FLUSH_ALL 2
 
+/*
+ * domap() return values
+ */
+#define DOMAP_RETRY	-1
+#define DOMAP_FAIL	0
+#define DOMAP_OK	1
+#define DOMAP_EXIST	2
+#define DOMAP_DRY	3
+
 struct vectors;
 
 int setup_map (struct multipath * mpp, char * params, int params_size,
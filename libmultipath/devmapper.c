@@ -238,6 +238,63 @@ libmp_dm_task_create(int task)
 	return dm_task_create(task);
 }
 
+/*
+ * udev cookie batching.
+ *
+ * Normally every DM_DEVICE_CREATE and DM_DEVICE_RESUME gets a cookie of
+ * its own, and we wait for udev to finish with the device before going
+ * on with the next one. Between libmp_udev_batch_start() and
+ * libmp_udev_batch_wait(), the calling thread's ioctls all share one
+ * cookie instead, each with its own udev flags, and the wait is done
+ * once for all of them at the end. The ioctls themselves still run one
+ * by one and report their errors to their callers as before.
+ */
+static __thread int udev_batch;
+static __thread uint32_t udev_batch_cookie;
+static __thread unsigned int udev_batch_nr;
+
+void libmp_udev_batch_start(void)
+{
+	udev_batch = 1;
+	udev_batch_cookie = 0;
+	udev_batch_nr = 0;
+}
+
+void libmp_udev_batch_wait(void)
+{
+	if (!udev_batch)
+		return;
+	udev_batch = 0;
+	if (udev_batch_nr) {
+		condlog(3, "waiting for udev to process %u devmap events",
+			udev_batch_nr);
+		dm_udev_wait(udev_batch_cookie);
+	}
+	udev_batch_cookie = 0;
+	udev_batch_nr = 0;
+}
+
+static int
+libmp_set_cookie (struct dm_task *dmt, uint32_t *cookie, uint16_t flags)
+{
+	if (!udev_batch)
+		return dm_task_set_cookie(dmt, cookie, flags);
+	/* a non-zero cookie is reused by libdevmapper */
+	*cookie = udev_batch_cookie;
+	if (!dm_task_set_cookie(dmt, cookie, flags))
+		return 0;
+	udev_batch_cookie = *cookie;
+	udev_batch_nr++;
+	return 1;
+}
+
+static void
+libmp_udev_wait (uint32_t cookie)
+{
+	if (!udev_batch)
+		dm_udev_wait(cookie);
+}
+
 #define do_deferred(x) ((x) == DEFERRED_REMOVE_ON || (x) == DEFERRED_REMOVE_IN_PROGRESS)
 
 static int
@@ -266,14 +323,14 @@ dm_simplecmd (int task, const char *name, int no_flush, int need_sync, uint16_t
 		dm_task_deferred_remove(dmt);
 #endif
 	if (udev_wait_flag &&
-	    !dm_task_set_cookie(dmt, &cookie,
-				DM_UDEV_DISABLE_LIBRARY_FALLBACK | udev_flags))
+	    !libmp_set_cookie(dmt, &cookie,
+			      DM_UDEV_DISABLE_LIBRARY_FALLBACK | udev_flags))
 		goto out;
 
 	r = dm_task_run (dmt);
 
 	if (udev_wait_flag)
-			dm_udev_wait(cookie);
+			libmp_udev_wait(cookie);
 out:
 	dm_task_destroy (dmt);
 	return r;
@@ -353,13 +410,13 @@ dm_addmap (int task, const char *target, struct multipath *mpp,
 	dm_task_no_open_count(dmt);
 
 	if (task == DM_DEVICE_CREATE &&
-	    !dm_task_set_cookie(dmt, &cookie, udev_flags))
+	    !libmp_set_cookie(dmt, &cookie, udev_flags))
 		goto freeout;
 
 	r = dm_task_run (dmt);
 
 	if (task == DM_DEVICE_CREATE)
-			dm_udev_wait(cookie);
+			libmp_udev_wait(cookie);
 freeout:
 	if (prefixed_uuid)
 		FREE(prefixed_uuid);
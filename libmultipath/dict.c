@@ -413,6 +413,12 @@ declare_def_snprint(retrigger_delay, print_int)
 declare_def_handler(uev_wait_timeout, set_int)
 declare_def_snprint(uev_wait_timeout, print_int)
 
+declare_def_handler(checker_threads, set_int)
+declare_def_snprint(checker_threads, print_int)
+
+declare_def_handler(discovery_threads, set_int)
+declare_def_snprint(discovery_threads, print_int)
+
 declare_def_handler(strict_timing, set_yes_no)
 declare_def_snprint(strict_timing, print_yes_no)
 
@@ -1475,6 +1481,8 @@ init_keywords(vector keywords)
 	install_keyword("remove_retries", &def_remove_retries_handler, &snprint_def_remove_retries);
 	install_keyword("max_sectors_kb", &def_max_sectors_kb_handler, &snprint_def_max_sectors_kb);
 	install_keyword("ghost_delay", &def_ghost_delay_handler, &snprint_def_ghost_delay);
+	install_keyword("checker_threads", &def_checker_threads_handler, &snprint_def_checker_threads);
+	install_keyword("discovery_threads", &def_discovery_threads_handler, &snprint_def_discovery_threads);
 	__deprecated install_keyword("default_selector", &def_selector_handler, NULL);
 	__deprecated install_keyword("default_path_grouping_policy", &def_pgpolicy_handler, NULL);
 	__deprecated install_keyword("default_uid_attribute", &def_uid_attribute_handler, NULL);
@@ -14,6 +14,9 @@
 #include <errno.h>
 #include <libgen.h>
 #include <libudev.h>
+#include <pthread.h>
+#include <time.h>
+#include <urcu.h>
 
 #include "checkers.h"
 #include "vector.h"
@@ -33,6 +36,8 @@
 #include "unaligned.h"
 #include "prioritizers/alua_rtpg.h"
 #include "foreign.h"
+#include "path_sched.h"
+#include "time-util.h"
 
 int
 alloc_path_with_pathinfo (struct config *conf, struct udev_device *udevice,
@@ -103,6 +108,7 @@ store_pathinfo (vector pathvec, struct config *conf,
 	err = store_path(pathvec, pp);
 	if (err)
 		goto out;
+	schedule_path(pp);
 
 out:
 	if (err)
@@ -138,16 +144,282 @@ path_discover (vector pathvec, struct config * conf,
 	return pathinfo(pp, conf, flag);
 }
 
+static struct discovery_stats discovery_stats;
+static pthread_mutex_t discovery_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+get_discovery_stats (struct discovery_stats *stats)
+{
+	pthread_mutex_lock(&discovery_stats_lock);
+	*stats = discovery_stats;
+	pthread_mutex_unlock(&discovery_stats_lock);
+}
+
+static void
+set_discovery_stats (const struct discovery_stats *stats)
+{
+	pthread_mutex_lock(&discovery_stats_lock);
+	discovery_stats = *stats;
+	pthread_mutex_unlock(&discovery_stats_lock);
+}
+
+/* add the time elapsed since @start to @sum, and restart it */
+static void
+account_time (struct timespec *sum, struct timespec *start)
+{
+	struct timespec now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, start, &diff);
+	sum->tv_sec += diff.tv_sec;
+	sum->tv_nsec += diff.tv_nsec;
+	normalize_timespec(sum);
+	*start = now;
+}
+
+/*
+ * Parallel path discovery.
+ *
+ * The block devices are enumerated, and the blacklisted ones skipped,
+ * by the calling thread. pathinfo() is then run for the remaining
+ * devices by a pool of threads, each taking the next device from the
+ * list, and finally the new paths are stored in pathvec in enumeration
+ * order, so that the result doesn't depend on the thread scheduling.
+ */
+struct discovery_work {
+	struct udev_device *udevice;
+	struct path *pp;
+	int new;
+	int ret;
+};
+
+struct discovery_pool {
+	pthread_mutex_t lock;
+	struct config *conf;
+	int flag;
+	struct discovery_work *work;
+	unsigned int nr_work;
+	unsigned int next;
+};
+
+static void
+run_discovery_work (struct discovery_pool *dp)
+{
+	struct discovery_work *dw;
+
+	while (1) {
+		pthread_mutex_lock(&dp->lock);
+		dw = dp->next < dp->nr_work ? &dp->work[dp->next++] : NULL;
+		pthread_mutex_unlock(&dp->lock);
+		if (!dw)
+			break;
+		dw->ret = pathinfo(dw->pp, dp->conf, dp->flag);
+	}
+}
+
+static void *
+discovery_worker (void *arg)
+{
+	rcu_register_thread();
+	run_discovery_work((struct discovery_pool *)arg);
+	rcu_unregister_thread();
+	return NULL;
+}
+
+static int
+add_discovery_work (struct discovery_pool *dp, unsigned int *work_size,
+		    vector pathvec, struct config *conf,
+		    struct udev_device *udevice)
+{
+	struct discovery_work *dw;
+	struct path *pp;
+	const char *devname;
+	char devt[BLK_DEV_SIZE];
+	char dev[FILE_NAME_SIZE];
+	dev_t devnum;
+	int new = 0;
+
+	devname = udev_device_get_sysname(udevice);
+	if (!devname)
+		return 1;
+
+	/* the cheap part of the blacklist check, done by pathinfo() first */
+	strlcpy(dev, devname, sizeof(dev));
+	if (is_claimed_by_foreign(udevice) ||
+	    filter_property(conf, udevice) > 0 ||
+	    filter_devnode(conf, dev) > 0)
+		return 1;
+
+	pp = find_path_by_dev(pathvec, devname);
+	if (!pp) {
+		devnum = udev_device_get_devnum(udevice);
+		snprintf(devt, BLK_DEV_SIZE, "%d:%d",
+			 major(devnum), minor(devnum));
+		pp = find_path_by_devt(pathvec, devt);
+	}
+	if (!pp) {
+		pp = alloc_path();
+		if (!pp)
+			return 1;
+		if (safe_sprintf(pp->dev, "%s", devname)) {
+			condlog(0, "pp->dev too small");
+			free_path(pp);
+			return 1;
+		}
+		pp->udev = udev_device_ref(udevice);
+		new = 1;
+	}
+
+	if (dp->nr_work == *work_size) {
+		unsigned int size = *work_size ? *work_size * 2 : 64;
+
+		dw = REALLOC(dp->work, size * sizeof(*dw));
+		if (!dw) {
+			if (new)
+				free_path(pp);
+			return 1;
+		}
+		dp->work = dw;
+		*work_size = size;
+	}
+	dw = &dp->work[dp->nr_work++];
+	dw->udevice = udev_device_ref(udevice);
+	dw->pp = pp;
+	dw->new = new;
+	dw->ret = PATHINFO_FAILED;
+	return 0;
+}
+
+static int
+parallel_path_discovery (vector pathvec, int flag, unsigned int nr_threads,
+			 struct discovery_stats *stats)
+{
+	struct discovery_pool dp = { .lock = PTHREAD_MUTEX_INITIALIZER };
+	struct udev_enumerate *udev_iter;
+	struct udev_list_entry *entry;
+	struct udev_device *udevice;
+	struct discovery_work *dw;
+	struct timespec start;
+	struct config *conf;
+	pthread_t *threads;
+	pthread_attr_t attr;
+	const char *devpath;
+	unsigned int i, work_size = 0, started = 0;
+	int num_paths = 0, total_paths = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	udev_iter = udev_enumerate_new(udev);
+	if (!udev_iter)
+		return -ENOMEM;
+
+	udev_enumerate_add_match_subsystem(udev_iter, "block");
+	udev_enumerate_add_match_is_initialized(udev_iter);
+	udev_enumerate_scan_devices(udev_iter);
+
+	conf = get_multipath_config();
+	udev_list_entry_foreach(entry,
+				udev_enumerate_get_list_entry(udev_iter)) {
+		const char *devtype;
+		devpath = udev_list_entry_get_name(entry);
+		condlog(4, "Discover device %s", devpath);
+		udevice = udev_device_new_from_syspath(udev, devpath);
+		if (!udevice) {
+			condlog(4, "%s: no udev information", devpath);
+			continue;
+		}
+		devtype = udev_device_get_devtype(udevice);
+		if(devtype && !strncmp(devtype, "disk", 4)) {
+			total_paths++;
+			add_discovery_work(&dp, &work_size, pathvec, conf,
+					   udevice);
+		}
+		udev_device_unref(udevice);
+	}
+	udev_enumerate_unref(udev_iter);
+	account_time(&stats->enumerate, &start);
+
+	dp.conf = conf;
+	dp.flag = flag;
+	if (nr_threads > dp.nr_work)
+		nr_threads = dp.nr_work;
+	threads = nr_threads ? MALLOC(nr_threads * sizeof(pthread_t)) : NULL;
+	if (threads) {
+		setup_thread_attr(&attr, 64 * 1024, 0);
+		for (i = 0; i < nr_threads; i++) {
+			if (pthread_create(&threads[started], &attr,
+					   discovery_worker, &dp))
+				break;
+			started++;
+		}
+		pthread_attr_destroy(&attr);
+	}
+	if (started < nr_threads)
+		condlog(1, "started %u of %u path discovery threads",
+			started, nr_threads);
+	/* lend a hand, and make progress even without workers */
+	run_discovery_work(&dp);
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	FREE(threads);
+	account_time(&stats->pathinfo, &start);
+
+	for (i = 0; i < dp.nr_work; i++) {
+		dw = &dp.work[i];
+		if (dw->ret == PATHINFO_OK && dw->new) {
+			if (store_path(pathvec, dw->pp))
+				dw->ret = PATHINFO_FAILED;
+			else
+				schedule_path(dw->pp);
+		}
+		if (dw->ret == PATHINFO_OK)
+			num_paths++;
+		else if (dw->new)
+			free_path(dw->pp);
+		udev_device_unref(dw->udevice);
+	}
+	FREE(dp.work);
+	put_multipath_config(conf);
+	pthread_mutex_destroy(&dp.lock);
+	account_time(&stats->merge, &start);
+
+	stats->threads = started;
+	stats->devices = total_paths;
+	stats->paths = num_paths;
+	condlog(4, "Discovered %d/%d paths", num_paths, total_paths);
+	return (total_paths - num_paths);
+}
+
 int
 path_discovery (vector pathvec, int flag)
 {
+	struct discovery_stats stats;
 	struct udev_enumerate *udev_iter;
 	struct udev_list_entry *entry;
 	struct udev_device *udevice;
 	struct config *conf;
+	struct timespec start, begin;
 	const char *devpath;
+	unsigned int nr_threads;
 	int num_paths = 0, total_paths = 0;
 
+	memset(&stats, 0, sizeof(stats));
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	start = begin;
+
+	conf = get_multipath_config();
+	nr_threads = conf->discovery_threads > 0 ? conf->discovery_threads : 0;
+	put_multipath_config(conf);
+	if (nr_threads) {
+		int ret = parallel_path_discovery(pathvec, flag,
+						  nr_threads, &stats);
+
+		if (ret >= 0) {
+			account_time(&stats.total, &begin);
+			set_discovery_stats(&stats);
+		}
+		return ret;
+	}
+
 	udev_iter = udev_enumerate_new(udev);
 	if (!udev_iter)
 		return -ENOMEM;
@@ -169,16 +441,24 @@ path_discovery (vector pathvec, int flag)
 		devtype = udev_device_get_devtype(udevice);
 		if(devtype && !strncmp(devtype, "disk", 4)) {
 			total_paths++;
+			account_time(&stats.enumerate, &start);
 			conf = get_multipath_config();
 			if (path_discover(pathvec, conf,
 					  udevice, flag) == PATHINFO_OK)
 				num_paths++;
 			put_multipath_config(conf);
+			account_time(&stats.pathinfo, &start);
 		}
 		udev_device_unref(udevice);
 	}
 	udev_enumerate_unref(udev_iter);
+	account_time(&stats.enumerate, &start);
 	condlog(4, "Discovered %d/%d paths", num_paths, total_paths);
+
+	stats.devices = total_paths;
+	stats.paths = num_paths;
+	account_time(&stats.total, &begin);
+	set_discovery_stats(&stats);
 	return (total_paths - num_paths);
 }
 
@@ -1133,7 +1413,7 @@ get_vpd_sgio (int fd, int pg, char * str, int maxlen)
 }
 
 static int
-scsi_sysfs_pathinfo (struct path * pp, vector hwtable)
+scsi_sysfs_pathinfo (struct path * pp, const struct config *conf)
 {
 	struct udev_device *parent;
 	const char *attr_path = NULL;
@@ -1175,7 +1455,7 @@ scsi_sysfs_pathinfo (struct path * pp, vector hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	pp->hwe = find_hwe(hwtable, pp->vendor_id, pp->product_id, pp->rev);
+	pp->hwe = find_hwe(conf, pp->vendor_id, pp->product_id, pp->rev);
 
 	/*
 	 * host / bus / target / lun
@@ -1200,7 +1480,7 @@ scsi_sysfs_pathinfo (struct path * pp, vector hwtable)
 }
 
 static int
-nvme_sysfs_pathinfo (struct path * pp, vector hwtable)
+nvme_sysfs_pathinfo (struct path * pp, const struct config *conf)
 {
 	struct udev_device *parent;
 	const char *attr_path = NULL;
@@ -1239,13 +1519,13 @@ nvme_sysfs_pathinfo (struct path * pp, vector hwtable)
 	condlog(3, "%s: serial = %s", pp->dev, pp->serial);
 	condlog(3, "%s: rev = %s", pp->dev, pp->rev);
 
-	pp->hwe = find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL);
+	pp->hwe = find_hwe(conf, pp->vendor_id, pp->product_id, NULL);
 
 	return 0;
 }
 
 static int
-rbd_sysfs_pathinfo (struct path * pp, vector hwtable)
+rbd_sysfs_pathinfo (struct path * pp, const struct config *conf)
 {
 	sprintf(pp->vendor_id, "Ceph");
 	sprintf(pp->product_id, "RBD");
@@ -1255,12 +1535,12 @@ rbd_sysfs_pathinfo (struct path * pp, vector hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	pp->hwe = find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL);
+	pp->hwe = find_hwe(conf, pp->vendor_id, pp->product_id, NULL);
 	return 0;
 }
 
 static int
-ccw_sysfs_pathinfo (struct path * pp, vector hwtable)
+ccw_sysfs_pathinfo (struct path * pp, const struct config *conf)
 {
 	struct udev_device *parent;
 	char attr_buff[NAME_SIZE];
@@ -1296,7 +1576,7 @@ ccw_sysfs_pathinfo (struct path * pp, vector hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	pp->hwe = find_hwe(hwtable, pp->vendor_id, pp->product_id, NULL);
+	pp->hwe = find_hwe(conf, pp->vendor_id, pp->product_id, NULL);
 
 	/*
 	 * host / bus / target / lun
@@ -1319,7 +1599,7 @@ ccw_sysfs_pathinfo (struct path * pp, vector hwtable)
 }
 
 static int
-cciss_sysfs_pathinfo (struct path * pp, vector hwtable)
+cciss_sysfs_pathinfo (struct path * pp, const struct config *conf)
 {
 	const char * attr_path = NULL;
 	struct udev_device *parent;
@@ -1359,7 +1639,7 @@ cciss_sysfs_pathinfo (struct path * pp, vector hwtable)
 	/*
 	 * set the hwe configlet pointer
 	 */
-	pp->hwe = find_hwe(hwtable, pp->vendor_id, pp->product_id, pp->rev);
+	pp->hwe = find_hwe(conf, pp->vendor_id, pp->product_id, pp->rev);
 
 	/*
 	 * host / bus / target / lun
@@ -1473,7 +1753,7 @@ path_offline (struct path * pp)
 }
 
 int
-sysfs_pathinfo(struct path * pp, vector hwtable)
+sysfs_pathinfo(struct path * pp, const struct config *conf)
 {
 	if (common_sysfs_pathinfo(pp))
 		return 1;
@@ -1493,19 +1773,19 @@ sysfs_pathinfo(struct path * pp, vector hwtable)
 	if (pp->bus == SYSFS_BUS_UNDEF)
 		return 0;
 	else if (pp->bus == SYSFS_BUS_SCSI) {
-		if (scsi_sysfs_pathinfo(pp, hwtable))
+		if (scsi_sysfs_pathinfo(pp, conf))
 			return 1;
 	} else if (pp->bus == SYSFS_BUS_CCW) {
-		if (ccw_sysfs_pathinfo(pp, hwtable))
+		if (ccw_sysfs_pathinfo(pp, conf))
 			return 1;
 	} else if (pp->bus == SYSFS_BUS_CCISS) {
-		if (cciss_sysfs_pathinfo(pp, hwtable))
+		if (cciss_sysfs_pathinfo(pp, conf))
 			return 1;
 	} else if (pp->bus == SYSFS_BUS_RBD) {
-		if (rbd_sysfs_pathinfo(pp, hwtable))
+		if (rbd_sysfs_pathinfo(pp, conf))
 			return 1;
 	} else if (pp->bus == SYSFS_BUS_NVME) {
-		if (nvme_sysfs_pathinfo(pp, hwtable))
+		if (nvme_sysfs_pathinfo(pp, conf))
 			return 1;
 	}
 	return 0;
@@ -1567,6 +1847,8 @@ int
 get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
 {
 	struct checker * c = &pp->checker;
+	/* checker workers don't hold vecs->lock, read this only once */
+	struct multipath *mpp = pp->mpp;
 	int state;
 
 	condlog(3, "%s: get_state", pp->dev);
@@ -1579,6 +1861,8 @@ get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
 				return PATH_UNCHECKED;
 			}
 		}
+		if (pp->lat_stats)
+			pp->lat_stats->check_pending = 0;
 		select_detect_checker(conf, pp);
 		select_checker(conf, pp);
 		if (!checker_selected(c)) {
@@ -1586,7 +1870,7 @@ get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
 			return PATH_UNCHECKED;
 		}
 		checker_set_fd(c, pp->fd);
-		if (checker_init(c, pp->mpp?&pp->mpp->mpcontext:NULL)) {
+		if (checker_init(c, mpp ? &mpp->mpcontext : NULL)) {
 			checker_clear(c);
 			condlog(3, "%s: checker init failed", pp->dev);
 			return PATH_UNCHECKED;
@@ -1602,7 +1886,25 @@ get_state (struct path * pp, struct config *conf, int daemon, int oldstate)
 	if (!conf->checker_timeout &&
 	    sysfs_get_timeout(pp, &(c->timeout)) <= 0)
 		c->timeout = DEF_TIMEOUT;
+	if (pp->lat_stats && !pp->lat_stats->check_pending)
+		clock_gettime(CLOCK_MONOTONIC, &pp->lat_stats->check_start);
 	state = checker_check(c, oldstate);
+	/*
+	 * Async checkers return PATH_PENDING until their result is in, and
+	 * it's only collected by a later call. They record the latency of
+	 * the check themselves; for the others, it's measured from the
+	 * call that started the check.
+	 */
+	if (pp->lat_stats && state == PATH_PENDING)
+		pp->lat_stats->check_pending = 1;
+	else if (pp->lat_stats) {
+		pp->lat_stats->check_pending = 0;
+		if (c->has_latency)
+			lat_hist_add_ts(&pp->lat_stats->checker, &c->latency);
+		else
+			lat_hist_add_since(&pp->lat_stats->checker,
+					   &pp->lat_stats->check_start);
+	}
 	condlog(3, "%s: %s state = %s", pp->dev,
 		checker_name(c), checker_state_name(state));
 	if (state != PATH_UP && state != PATH_GHOST &&
@@ -1617,6 +1919,7 @@ get_prio (struct path * pp)
 {
 	struct prio * p;
 	struct config *conf;
+	struct timespec start;
 
 	if (!pp)
 		return 0;
@@ -1634,7 +1937,11 @@ get_prio (struct path * pp)
 		}
 	}
 	conf = get_multipath_config();
+	if (pp->lat_stats)
+		clock_gettime(CLOCK_MONOTONIC, &start);
 	pp->priority = prio_getprio(p, pp, conf->checker_timeout);
+	if (pp->lat_stats)
+		lat_hist_add_since(&pp->lat_stats->prio, &start);
 	put_multipath_config(conf);
 	if (pp->priority < 0) {
 		condlog(3, "%s: %s prio error", pp->dev, prio_name(p));
@@ -1927,9 +2234,7 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 			 filter_property(conf, pp->udev) > 0))
 		return PATHINFO_SKIPPED;
 
-	if (filter_devnode(conf->blist_devnode,
-			   conf->elist_devnode,
-			   pp->dev) > 0)
+	if (filter_devnode(conf, pp->dev) > 0)
 		return PATHINFO_SKIPPED;
 
 	condlog(3, "%s: mask = 0x%x", pp->dev, mask);
@@ -1947,12 +2252,11 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 	/*
 	 * fetch info available in sysfs
 	 */
-	if (mask & DI_SYSFS && sysfs_pathinfo(pp, conf->hwtable))
+	if (mask & DI_SYSFS && sysfs_pathinfo(pp, conf))
 		return PATHINFO_FAILED;
 
 	if (mask & DI_BLACKLIST && mask & DI_SYSFS) {
-		if (filter_device(conf->blist_device, conf->elist_device,
-				  pp->vendor_id, pp->product_id) > 0) {
+		if (filter_device(conf, pp->vendor_id, pp->product_id) > 0) {
 			return PATHINFO_SKIPPED;
 		}
 	}
@@ -2019,16 +2323,15 @@ int pathinfo(struct path *pp, struct config *conf, int mask)
 		get_uid(pp, path_state, pp->udev);
 		if (!strlen(pp->wwid)) {
 			pp->initialized = INIT_MISSING_UDEV;
-			pp->tick = conf->retrigger_delay;
+			set_path_tick(pp, conf->retrigger_delay);
 			return PATHINFO_OK;
 		}
 		else
-			pp->tick = 1;
+			set_path_tick(pp, 1);
 	}
 
 	if (mask & DI_BLACKLIST && mask & DI_WWID) {
-		if (filter_wwid(conf->blist_wwid, conf->elist_wwid,
-				pp->wwid, pp->dev) > 0) {
+		if (filter_wwid(conf, pp->wwid, pp->dev) > 0) {
 			return PATHINFO_SKIPPED;
 		}
 	}
@@ -1,6 +1,8 @@
 #ifndef DISCOVERY_H
 #define DISCOVERY_H
 
+#include <time.h>
+
 #define SYSFS_PATH_SIZE 255
 #define INQUIRY_CMDLEN  6
 #define INQUIRY_CMD     0x12
@@ -30,7 +32,19 @@
 
 struct config;
 
+/* wall time of the phases of the last path_discovery() */
+struct discovery_stats {
+	unsigned int threads;	/* 0: serial discovery */
+	unsigned int devices;
+	unsigned int paths;
+	struct timespec enumerate;
+	struct timespec pathinfo;
+	struct timespec merge;
+	struct timespec total;
+};
+
 int path_discovery (vector pathvec, int flag);
+void get_discovery_stats (struct discovery_stats *stats);
 
 int do_tur (char *);
 int path_offline (struct path *);
@@ -0,0 +1,417 @@
+/*
+ * Single threaded dm event monitoring.
+ *
+ * The kernel (dm ioctl interface 4.37 and later) makes
+ * /dev/mapper/control pollable: after DM_DEV_ARM_POLL, the fd becomes
+ * readable as soon as any dm device raises an event, and DM_LIST_DEVICES
+ * reports the current event number of every device. Comparing those
+ * against the numbers we saw last tells us which maps changed.
+ */
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <linux/dm-ioctl.h>
+#include <libdevmapper.h>
+#include <pthread.h>
+#include <urcu.h>
+
+#include "vector.h"
+#include "memory.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "devmapper.h"
+#include "debug.h"
+#include "lock.h"
+#include "dmevents.h"
+
+#ifndef DM_DEV_ARM_POLL
+#define DM_DEV_ARM_POLL _IOWR(DM_IOCTL, DM_DEV_SET_GEOMETRY_CMD + 1, \
+			      struct dm_ioctl)
+#endif
+
+#define DM_CONTROL_PATH "/dev/" DM_DIR "/" DM_CONTROL_NODE
+
+int poll_dmevents = 0;
+
+struct dev_event {
+	char name[WWID_SIZE];
+	uint32_t evt_nr;
+	unsigned int gen;
+};
+
+struct dmevent_waiter {
+	int fd;
+	struct vectors *vecs;
+	vector events;
+	unsigned int gen;
+	pthread_mutex_t events_lock;
+};
+
+static struct dmevent_waiter *waiter;
+
+static const char *
+dev_event_key (const void *elem, char *buf, size_t len)
+{
+	return ((const struct dev_event *)elem)->name;
+}
+
+static struct dev_event *
+find_dev_event (const char *name)
+{
+	void *elem;
+
+	if (vector_index_find(waiter->events, dev_event_key, name, &elem))
+		return NULL;
+	return elem;
+}
+
+int dmevent_poll_supported(void)
+{
+	unsigned int minv[3] = {4, 37, 0};
+	unsigned int v[3];
+	char version[64];
+
+	if (!dm_driver_version(version, sizeof(version)))
+		return 0;
+	if (sscanf(version, "%u.%u.%u", &v[0], &v[1], &v[2]) != 3)
+		return 0;
+	return VERSION_GE(v, minv);
+}
+
+int init_dmevent_waiter(struct vectors *vecs)
+{
+	if (!vecs) {
+		condlog(0, "can't create waiter structure. invalid vectors");
+		goto fail;
+	}
+	waiter = (struct dmevent_waiter *)MALLOC(sizeof(struct dmevent_waiter));
+	if (!waiter) {
+		condlog(0, "failed to allocate waiter structure");
+		goto fail;
+	}
+	memset(waiter, 0, sizeof(struct dmevent_waiter));
+	waiter->events = vector_alloc();
+	if (!waiter->events) {
+		condlog(0, "failed to allocate waiter events vector");
+		goto fail_waiter;
+	}
+	if (vector_add_index(waiter->events, dev_event_key)) {
+		condlog(0, "failed to index waiter events vector");
+		goto fail_events;
+	}
+	waiter->fd = open(DM_CONTROL_PATH, O_RDWR | O_CLOEXEC);
+	if (waiter->fd < 0) {
+		condlog(0, "failed to open %s for waiting on events : %s",
+			DM_CONTROL_PATH, strerror(errno));
+		goto fail_events;
+	}
+	pthread_mutex_init(&waiter->events_lock, NULL);
+	waiter->vecs = vecs;
+
+	return 0;
+fail_events:
+	vector_free(waiter->events);
+fail_waiter:
+	FREE(waiter);
+	waiter = NULL;
+fail:
+	return -1;
+}
+
+void cleanup_dmevent_waiter(void)
+{
+	struct dev_event *dev_evt;
+	int i;
+
+	if (!waiter)
+		return;
+	pthread_mutex_destroy(&waiter->events_lock);
+	close(waiter->fd);
+	vector_foreach_slot(waiter->events, dev_evt, i)
+		FREE(dev_evt);
+	vector_free(waiter->events);
+	FREE(waiter);
+	waiter = NULL;
+}
+
+static int arm_dm_event_poll(int fd)
+{
+	struct dm_ioctl dmi;
+
+	memset(&dmi, 0, sizeof(dmi));
+	dmi.version[0] = DM_VERSION_MAJOR;
+	dmi.version[1] = DM_VERSION_MINOR;
+	dmi.version[2] = DM_VERSION_PATCHLEVEL;
+	dmi.flags = 0x4; /* DM_EXISTS_FLAG */
+	dmi.data_start = offsetof(struct dm_ioctl, data);
+	dmi.data_size = sizeof(dmi);
+	return ioctl(fd, DM_DEV_ARM_POLL, &dmi);
+}
+
+/*
+ * Since 4.37, the kernel stores the event number of each device after
+ * its name, aligned to 8 bytes.
+ */
+static uint32_t dm_event_nr(struct dm_names *n)
+{
+	return *(uint32_t *)(((uintptr_t)(strchr(n->name, 0) + 1) + 7) & ~7);
+}
+
+/*
+ * Collect the names of the watched maps whose event number changed into
+ * @changed, and stop watching maps which are gone.
+ */
+static int dm_get_events(vector changed)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	struct dev_event *dev_evt;
+	unsigned int list_gen;
+	unsigned next = 0;
+	char *name;
+	int i, r = -1;
+
+	pthread_mutex_lock(&waiter->events_lock);
+	list_gen = ++waiter->gen;
+	pthread_mutex_unlock(&waiter->events_lock);
+
+	if (!(dmt = libmp_dm_task_create(DM_DEVICE_LIST)))
+		return -1;
+
+	dm_task_no_open_count(dmt);
+
+	if (!dm_task_run(dmt))
+		goto out;
+
+	if (!(names = dm_task_get_names(dmt)))
+		goto out;
+
+	pthread_mutex_lock(&waiter->events_lock);
+	/*
+	 * Every map seen in the list gets the list generation. Maps
+	 * watched before the list was taken, and not seen in it, are gone.
+	 */
+	while (names->dev) {
+		dev_evt = find_dev_event(names->name);
+		if (dev_evt) {
+			uint32_t event_nr = dm_event_nr(names);
+
+			dev_evt->gen = list_gen;
+			if (event_nr != dev_evt->evt_nr) {
+				dev_evt->evt_nr = event_nr;
+				name = STRDUP(dev_evt->name);
+				if (name && vector_alloc_slot(changed))
+					vector_set_slot(changed, name);
+				else if (name)
+					FREE(name);
+			}
+		}
+		next = names->next;
+		if (!next)
+			break;
+		names = (void *)names + next;
+	}
+	vector_foreach_slot(waiter->events, dev_evt, i) {
+		if (dev_evt->gen >= list_gen)
+			continue;
+		condlog(2, "%s: devmap removed, stop watching for events",
+			dev_evt->name);
+		vector_del_slot(waiter->events, i--);
+		FREE(dev_evt);
+	}
+	pthread_mutex_unlock(&waiter->events_lock);
+	r = 0;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
+/* You must call update_multipath() after calling this function, to
+ * deal with any events that came in before the device was added */
+int watch_dmevents(const char *name)
+{
+	int event_nr;
+	struct dev_event *dev_evt;
+
+	if (!waiter || !name)
+		return -1;
+
+	if ((event_nr = dm_geteventnr(name)) < 0)
+		return -1;
+
+	pthread_mutex_lock(&waiter->events_lock);
+	dev_evt = find_dev_event(name);
+	if (dev_evt) {
+		dev_evt->evt_nr = event_nr;
+		dev_evt->gen = waiter->gen;
+		pthread_mutex_unlock(&waiter->events_lock);
+		return 0;
+	}
+	dev_evt = (struct dev_event *)MALLOC(sizeof(struct dev_event));
+	if (!dev_evt || !vector_alloc_slot(waiter->events)) {
+		pthread_mutex_unlock(&waiter->events_lock);
+		condlog(0, "%s: can't allocate event waiter structure", name);
+		if (dev_evt)
+			FREE(dev_evt);
+		return -1;
+	}
+	strncpy(dev_evt->name, name, WWID_SIZE - 1);
+	dev_evt->evt_nr = event_nr;
+	dev_evt->gen = waiter->gen;
+	vector_set_slot(waiter->events, dev_evt);
+	pthread_mutex_unlock(&waiter->events_lock);
+
+	condlog(3, "%s: watching for events", name);
+	return 0;
+}
+
+void unwatch_dmevents(const char *name)
+{
+	struct dev_event *dev_evt;
+	int i;
+
+	if (!waiter || !name)
+		return;
+
+	pthread_mutex_lock(&waiter->events_lock);
+	dev_evt = find_dev_event(name);
+	if (dev_evt && (i = find_slot(waiter->events, dev_evt)) != -1) {
+		vector_del_slot(waiter->events, i);
+		FREE(dev_evt);
+	}
+	pthread_mutex_unlock(&waiter->events_lock);
+}
+
+void unwatch_all_dmevents(void)
+{
+	struct dev_event *dev_evt;
+	int i;
+
+	if (!waiter)
+		return;
+
+	pthread_mutex_lock(&waiter->events_lock);
+	vector_foreach_slot(waiter->events, dev_evt, i) {
+		vector_del_slot(waiter->events, i--);
+		FREE(dev_evt);
+	}
+	pthread_mutex_unlock(&waiter->events_lock);
+}
+
+static void free_names(void *arg)
+{
+	vector changed = (vector)arg;
+	char *name;
+	int i;
+
+	vector_foreach_slot(changed, name, i)
+		FREE(name);
+	vector_free(changed);
+}
+
+/*
+ * returns the reschedule delay
+ * negative means *stop*
+ */
+static int dmevent_loop(void)
+{
+	struct pollfd pfd;
+	vector changed;
+	char *name;
+	int i, r;
+
+	pfd.fd = waiter->fd;
+	pfd.events = POLLIN;
+	r = poll(&pfd, 1, -1);
+	if (r <= 0) {
+		if (r < 0 && errno == EINTR)
+			return 0;
+		condlog(0, "failed polling for dm events: %s",
+			strerror(errno));
+		return 1;
+	}
+
+	if (arm_dm_event_poll(waiter->fd) != 0) {
+		condlog(0, "Cannot re-arm event polling: %s",
+			strerror(errno));
+		return 1;
+	}
+
+	changed = vector_alloc();
+	if (!changed)
+		return 1;
+	pthread_cleanup_push(free_names, changed);
+
+	if (dm_get_events(changed) != 0) {
+		condlog(0, "failed getting dm events");
+		r = 1;
+	} else
+		r = 0;
+
+	/*
+	 * event might be :
+	 *
+	 * 1) a table reload, which means our mpp structure is
+	 *    obsolete : refresh it through update_multipath()
+	 * 2) a path failed by DM : mark as such through
+	 *    update_multipath()
+	 * 3) map has gone away : stop watching it.
+	 * 4) a path reinstate : nothing to do
+	 * 5) a switch group : nothing to do
+	 */
+	if (VECTOR_SIZE(changed)) {
+		pthread_cleanup_push(cleanup_lock, &waiter->vecs->lock);
+		lock(&waiter->vecs->lock);
+		pthread_testcancel();
+		vector_foreach_slot(changed, name, i) {
+			condlog(3, "%s: devmap event", name);
+			if (update_multipath(waiter->vecs, name, 1)) {
+				condlog(2, "%s: stop watching for events",
+					name);
+				unwatch_dmevents(name);
+			}
+		}
+		lock_cleanup_pop(waiter->vecs->lock);
+	}
+	pthread_cleanup_pop(1);
+	return r;
+}
+
+static void rcu_unregister(void *unused)
+{
+	rcu_unregister_thread();
+}
+
+void *wait_dmevents(void *unused)
+{
+	int r;
+
+	if (!waiter) {
+		condlog(0, "dmevents waiter not initialized");
+		return NULL;
+	}
+
+	mlockall(MCL_CURRENT | MCL_FUTURE);
+	rcu_register_thread();
+	pthread_cleanup_push(rcu_unregister, NULL);
+
+	if (arm_dm_event_poll(waiter->fd) != 0)
+		condlog(0, "Cannot arm event polling: %s", strerror(errno));
+	else while (1) {
+		r = dmevent_loop();
+
+		if (r < 0)
+			break;
+
+		sleep(r);
+	}
+
+	pthread_cleanup_pop(1);
+	return NULL;
+}
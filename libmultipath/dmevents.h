@@ -0,0 +1,25 @@
+#ifndef _DMEVENTS_H
+#define _DMEVENTS_H
+
+struct vectors;
+
+/*
+ * Single threaded dm event monitoring.
+ *
+ * Instead of one thread per map blocking in DM_DEVICE_WAITEVENT, one
+ * thread polls /dev/mapper/control. When it wakes up, it lists the
+ * dm devices with their event numbers and calls update_multipath()
+ * for every watched map whose event number changed, all under one
+ * acquisition of vecs->lock. Needs dm ioctl interface 4.37 or later.
+ */
+extern int poll_dmevents;
+
+int dmevent_poll_supported(void);
+int init_dmevent_waiter(struct vectors *vecs);
+void cleanup_dmevent_waiter(void);
+int watch_dmevents(const char *name);
+void unwatch_dmevents(const char *name);
+void unwatch_all_dmevents(void);
+void *wait_dmevents(void *unused);
+
+#endif /* _DMEVENTS_H */
@@ -178,3 +178,89 @@ fail:
 	close(fd);
 	return -1;
 }
+
+static void
+stat_to_stamp(const struct stat *s, struct file_stamp *stamp)
+{
+	stamp->dev = s->st_dev;
+	stamp->ino = s->st_ino;
+	stamp->size = s->st_size;
+	stamp->mtime = s->st_mtim;
+}
+
+/*
+ * Record the identity, size and modification time of the open file @fd.
+ */
+int
+get_file_stamp(int fd, struct file_stamp *stamp)
+{
+	struct stat s;
+
+	if (fstat(fd, &s) < 0)
+		return -1;
+	stat_to_stamp(&s, stamp);
+	return 0;
+}
+
+/*
+ * Check whether the file has been replaced or modified since @stamp was
+ * taken, through @fd if it's open, or else by name.
+ */
+int
+file_stamp_changed(int fd, const char *file, const struct file_stamp *stamp)
+{
+	struct stat s;
+	struct file_stamp now;
+
+	if ((fd >= 0 ? fstat(fd, &s) : stat(file, &s)) < 0)
+		return 1;
+	stat_to_stamp(&s, &now);
+	return (now.dev != stamp->dev || now.ino != stamp->ino ||
+		now.size != stamp->size ||
+		now.mtime.tv_sec != stamp->mtime.tv_sec ||
+		now.mtime.tv_nsec != stamp->mtime.tv_nsec);
+}
+
+/*
+ * Read the whole file @fd into a newly allocated, NUL terminated buffer.
+ */
+char *
+read_file_contents(int fd)
+{
+	char *buf, *tmp;
+	size_t size = 4096, len = 0;
+	ssize_t n;
+
+	if (lseek(fd, 0, SEEK_SET) < 0) {
+		condlog(0, "Cannot seek to the start of the file : %s",
+			strerror(errno));
+		return NULL;
+	}
+	buf = malloc(size);
+	if (!buf)
+		return NULL;
+	while (1) {
+		if (len + 1 == size) {
+			tmp = realloc(buf, size * 2);
+			if (!tmp)
+				goto fail;
+			buf = tmp;
+			size *= 2;
+		}
+		n = read(fd, buf + len, size - len - 1);
+		if (n < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			condlog(0, "Cannot read file : %s", strerror(errno));
+			goto fail;
+		}
+		if (n == 0)
+			break;
+		len += n;
+	}
+	buf[len] = '\0';
+	return buf;
+fail:
+	free(buf);
+	return NULL;
+}
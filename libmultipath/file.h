@@ -5,7 +5,26 @@
 #ifndef _FILE_H
 #define _FILE_H
 
+#include <sys/types.h>
+#include <time.h>
+
 #define FILE_TIMEOUT 30
+
+/*
+ * What we know about a file we keep a copy of in memory, to notice
+ * modifications by other processes without reading it.
+ */
+struct file_stamp {
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
 int open_file(char *file, int *can_write, char *header);
+int get_file_stamp(int fd, struct file_stamp *stamp);
+int file_stamp_changed(int fd, const char *file,
+		       const struct file_stamp *stamp);
+char *read_file_contents(int fd);
 
 #endif /* _FILE_H */
@@ -20,6 +20,8 @@
 #define _FOREIGN_H
 #include <stdbool.h>
 #include <libudev.h>
+#include "strbuf.h"
+#include "generic.h"
 
 #define LIBMP_FOREIGN_API ((1 << 8) | 0)
 
@@ -250,54 +252,53 @@ int delete_all_foreign(void);
 void check_foreign(void);
 
 /**
- * foreign_path_layout()
+ * foreign_path_layout(width)
  * call this before printing paths, after get_path_layout(), to determine
  * output field width.
+ * @param width: column widths, from alloc_path_layout()
  */
-void foreign_path_layout(void);
+void foreign_path_layout(fieldwidth_t *width);
 
 /**
- * foreign_multipath_layout()
+ * foreign_multipath_layout(width)
  * call this before printing maps, after get_multipath_layout(), to determine
  * output field width.
+ * @param width: column widths, from alloc_multipath_layout()
  */
-void foreign_multipath_layout(void);
+void foreign_multipath_layout(fieldwidth_t *width);
 
 /**
- * snprint_foreign_topology(buf, len, verbosity);
- * prints topology information from foreign libraries into buffer,
- * '\0' - terminated.
+ * snprint_foreign_topology(buf, verbosity, width);
+ * appends topology information from foreign libraries to buffer.
  * @param buf: output buffer
- * @param len: size of output buffer
  * @param verbosity: verbosity level
- * @returns: number of printed characters excluding trailing '\0'.
+ * @param width: path column widths, or NULL
+ * @returns: number of appended characters, or negative error code.
  */
-int snprint_foreign_topology(char *buf, int len, int verbosity);
+int snprint_foreign_topology(struct strbuf *buf, int verbosity,
+			     const fieldwidth_t *width);
 
 /**
- * snprint_foreign_paths(buf, len, style, pad);
- * prints formatted path information from foreign libraries into buffer,
- * '\0' - terminated.
+ * snprint_foreign_paths(buf, style, width);
+ * appends formatted path information from foreign libraries to buffer.
  * @param buf: output buffer
- * @param len: size of output buffer
  * @param style: format string
- * @param pad: whether to pad field width
- * @returns: number of printed characters excluding trailing '\0'.
+ * @param width: column widths to pad to, or NULL for no padding
+ * @returns: number of appended characters, or negative error code.
  */
-int snprint_foreign_paths(char *buf, int len, const char *style, int pad);
+int snprint_foreign_paths(struct strbuf *buf, const char *style,
+			  const fieldwidth_t *width);
 
 /**
- * snprint_foreign_multipaths(buf, len, style, pad);
- * prints formatted map information from foreign libraries into buffer,
- * '\0' - terminated.
+ * snprint_foreign_multipaths(buf, style, width);
+ * appends formatted map information from foreign libraries to buffer.
  * @param buf: output buffer
- * @param len: size of output buffer
  * @param style: format string
- * @param pad: whether to pad field width
- * @returns: number of printed characters excluding trailing '\0'.
+ * @param width: column widths to pad to, or NULL for no padding
+ * @returns: number of appended characters, or negative error code.
  */
-int snprint_foreign_multipaths(char *buf, int len,
-			       const char *style, int pretty);
+int snprint_foreign_multipaths(struct strbuf *buf, const char *style,
+			       const fieldwidth_t *width);
 
 /**
  * print_foreign_topology(v)
@@ -586,6 +586,7 @@ static int _add_map(struct context *ctx, struct udev_device *ud,
 	map->gpg = nvme_pg_to_gen(&map->pg);
 
 	map->pgvec.allocated = 1;
+	map->pgvec.capacity = 1;
 	map->pgvec.slot = (void**)&map->gpg;
 
 	if (vector_alloc_slot(ctx->mpvec) == NULL) {
@@ -24,6 +24,9 @@ struct gen_multipath;
 struct gen_pathgroup;
 struct gen_path;
 
+/* Column widths for printing, indexed like the wildcards in print.c */
+typedef unsigned char fieldwidth_t;
+
 /**
  * Methods implemented for gen_multipath "objects"
  */
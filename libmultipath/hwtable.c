@@ -1226,3 +1226,9 @@ int setup_default_hwtable(vector hw)
 	}
 	return r;
 }
+
+/* The built-in entries, terminated by one without vendor */
+const struct hwentry *default_hwtable(void)
+{
+	return default_hw;
+}
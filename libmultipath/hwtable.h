@@ -2,5 +2,6 @@
 #define _HWTABLE_H
 
 int setup_default_hwtable (vector hw);
+const struct hwentry *default_hwtable (void);
 
 #endif /* _HWTABLE_H */
@@ -34,6 +34,7 @@
 #include "lock.h"
 #include "time-util.h"
 #include "io_err_stat.h"
+#include "path_sched.h"
 
 #define IOTIMEOUT_SEC			60
 #define TIMEOUT_NO_IO_NSEC		10000000 /*10ms = 10000000ns*/
@@ -299,7 +300,7 @@ static int enqueue_io_err_stat_by_path(struct path *path)
 		 * schedule path check as soon as possible to
 		 * update path state to delayed state
 		 */
-		path->tick = 1;
+		set_path_tick(path, 1);
 
 	}
 	io_err_stat_log(2, "%s: enqueue path %s to check",
@@ -428,7 +429,7 @@ int hit_io_err_recheck_time(struct path *pp)
 recover:
 	pp->io_err_pathfail_cnt = 0;
 	pp->io_err_disable_reinstate = 0;
-	pp->tick = 1;
+	set_path_tick(pp, 1);
 	return 0;
 }
 
@@ -494,7 +495,7 @@ static int poll_io_err_stat(struct vectors *vecs, struct io_err_stat_path *pp)
 		 * schedule path check as soon as possible to
 		 * update path state. Do NOT reinstate dm path here
 		 */
-		path->tick = 1;
+		set_path_tick(path, 1);
 
 	} else if (path->mpp && path->mpp->nr_active > 1) {
 		io_err_stat_log(3, "%s: keep failing the dm path %s",
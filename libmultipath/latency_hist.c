@@ -0,0 +1,111 @@
+/*
+ * Log-linear latency histograms, see latency_hist.h.
+ */
+#include <string.h>
+#include <time.h>
+
+#include "time-util.h"
+#include "latency_hist.h"
+
+static unsigned int
+lat_bucket (unsigned int usecs)
+{
+	unsigned int msb;
+
+	if (usecs < LAT_HIST_SUB_BUCKETS)
+		return usecs;
+	if (usecs >> LAT_HIST_BITS)
+		return LAT_HIST_BUCKETS - 1;
+	msb = 31 - __builtin_clz(usecs);
+	return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB_BUCKETS +
+		((usecs >> (msb - LAT_HIST_SUB_BITS)) &
+		 (LAT_HIST_SUB_BUCKETS - 1));
+}
+
+/* the largest latency counted in @bucket */
+static unsigned int
+lat_bucket_max (unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < LAT_HIST_SUB_BUCKETS)
+		return bucket;
+	shift = bucket / LAT_HIST_SUB_BUCKETS - 1;
+	return ((LAT_HIST_SUB_BUCKETS + bucket % LAT_HIST_SUB_BUCKETS + 1)
+		<< shift) - 1;
+}
+
+void
+lat_hist_add (struct latency_hist *h, unsigned int usecs)
+{
+	h->buckets[lat_bucket(usecs)]++;
+	h->count++;
+	h->sum += usecs;
+	if (usecs > h->max)
+		h->max = usecs;
+}
+
+void
+lat_hist_add_ts (struct latency_hist *h, const struct timespec *lat)
+{
+	if (lat->tv_sec < 0)
+		return;
+	if (lat->tv_sec >= (1 << LAT_HIST_BITS) / 1000000)
+		lat_hist_add(h, 1U << LAT_HIST_BITS);
+	else
+		lat_hist_add(h, lat->tv_sec * 1000000 + lat->tv_nsec / 1000);
+}
+
+void
+lat_hist_add_since (struct latency_hist *h, const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		return;
+	timespecsub(&now, start, &diff);
+	lat_hist_add_ts(h, &diff);
+}
+
+void
+lat_hist_merge (struct latency_hist *dst, const struct latency_hist *src)
+{
+	unsigned int i;
+
+	for (i = 0; i < LAT_HIST_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+unsigned int
+lat_hist_mean (const struct latency_hist *h)
+{
+	return h->count ? h->sum / h->count : 0;
+}
+
+/*
+ * The latency under which @permille per thousand of the recorded ones
+ * are, rounded up to the end of its bucket.
+ */
+unsigned int
+lat_hist_percentile (const struct latency_hist *h, unsigned int permille)
+{
+	unsigned long long rank, seen = 0;
+	unsigned int i, lat;
+
+	if (!h->count)
+		return 0;
+	rank = ((unsigned long long)h->count * permille + 999) / 1000;
+	if (!rank)
+		rank = 1;
+	for (i = 0; i < LAT_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+	lat = lat_bucket_max(i < LAT_HIST_BUCKETS ? i : LAT_HIST_BUCKETS - 1);
+	return lat < h->max ? lat : h->max;
+}
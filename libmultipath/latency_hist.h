@@ -0,0 +1,36 @@
+#ifndef _LATENCY_HIST_H
+#define _LATENCY_HIST_H
+
+#include <time.h>
+
+/*
+ * Latency histograms in the manner of HDR histograms: the latencies, in
+ * microseconds, are bucketed by power of two, and every power of two is
+ * split into LAT_HIST_SUB_BUCKETS linear buckets, which bounds the
+ * relative error of the percentiles at 1/LAT_HIST_SUB_BUCKETS.
+ * Latencies of 2^LAT_HIST_BITS us (about 33s) and more go to the last
+ * bucket. Recording a latency is a few arithmetic operations and never
+ * allocates.
+ */
+#define LAT_HIST_SUB_BITS	2
+#define LAT_HIST_SUB_BUCKETS	(1 << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BITS		25
+#define LAT_HIST_BUCKETS	((LAT_HIST_BITS - LAT_HIST_SUB_BITS + 1) * \
+				 LAT_HIST_SUB_BUCKETS)
+
+struct latency_hist {
+	unsigned long count;
+	unsigned long long sum;
+	unsigned int max;
+	unsigned int buckets[LAT_HIST_BUCKETS];
+};
+
+void lat_hist_add(struct latency_hist *h, unsigned int usecs);
+void lat_hist_add_ts(struct latency_hist *h, const struct timespec *lat);
+void lat_hist_add_since(struct latency_hist *h, const struct timespec *start);
+void lat_hist_merge(struct latency_hist *dst, const struct latency_hist *src);
+unsigned int lat_hist_mean(const struct latency_hist *h);
+unsigned int lat_hist_percentile(const struct latency_hist *h,
+				 unsigned int permille);
+
+#endif /* _LATENCY_HIST_H */
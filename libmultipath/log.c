@@ -9,37 +9,19 @@
 #include <string.h>
 #include <syslog.h>
 #include <time.h>
+#include <urcu/uatomic.h>
+#include <urcu/arch.h>
 
 #include "memory.h"
 #include "log.h"
-
-#define ALIGN(len, s) (((len)+(s)-1)/(s)*(s))
+#include "util.h"
 
 struct logarea* la;
 
-#if LOGDBG
-static void dump_logarea (void)
-{
-	struct logmsg * msg;
-
-	logdbg(stderr, "\n==== area: start addr = %p, end addr = %p ====\n",
-		la->start, la->end);
-	logdbg(stderr, "|addr     |next     |prio|msg\n");
-
-	for (msg = (struct logmsg *)la->head; (void *)msg != la->tail;
-	     msg = msg->next)
-		logdbg(stderr, "|%p |%p |%i   |%s\n", (void *)msg, msg->next,
-				msg->prio, (char *)&msg->str);
-
-	logdbg(stderr, "|%p |%p |%i   |%s\n", (void *)msg, msg->next,
-			msg->prio, (char *)&msg->str);
-
-	logdbg(stderr, "\n\n");
-}
-#endif
-
 static int logarea_init (int size)
 {
+	unsigned int nr;
+
 	logdbg(stderr,"enter logarea_init\n");
 	la = (struct logarea *)MALLOC(sizeof(struct logarea));
 
@@ -49,22 +31,23 @@ static int logarea_init (int size)
 	if (size < MAX_MSG_SIZE)
 		size = DEFAULT_AREA_SIZE;
 
-	la->start = MALLOC(size);
-	if (!la->start) {
+	/* the slot indexes wrap around, so use a power of 2 */
+	for (nr = 1; nr * 2 * sizeof(struct logslot) <= size; nr *= 2)
+		;
+	la->slots = MALLOC(nr * sizeof(struct logslot));
+	if (!la->slots) {
 		FREE(la);
 		return 1;
 	}
-	memset(la->start, 0, size);
-
-	la->empty = 1;
-	la->end = la->start + size;
-	la->head = la->start;
-	la->tail = la->start;
+	la->size = nr;
+	for (nr = 0; nr < la->size; nr++)
+		la->slots[nr].seq = nr;
+	la->head = la->tail = la->dropped = 0;
 
 	la->buff = MALLOC(MAX_MSG_SIZE + sizeof(struct logmsg));
 
 	if (!la->buff) {
-		FREE(la->start);
+		FREE(la->slots);
 		FREE(la);
 		return 1;
 	}
@@ -85,7 +68,7 @@ int log_init(char *program_name, int size)
 
 void free_logarea (void)
 {
-	FREE(la->start);
+	FREE(la->slots);
 	FREE(la->buff);
 	FREE(la);
 	return;
@@ -108,90 +91,80 @@ void log_reset (char *program_name)
 
 int log_enqueue (int prio, const char * fmt, va_list ap)
 {
-	int len, fwd;
-	char buff[MAX_MSG_SIZE];
-	struct logmsg * msg;
-	struct logmsg * lastmsg;
-
-	lastmsg = (struct logmsg *)la->tail;
-
-	if (!la->empty) {
-		fwd = sizeof(struct logmsg) +
-		      strlen((char *)&lastmsg->str) * sizeof(char) + 1;
-		la->tail += ALIGN(fwd, sizeof(void *));
+	struct logslot * slot;
+	unsigned long pos, seq, old;
+	long diff;
+
+	pos = uatomic_read(&la->tail);
+	while (1) {
+		slot = &la->slots[pos & (la->size - 1)];
+		seq = uatomic_read(&slot->seq);
+		cmm_smp_rmb();
+		diff = (long)(seq - pos);
+		if (diff == 0) {
+			/* the slot is free, try to claim it */
+			old = uatomic_cmpxchg(&la->tail, pos, pos + 1);
+			if (old == pos)
+				break;
+			pos = old;
+		} else if (diff < 0) {
+			/* the consumer hasn't freed it yet: the ring is full */
+			logdbg(stderr, "enqueue: log area overrun, drop msg\n");
+			uatomic_inc(&la->dropped);
+			return 1;
+		} else
+			/* claimed by another producer meanwhile */
+			pos = uatomic_read(&la->tail);
 	}
-	vsnprintf(buff, MAX_MSG_SIZE, fmt, ap);
-	len = ALIGN(sizeof(struct logmsg) + strlen(buff) * sizeof(char) + 1,
-		    sizeof(void *));
-
-	/* not enough space on tail : rewind */
-	if (la->head <= la->tail && len > (la->end - la->tail)) {
-		logdbg(stderr, "enqueue: rewind tail to %p\n", la->tail);
-		if (la->head == la->start ) {
-			logdbg(stderr, "enqueue: can not rewind tail, drop msg\n");
-			la->tail = lastmsg;
-			return 1;  /* can't reuse */
-		}
-		la->tail = la->start;
-
-		if (la->empty)
-			la->head = la->start;
-	}
-
-	/* not enough space on head : drop msg */
-	if (la->head > la->tail && len >= (la->head - la->tail)) {
-		logdbg(stderr, "enqueue: log area overrun, drop msg\n");
 
-		if (!la->empty)
-			la->tail = lastmsg;
+	slot->prio = prio;
+	vsnprintf(slot->str, MAX_MSG_SIZE, fmt, ap);
+	cmm_smp_wmb();
+	uatomic_set(&slot->seq, pos + 1);
 
-		return 1;
-	}
-
-	/* ok, we can stage the msg in the area */
-	la->empty = 0;
-	msg = (struct logmsg *)la->tail;
-	msg->prio = prio;
-	memcpy((void *)&msg->str, buff, strlen(buff) + 1);
-	lastmsg->next = la->tail;
-	msg->next = la->head;
-
-	logdbg(stderr, "enqueue: %p, %p, %i, %s\n", (void *)msg, msg->next,
-		msg->prio, (char *)&msg->str);
-
-#if LOGDBG
-	dump_logarea();
-#endif
+	logdbg(stderr, "enqueue: %lu, %i, %s\n", pos, slot->prio, slot->str);
 	return 0;
 }
 
+/*
+ * Only one thread at a time may dequeue. A message which is still being
+ * written stops the dequeuing, to keep the messages in order.
+ */
 int log_dequeue (void * buff)
 {
-	struct logmsg * src = (struct logmsg *)la->head;
 	struct logmsg * dst = (struct logmsg *)buff;
-	struct logmsg * lst = (struct logmsg *)la->tail;
+	struct logslot * slot;
+	unsigned long pos = la->head;
 
-	if (la->empty)
+	slot = &la->slots[pos & (la->size - 1)];
+	if (uatomic_read(&slot->seq) != pos + 1)
 		return 1;
+	cmm_smp_rmb();
 
-	int len = strlen((char *)&src->str) * sizeof(char) +
-		  sizeof(struct logmsg) + 1;
+	dst->prio = slot->prio;
+	strlcpy((char *)&dst->str, slot->str, MAX_MSG_SIZE);
+	logdbg(stderr, "dequeue: %lu, %i, %s\n", pos, dst->prio,
+		(char *)&dst->str);
 
-	dst->prio = src->prio;
-	memcpy(dst, src,  len);
+	/* hand the slot back to the producers */
+	cmm_smp_mb();
+	uatomic_set(&slot->seq, pos + la->size);
+	la->head = pos + 1;
 
-	if (la->tail == la->head)
-		la->empty = 1; /* we purge the last logmsg */
-	else {
-		la->head = src->next;
-		lst->next = la->head;
-	}
-	logdbg(stderr, "dequeue: %p, %p, %i, %s\n",
-		(void *)src, src->next, src->prio, (char *)&src->str);
+	return 0;
+}
 
-	memset((void *)src, 0,  len);
+int log_empty (void)
+{
+	struct logslot * slot = &la->slots[la->head & (la->size - 1)];
 
-	return 0;
+	return uatomic_read(&slot->seq) != la->head + 1;
+}
+
+/* the number of messages dropped since the last call */
+unsigned long log_dropped (void)
+{
+	return uatomic_xchg(&la->dropped, 0);
 }
 
 /*
@@ -1,7 +1,7 @@
 #ifndef LOG_H
 #define LOG_H
 
-#define DEFAULT_AREA_SIZE 16384
+#define DEFAULT_AREA_SIZE 131072
 #define MAX_MSG_SIZE 256
 
 #ifndef LOGLEVEL
@@ -20,12 +20,25 @@ struct logmsg {
 	char str[0];
 };
 
+/*
+ * Bounded lock-free ring of messages, with many producers and one
+ * consumer. A producer claims the slot at "tail" by advancing it with
+ * cmpxchg, fills it, and then publishes it by setting its sequence
+ * number. Producers never wait: if the ring is full, the message is
+ * dropped and counted. Only the consumer reads "head".
+ */
+struct logslot {
+	unsigned long seq;
+	short int prio;
+	char str[MAX_MSG_SIZE];
+};
+
 struct logarea {
-	int empty;
-	void * head;
-	void * tail;
-	void * start;
-	void * end;
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+	unsigned int size;
+	struct logslot * slots;
 	char * buff;
 };
 
@@ -36,6 +49,8 @@ void log_close (void);
 void log_reset (char * progname);
 int log_enqueue (int prio, const char * fmt, va_list ap);
 int log_dequeue (void *);
+int log_empty (void);
+unsigned long log_dropped (void);
 void log_syslog (void *);
 void dump_logmsg (void *);
 void free_logarea (void);
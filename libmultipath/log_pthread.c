@@ -7,6 +7,8 @@
 #include <syslog.h>
 #include <pthread.h>
 #include <sys/mman.h>
+#include <urcu/uatomic.h>
+#include <urcu/arch.h>
 
 #include "memory.h"
 
@@ -21,7 +23,13 @@ pthread_mutex_t logev_lock;
 pthread_cond_t logev_cond;
 
 int logq_running;
+static int logq_sleeping;
 
+/*
+ * Producers don't take any lock, unless the log thread is waiting for
+ * messages. Both sides set their flag, then check the other side's
+ * after a full barrier, so that a message is never left behind.
+ */
 void log_safe (int prio, const char * fmt, va_list ap)
 {
 	if (log_thr == (pthread_t)0) {
@@ -29,39 +37,42 @@ void log_safe (int prio, const char * fmt, va_list ap)
 		return;
 	}
 
-	pthread_mutex_lock(&logq_lock);
 	log_enqueue(prio, fmt, ap);
-	pthread_mutex_unlock(&logq_lock);
 
-	pthread_mutex_lock(&logev_lock);
-	pthread_cond_signal(&logev_cond);
-	pthread_mutex_unlock(&logev_lock);
+	cmm_smp_mb();
+	if (uatomic_read(&logq_sleeping)) {
+		pthread_mutex_lock(&logev_lock);
+		pthread_cond_signal(&logev_cond);
+		pthread_mutex_unlock(&logev_lock);
+	}
 }
 
-void log_thread_flush (void)
+static void unlock_mutex (void *arg)
 {
-	int empty;
-
-	do {
-		pthread_mutex_lock(&logq_lock);
-		empty = log_dequeue(la->buff);
-		pthread_mutex_unlock(&logq_lock);
-		if (!empty)
-			log_syslog(la->buff);
-	} while (empty == 0);
+	pthread_mutex_unlock((pthread_mutex_t *)arg);
 }
 
-static void flush_logqueue (void)
+/*
+ * Write out all queued messages. logq_lock serializes the consumers,
+ * and log_reset() with them.
+ */
+void log_thread_flush (void)
 {
+	unsigned long dropped;
 	int empty;
 
+	pthread_mutex_lock(&logq_lock);
+	pthread_cleanup_push(unlock_mutex, &logq_lock);
 	do {
-		pthread_mutex_lock(&logq_lock);
 		empty = log_dequeue(la->buff);
-		pthread_mutex_unlock(&logq_lock);
 		if (!empty)
 			log_syslog(la->buff);
 	} while (empty == 0);
+	dropped = log_dropped();
+	if (dropped)
+		syslog(LOG_WARNING, "log buffer overrun, %lu messages dropped",
+		       dropped);
+	pthread_cleanup_pop(1);
 }
 
 static void * log_thread (void * et)
@@ -77,9 +88,14 @@ static void * log_thread (void * et)
 
 	while (1) {
 		pthread_mutex_lock(&logev_lock);
-		pthread_cond_wait(&logev_cond, &logev_lock);
+		pthread_cleanup_push(unlock_mutex, &logev_lock);
+		uatomic_set(&logq_sleeping, 1);
+		cmm_smp_mb();
+		if (log_empty() && logq_running)
+			pthread_cond_wait(&logev_cond, &logev_lock);
+		uatomic_set(&logq_sleeping, 0);
 		running = logq_running;
-		pthread_mutex_unlock(&logev_lock);
+		pthread_cleanup_pop(1);
 		if (!running)
 			break;
 		log_thread_flush();
@@ -116,13 +132,11 @@ void log_thread_stop (void)
 	pthread_cond_signal(&logev_cond);
 	pthread_mutex_unlock(&logev_lock);
 
-	pthread_mutex_lock(&logq_lock);
 	pthread_cancel(log_thr);
-	pthread_mutex_unlock(&logq_lock);
 	pthread_join(log_thr, NULL);
 	log_thr = (pthread_t)0;
 
-	flush_logqueue();
+	log_thread_flush();
 
 	pthread_mutex_destroy(&logq_lock);
 	pthread_mutex_destroy(&logev_lock);
@@ -25,6 +25,7 @@
 #include "parser.h"
 #include "memory.h"
 #include "debug.h"
+#include "strbuf.h"
 
 /* local vars */
 static int sublevel = 0;
@@ -144,46 +145,76 @@ find_keyword(vector keywords, vector v, char * name)
 	return NULL;
 }
 
+/*
+ * Append the value of @kw to @buff. The value is rendered into a
+ * scratch buffer first, which is only allocated for long values.
+ */
+static int
+snprint_keyword_value(struct strbuf *buff, struct keyword *kw,
+		      const void *data)
+{
+	struct config *conf;
+	char scratch[256];
+	char *val = scratch;
+	int r, size = sizeof(scratch);
+
+	conf = get_multipath_config();
+	r = kw->print(conf, val, size, data);
+	if (r >= size) {
+		size = r + 1;
+		val = MALLOC(size);
+		if (val)
+			r = kw->print(conf, val, size, data);
+	}
+	put_multipath_config(conf);
+	if (!val)
+		return -ENOMEM;
+	if (r > 0)
+		r = append_strbuf_str(buff, val);
+	if (val != scratch)
+		FREE(val);
+	return r;
+}
+
 int
-snprint_keyword(char *buff, int len, char *fmt, struct keyword *kw,
+snprint_keyword(struct strbuf *buff, const char *fmt, struct keyword *kw,
 		const void *data)
 {
 	int r;
-	int fwd = 0;
-	char *f = fmt;
-	struct config *conf;
+	const char *f;
+	size_t initial_len = get_strbuf_len(buff);
 
 	if (!kw || !kw->print)
 		return 0;
 
-	do {
-		if (fwd == len || *f == '\0')
-			break;
+	for (f = fmt; *f; f++) {
 		if (*f != '%') {
-			*(buff + fwd) = *f;
-			fwd++;
-			continue;
-		}
-		f++;
-		switch(*f) {
-		case 'k':
-			fwd += snprintf(buff + fwd, len - fwd, "%s", kw->string);
-			break;
-		case 'v':
-			conf = get_multipath_config();
-			r = kw->print(conf, buff + fwd, len - fwd, data);
-			put_multipath_config(conf);
-			if (!r) { /* no output if no value */
-				buff[0] = '\0';
-				return 0;
+			r = __append_strbuf_str(buff, f, 1);
+		} else {
+			switch(*++f) {
+			case 'k':
+				r = append_strbuf_str(buff, kw->string);
+				break;
+			case 'v':
+				r = snprint_keyword_value(buff, kw, data);
+				if (r == 0) {
+					/* no output if no value */
+					truncate_strbuf(buff, initial_len);
+					return 0;
+				}
+				break;
+			case '\0':
+				f--;
+				/* fall through */
+			default:
+				r = 0;
+				break;
 			}
-			fwd += r;
-			break;
 		}
-		if (fwd > len)
-			fwd = len;
-	} while (*f++);
-	return fwd;
+		if (r < 0)
+			return r;
+	}
+	return get_strbuf_len(buff) - initial_len;
 }
 
 static const char quote_marker[] = { '\0', '"', '\0' };
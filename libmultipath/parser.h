@@ -34,6 +34,7 @@
 /* local includes */
 #include "vector.h"
 #include "config.h"
+#include "strbuf.h"
 
 /* Global definitions */
 #define EOB  "}"
@@ -79,7 +80,7 @@ extern vector alloc_strvec(char *string);
 extern void *set_value(vector strvec);
 extern int process_file(struct config *conf, char *conf_file);
 extern struct keyword * find_keyword(vector keywords, vector v, char * name);
-int snprint_keyword(char *buff, int len, char *fmt, struct keyword *kw,
+int snprint_keyword(struct strbuf *buff, const char *fmt, struct keyword *kw,
 		    const void *data);
 bool is_quote(const char* token);
 
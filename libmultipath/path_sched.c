@@ -0,0 +1,225 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "memory.h"
+#include "debug.h"
+#include "structs.h"
+#include "time-util.h"
+#include "path_sched.h"
+
+#define SCHED_HEAP_CHUNK 64
+
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct path **sched_heap;
+static unsigned int sched_nr;
+static unsigned int sched_size;
+static int sched_running;
+
+static inline int
+sched_before (const struct path *a, const struct path *b)
+{
+	return timespeccmp(&a->next_check, &b->next_check) < 0;
+}
+
+static inline void
+sched_place (struct path *pp, unsigned int slot)
+{
+	sched_heap[slot] = pp;
+	pp->sched_slot = slot;
+}
+
+static void
+sched_sift_up (unsigned int slot)
+{
+	struct path *pp = sched_heap[slot];
+
+	while (slot > 0) {
+		unsigned int parent = (slot - 1) / 2;
+
+		if (!sched_before(pp, sched_heap[parent]))
+			break;
+		sched_place(sched_heap[parent], slot);
+		slot = parent;
+	}
+	sched_place(pp, slot);
+}
+
+static void
+sched_sift_down (unsigned int slot)
+{
+	struct path *pp = sched_heap[slot];
+
+	while (1) {
+		unsigned int child = 2 * slot + 1;
+
+		if (child >= sched_nr)
+			break;
+		if (child + 1 < sched_nr &&
+		    sched_before(sched_heap[child + 1], sched_heap[child]))
+			child++;
+		if (!sched_before(sched_heap[child], pp))
+			break;
+		sched_place(sched_heap[child], slot);
+		slot = child;
+	}
+	sched_place(pp, slot);
+}
+
+static int
+sched_insert (struct path *pp)
+{
+	if (sched_nr == sched_size) {
+		struct path **heap;
+
+		heap = REALLOC(sched_heap, (sched_size + SCHED_HEAP_CHUNK) *
+			       sizeof(struct path *));
+		if (!heap)
+			return 1;
+		sched_heap = heap;
+		sched_size += SCHED_HEAP_CHUNK;
+	}
+	sched_place(pp, sched_nr++);
+	sched_sift_up(pp->sched_slot);
+	return 0;
+}
+
+static void
+sched_remove (struct path *pp)
+{
+	unsigned int slot = pp->sched_slot;
+	struct path *last;
+
+	pp->sched_slot = -1;
+	last = sched_heap[--sched_nr];
+	if (last == pp)
+		return;
+	sched_place(last, slot);
+	if (slot > 0 && sched_before(last, sched_heap[(slot - 1) / 2]))
+		sched_sift_up(slot);
+	else
+		sched_sift_down(slot);
+}
+
+void
+start_path_scheduler (void)
+{
+	pthread_mutex_lock(&sched_lock);
+	sched_running = 1;
+	pthread_mutex_unlock(&sched_lock);
+}
+
+void
+stop_path_scheduler (void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&sched_lock);
+	for (i = 0; i < sched_nr; i++)
+		sched_heap[i]->sched_slot = -1;
+	FREE(sched_heap);
+	sched_nr = sched_size = 0;
+	sched_running = 0;
+	pthread_mutex_unlock(&sched_lock);
+}
+
+/*
+ * Set the next check of @pp to @tick seconds from now. Paths which
+ * aren't scheduled only remember the deadline, for schedule_path().
+ */
+void
+set_path_tick (struct path *pp, unsigned int tick)
+{
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		now.tv_sec = now.tv_nsec = 0;
+
+	pthread_mutex_lock(&sched_lock);
+	pp->next_check.tv_sec = now.tv_sec + tick;
+	pp->next_check.tv_nsec = 0;
+	if (pp->sched_slot >= 0) {
+		sched_sift_up(pp->sched_slot);
+		sched_sift_down(pp->sched_slot);
+	}
+	pthread_mutex_unlock(&sched_lock);
+}
+
+/*
+ * Return the number of seconds until the next check of @pp,
+ * rounded up.
+ */
+unsigned int
+get_path_tick (const struct path *pp)
+{
+	struct timespec now, next_check, diff;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+		return 0;
+	pthread_mutex_lock(&sched_lock);
+	next_check = pp->next_check;
+	pthread_mutex_unlock(&sched_lock);
+	if (timespeccmp(&next_check, &now) <= 0)
+		return 0;
+	timespecsub(&next_check, &now, &diff);
+	return diff.tv_sec + (diff.tv_nsec ? 1 : 0);
+}
+
+/*
+ * Add @pp to the schedule, with the deadline of the last set_path_tick().
+ * Called when @pp is stored in the pathvec of multipathd, paths which
+ * are only allocated temporarily are never checked.
+ */
+void
+schedule_path (struct path *pp)
+{
+	pthread_mutex_lock(&sched_lock);
+	if (pp->sched_slot < 0 && sched_running && sched_insert(pp))
+		condlog(0, "%s: failed to schedule path check", pp->dev);
+	pthread_mutex_unlock(&sched_lock);
+}
+
+void
+unschedule_path (struct path *pp)
+{
+	pthread_mutex_lock(&sched_lock);
+	if (pp->sched_slot >= 0)
+		sched_remove(pp);
+	pthread_mutex_unlock(&sched_lock);
+}
+
+/*
+ * Remove and return the path with the earliest deadline, if that
+ * deadline is not after @now. The caller is responsible for
+ * rescheduling the path with set_path_tick() and schedule_path().
+ */
+struct path *
+get_due_path (const struct timespec *now)
+{
+	struct path *pp = NULL;
+
+	pthread_mutex_lock(&sched_lock);
+	if (sched_nr && timespeccmp(&sched_heap[0]->next_check, now) <= 0) {
+		pp = sched_heap[0];
+		sched_remove(pp);
+	}
+	pthread_mutex_unlock(&sched_lock);
+	return pp;
+}
+
+/*
+ * Store the earliest deadline of all scheduled paths in @deadline.
+ * Returns 1 if no path is scheduled, and 0 otherwise.
+ */
+int
+get_next_path_deadline (struct timespec *deadline)
+{
+	int ret = 1;
+
+	pthread_mutex_lock(&sched_lock);
+	if (sched_nr) {
+		*deadline = sched_heap[0]->next_check;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&sched_lock);
+	return ret;
+}
@@ -0,0 +1,29 @@
+#ifndef _PATH_SCHED_H
+#define _PATH_SCHED_H
+
+#include <time.h>
+
+struct path;
+
+/*
+ * Deadline scheduler for path checks.
+ *
+ * Each path carries the CLOCK_MONOTONIC time of its next check. Once
+ * the scheduler is started, the paths in the pathvec are kept in a
+ * min-heap keyed on that deadline, so that the checker only needs to look
+ * at the paths which are actually due. Paths are added with
+ * schedule_path() when they are stored in the pathvec, and removed with
+ * unschedule_path() when they leave it, at the latest in free_path().
+ */
+void start_path_scheduler(void);
+void stop_path_scheduler(void);
+
+void set_path_tick(struct path *pp, unsigned int tick);
+unsigned int get_path_tick(const struct path *pp);
+void schedule_path(struct path *pp);
+void unschedule_path(struct path *pp);
+
+struct path *get_due_path(const struct timespec *now);
+int get_next_path_deadline(struct timespec *deadline);
+
+#endif /* _PATH_SCHED_H */
@@ -14,6 +14,7 @@
 
 #include "checkers.h"
 #include "vector.h"
+#include "memory.h"
 #include "structs.h"
 #include "structs_vec.h"
 #include "dmparser.h"
@@ -29,35 +30,12 @@
 #include "uevent.h"
 #include "debug.h"
 #include "discovery.h"
+#include "path_sched.h"
+#include "mpath_tlv.h"
 
 #define MAX(x,y) (((x) > (y)) ? (x) : (y))
 #define MIN(x,y) (((x) > (y)) ? (y) : (x))
-#define TAIL     (line + len - 1 - c)
-#define NOPAD    s = c
-#define PAD(x) \
-do { \
-	while ((int)(c - s) < (x) && (c < (line + len - 1))) \
-		*c++ = ' '; \
-	s = c; \
-} while (0)
-
-static char *
-__endline(char *line, size_t len, char *c)
-{
-	if (c > line) {
-		if (c >= line + len)
-			c = line + len - 1;
-		*(c - 1) = '\n';
-		*c = '\0';
-	}
-	return c;
-}
-
-#define PRINT(var, size, format, args...) \
-do { \
-	fwd = snprintf(var, size, format, ##args); \
-	c += (fwd >= size) ? size : fwd; \
-} while (0)
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
 /*
  * information printing helpers
@@ -472,7 +450,7 @@ snprint_next_check (char * buff, size_t len, const struct path * pp)
 	if (!pp || !pp->mpp)
 		return snprintf(buff, len, "orphan");
 
-	return snprint_progress(buff, len, pp->tick, pp->checkint);
+	return snprint_progress(buff, len, get_path_tick(pp), pp->checkint);
 }
 
 static int
@@ -633,95 +611,119 @@ snprint_path_foreign (char * buff, size_t len, const struct path * pp)
 }
 
 struct multipath_data mpd[] = {
-	{'n', "name",          0, snprint_name},
-	{'w', "uuid",          0, snprint_multipath_uuid},
-	{'d', "sysfs",         0, snprint_sysfs},
-	{'F', "failback",      0, snprint_failback},
-	{'Q', "queueing",      0, snprint_queueing},
-	{'N', "paths",         0, snprint_nb_paths},
-	{'r', "write_prot",    0, snprint_ro},
-	{'t', "dm-st",         0, snprint_dm_map_state},
-	{'S', "size",          0, snprint_multipath_size},
-	{'f', "features",      0, snprint_features},
-	{'x', "failures",      0, snprint_map_failures},
-	{'h', "hwhandler",     0, snprint_hwhandler},
-	{'A', "action",        0, snprint_action},
-	{'0', "path_faults",   0, snprint_path_faults},
-	{'1', "switch_grp",    0, snprint_switch_grp},
-	{'2', "map_loads",     0, snprint_map_loads},
-	{'3', "total_q_time",  0, snprint_total_q_time},
-	{'4', "q_timeouts",    0, snprint_q_timeouts},
-	{'s', "vend/prod/rev", 0, snprint_multipath_vpr},
-	{'v', "vend",          0, snprint_multipath_vend},
-	{'p', "prod",          0, snprint_multipath_prod},
-	{'e', "rev",           0, snprint_multipath_rev},
-	{'G', "foreign",       0, snprint_multipath_foreign},
-	{0, NULL, 0 , NULL}
+	{'n', "name",          snprint_name},
+	{'w', "uuid",          snprint_multipath_uuid},
+	{'d', "sysfs",         snprint_sysfs},
+	{'F', "failback",      snprint_failback},
+	{'Q', "queueing",      snprint_queueing},
+	{'N', "paths",         snprint_nb_paths},
+	{'r', "write_prot",    snprint_ro},
+	{'t', "dm-st",         snprint_dm_map_state},
+	{'S', "size",          snprint_multipath_size},
+	{'f', "features",      snprint_features},
+	{'x', "failures",      snprint_map_failures},
+	{'h', "hwhandler",     snprint_hwhandler},
+	{'A', "action",        snprint_action},
+	{'0', "path_faults",   snprint_path_faults},
+	{'1', "switch_grp",    snprint_switch_grp},
+	{'2', "map_loads",     snprint_map_loads},
+	{'3', "total_q_time",  snprint_total_q_time},
+	{'4', "q_timeouts",    snprint_q_timeouts},
+	{'s', "vend/prod/rev", snprint_multipath_vpr},
+	{'v', "vend",          snprint_multipath_vend},
+	{'p', "prod",          snprint_multipath_prod},
+	{'e', "rev",           snprint_multipath_rev},
+	{'G', "foreign",       snprint_multipath_foreign},
+	{0, NULL, NULL}
 };
 
 struct path_data pd[] = {
-	{'w', "uuid",          0, snprint_path_uuid},
-	{'i', "hcil",          0, snprint_hcil},
-	{'d', "dev",           0, snprint_dev},
-	{'D', "dev_t",         0, snprint_dev_t},
-	{'t', "dm_st",         0, snprint_dm_path_state},
-	{'o', "dev_st",        0, snprint_offline},
-	{'T', "chk_st",        0, snprint_chk_state},
-	{'s', "vend/prod/rev", 0, snprint_vpr},
-	{'c', "checker",       0, snprint_path_checker},
-	{'C', "next_check",    0, snprint_next_check},
-	{'p', "pri",           0, snprint_pri},
-	{'S', "size",          0, snprint_path_size},
-	{'z', "serial",        0, snprint_path_serial},
-	{'m', "multipath",     0, snprint_path_mpp},
-	{'N', "host WWNN",     0, snprint_host_wwnn},
-	{'n', "target WWNN",   0, snprint_tgt_wwnn},
-	{'R', "host WWPN",     0, snprint_host_wwpn},
-	{'r', "target WWPN",   0, snprint_tgt_wwpn},
-	{'a', "host adapter",  0, snprint_host_adapter},
-	{'G', "foreign",       0, snprint_path_foreign},
-	{0, NULL, 0 , NULL}
+	{'w', "uuid",          snprint_path_uuid},
+	{'i', "hcil",          snprint_hcil},
+	{'d', "dev",           snprint_dev},
+	{'D', "dev_t",         snprint_dev_t},
+	{'t', "dm_st",         snprint_dm_path_state},
+	{'o', "dev_st",        snprint_offline},
+	{'T', "chk_st",        snprint_chk_state},
+	{'s', "vend/prod/rev", snprint_vpr},
+	{'c', "checker",       snprint_path_checker},
+	{'C', "next_check",    snprint_next_check},
+	{'p', "pri",           snprint_pri},
+	{'S', "size",          snprint_path_size},
+	{'z', "serial",        snprint_path_serial},
+	{'m', "multipath",     snprint_path_mpp},
+	{'N', "host WWNN",     snprint_host_wwnn},
+	{'n', "target WWNN",   snprint_tgt_wwnn},
+	{'R', "host WWPN",     snprint_host_wwpn},
+	{'r', "target WWPN",   snprint_tgt_wwpn},
+	{'a', "host adapter",  snprint_host_adapter},
+	{'G', "foreign",       snprint_path_foreign},
+	{0, NULL, NULL}
 };
 
 struct pathgroup_data pgd[] = {
-	{'s', "selector",      0, snprint_pg_selector},
-	{'p', "pri",           0, snprint_pg_pri},
-	{'t', "dm_st",         0, snprint_pg_state},
-	{0, NULL, 0 , NULL}
+	{'s', "selector",      snprint_pg_selector},
+	{'p', "pri",           snprint_pg_pri},
+	{'t', "dm_st",         snprint_pg_state},
+	{0, NULL, NULL}
 };
 
 int
-snprint_wildcards (char * buff, int len)
+snprint_wildcards (struct strbuf *buff)
 {
-	int i, fwd = 0;
+	int i, rc;
+	size_t initial_len = get_strbuf_len(buff);
 
-	fwd += snprintf(buff + fwd, len - fwd, "multipath format wildcards:\n");
+	if ((rc = append_strbuf_str(buff, "multipath format wildcards:\n")) < 0)
+		return rc;
 	for (i = 0; mpd[i].header; i++)
-		fwd += snprintf(buff + fwd, len - fwd, "%%%c  %s\n",
-				mpd[i].wildcard, mpd[i].header);
-	fwd += snprintf(buff + fwd, len - fwd, "\npath format wildcards:\n");
+		if ((rc = print_strbuf(buff, "%%%c  %s\n",
+				       mpd[i].wildcard, mpd[i].header)) < 0)
+			return rc;
+	if ((rc = append_strbuf_str(buff, "\npath format wildcards:\n")) < 0)
+		return rc;
 	for (i = 0; pd[i].header; i++)
-		fwd += snprintf(buff + fwd, len - fwd, "%%%c  %s\n",
-				pd[i].wildcard, pd[i].header);
-	fwd += snprintf(buff + fwd, len - fwd, "\npathgroup format wildcards:\n");
+		if ((rc = print_strbuf(buff, "%%%c  %s\n",
+				       pd[i].wildcard, pd[i].header)) < 0)
+			return rc;
+	if ((rc = append_strbuf_str(buff, "\npathgroup format wildcards:\n")) < 0)
+		return rc;
 	for (i = 0; pgd[i].header; i++)
-		fwd += snprintf(buff + fwd, len - fwd, "%%%c  %s\n",
-				pgd[i].wildcard, pgd[i].header);
-	return fwd;
+		if ((rc = print_strbuf(buff, "%%%c  %s\n",
+				       pgd[i].wildcard, pgd[i].header)) < 0)
+			return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
+
+/*
+ * The column widths are kept by the caller, so that several threads can
+ * print at the same time. Free them with FREE().
+ */
+fieldwidth_t *
+alloc_path_layout(void)
+{
+	return MALLOC(ARRAY_SIZE(pd) * sizeof(fieldwidth_t));
+}
+
+fieldwidth_t *
+alloc_multipath_layout(void)
+{
+	return MALLOC(ARRAY_SIZE(mpd) * sizeof(fieldwidth_t));
 }
 
 void
-get_path_layout(vector pathvec, int header)
+get_path_layout(vector pathvec, int header, fieldwidth_t *width)
 {
 	vector gpvec = vector_convert(NULL, pathvec, struct path,
 				      dm_path_to_gen);
 	_get_path_layout(gpvec,
-			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO);
+			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+			 width);
 	vector_free(gpvec);
 }
 
 static void
-reset_width(int *width, enum layout_reset reset, const char *header)
+reset_width(fieldwidth_t *width, enum layout_reset reset, const char *header)
 {
 	switch (reset) {
 	case LAYOUT_RESET_HEADER:
@@ -737,15 +739,19 @@ reset_width(int *width, enum layout_reset reset, const char *header)
 }
 
 void
-_get_path_layout (const struct _vector *gpvec, enum layout_reset reset)
+_get_path_layout (const struct _vector *gpvec, enum layout_reset reset,
+		  fieldwidth_t *width)
 {
 	int i, j;
 	char buff[MAX_FIELD_LEN];
 	const struct gen_path *gp;
 
+	if (width == NULL)
+		return;
+
 	for (j = 0; pd[j].header; j++) {
 
-		reset_width(&pd[j].width, reset, pd[j].header);
+		reset_width(&width[j], reset, pd[j].header);
 
 		if (gpvec == NULL)
 			continue;
@@ -753,40 +759,35 @@ _get_path_layout (const struct _vector *gpvec, enum layout_reset reset)
 		vector_foreach_slot (gpvec, gp, i) {
 			gp->ops->snprint(gp, buff, MAX_FIELD_LEN,
 					 pd[j].wildcard);
-			pd[j].width = MAX(pd[j].width, strlen(buff));
+			width[j] = MAX(width[j], strlen(buff));
 		}
 	}
 }
 
-static void
-reset_multipath_layout (void)
-{
-	int i;
-
-	for (i = 0; mpd[i].header; i++)
-		mpd[i].width = 0;
-}
-
 void
-get_multipath_layout (vector mpvec, int header) {
+get_multipath_layout (vector mpvec, int header, fieldwidth_t *width) {
 	vector gmvec = vector_convert(NULL, mpvec, struct multipath,
 				      dm_multipath_to_gen);
 	_get_multipath_layout(gmvec,
-			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO);
+			 header ? LAYOUT_RESET_HEADER : LAYOUT_RESET_ZERO,
+			 width);
 	vector_free(gmvec);
 }
 
 void
 _get_multipath_layout (const struct _vector *gmvec,
-			    enum layout_reset reset)
+		       enum layout_reset reset, fieldwidth_t *width)
 {
 	int i, j;
 	char buff[MAX_FIELD_LEN];
 	const struct gen_multipath * gm;
 
+	if (width == NULL)
+		return;
+
 	for (j = 0; mpd[j].header; j++) {
 
-		reset_width(&mpd[j].width, reset, mpd[j].header);
+		reset_width(&width[j], reset, mpd[j].header);
 
 		if (gmvec == NULL)
 			continue;
@@ -794,9 +795,9 @@ _get_multipath_layout (const struct _vector *gmvec,
 		vector_foreach_slot (gmvec, gm, i) {
 			gm->ops->snprint(gm, buff, MAX_FIELD_LEN,
 					 mpd[j].wildcard);
-			mpd[j].width = MAX(mpd[j].width, strlen(buff));
+			width[j] = MAX(width[j], strlen(buff));
 		}
-		condlog(4, "%s: width %d", mpd[j].header, mpd[j].width);
+		condlog(4, "%s: width %d", mpd[j].header, width[j]);
 	}
 }
 
@@ -869,203 +870,171 @@ int snprint_pathgroup_attr(const struct gen_pathgroup* gpg,
 	return pdg->snprint(buf, len, pg);
 }
 
-int
-snprint_multipath_header (char * line, int len, const char * format)
-{
-	char * c = line;   /* line cursor */
-	char * s = line;   /* for padding */
-	const char * f = format; /* format string cursor */
-	int fwd;
-	struct multipath_data * data;
+/*
+ * Append @format to @line, with the wildcards expanded by @print_field,
+ * and a newline. If @width is set, every field is padded to the width
+ * stored for it at the index @print_field returns.
+ */
+typedef int (print_field_fn)(const void *obj, char wildcard, char *buff);
 
-	do {
-		if (TAIL <= 0)
+static int
+print_line (struct strbuf *line, const char *format, const fieldwidth_t *width,
+	    print_field_fn *print_field, const void *obj)
+{
+	size_t initial_len = get_strbuf_len(line);
+	char buff[MAX_FIELD_LEN];
+	const char *f = format, *pct;
+	int idx, rc;
+
+	while ((pct = strchr(f, '%')) != NULL) {
+		if ((rc = __append_strbuf_str(line, f, pct - f)) < 0)
+			return rc;
+		f = pct + 1;
+		if (*f == '\0')
 			break;
-
-		if (*f != '%') {
-			*c++ = *f;
-			NOPAD;
-			continue;
-		}
-		f++;
-
-		if (!(data = mpd_lookup(*f)))
+		buff[0] = '\0';
+		if ((idx = print_field(obj, *f++, buff)) < 0)
 			continue; /* unknown wildcard */
+		if ((rc = append_strbuf_str(line, buff)) < 0)
+			return rc;
+		if (width && (rc = fill_strbuf(line, ' ', width[idx] - rc)) < 0)
+			return rc;
+	}
+	if ((rc = append_strbuf_str(line, f)) < 0 ||
+	    (rc = append_strbuf_str(line, "\n")) < 0)
+		return rc;
+	return get_strbuf_len(line) - initial_len;
+}
 
-		PRINT(c, TAIL, "%s", data->header);
-		PAD(data->width);
-	} while (*f++);
+static int
+print_multipath_header_field (const void *obj, char wildcard, char *buff)
+{
+	struct multipath_data *data = mpd_lookup(wildcard);
 
-	__endline(line, len, c);
-	return (c - line);
+	if (!data)
+		return -1;
+	strcpy(buff, data->header);
+	return data - mpd;
 }
 
 int
-_snprint_multipath (const struct gen_multipath * gmp,
-		    char * line, int len, const char * format, int pad)
-{
-	char * c = line;   /* line cursor */
-	char * s = line;   /* for padding */
-	const char * f = format; /* format string cursor */
-	int fwd;
-	struct multipath_data * data;
-	char buff[MAX_FIELD_LEN] = {};
-
-	do {
-		if (TAIL <= 0)
-			break;
-
-		if (*f != '%') {
-			*c++ = *f;
-			NOPAD;
-			continue;
-		}
-		f++;
-
-		if (!(data = mpd_lookup(*f)))
-			continue;
+snprint_multipath_header (struct strbuf *line, const char *format,
+			  const fieldwidth_t *width)
+{
+	return print_line(line, format, width, print_multipath_header_field,
+			  NULL);
+}
 
-		gmp->ops->snprint(gmp, buff, MAX_FIELD_LEN, *f);
-		PRINT(c, TAIL, "%s", buff);
-		if (pad)
-			PAD(data->width);
-		buff[0] = '\0';
-	} while (*f++);
+static int
+print_multipath_field (const void *obj, char wildcard, char *buff)
+{
+	const struct gen_multipath *gmp = obj;
+	struct multipath_data *data = mpd_lookup(wildcard);
 
-	__endline(line, len, c);
-	return (c - line);
+	if (!data)
+		return -1;
+	gmp->ops->snprint(gmp, buff, MAX_FIELD_LEN, wildcard);
+	return data - mpd;
 }
 
 int
-snprint_path_header (char * line, int len, const char * format)
+_snprint_multipath (const struct gen_multipath *gmp, struct strbuf *line,
+		    const char *format, const fieldwidth_t *width)
 {
-	char * c = line;   /* line cursor */
-	char * s = line;   /* for padding */
-	const char * f = format; /* format string cursor */
-	int fwd;
-	struct path_data * data;
-
-	do {
-		if (TAIL <= 0)
-			break;
-
-		if (*f != '%') {
-			*c++ = *f;
-			NOPAD;
-			continue;
-		}
-		f++;
-
-		if (!(data = pd_lookup(*f)))
-			continue; /* unknown wildcard */
+	return print_line(line, format, width, print_multipath_field, gmp);
+}
 
-		PRINT(c, TAIL, "%s", data->header);
-		PAD(data->width);
-	} while (*f++);
+static int
+print_path_header_field (const void *obj, char wildcard, char *buff)
+{
+	struct path_data *data = pd_lookup(wildcard);
 
-	__endline(line, len, c);
-	return (c - line);
+	if (!data)
+		return -1;
+	strcpy(buff, data->header);
+	return data - pd;
 }
 
 int
-_snprint_path (const struct gen_path * gp, char * line, int len,
-	       const char * format, int pad)
-{
-	char * c = line;   /* line cursor */
-	char * s = line;   /* for padding */
-	const char * f = format; /* format string cursor */
-	int fwd;
-	struct path_data * data;
-	char buff[MAX_FIELD_LEN];
-
-	do {
-		if (TAIL <= 0)
-			break;
-
-		if (*f != '%') {
-			*c++ = *f;
-			NOPAD;
-			continue;
-		}
-		f++;
-
-		if (!(data = pd_lookup(*f)))
-			continue;
+snprint_path_header (struct strbuf *line, const char *format,
+		     const fieldwidth_t *width)
+{
+	return print_line(line, format, width, print_path_header_field, NULL);
+}
 
-		gp->ops->snprint(gp, buff, MAX_FIELD_LEN, *f);
-		PRINT(c, TAIL, "%s", buff);
-		if (pad)
-			PAD(data->width);
-	} while (*f++);
+static int
+print_path_field (const void *obj, char wildcard, char *buff)
+{
+	const struct gen_path *gp = obj;
+	struct path_data *data = pd_lookup(wildcard);
 
-	__endline(line, len, c);
-	return (c - line);
+	if (!data)
+		return -1;
+	gp->ops->snprint(gp, buff, MAX_FIELD_LEN, wildcard);
+	return data - pd;
 }
 
 int
-_snprint_pathgroup (const struct gen_pathgroup * ggp, char * line, int len,
-		    char * format)
-{
-	char * c = line;   /* line cursor */
-	char * s = line;   /* for padding */
-	char * f = format; /* format string cursor */
-	int fwd;
-	struct pathgroup_data * data;
-	char buff[MAX_FIELD_LEN];
-
-	do {
-		if (TAIL <= 0)
-			break;
-
-		if (*f != '%') {
-			*c++ = *f;
-			NOPAD;
-			continue;
-		}
-		f++;
+_snprint_path (const struct gen_path *gp, struct strbuf *line,
+	       const char *format, const fieldwidth_t *width)
+{
+	return print_line(line, format, width, print_path_field, gp);
+}
 
-		if (!(data = pgd_lookup(*f)))
-			continue;
+static int
+print_pathgroup_field (const void *obj, char wildcard, char *buff)
+{
+	const struct gen_pathgroup *ggp = obj;
+	struct pathgroup_data *data = pgd_lookup(wildcard);
 
-		ggp->ops->snprint(ggp, buff, MAX_FIELD_LEN, *f);
-		PRINT(c, TAIL, "%s", buff);
-		PAD(data->width);
-	} while (*f++);
+	if (!data)
+		return -1;
+	ggp->ops->snprint(ggp, buff, MAX_FIELD_LEN, wildcard);
+	return data - pgd;
+}
 
-	__endline(line, len, c);
-	return (c - line);
+static int
+_snprint_pathgroup (const struct gen_pathgroup *ggp, struct strbuf *line,
+		    const char *format)
+{
+	return print_line(line, format, NULL, print_pathgroup_field, ggp);
 }
-#define snprint_pathgroup(line, len, fmt, pgp) \
-	_snprint_pathgroup(dm_pathgroup_to_gen(pgp), line, len, fmt)
+#define snprint_pathgroup(line, fmt, pgp) \
+	_snprint_pathgroup(dm_pathgroup_to_gen(pgp), line, fmt)
 
 void _print_multipath_topology(const struct gen_multipath *gmp, int verbosity)
 {
-	int resize;
-	char *buff = NULL;
-	char *old = NULL;
-	int len, maxlen = MAX_LINE_LEN * MAX_LINES;
-
-	buff = MALLOC(maxlen);
-	do {
-		if (!buff) {
-			if (old)
-				FREE(old);
-			condlog(0, "couldn't allocate memory for list: %s\n",
-				strerror(errno));
-			return;
-		}
-
-		len = _snprint_multipath_topology(gmp, buff, maxlen, verbosity);
-		resize = (len == maxlen - 1);
+	struct strbuf buff = STRBUF_INIT;
+	const struct _vector *pgvec, *pathvec;
+	const struct gen_pathgroup *gpg;
+	fieldwidth_t *p_width;
+	int j;
 
-		if (resize) {
-			maxlen *= 2;
-			old = buff;
-			buff = REALLOC(buff, maxlen);
+	/* align the paths of this map */
+	p_width = alloc_path_layout();
+	pgvec = gmp->ops->get_pathgroups(gmp);
+	if (p_width && pgvec != NULL) {
+		vector_foreach_slot (pgvec, gpg, j) {
+			pathvec = gpg->ops->get_paths(gpg);
+			if (pathvec == NULL)
+				continue;
+			_get_path_layout(pathvec, LAYOUT_RESET_NOT, p_width);
+			gpg->ops->rel_paths(gpg, pathvec);
 		}
-	} while (resize);
-	printf("%s", buff);
-	FREE(buff);
+	}
+	if (pgvec != NULL)
+		gmp->ops->rel_pathgroups(gmp, pgvec);
+
+	if (_snprint_multipath_topology(gmp, &buff, verbosity, p_width) < 0) {
+		condlog(0, "couldn't allocate memory for list: %s\n",
+			strerror(ENOMEM));
+		reset_strbuf(&buff);
+		FREE_PTR(p_width);
+		return;
+	}
+	printf("%s", get_strbuf_str(&buff));
+	reset_strbuf(&buff);
+	FREE_PTR(p_width);
 }
 
 int
@@ -1086,24 +1055,27 @@ snprint_multipath_style(const struct gen_multipath *gmp, char *style, int len,
 	return MIN(n, len - 1);
 }
 
+/*
+ * The paths are aligned to the column widths in @p_width, if set.
+ */
 int _snprint_multipath_topology(const struct gen_multipath *gmp,
-				char *buff, int len, int verbosity)
+				struct strbuf *buff, int verbosity,
+				const fieldwidth_t *p_width)
 {
-	int j, i, fwd = 0;
+	int j, i, rc = 0;
 	const struct _vector *pgvec;
 	const struct gen_pathgroup *gpg;
 	char style[64];
 	char * c = style;
 	char fmt[64];
 	char * f;
+	size_t initial_len = get_strbuf_len(buff);
 
 	if (verbosity <= 0)
-		return fwd;
-
-	reset_multipath_layout();
+		return 0;
 
 	if (verbosity == 1)
-		return _snprint_multipath(gmp, buff, len, "%n", 1);
+		return _snprint_multipath(gmp, buff, "%n", NULL);
 
 	if(isatty(1))
 		c += sprintf(c, "%c[%dm", 0x1B, 1); /* bold on */
@@ -1113,17 +1085,13 @@ int _snprint_multipath_topology(const struct gen_multipath *gmp,
 	if(isatty(1))
 		c += sprintf(c, "%c[%dm", 0x1B, 0); /* bold off */
 
-	fwd += _snprint_multipath(gmp, buff + fwd, len - fwd, style, 1);
-	if (fwd >= len)
-		return len;
-	fwd += _snprint_multipath(gmp, buff + fwd, len - fwd,
-				  PRINT_MAP_PROPS, 1);
-	if (fwd >= len)
-		return len;
+	if ((rc = _snprint_multipath(gmp, buff, style, NULL)) < 0 ||
+	    (rc = _snprint_multipath(gmp, buff, PRINT_MAP_PROPS, NULL)) < 0)
+		return rc;
 
 	pgvec = gmp->ops->get_pathgroups(gmp);
 	if (pgvec == NULL)
-		return fwd;
+		goto out;
 
 	vector_foreach_slot (pgvec, gpg, j) {
 		const struct _vector *pathvec;
@@ -1135,12 +1103,8 @@ int _snprint_multipath_topology(const struct gen_multipath *gmp,
 			strcpy(f, "|-+- " PRINT_PG_INDENT);
 		} else
 			strcpy(f, "`-+- " PRINT_PG_INDENT);
-		fwd += _snprint_pathgroup(gpg, buff + fwd, len - fwd, fmt);
-
-		if (fwd >= len) {
-			fwd = len;
+		if ((rc = _snprint_pathgroup(gpg, buff, fmt)) < 0)
 			break;
-		}
 
 		pathvec = gpg->ops->get_paths(gpg);
 		if (pathvec == NULL)
@@ -1155,192 +1119,340 @@ int _snprint_multipath_topology(const struct gen_multipath *gmp,
 				strcpy(f, " |- " PRINT_PATH_INDENT);
 			else
 				strcpy(f, " `- " PRINT_PATH_INDENT);
-			fwd += _snprint_path(gp, buff + fwd, len - fwd, fmt, 1);
-			if (fwd >= len) {
-				fwd = len;
+			if ((rc = _snprint_path(gp, buff, fmt, p_width)) < 0)
 				break;
-			}
 		}
 		gpg->ops->rel_paths(gpg, pathvec);
 
-		if (fwd == len)
+		if (rc < 0)
 			break;
 	}
 	gmp->ops->rel_pathgroups(gmp, pgvec);
-	return fwd;
+	if (rc < 0)
+		return rc;
+out:
+	return get_strbuf_len(buff) - initial_len;
 }
 
 
 static int
-snprint_json (char * buff, int len, int indent, char *json_str)
+snprint_json (struct strbuf *buff, int indent, const char *json_str)
 {
-	int fwd = 0, i;
+	int i, rc, fwd = 0;
 
 	for (i = 0; i < indent; i++) {
-		fwd += snprintf(buff + fwd, len - fwd, PRINT_JSON_INDENT);
-		if (fwd >= len)
-			return fwd;
+		if ((rc = append_strbuf_str(buff, PRINT_JSON_INDENT)) < 0)
+			return rc;
+		fwd += rc;
 	}
 
-	fwd += snprintf(buff + fwd, len - fwd, "%s", json_str);
-	return fwd;
+	if ((rc = append_strbuf_str(buff, json_str)) < 0)
+		return rc;
+	return fwd + rc;
 }
 
 static int
-snprint_json_header (char * buff, int len)
+snprint_json_header (struct strbuf *buff)
 {
-	int fwd = 0;
+	int rc, fwd;
 
-	fwd +=  snprint_json(buff, len, 0, PRINT_JSON_START_ELEM);
-	if (fwd >= len)
+	if ((fwd = snprint_json(buff, 0, PRINT_JSON_START_ELEM)) < 0)
 		return fwd;
 
-	fwd +=  snprintf(buff + fwd, len  - fwd, PRINT_JSON_START_VERSION,
-			PRINT_JSON_MAJOR_VERSION, PRINT_JSON_MINOR_VERSION);
-	return fwd;
+	if ((rc = print_strbuf(buff, PRINT_JSON_START_VERSION,
+			       PRINT_JSON_MAJOR_VERSION,
+			       PRINT_JSON_MINOR_VERSION)) < 0)
+		return rc;
+	return fwd + rc;
 }
 
 static int
-snprint_json_elem_footer (char * buff, int len, int indent, int last)
+snprint_json_elem_footer (struct strbuf *buff, int indent, int last)
 {
-	int fwd = 0, i;
-
-	for (i = 0; i < indent; i++) {
-		fwd += snprintf(buff + fwd, len - fwd, PRINT_JSON_INDENT);
-		if (fwd >= len)
-			return fwd;
-	}
-
-	if (last == 1)
-		fwd += snprintf(buff + fwd, len - fwd, "%s", PRINT_JSON_END_LAST_ELEM);
-	else
-		fwd += snprintf(buff + fwd, len - fwd, "%s", PRINT_JSON_END_ELEM);
-	return fwd;
+	return snprint_json(buff, indent, last == 1 ?
+			    PRINT_JSON_END_LAST_ELEM : PRINT_JSON_END_ELEM);
 }
 
 static int
-snprint_multipath_fields_json (char * buff, int len,
+snprint_multipath_fields_json (struct strbuf *buff,
 		const struct multipath * mpp, int last)
 {
-	int i, j, fwd = 0;
+	int i, j, rc;
 	struct path *pp;
 	struct pathgroup *pgp;
+	size_t initial_len = get_strbuf_len(buff);
 
-	fwd += snprint_multipath(buff, len, PRINT_JSON_MAP, mpp, 0);
-	if (fwd >= len)
-		return fwd;
-
-	fwd += snprint_json(buff + fwd, len - fwd, 2, PRINT_JSON_START_GROUPS);
-	if (fwd >= len)
-		return fwd;
+	if ((rc = snprint_multipath(buff, PRINT_JSON_MAP, mpp, NULL)) < 0 ||
+	    (rc = snprint_json(buff, 2, PRINT_JSON_START_GROUPS)) < 0)
+		return rc;
 
 	vector_foreach_slot (mpp->pg, pgp, i) {
 
-		fwd += snprint_pathgroup(buff + fwd, len - fwd, PRINT_JSON_GROUP, pgp);
-		if (fwd >= len)
-			return fwd;
-
-		fwd += snprintf(buff + fwd, len - fwd, PRINT_JSON_GROUP_NUM, i + 1);
-		if (fwd >= len)
-			return fwd;
-
-		fwd += snprint_json(buff + fwd, len - fwd, 3, PRINT_JSON_START_PATHS);
-		if (fwd >= len)
-			return fwd;
+		if ((rc = snprint_pathgroup(buff, PRINT_JSON_GROUP, pgp)) < 0 ||
+		    (rc = print_strbuf(buff, PRINT_JSON_GROUP_NUM, i + 1)) < 0 ||
+		    (rc = snprint_json(buff, 3, PRINT_JSON_START_PATHS)) < 0)
+			return rc;
 
 		vector_foreach_slot (pgp->paths, pp, j) {
-			fwd += snprint_path(buff + fwd, len - fwd, PRINT_JSON_PATH, pp, 0);
-			if (fwd >= len)
-				return fwd;
-
-			fwd += snprint_json_elem_footer(buff + fwd,
-					len - fwd, 3, j + 1 == VECTOR_SIZE(pgp->paths));
-			if (fwd >= len)
-				return fwd;
+			if ((rc = snprint_path(buff, PRINT_JSON_PATH,
+					       pp, NULL)) < 0 ||
+			    (rc = snprint_json_elem_footer(buff, 3,
+					j + 1 == VECTOR_SIZE(pgp->paths))) < 0)
+				return rc;
 		}
-		fwd += snprint_json(buff + fwd, len - fwd, 0, PRINT_JSON_END_ARRAY);
-		if (fwd >= len)
-			return fwd;
-
-		fwd +=  snprint_json_elem_footer(buff + fwd,
-				len - fwd, 2, i + 1 == VECTOR_SIZE(mpp->pg));
-		if (fwd >= len)
-			return fwd;
+		if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+		    (rc = snprint_json_elem_footer(buff, 2,
+					i + 1 == VECTOR_SIZE(mpp->pg))) < 0)
+			return rc;
 	}
 
-	fwd += snprint_json(buff + fwd, len - fwd, 0, PRINT_JSON_END_ARRAY);
-	if (fwd >= len)
-		return fwd;
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json_elem_footer(buff, 1, last)) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
 
-	fwd += snprint_json_elem_footer(buff + fwd, len - fwd, 1, last);
-	return fwd;
+int
+snprint_multipath_map_json (struct strbuf *buff, const struct multipath * mpp)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_START_MAP)) < 0 ||
+	    (rc = snprint_multipath_fields_json(buff, mpp, 1)) < 0 ||
+	    (rc = snprint_json(buff, 0, "\n")) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
 int
-snprint_multipath_map_json (char * buff, int len,
-		const struct multipath * mpp, int last){
-	int fwd = 0;
+snprint_multipath_topology_json (struct strbuf *buff,
+				 const struct vectors * vecs)
+{
+	int i, rc;
+	struct multipath * mpp;
+	size_t initial_len = get_strbuf_len(buff);
 
-	fwd +=  snprint_json_header(buff, len);
-	if (fwd >= len)
-		return len;
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_json(buff, 1, PRINT_JSON_START_MAPS)) < 0)
+		return rc;
 
-	fwd +=  snprint_json(buff + fwd, len - fwd, 0, PRINT_JSON_START_MAP);
-	if (fwd >= len)
-		return len;
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if ((rc = snprint_multipath_fields_json(buff, mpp,
+				i + 1 == VECTOR_SIZE(vecs->mpvec))) < 0)
+			return rc;
+	}
 
-	fwd += snprint_multipath_fields_json(buff + fwd, len - fwd, mpp, 1);
-	if (fwd >= len)
-		return len;
+	if ((rc = snprint_json(buff, 0, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
 
-	fwd +=  snprint_json(buff + fwd, len - fwd, 0, "\n");
-	if (fwd >= len)
-		return len;
+/*
+ * Binary topology dump, see mpath_tlv.h for the format. The string
+ * attributes are rendered by the same functions as the JSON fields.
+ */
+static const struct {
+	uint16_t tag;
+	int (*snprint)(char * buff, size_t len, const struct multipath * mpp);
+} map_tlv_attrs[] = {
+	{MPATH_TLV_MAP_NAME,		snprint_name},
+	{MPATH_TLV_MAP_UUID,		snprint_multipath_uuid},
+	{MPATH_TLV_MAP_SYSFS,		snprint_sysfs},
+	{MPATH_TLV_MAP_FAILBACK,	snprint_failback},
+	{MPATH_TLV_MAP_QUEUEING,	snprint_queueing},
+	{MPATH_TLV_MAP_DM_ST,		snprint_dm_map_state},
+	{MPATH_TLV_MAP_FEATURES,	snprint_features},
+	{MPATH_TLV_MAP_HWHANDLER,	snprint_hwhandler},
+	{MPATH_TLV_MAP_ACTION,		snprint_action},
+	{MPATH_TLV_MAP_WRITE_PROT,	snprint_ro},
+	{MPATH_TLV_MAP_VEND,		snprint_multipath_vend},
+	{MPATH_TLV_MAP_PROD,		snprint_multipath_prod},
+	{MPATH_TLV_MAP_REV,		snprint_multipath_rev},
+};
 
-	fwd +=  snprint_json(buff + fwd, len - fwd, 0, PRINT_JSON_END_LAST);
-	if (fwd >= len)
-		return len;
-	return fwd;
+static const struct {
+	uint16_t tag;
+	int (*snprint)(char * buff, size_t len, const struct pathgroup * pgp);
+} pg_tlv_attrs[] = {
+	{MPATH_TLV_PG_SELECTOR,		snprint_pg_selector},
+	{MPATH_TLV_PG_DM_ST,		snprint_pg_state},
+};
+
+static const struct {
+	uint16_t tag;
+	int (*snprint)(char * buff, size_t len, const struct path * pp);
+} path_tlv_attrs[] = {
+	{MPATH_TLV_PATH_DEV,		snprint_dev},
+	{MPATH_TLV_PATH_DEV_T,		snprint_dev_t},
+	{MPATH_TLV_PATH_DM_ST,		snprint_dm_path_state},
+	{MPATH_TLV_PATH_DEV_ST,		snprint_offline},
+	{MPATH_TLV_PATH_CHK_ST,		snprint_chk_state},
+	{MPATH_TLV_PATH_CHECKER,	snprint_path_checker},
+	{MPATH_TLV_PATH_PRI,		snprint_pri},
+};
+
+static int
+tlv_put (struct strbuf *buff, uint16_t tag, const void *val, uint32_t len)
+{
+	struct mpath_tlv tlv = { .tag = tag, .len = len, };
+	int rc;
+
+	if ((rc = __append_strbuf_str(buff, (const char *)&tlv,
+				      sizeof(tlv))) < 0 ||
+	    (rc = __append_strbuf_str(buff, val, len)) < 0)
+		return rc;
+	return 0;
 }
 
-int
-snprint_multipath_topology_json (char * buff, int len, const struct vectors * vecs)
+static int
+tlv_put_u32 (struct strbuf *buff, uint16_t tag, uint32_t val)
 {
-	int i, fwd = 0;
-	struct multipath * mpp;
+	return tlv_put(buff, tag, &val, sizeof(val));
+}
 
-	fwd +=  snprint_json_header(buff, len);
-	if (fwd >= len)
-		return len;
+/* @len is the return value of a snprint function writing to @str */
+static int
+tlv_put_str (struct strbuf *buff, uint16_t tag, const char *str, int len)
+{
+	if (len < 0)
+		len = 0;
+	else if (len >= MAX_FIELD_LEN)
+		len = MAX_FIELD_LEN - 1;
+	return tlv_put(buff, tag, str, len);
+}
+
+/*
+ * Start a record containing other records. Returns its offset, to be
+ * passed to tlv_end() once the contents have been appended.
+ */
+static int
+tlv_begin (struct strbuf *buff, uint16_t tag)
+{
+	struct mpath_tlv tlv = { .tag = tag, };
+	size_t offs = get_strbuf_len(buff);
+	int rc;
 
-	fwd +=  snprint_json(buff + fwd, len  - fwd, 1, PRINT_JSON_START_MAPS);
-	if (fwd >= len)
-		return len;
+	if ((rc = __append_strbuf_str(buff, (const char *)&tlv,
+				      sizeof(tlv))) < 0)
+		return rc;
+	return offs;
+}
 
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		fwd += snprint_multipath_fields_json(buff + fwd, len - fwd,
-				mpp, i + 1 == VECTOR_SIZE(vecs->mpvec));
-		if (fwd >= len)
-			return len;
+static void
+tlv_end (struct strbuf *buff, int offs)
+{
+	uint32_t len = get_strbuf_len(buff) - offs - sizeof(struct mpath_tlv);
+
+	memcpy(buff->buf + offs + offsetof(struct mpath_tlv, len),
+	       &len, sizeof(len));
+}
+
+static int
+snprint_path_tlv (struct strbuf *buff, const struct path *pp)
+{
+	char field[MAX_FIELD_LEN];
+	int i, rc, offs;
+
+	if ((offs = tlv_begin(buff, MPATH_TLV_PATH)) < 0)
+		return offs;
+	for (i = 0; i < ARRAY_SIZE(path_tlv_attrs); i++) {
+		rc = path_tlv_attrs[i].snprint(field, sizeof(field), pp);
+		if ((rc = tlv_put_str(buff, path_tlv_attrs[i].tag,
+				      field, rc)) < 0)
+			return rc;
+	}
+	tlv_end(buff, offs);
+	return 0;
+}
+
+static int
+snprint_pathgroup_tlv (struct strbuf *buff, const struct pathgroup *pgp,
+		       int group)
+{
+	char field[MAX_FIELD_LEN];
+	struct path *pp;
+	int i, rc, offs;
+
+	if ((offs = tlv_begin(buff, MPATH_TLV_PATHGROUP)) < 0)
+		return offs;
+	for (i = 0; i < ARRAY_SIZE(pg_tlv_attrs); i++) {
+		rc = pg_tlv_attrs[i].snprint(field, sizeof(field), pgp);
+		if ((rc = tlv_put_str(buff, pg_tlv_attrs[i].tag,
+				      field, rc)) < 0)
+			return rc;
+	}
+	if ((rc = tlv_put_u32(buff, MPATH_TLV_PG_PRI, pgp->priority)) < 0 ||
+	    (rc = tlv_put_u32(buff, MPATH_TLV_PG_GROUP, group)) < 0)
+		return rc;
+	vector_foreach_slot (pgp->paths, pp, i) {
+		if ((rc = snprint_path_tlv(buff, pp)) < 0)
+			return rc;
+	}
+	tlv_end(buff, offs);
+	return 0;
+}
+
+static int
+snprint_multipath_tlv (struct strbuf *buff, const struct multipath *mpp)
+{
+	char field[MAX_FIELD_LEN];
+	struct pathgroup *pgp;
+	int i, rc, offs;
+
+	if ((offs = tlv_begin(buff, MPATH_TLV_MAP)) < 0)
+		return offs;
+	for (i = 0; i < ARRAY_SIZE(map_tlv_attrs); i++) {
+		rc = map_tlv_attrs[i].snprint(field, sizeof(field), mpp);
+		if ((rc = tlv_put_str(buff, map_tlv_attrs[i].tag,
+				      field, rc)) < 0)
+			return rc;
+	}
+	vector_foreach_slot (mpp->pg, pgp, i) {
+		if ((rc = snprint_pathgroup_tlv(buff, pgp, i + 1)) < 0)
+			return rc;
 	}
+	tlv_end(buff, offs);
+	return 0;
+}
 
-	fwd +=  snprint_json(buff + fwd, len - fwd, 0, PRINT_JSON_END_ARRAY);
-	if (fwd >= len)
-		return len;
+int
+snprint_multipath_topology_binary (struct strbuf *buff,
+				   const struct vectors * vecs)
+{
+	struct mpath_tlv_header hdr = {
+		.major = MPATH_TLV_MAJOR_VERSION,
+		.minor = MPATH_TLV_MINOR_VERSION,
+	};
+	struct multipath * mpp;
+	size_t initial_len = get_strbuf_len(buff);
+	int i, rc;
 
-	fwd +=  snprint_json(buff + fwd, len - fwd, 0, PRINT_JSON_END_LAST);
-	if (fwd >= len)
-		return len;
-	return fwd;
+	memcpy(hdr.magic, MPATH_TLV_MAGIC, MPATH_TLV_MAGIC_LEN);
+	if ((rc = __append_strbuf_str(buff, (const char *)&hdr,
+				      sizeof(hdr))) < 0)
+		return rc;
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if ((rc = snprint_multipath_tlv(buff, mpp)) < 0)
+			return rc;
+	}
+	hdr.len = get_strbuf_len(buff) - initial_len - sizeof(hdr);
+	memcpy(buff->buf + initial_len + offsetof(struct mpath_tlv_header, len),
+	       &hdr.len, sizeof(hdr.len));
+	return get_strbuf_len(buff) - initial_len;
 }
 
 static int
-snprint_hwentry (struct config *conf, char * buff, int len, const struct hwentry * hwe)
+snprint_hwentry (struct config *conf, struct strbuf *buff,
+		 const struct hwentry * hwe)
 {
-	int i;
-	int fwd = 0;
+	int i, rc;
 	struct keyword * kw;
 	struct keyword * rootkw;
+	size_t initial_len = get_strbuf_len(buff);
 
 	rootkw = find_keyword(conf->keywords, NULL, "devices");
 
@@ -1352,455 +1464,631 @@ snprint_hwentry (struct config *conf, char * buff, int len, const struct hwentry
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "\tdevice {\n");
-	if (fwd >= len)
-		return len;
+	if ((rc = append_strbuf_str(buff, "\tdevice {\n")) < 0)
+		return rc;
 	iterate_sub_keywords(rootkw, kw, i) {
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t\t%k %v\n",
-				kw, hwe);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t\t%k %v\n", kw, hwe)) < 0)
+			return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "\t}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "\t}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
-int snprint_hwtable(struct config *conf, char *buff, int len, vector hwtable)
+int snprint_hwtable(struct config *conf, struct strbuf *buff, vector hwtable)
 {
-	int fwd = 0;
-	int i;
+	int i, rc;
 	struct hwentry * hwe;
 	struct keyword * rootkw;
+	size_t initial_len = get_strbuf_len(buff);
 
 	rootkw = find_keyword(conf->keywords, NULL, "devices");
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "devices {\n");
-	if (fwd >= len)
-		return len;
+	if ((rc = append_strbuf_str(buff, "devices {\n")) < 0)
+		return rc;
 	vector_foreach_slot (hwtable, hwe, i) {
-		fwd += snprint_hwentry(conf, buff + fwd, len - fwd, hwe);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_hwentry(conf, buff, hwe)) < 0)
+			return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
 static int
-snprint_mpentry (struct config *conf, char * buff, int len, const struct mpentry * mpe)
+snprint_mpentry (struct config *conf, struct strbuf *buff,
+		 const struct mpentry * mpe)
 {
-	int i;
-	int fwd = 0;
+	int i, rc;
 	struct keyword * kw;
 	struct keyword * rootkw;
+	size_t initial_len = get_strbuf_len(buff);
 
 	rootkw = find_keyword(conf->keywords, NULL, "multipath");
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "\tmultipath {\n");
-	if (fwd >= len)
-		return len;
+	if ((rc = append_strbuf_str(buff, "\tmultipath {\n")) < 0)
+		return rc;
 	iterate_sub_keywords(rootkw, kw, i) {
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t\t%k %v\n",
-				kw, mpe);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t\t%k %v\n", kw, mpe)) < 0)
+			return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "\t}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "\t}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
-int snprint_mptable(struct config *conf, char *buff, int len, vector mptable)
+int snprint_mptable(struct config *conf, struct strbuf *buff, vector mptable)
 {
-	int fwd = 0;
-	int i;
+	int i, rc;
 	struct mpentry * mpe;
 	struct keyword * rootkw;
+	size_t initial_len = get_strbuf_len(buff);
 
 	rootkw = find_keyword(conf->keywords, NULL, "multipaths");
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "multipaths {\n");
-	if (fwd >= len)
-		return len;
+	if ((rc = append_strbuf_str(buff, "multipaths {\n")) < 0)
+		return rc;
 	vector_foreach_slot (mptable, mpe, i) {
-		fwd += snprint_mpentry(conf, buff + fwd, len - fwd, mpe);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_mpentry(conf, buff, mpe)) < 0)
+			return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
-int snprint_overrides(struct config *conf, char * buff, int len,
+int snprint_overrides(struct config *conf, struct strbuf *buff,
 		      const struct hwentry *overrides)
 {
-	int fwd = 0;
-	int i;
+	int i, rc;
 	struct keyword *rootkw;
 	struct keyword *kw;
+	size_t initial_len = get_strbuf_len(buff);
 
 	rootkw = find_keyword(conf->keywords, NULL, "overrides");
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "overrides {\n");
-	if (fwd >= len)
-		return len;
+	if ((rc = append_strbuf_str(buff, "overrides {\n")) < 0)
+		return rc;
 	if (!overrides)
 		goto out;
 	iterate_sub_keywords(rootkw, kw, i) {
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, NULL);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, NULL)) < 0)
+			return rc;
 	}
 out:
-	fwd += snprintf(buff + fwd, len - fwd, "}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
-int snprint_defaults(struct config *conf, char *buff, int len)
+/* The whole config, as "multipath -t" and "show config" print it */
+int snprint_config(struct config *conf, struct strbuf *buff)
 {
-	int fwd = 0;
-	int i;
+	int rc;
+	size_t initial_len = get_strbuf_len(buff);
+
+	if ((rc = snprint_defaults(conf, buff)) < 0 ||
+	    (rc = snprint_blacklist(conf, buff)) < 0 ||
+	    (rc = snprint_blacklist_except(conf, buff)) < 0 ||
+	    (rc = snprint_hwtable(conf, buff, conf->hwtable)) < 0 ||
+	    (rc = snprint_overrides(conf, buff, conf->overrides)) < 0)
+		return rc;
+	if (VECTOR_SIZE(conf->mptable) > 0 &&
+	    (rc = snprint_mptable(conf, buff, conf->mptable)) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
+
+int snprint_defaults(struct config *conf, struct strbuf *buff)
+{
+	int i, rc;
 	struct keyword *rootkw;
 	struct keyword *kw;
+	size_t initial_len = get_strbuf_len(buff);
 
 	rootkw = find_keyword(conf->keywords, NULL, "defaults");
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "defaults {\n");
-	if (fwd >= len)
-		return len;
+	if ((rc = append_strbuf_str(buff, "defaults {\n")) < 0)
+		return rc;
 
 	iterate_sub_keywords(rootkw, kw, i) {
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				kw, NULL);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, NULL)) < 0)
+			return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
+
+static int
+snprint_blacklist_origin (struct strbuf *buff, int origin)
+{
+	if (origin == ORIGIN_CONFIG)
+		return append_strbuf_str(buff, "        (config file rule) ");
+	else if (origin == ORIGIN_DEFAULT)
+		return append_strbuf_str(buff, "        (default rule)     ");
+	return 0;
 }
 
 static int
-snprint_blacklist_group (char *buff, int len, int *fwd, vector *vec)
+snprint_blacklist_group (struct strbuf *buff, vector *vec)
 {
-	int threshold = MAX_LINE_LEN;
 	struct blentry * ble;
-	int pos;
-	int i;
+	size_t initial_len = get_strbuf_len(buff);
+	int i, rc;
 
-	pos = *fwd;
 	if (!VECTOR_SIZE(*vec)) {
-		if ((len - pos - threshold) <= 0)
-			return 0;
-		pos += snprintf(buff + pos, len - pos, "        <empty>\n");
+		if ((rc = append_strbuf_str(buff, "        <empty>\n")) < 0)
+			return rc;
 	} else vector_foreach_slot (*vec, ble, i) {
-		if ((len - pos - threshold) <= 0)
-			return 0;
-		if (ble->origin == ORIGIN_CONFIG)
-			pos += snprintf(buff + pos, len - pos, "        (config file rule) ");
-		else if (ble->origin == ORIGIN_DEFAULT)
-			pos += snprintf(buff + pos, len - pos, "        (default rule)     ");
-		pos += snprintf(buff + pos, len - pos, "%s\n", ble->str);
+		if ((rc = snprint_blacklist_origin(buff, ble->origin)) < 0 ||
+		    (rc = print_strbuf(buff, "%s\n", ble->str)) < 0)
+			return rc;
 	}
 
-	*fwd = pos;
-	return pos;
+	return get_strbuf_len(buff) - initial_len;
 }
 
 static int
-snprint_blacklist_devgroup (char *buff, int len, int *fwd, vector *vec)
+snprint_blacklist_devgroup (struct strbuf *buff, vector *vec)
 {
-	int threshold = MAX_LINE_LEN;
 	struct blentry_device * bled;
-	int pos;
-	int i;
+	size_t initial_len = get_strbuf_len(buff);
+	int i, rc;
 
-	pos = *fwd;
 	if (!VECTOR_SIZE(*vec)) {
-		if ((len - pos - threshold) <= 0)
-			return 0;
-		pos += snprintf(buff + pos, len - pos, "        <empty>\n");
+		if ((rc = append_strbuf_str(buff, "        <empty>\n")) < 0)
+			return rc;
 	} else vector_foreach_slot (*vec, bled, i) {
-		if ((len - pos - threshold) <= 0)
-			return 0;
-		if (bled->origin == ORIGIN_CONFIG)
-			pos += snprintf(buff + pos, len - pos, "        (config file rule) ");
-		else if (bled->origin == ORIGIN_DEFAULT)
-			pos += snprintf(buff + pos, len - pos, "        (default rule)     ");
-		pos += snprintf(buff + pos, len - pos, "%s:%s\n", bled->vendor, bled->product);
+		if ((rc = snprint_blacklist_origin(buff, bled->origin)) < 0 ||
+		    (rc = print_strbuf(buff, "%s:%s\n", bled->vendor,
+				       bled->product)) < 0)
+			return rc;
 	}
 
-	*fwd = pos;
-	return pos;
-}
-
-int snprint_blacklist_report(struct config *conf, char *buff, int len)
-{
-	int threshold = MAX_LINE_LEN;
-	int fwd = 0;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "device node rules:\n"
-					       "- blacklist:\n");
-	if (!snprint_blacklist_group(buff, len, &fwd, &conf->blist_devnode))
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "- exceptions:\n");
-	if (snprint_blacklist_group(buff, len, &fwd, &conf->elist_devnode) == 0)
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "udev property rules:\n"
-					       "- blacklist:\n");
-	if (!snprint_blacklist_group(buff, len, &fwd, &conf->blist_property))
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "- exceptions:\n");
-	if (snprint_blacklist_group(buff, len, &fwd, &conf->elist_property) == 0)
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "wwid rules:\n"
-					       "- blacklist:\n");
-	if (snprint_blacklist_group(buff, len, &fwd, &conf->blist_wwid) == 0)
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "- exceptions:\n");
-	if (snprint_blacklist_group(buff, len, &fwd, &conf->elist_wwid) == 0)
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "device rules:\n"
-					       "- blacklist:\n");
-	if (snprint_blacklist_devgroup(buff, len, &fwd, &conf->blist_device) == 0)
-		return len;
-
-	if ((len - fwd - threshold) <= 0)
-		return len;
-	fwd += snprintf(buff + fwd, len - fwd, "- exceptions:\n");
-	if (snprint_blacklist_devgroup(buff, len, &fwd, &conf->elist_device) == 0)
-		return len;
-
-	if (fwd > len)
-		return len;
-	return fwd;
-}
-
-int snprint_blacklist(struct config *conf, char *buff, int len)
+	return get_strbuf_len(buff) - initial_len;
+}
+
+int snprint_blacklist_report(struct config *conf, struct strbuf *buff)
 {
-	int i;
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	if ((rc = append_strbuf_str(buff, "device node rules:\n"
+				    "- blacklist:\n")) < 0 ||
+	    (rc = snprint_blacklist_group(buff, &conf->blist_devnode)) < 0 ||
+	    (rc = append_strbuf_str(buff, "- exceptions:\n")) < 0 ||
+	    (rc = snprint_blacklist_group(buff, &conf->elist_devnode)) < 0)
+		return rc;
+
+	if ((rc = append_strbuf_str(buff, "udev property rules:\n"
+				    "- blacklist:\n")) < 0 ||
+	    (rc = snprint_blacklist_group(buff, &conf->blist_property)) < 0 ||
+	    (rc = append_strbuf_str(buff, "- exceptions:\n")) < 0 ||
+	    (rc = snprint_blacklist_group(buff, &conf->elist_property)) < 0)
+		return rc;
+
+	if ((rc = append_strbuf_str(buff, "wwid rules:\n"
+				    "- blacklist:\n")) < 0 ||
+	    (rc = snprint_blacklist_group(buff, &conf->blist_wwid)) < 0 ||
+	    (rc = append_strbuf_str(buff, "- exceptions:\n")) < 0 ||
+	    (rc = snprint_blacklist_group(buff, &conf->elist_wwid)) < 0)
+		return rc;
+
+	if ((rc = append_strbuf_str(buff, "device rules:\n"
+				    "- blacklist:\n")) < 0 ||
+	    (rc = snprint_blacklist_devgroup(buff, &conf->blist_device)) < 0 ||
+	    (rc = append_strbuf_str(buff, "- exceptions:\n")) < 0 ||
+	    (rc = snprint_blacklist_devgroup(buff, &conf->elist_device)) < 0)
+		return rc;
+
+	return get_strbuf_len(buff) - initial_len;
+}
+
+static int
+snprint_blacklist_keywords (struct config *conf, struct strbuf *buff,
+			    struct keyword *rootkw, vector devnode,
+			    vector wwid, vector property, vector device)
+{
+	int i, rc;
 	struct blentry * ble;
 	struct blentry_device * bled;
-	int fwd = 0;
-	struct keyword *rootkw;
 	struct keyword *kw;
 
-	rootkw = find_keyword(conf->keywords, NULL, "blacklist");
-	if (!rootkw)
-		return 0;
-
-	fwd += snprintf(buff + fwd, len - fwd, "blacklist {\n");
-	if (fwd >= len)
-		return len;
-
-	vector_foreach_slot (conf->blist_devnode, ble, i) {
+	vector_foreach_slot (devnode, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "devnode");
 		if (!kw)
 			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, ble);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+			return rc;
 	}
-	vector_foreach_slot (conf->blist_wwid, ble, i) {
+	vector_foreach_slot (wwid, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "wwid");
 		if (!kw)
 			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, ble);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+			return rc;
 	}
-	vector_foreach_slot (conf->blist_property, ble, i) {
+	vector_foreach_slot (property, ble, i) {
 		kw = find_keyword(conf->keywords, rootkw->sub, "property");
 		if (!kw)
 			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, ble);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t%k %v\n", kw, ble)) < 0)
+			return rc;
 	}
 	rootkw = find_keyword(conf->keywords, rootkw->sub, "device");
 	if (!rootkw)
 		return 0;
 
-	vector_foreach_slot (conf->blist_device, bled, i) {
-		fwd += snprintf(buff + fwd, len - fwd, "\tdevice {\n");
-		if (fwd >= len)
-			return len;
+	vector_foreach_slot (device, bled, i) {
+		if ((rc = append_strbuf_str(buff, "\tdevice {\n")) < 0)
+			return rc;
 		kw = find_keyword(conf->keywords, rootkw->sub, "vendor");
 		if (!kw)
 			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t\t%k %v\n",
-				       kw, bled);
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t\t%k %v\n", kw, bled)) < 0)
+			return rc;
 		kw = find_keyword(conf->keywords, rootkw->sub, "product");
 		if (!kw)
 			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t\t%k %v\n",
-				       kw, bled);
-		if (fwd >= len)
-			return len;
-		fwd += snprintf(buff + fwd, len - fwd, "\t}\n");
-		if (fwd >= len)
-			return len;
+		if ((rc = snprint_keyword(buff, "\t\t%k %v\n", kw, bled)) < 0 ||
+		    (rc = append_strbuf_str(buff, "\t}\n")) < 0)
+			return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	return 1;
 }
 
-int snprint_blacklist_except(struct config *conf, char *buff, int len)
+int snprint_blacklist(struct config *conf, struct strbuf *buff)
 {
-	int i;
-	struct blentry * ele;
-	struct blentry_device * eled;
-	int fwd = 0;
 	struct keyword *rootkw;
-	struct keyword *kw;
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
 
-	rootkw = find_keyword(conf->keywords, NULL, "blacklist_exceptions");
+	rootkw = find_keyword(conf->keywords, NULL, "blacklist");
 	if (!rootkw)
 		return 0;
 
-	fwd += snprintf(buff + fwd, len - fwd, "blacklist_exceptions {\n");
-	if (fwd >= len)
-		return len;
-
-	vector_foreach_slot (conf->elist_devnode, ele, i) {
-		kw = find_keyword(conf->keywords, rootkw->sub, "devnode");
-		if (!kw)
-			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, ele);
-		if (fwd >= len)
-			return len;
-	}
-	vector_foreach_slot (conf->elist_wwid, ele, i) {
-		kw = find_keyword(conf->keywords, rootkw->sub, "wwid");
-		if (!kw)
-			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, ele);
-		if (fwd >= len)
-			return len;
-	}
-	vector_foreach_slot (conf->elist_property, ele, i) {
-		kw = find_keyword(conf->keywords, rootkw->sub, "property");
-		if (!kw)
-			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t%k %v\n",
-				       kw, ele);
-		if (fwd >= len)
-			return len;
+	if ((rc = append_strbuf_str(buff, "blacklist {\n")) < 0)
+		return rc;
+	rc = snprint_blacklist_keywords(conf, buff, rootkw,
+					conf->blist_devnode, conf->blist_wwid,
+					conf->blist_property,
+					conf->blist_device);
+	if (rc <= 0) {
+		truncate_strbuf(buff, initial_len);
+		return rc;
 	}
-	rootkw = find_keyword(conf->keywords, rootkw->sub, "device");
+	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
+
+int snprint_blacklist_except(struct config *conf, struct strbuf *buff)
+{
+	struct keyword *rootkw;
+	size_t initial_len = get_strbuf_len(buff);
+	int rc;
+
+	rootkw = find_keyword(conf->keywords, NULL, "blacklist_exceptions");
 	if (!rootkw)
 		return 0;
 
-	vector_foreach_slot (conf->elist_device, eled, i) {
-		fwd += snprintf(buff + fwd, len - fwd, "\tdevice {\n");
-		if (fwd >= len)
-			return len;
-		kw = find_keyword(conf->keywords, rootkw->sub, "vendor");
-		if (!kw)
-			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t\t%k %v\n",
-				       kw, eled);
-		if (fwd >= len)
-			return len;
-		kw = find_keyword(conf->keywords, rootkw->sub, "product");
-		if (!kw)
-			return 0;
-		fwd += snprint_keyword(buff + fwd, len - fwd, "\t\t%k %v\n",
-				       kw, eled);
-		if (fwd >= len)
-			return len;
-		fwd += snprintf(buff + fwd, len - fwd, "\t}\n");
-		if (fwd >= len)
-			return len;
+	if ((rc = append_strbuf_str(buff, "blacklist_exceptions {\n")) < 0)
+		return rc;
+	rc = snprint_blacklist_keywords(conf, buff, rootkw,
+					conf->elist_devnode, conf->elist_wwid,
+					conf->elist_property,
+					conf->elist_device);
+	if (rc <= 0) {
+		truncate_strbuf(buff, initial_len);
+		return rc;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "}\n");
-	if (fwd >= len)
-		return len;
-	return fwd;
+	if ((rc = append_strbuf_str(buff, "}\n")) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
 }
 
-int snprint_status(char *buff, int len, const struct vectors *vecs)
+int snprint_status(struct strbuf *buff, const struct vectors *vecs)
 {
-	int fwd = 0;
-	int i;
+	int i, rc;
 	unsigned int count[PATH_MAX_STATE] = {0};
+	int monitored_count = 0;
 	struct path * pp;
+	size_t initial_len = get_strbuf_len(buff);
 
 	vector_foreach_slot (vecs->pathvec, pp, i) {
 		count[pp->state]++;
 	}
-	fwd += snprintf(buff + fwd, len - fwd, "path checker states:\n");
+	if ((rc = append_strbuf_str(buff, "path checker states:\n")) < 0)
+		return rc;
 	for (i=0; i<PATH_MAX_STATE; i++) {
 		if (!count[i])
 			continue;
-		fwd += snprintf(buff + fwd, len - fwd, "%-20s%u\n",
-				checker_state_name(i), count[i]);
+		if ((rc = print_strbuf(buff, "%-20s%u\n",
+				       checker_state_name(i), count[i])) < 0)
+			return rc;
 	}
 
-	int monitored_count = 0;
-
 	vector_foreach_slot(vecs->pathvec, pp, i)
 		if (pp->fd >= 0)
 			monitored_count++;
-	fwd += snprintf(buff + fwd, len - fwd, "\npaths: %d\nbusy: %s\n",
-			monitored_count, is_uevent_busy()? "True" : "False");
+	if ((rc = print_strbuf(buff, "\npaths: %d\nbusy: %s\n",
+			       monitored_count,
+			       is_uevent_busy()? "True" : "False")) < 0)
+		return rc;
 
-	if (fwd >= len)
-		return len;
-	return fwd;
+	return get_strbuf_len(buff) - initial_len;
 }
 
-int snprint_devices(struct config *conf, char * buff, int len,
+/*
+ * Checker and prioritizer call latencies, in microseconds.
+ */
+#define LAT_HEADER_FMT "%-10s %-8s %-10s %10s %8s %8s %8s %8s %9s\n"
+#define LAT_ROW_FMT "%-10s %-8s %-10s %10lu %8u %8u %8u %8u %9u\n"
+#define LAT_GROUP_HEADER_FMT "%-8s %-10s %6s %10s %8s %8s %8s %8s %9s\n"
+#define LAT_GROUP_ROW_FMT "%-8s %-10s %6u %10lu %8u %8u %8u %8u %9u\n"
+#define LAT_JSON_FMT "\"name\" : \"%s\", \"calls\" : %lu, " \
+	"\"mean_us\" : %u, \"p50_us\" : %u, \"p90_us\" : %u, " \
+	"\"p99_us\" : %u, \"max_us\" : %u"
+
+static const char *
+lat_name (const char *name)
+{
+	return *name ? name : "-";
+}
+
+static int
+snprint_lat_row (struct strbuf *buff, const char *col1, const char *type,
+		 const char *name, const struct latency_hist *h)
+{
+	return print_strbuf(buff, LAT_ROW_FMT, col1, type, lat_name(name),
+			    h->count, lat_hist_mean(h),
+			    lat_hist_percentile(h, 500),
+			    lat_hist_percentile(h, 900),
+			    lat_hist_percentile(h, 990), h->max);
+}
+
+static int
+snprint_lat_json (struct strbuf *buff, const char *name,
+		  const struct latency_hist *h)
+{
+	return print_strbuf(buff, LAT_JSON_FMT, lat_name(name),
+			    h->count, lat_hist_mean(h),
+			    lat_hist_percentile(h, 500),
+			    lat_hist_percentile(h, 900),
+			    lat_hist_percentile(h, 990), h->max);
+}
+
+int snprint_path_stats(struct strbuf *buff, const struct vectors *vecs)
+{
+	const struct path *pp;
+	size_t initial_len = get_strbuf_len(buff);
+	int i, rc;
+
+	if ((rc = print_strbuf(buff, LAT_HEADER_FMT, "dev", "type", "name",
+			       "calls", "mean_us", "p50_us", "p90_us",
+			       "p99_us", "max_us")) < 0)
+		return rc;
+	vector_foreach_slot (vecs->pathvec, pp, i) {
+		if (!pp->lat_stats)
+			continue;
+		if (pp->lat_stats->checker.count &&
+		    (rc = snprint_lat_row(buff, pp->dev, "checker",
+					  pp->checker.name,
+					  &pp->lat_stats->checker)) < 0)
+			return rc;
+		if (pp->lat_stats->prio.count &&
+		    (rc = snprint_lat_row(buff, pp->dev, "prio",
+					  pp->prio.name,
+					  &pp->lat_stats->prio)) < 0)
+			return rc;
+	}
+	return get_strbuf_len(buff) - initial_len;
+}
+
+int snprint_path_stats_json(struct strbuf *buff, const struct vectors *vecs)
+{
+	const struct path *pp;
+	size_t initial_len = get_strbuf_len(buff);
+	int i, rc;
+
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_json(buff, 1, PRINT_JSON_START_PATHS "\n")) < 0)
+		return rc;
+	vector_foreach_slot (vecs->pathvec, pp, i) {
+		const struct latency_hist empty = { .count = 0 };
+		const struct path_lat_stats *ls = pp->lat_stats;
+
+		if ((rc = snprint_json(buff, 2, PRINT_JSON_START_ELEM)) < 0 ||
+		    (rc = print_strbuf(buff, "%s\"dev\" : \"%s\",\n",
+				       PRINT_JSON_INDENT PRINT_JSON_INDENT
+				       PRINT_JSON_INDENT, pp->dev)) < 0 ||
+		    (rc = snprint_json(buff, 3, "\"checker\" : {")) < 0 ||
+		    (rc = snprint_lat_json(buff, pp->checker.name,
+					   ls ? &ls->checker : &empty)) < 0 ||
+		    (rc = append_strbuf_str(buff, "},\n")) < 0 ||
+		    (rc = snprint_json(buff, 3, "\"prio\" : {")) < 0 ||
+		    (rc = snprint_lat_json(buff, pp->prio.name,
+					   ls ? &ls->prio : &empty)) < 0 ||
+		    (rc = append_strbuf_str(buff, "}\n")) < 0 ||
+		    (rc = snprint_json_elem_footer(buff, 2,
+				i + 1 == VECTOR_SIZE(vecs->pathvec))) < 0 ||
+		    (rc = append_strbuf_str(buff, "\n")) < 0)
+			return rc;
+	}
+	if ((rc = snprint_json(buff, 1, PRINT_JSON_END_ARRAY)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		return rc;
+	return get_strbuf_len(buff) - initial_len;
+}
+
+struct lat_group {
+	const char *type;
+	const char *name;
+	unsigned int paths;
+	struct latency_hist hist;
+};
+
+static int
+add_lat_group (vector groups, const char *type, const char *name,
+	       const struct latency_hist *h)
+{
+	struct lat_group *lg;
+	int i;
+
+	if (!h->count)
+		return 0;
+	vector_foreach_slot (groups, lg, i) {
+		if (lg->type == type && !strcmp(lg->name, name))
+			goto found;
+	}
+	lg = MALLOC(sizeof(struct lat_group));
+	if (!lg)
+		return -ENOMEM;
+	if (!vector_alloc_slot(groups)) {
+		FREE(lg);
+		return -ENOMEM;
+	}
+	vector_set_slot(groups, lg);
+	lg->type = type;
+	lg->name = name;
+found:
+	lg->paths++;
+	lat_hist_merge(&lg->hist, h);
+	return 0;
+}
+
+static void
+free_lat_groups (vector groups)
+{
+	struct lat_group *lg;
+	int i;
+
+	vector_foreach_slot (groups, lg, i)
+		FREE(lg);
+	vector_free(groups);
+}
+
+static const char lat_type_checker[] = "checker";
+static const char lat_type_prio[] = "prio";
+
+/*
+ * Group the latencies of the monitored paths by checker and by
+ * prioritizer.
+ */
+static vector
+get_lat_groups (const struct vectors *vecs)
+{
+	const struct path *pp;
+	vector groups;
+	int i;
+
+	groups = vector_alloc();
+	if (!groups)
+		return NULL;
+	vector_foreach_slot (vecs->pathvec, pp, i) {
+		if (!pp->lat_stats)
+			continue;
+		if (add_lat_group(groups, lat_type_checker,
+				  pp->checker.name,
+				  &pp->lat_stats->checker) ||
+		    add_lat_group(groups, lat_type_prio, pp->prio.name,
+				  &pp->lat_stats->prio)) {
+			free_lat_groups(groups);
+			return NULL;
+		}
+	}
+	return groups;
+}
+
+int snprint_checker_stats(struct strbuf *buff, const struct vectors *vecs)
+{
+	const struct lat_group *lg;
+	size_t initial_len = get_strbuf_len(buff);
+	vector groups;
+	int i, rc;
+
+	if (!(groups = get_lat_groups(vecs)))
+		return -ENOMEM;
+	if ((rc = print_strbuf(buff, LAT_GROUP_HEADER_FMT, "type", "name",
+			       "paths", "calls", "mean_us", "p50_us",
+			       "p90_us", "p99_us", "max_us")) < 0)
+		goto out;
+	vector_foreach_slot (groups, lg, i) {
+		const struct latency_hist *h = &lg->hist;
+
+		if ((rc = print_strbuf(buff, LAT_GROUP_ROW_FMT, lg->type,
+				       lat_name(lg->name), lg->paths,
+				       h->count, lat_hist_mean(h),
+				       lat_hist_percentile(h, 500),
+				       lat_hist_percentile(h, 900),
+				       lat_hist_percentile(h, 990),
+				       h->max)) < 0)
+			goto out;
+	}
+	rc = get_strbuf_len(buff) - initial_len;
+out:
+	free_lat_groups(groups);
+	return rc;
+}
+
+static int
+snprint_lat_groups_json (struct strbuf *buff, vector groups,
+			 const char *type, const char *key, int last)
+{
+	const struct lat_group *lg;
+	int i, rc, n = 0;
+
+	if ((rc = print_strbuf(buff, "%s\"%s\": [\n", PRINT_JSON_INDENT,
+			       key)) < 0)
+		return rc;
+	vector_foreach_slot (groups, lg, i) {
+		if (lg->type != type)
+			continue;
+		if ((n++ && (rc = append_strbuf_str(buff, ",\n")) < 0) ||
+		    (rc = snprint_json(buff, 2, "{")) < 0 ||
+		    (rc = snprint_lat_json(buff, lg->name, &lg->hist)) < 0 ||
+		    (rc = print_strbuf(buff, ", \"paths\" : %u}",
+				       lg->paths)) < 0)
+			return rc;
+	}
+	return print_strbuf(buff, "%s%s]%s\n", n ? "\n" : "",
+			    PRINT_JSON_INDENT, last ? "" : ",");
+}
+
+int snprint_checker_stats_json(struct strbuf *buff,
+			       const struct vectors *vecs)
+{
+	size_t initial_len = get_strbuf_len(buff);
+	vector groups;
+	int rc;
+
+	if (!(groups = get_lat_groups(vecs)))
+		return -ENOMEM;
+	if ((rc = snprint_json_header(buff)) < 0 ||
+	    (rc = snprint_lat_groups_json(buff, groups, lat_type_checker,
+					  "checkers", 0)) < 0 ||
+	    (rc = snprint_lat_groups_json(buff, groups, lat_type_prio,
+					  "prioritizers", 1)) < 0 ||
+	    (rc = snprint_json(buff, 0, PRINT_JSON_END_LAST)) < 0)
+		goto out;
+	rc = get_strbuf_len(buff) - initial_len;
+out:
+	free_lat_groups(groups);
+	return rc;
+}
+
+int snprint_devices(struct config *conf, struct strbuf *buff,
 		    const struct vectors *vecs)
 {
 	DIR *blkdir;
@@ -1808,23 +2096,21 @@ int snprint_devices(struct config *conf, char * buff, int len,
 	struct stat statbuf;
 	char devpath[PATH_MAX];
 	char *devptr;
-	int threshold = MAX_LINE_LEN;
-	int fwd = 0;
-	int r;
+	size_t initial_len = get_strbuf_len(buff);
+	int r, rc;
 
 	struct path * pp;
 
 	if (!(blkdir = opendir("/sys/block")))
-		return 1;
+		return -errno;
 
-	if ((len - fwd - threshold) <= 0) {
-		closedir(blkdir);
-		return len;
-	}
-	fwd += snprintf(buff + fwd, len - fwd, "available block devices:\n");
+	if ((rc = append_strbuf_str(buff, "available block devices:\n")) < 0)
+		goto out;
 
 	strcpy(devpath,"/sys/block/");
 	while ((blkdev = readdir(blkdir)) != NULL) {
+		const char *status;
+
 		if ((strcmp(blkdev->d_name,".") == 0) ||
 		    (strcmp(blkdev->d_name,"..") == 0))
 			continue;
@@ -1838,44 +2124,34 @@ int snprint_devices(struct config *conf, char * buff, int len,
 		if (S_ISDIR(statbuf.st_mode) == 0)
 			continue;
 
-		if ((len - fwd - threshold)  <= 0) {
-			closedir(blkdir);
-			return len;
-		}
-
-		fwd += snprintf(buff + fwd, len - fwd, "    %s", devptr);
 		pp = find_path_by_dev(vecs->pathvec, devptr);
 		if (!pp) {
-			r = filter_devnode(conf->blist_devnode,
-					   conf->elist_devnode, devptr);
+			r = filter_devnode(conf, devptr);
 			if (r > 0)
-				fwd += snprintf(buff + fwd, len - fwd,
-						" devnode blacklisted, unmonitored");
-			else if (r <= 0)
-				fwd += snprintf(buff + fwd, len - fwd,
-						" devnode whitelisted, unmonitored");
+				status = " devnode blacklisted, unmonitored";
+			else
+				status = " devnode whitelisted, unmonitored";
 		} else
-			fwd += snprintf(buff + fwd, len - fwd,
-					" devnode whitelisted, monitored");
-		fwd += snprintf(buff + fwd, len - fwd, "\n");
+			status = " devnode whitelisted, monitored";
+		if ((rc = print_strbuf(buff, "    %s%s\n", devptr, status)) < 0)
+			goto out;
 	}
+	rc = get_strbuf_len(buff) - initial_len;
+out:
 	closedir(blkdir);
-
-	if (fwd >= len)
-		return len;
-	return fwd;
+	return rc;
 }
 
 /*
  * stdout printing helpers
  */
-void print_path(struct path *pp, char *style)
+static void print_path(struct path *pp, char *style, const fieldwidth_t *width)
 {
-	char line[MAX_LINE_LEN];
+	struct strbuf line = STRBUF_INIT;
 
-	memset(&line[0], 0, MAX_LINE_LEN);
-	snprint_path(&line[0], MAX_LINE_LEN, style, pp, 1);
-	printf("%s", line);
+	if (snprint_path(&line, style, pp, width) >= 0)
+		printf("%s", get_strbuf_str(&line));
+	reset_strbuf(&line);
 }
 
 void print_all_paths(vector pathvec, int banner)
@@ -1887,7 +2163,8 @@ void print_all_paths_custo(vector pathvec, int banner, char *fmt)
 {
 	int i;
 	struct path * pp;
-	char line[MAX_LINE_LEN];
+	struct strbuf line = STRBUF_INIT;
+	fieldwidth_t *width;
 
 	if (!VECTOR_SIZE(pathvec)) {
 		if (banner)
@@ -1898,10 +2175,13 @@ void print_all_paths_custo(vector pathvec, int banner, char *fmt)
 	if (banner)
 		fprintf(stdout, "===== paths list =====\n");
 
-	get_path_layout(pathvec, 1);
-	snprint_path_header(line, MAX_LINE_LEN, fmt);
-	fprintf(stdout, "%s", line);
+	width = alloc_path_layout();
+	get_path_layout(pathvec, 1, width);
+	if (snprint_path_header(&line, fmt, width) >= 0)
+		fprintf(stdout, "%s", get_strbuf_str(&line));
+	reset_strbuf(&line);
 
 	vector_foreach_slot (pathvec, pp, i)
-		print_path(pp, fmt);
+		print_path(pp, fmt, width);
+	FREE_PTR(width);
 }
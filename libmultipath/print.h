@@ -1,6 +1,7 @@
 #ifndef _PRINT_H
 #define _PRINT_H
 #include "dm-generic.h"
+#include "strbuf.h"
 
 #define PRINT_PATH_LONG      "%w %i %d %D %p %t %T %s %o"
 #define PRINT_PATH_INDENT    "%i %d %D %t %T %o"
@@ -11,7 +12,6 @@
 #define PRINT_MAP_PROPS      "size=%S features='%f' hwhandler='%h' wp=%r"
 #define PRINT_PG_INDENT      "policy='%s' prio=%p status=%t"
 
-#define PRINT_JSON_MULTIPLIER     5
 #define PRINT_JSON_MAJOR_VERSION  0
 #define PRINT_JSON_MINOR_VERSION  1
 #define PRINT_JSON_START_VERSION  "   \"major_version\": %d,\n" \
@@ -68,29 +68,24 @@
 			     "            \"target_wwpn\" : \"%r\",\n" \
 			     "            \"host_adapter\" : \"%a\""
 
-#define MAX_LINE_LEN  80
-#define MAX_LINES     64
 #define MAX_FIELD_LEN 128
 #define PROGRESS_LEN  10
 
 struct path_data {
 	char wildcard;
 	char * header;
-	int width;
 	int (*snprint)(char * buff, size_t len, const struct path * pp);
 };
 
 struct multipath_data {
 	char wildcard;
 	char * header;
-	int width;
 	int (*snprint)(char * buff, size_t len, const struct multipath * mpp);
 };
 
 struct pathgroup_data {
 	char wildcard;
 	char * header;
-	int width;
 	int (*snprint)(char * buff, size_t len, const struct pathgroup * pgp);
 };
 
@@ -100,37 +95,53 @@ enum layout_reset {
 	LAYOUT_RESET_HEADER,
 };
 
-void _get_path_layout (const struct _vector *gpvec, enum layout_reset);
-void get_path_layout (vector pathvec, int header);
-void _get_multipath_layout (const struct _vector *gmvec, enum layout_reset);
-void get_multipath_layout (vector mpvec, int header);
-int snprint_path_header (char *, int, const char *);
-int snprint_multipath_header (char *, int, const char *);
-int _snprint_path (const struct gen_path *, char *, int, const char *, int);
-#define snprint_path(buf, len, fmt, pp, v) \
-	_snprint_path(dm_path_to_gen(pp), buf, len, fmt,  v)
-int _snprint_multipath (const struct gen_multipath *, char *, int,
-			const char *, int);
-#define snprint_multipath(buf, len, fmt, mp, v)				\
-	_snprint_multipath(dm_multipath_to_gen(mp), buf, len, fmt,  v)
-int _snprint_multipath_topology (const struct gen_multipath *, char *, int, 
-				 int verbosity);
-#define snprint_multipath_topology(buf, len, mpp, v) \
-	_snprint_multipath_topology (dm_multipath_to_gen(mpp), buf, len, v)
-int snprint_multipath_topology_json (char * buff, int len,
+fieldwidth_t *alloc_path_layout (void);
+fieldwidth_t *alloc_multipath_layout (void);
+void _get_path_layout (const struct _vector *gpvec, enum layout_reset,
+		       fieldwidth_t *width);
+void get_path_layout (vector pathvec, int header, fieldwidth_t *width);
+void _get_multipath_layout (const struct _vector *gmvec, enum layout_reset,
+			    fieldwidth_t *width);
+void get_multipath_layout (vector mpvec, int header, fieldwidth_t *width);
+int snprint_path_header (struct strbuf *, const char *,
+			 const fieldwidth_t *width);
+int snprint_multipath_header (struct strbuf *, const char *,
+			      const fieldwidth_t *width);
+int _snprint_path (const struct gen_path *, struct strbuf *, const char *,
+		   const fieldwidth_t *width);
+#define snprint_path(buf, fmt, pp, w) \
+	_snprint_path(dm_path_to_gen(pp), buf, fmt, w)
+int _snprint_multipath (const struct gen_multipath *, struct strbuf *,
+			const char *, const fieldwidth_t *width);
+#define snprint_multipath(buf, fmt, mp, w)				\
+	_snprint_multipath(dm_multipath_to_gen(mp), buf, fmt, w)
+int _snprint_multipath_topology (const struct gen_multipath *, struct strbuf *,
+				 int verbosity, const fieldwidth_t *p_width);
+#define snprint_multipath_topology(buf, mpp, v, w) \
+	_snprint_multipath_topology (dm_multipath_to_gen(mpp), buf, v, w)
+int snprint_multipath_topology_json (struct strbuf *,
 				const struct vectors * vecs);
-int snprint_multipath_map_json (char * buff, int len,
-				const struct multipath * mpp, int last);
-int snprint_defaults (struct config *, char *, int);
-int snprint_blacklist (struct config *, char *, int);
-int snprint_blacklist_except (struct config *, char *, int);
-int snprint_blacklist_report (struct config *, char *, int);
-int snprint_wildcards (char *, int);
-int snprint_status (char *, int, const struct vectors *);
-int snprint_devices (struct config *, char *, int, const struct vectors *);
-int snprint_hwtable (struct config *, char *, int, const vector);
-int snprint_mptable (struct config *, char *, int, const vector);
-int snprint_overrides (struct config *, char *, int, const struct hwentry *);
+int snprint_multipath_map_json (struct strbuf *,
+				const struct multipath * mpp);
+int snprint_multipath_topology_binary (struct strbuf *,
+				       const struct vectors * vecs);
+int snprint_config (struct config *, struct strbuf *);
+int snprint_defaults (struct config *, struct strbuf *);
+int snprint_blacklist (struct config *, struct strbuf *);
+int snprint_blacklist_except (struct config *, struct strbuf *);
+int snprint_blacklist_report (struct config *, struct strbuf *);
+int snprint_wildcards (struct strbuf *);
+int snprint_status (struct strbuf *, const struct vectors *);
+int snprint_path_stats (struct strbuf *, const struct vectors *);
+int snprint_path_stats_json (struct strbuf *, const struct vectors *);
+int snprint_checker_stats (struct strbuf *, const struct vectors *);
+int snprint_checker_stats_json (struct strbuf *, const struct vectors *);
+int snprint_devices (struct config *, struct strbuf *,
+		     const struct vectors *);
+int snprint_hwtable (struct config *, struct strbuf *, const vector);
+int snprint_mptable (struct config *, struct strbuf *, const vector);
+int snprint_overrides (struct config *, struct strbuf *,
+		       const struct hwentry *);
 int snprint_path_serial (char *, size_t, const struct path *);
 int snprint_host_wwnn (char *, size_t, const struct path *);
 int snprint_host_wwpn (char *, size_t, const struct path *);
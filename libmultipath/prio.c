@@ -2,12 +2,26 @@
 #include <string.h>
 #include <stddef.h>
 #include <dlfcn.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
 #include "debug.h"
 #include "prio.h"
 
 static LIST_HEAD(prioritizers);
+/* paths may be set up by several threads during parallel discovery */
+static pthread_mutex_t prioritizers_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread int nowait;
+
+void prio_set_nowait (int val)
+{
+	nowait = val;
+}
+
+int prio_nowait (void)
+{
+	return nowait;
+}
 
 unsigned int get_prio_timeout(unsigned int checker_timeout,
 			      unsigned int default_timeout)
@@ -118,6 +132,9 @@ struct prio * add_prio (char *multipath_dir, char * name)
 		condlog(0, "A dynamic linking error occurred: (%s)", errstr);
 	if (!p->getprio)
 		goto out;
+	p->putprio = (void (*)(struct path *)) dlsym(p->handle, "putprio");
+	/* putprio is optional, so there's nothing to report */
+	dlerror();
 	list_add(&p->node, &prioritizers);
 	return p;
 out:
@@ -154,12 +171,14 @@ void prio_get (char *multipath_dir, struct prio * dst, char * name, char * args)
 	if (!dst)
 		return;
 
+	pthread_mutex_lock(&prioritizers_lock);
 	if (name && strlen(name)) {
 		src = prio_lookup(name);
 		if (!src)
 			src = add_prio(multipath_dir, name);
 	}
 	if (!src) {
+		pthread_mutex_unlock(&prioritizers_lock);
 		dst->getprio = NULL;
 		return;
 	}
@@ -168,19 +187,25 @@ void prio_get (char *multipath_dir, struct prio * dst, char * name, char * args)
 	if (args)
 		strncpy(dst->args, args, PRIO_ARGS_LEN - 1);
 	dst->getprio = src->getprio;
+	dst->putprio = src->putprio;
 	dst->handle = NULL;
 
 	src->refcount++;
+	pthread_mutex_unlock(&prioritizers_lock);
 }
 
-void prio_put (struct prio * dst)
+void prio_put (struct prio * dst, struct path * pp)
 {
 	struct prio * src;
 
 	if (!dst || !dst->getprio)
 		return;
 
+	if (dst->putprio)
+		dst->putprio(pp);
+	pthread_mutex_lock(&prioritizers_lock);
 	src = prio_lookup(dst->name);
-	memset(dst, 0x0, sizeof(struct prio));
 	free_prio(src);
+	pthread_mutex_unlock(&prioritizers_lock);
+	memset(dst, 0x0, sizeof(struct prio));
 }
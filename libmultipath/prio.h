@@ -30,6 +30,7 @@ struct path;
 #define PRIO_WEIGHTED_PATH	"weightedpath"
 #define PRIO_SYSFS		"sysfs"
 #define PRIO_PATH_LATENCY	"path_latency"
+#define PRIO_DISKSTATS		"diskstats"
 
 /*
  * Value used to mark the fact prio was not defined
@@ -50,6 +51,7 @@ struct prio {
 	char name[PRIO_NAME_LEN];
 	char args[PRIO_ARGS_LEN];
 	int (*getprio)(struct path *, char *, unsigned int);
+	void (*putprio)(struct path *);
 };
 
 unsigned int get_prio_timeout(unsigned int checker_timeout,
@@ -59,13 +61,24 @@ void cleanup_prio (void);
 struct prio * add_prio (char *, char *);
 int prio_getprio (struct prio *, struct path *, unsigned int);
 void prio_get (char *, struct prio *, char *, char *);
-void prio_put (struct prio *);
+void prio_put (struct prio *, struct path *);
 int prio_selected (struct prio *);
 char * prio_name (struct prio *);
 char * prio_args (struct prio *);
 int prio_set_args (struct prio *, char *);
+/*
+ * Threads which must not be held up by a prioritizer gathering data,
+ * like multipathd's checker thread, call prio_set_nowait(1).
+ */
+void prio_set_nowait (int);
+int prio_nowait (void);
 
-/* The only function exported by prioritizer dynamic libraries (.so) */
+/* The function exported by prioritizer dynamic libraries (.so) */
 int getprio(struct path *, char *, unsigned int);
+/*
+ * Optionally exported by prioritizers which keep state per path. Called
+ * when a path stops using the prioritizer.
+ */
+void putprio(struct path *);
 
 #endif /* _PRIO_H */
@@ -0,0 +1,351 @@
+/*
+ * diskstats.c
+ *
+ * Prioritizer which derives the path priority from the block layer
+ * statistics of the path device, without sending any I/O of its own.
+ *
+ * Between two calls for a path, the deltas of /sys/block/<dev>/stat
+ * give the average service time of an I/O (io_ticks / ios) and the
+ * average queue depth (time_in_queue / elapsed time). The expected time
+ * for a new I/O on the path is estimated as
+ *
+ *	cost = service time * (1 + queue depth)
+ *
+ * The cost is normalized by the geometric mean of the costs of all
+ * paths of the map, so that the priorities don't change when the whole
+ * array slows down or speeds up, and mapped onto a logarithmic scale
+ * with the base "base_num", like the path_latency prioritizer does.
+ * A path as fast as the map average gets MID_PRIO.
+ *
+ * Each stat file is opened once and re-read with pread(), and parsed
+ * with a simple integer scanner, so that this stays cheap with
+ * thousands of paths.
+ *
+ * This file is released under the GPL version 2, or any later version.
+ */
+#include <stdio.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "prio.h"
+#include "structs.h"
+#include "util.h"
+#include "time-util.h"
+
+#define pp_ds_log(prio, fmt, args...) condlog(prio, "diskstats prio: " fmt, ##args)
+
+#define MAX_BASE_NUM		10
+#define MIN_BASE_NUM		1.1
+// This is 10**(1/4). 4 prio steps correspond to a factor of 10.
+#define DEF_BASE_NUM		1.77827941004
+
+#define MID_PRIO		20
+#define MAX_PRIO		(2 * MID_PRIO)
+
+/* don't compute deltas over less than this, Unit: ms */
+#define MIN_INTERVAL		1000
+/* forget paths getprio() hasn't asked for in this long, Unit: s */
+#define EXPIRE_TIME		300
+
+/* fields of /sys/block/<dev>/stat, see Documentation/block/stat.rst */
+enum {
+	STAT_READ_IOS,
+	STAT_READ_MERGES,
+	STAT_READ_SECTORS,
+	STAT_READ_TICKS,
+	STAT_WRITE_IOS,
+	STAT_WRITE_MERGES,
+	STAT_WRITE_SECTORS,
+	STAT_WRITE_TICKS,
+	STAT_IN_FLIGHT,
+	STAT_IO_TICKS,
+	STAT_TIME_IN_QUEUE,
+	__STAT_FIELDS,
+};
+
+struct ds_path {
+	char dev_t[BLK_DEV_SIZE];
+	char dev[FILE_NAME_SIZE];
+	int fd;
+	/* counters and time at the start of the current interval */
+	uint64_t ios;
+	uint64_t io_ticks;
+	uint64_t time_in_queue;
+	struct timespec stamp;
+	int have_stamp;
+	/* result of the last complete interval, 0 if unknown */
+	double cost;
+	double svctm;
+	double qdepth;
+	time_t last_used;
+};
+
+static pthread_mutex_t ds_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector ds_paths;
+static time_t ds_last_expire;
+
+static void cleanup_ds_lock(void *arg)
+{
+	pthread_mutex_unlock(&ds_lock);
+}
+
+static const char *ds_path_key(const void *elem, char *buf, size_t len)
+{
+	return ((const struct ds_path *)elem)->dev_t;
+}
+
+static struct ds_path *find_ds_path(const char *dev_t)
+{
+	void *elem;
+
+	if (!dev_t || !*dev_t ||
+	    vector_index_find(ds_paths, ds_path_key, dev_t, &elem))
+		return NULL;
+	return elem;
+}
+
+static void free_ds_path(struct ds_path *dp)
+{
+	if (dp->fd >= 0)
+		close(dp->fd);
+	FREE(dp);
+}
+
+static struct ds_path *alloc_ds_path(struct path *pp)
+{
+	struct ds_path *dp;
+	char file[PATH_MAX];
+
+	dp = MALLOC(sizeof(*dp));
+	if (!dp)
+		return NULL;
+	strlcpy(dp->dev_t, pp->dev_t, sizeof(dp->dev_t));
+	strlcpy(dp->dev, pp->dev, sizeof(dp->dev));
+	snprintf(file, sizeof(file), "/sys/block/%s/stat", pp->dev);
+	dp->fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (dp->fd < 0) {
+		pp_ds_log(0, "%s: cannot open %s: %s", pp->dev, file,
+			  strerror(errno));
+		FREE(dp);
+		return NULL;
+	}
+	return dp;
+}
+
+static void expire_ds_paths(time_t now)
+{
+	struct ds_path *dp;
+	int i;
+
+	vector_foreach_slot(ds_paths, dp, i) {
+		if (now - dp->last_used < EXPIRE_TIME)
+			continue;
+		vector_del_slot(ds_paths, i--);
+		free_ds_path(dp);
+	}
+	ds_last_expire = now;
+}
+
+/*
+ * Parse up to @nr whitespace separated unsigned decimal numbers from
+ * @buf. Returns the number of fields found.
+ */
+static int scan_u64(const char *buf, uint64_t *val, int nr)
+{
+	const char *p = buf;
+	int n = 0;
+
+	while (n < nr) {
+		uint64_t v = 0;
+
+		while (*p == ' ' || *p == '\t')
+			p++;
+		if (*p < '0' || *p > '9')
+			break;
+		while (*p >= '0' && *p <= '9')
+			v = v * 10 + (*p++ - '0');
+		val[n++] = v;
+	}
+	return n;
+}
+
+static int read_ds_stat(struct ds_path *dp, uint64_t *val)
+{
+	char buf[256];
+	ssize_t len;
+
+	len = pread(dp->fd, buf, sizeof(buf) - 1, 0);
+	if (len <= 0)
+		return 1;
+	buf[len] = '\0';
+	return scan_u64(buf, val, __STAT_FIELDS) != __STAT_FIELDS;
+}
+
+/*
+ * Start a new interval if the current one is long enough, and compute
+ * the cost of the path over it. A path without I/O in the interval
+ * keeps its last cost, if any.
+ */
+static int update_ds_path(struct ds_path *dp)
+{
+	uint64_t val[__STAT_FIELDS];
+	uint64_t ios, d_ios;
+	struct timespec now, diff;
+	double elapsed;
+
+	if (read_ds_stat(dp, val))
+		return 1;
+	ios = val[STAT_READ_IOS] + val[STAT_WRITE_IOS];
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (dp->have_stamp) {
+		timespecsub(&now, &dp->stamp, &diff);
+		elapsed = diff.tv_sec * 1000. + diff.tv_nsec / 1000000.;
+		if (elapsed < MIN_INTERVAL)
+			return 0;
+		d_ios = ios - dp->ios;
+		if (d_ios && ios >= dp->ios) {
+			dp->svctm = (double)(val[STAT_IO_TICKS] -
+					     dp->io_ticks) / d_ios;
+			dp->qdepth = (double)(val[STAT_TIME_IN_QUEUE] -
+					      dp->time_in_queue) / elapsed;
+			/* service time in ms, 1us resolution at best */
+			dp->cost = (dp->svctm > 0.001 ? dp->svctm : 0.001) *
+				(1 + dp->qdepth);
+		}
+	}
+	dp->ios = ios;
+	dp->io_ticks = val[STAT_IO_TICKS];
+	dp->time_in_queue = val[STAT_TIME_IN_QUEUE];
+	dp->stamp = now;
+	dp->have_stamp = 1;
+	return 0;
+}
+
+/* Geometric mean of the known costs of the paths of @pp's map */
+static double map_log_cost(struct path *pp, int *nr)
+{
+	struct path *pp1;
+	struct ds_path *dp;
+	double sum = 0;
+	int i;
+
+	*nr = 0;
+	if (!pp->mpp || !pp->mpp->paths)
+		return 0;
+	vector_foreach_slot(pp->mpp->paths, pp1, i) {
+		dp = find_ds_path(pp1->dev_t);
+		if (!dp || dp->cost <= 0)
+			continue;
+		sum += log(dp->cost);
+		(*nr)++;
+	}
+	return *nr ? sum / *nr : 0;
+}
+
+static double get_base_num(char *args)
+{
+	char *p, *end;
+	double base_num;
+
+	if (!args || !(p = strstr(args, "base_num=")))
+		return DEF_BASE_NUM;
+	base_num = strtod(p + 9, &end);
+	if (end == p + 9 || base_num < MIN_BASE_NUM ||
+	    base_num > MAX_BASE_NUM) {
+		pp_ds_log(0, "invalid base_num in \"%s\", set default", args);
+		return DEF_BASE_NUM;
+	}
+	return base_num;
+}
+
+int getprio(struct path *pp, char *args, unsigned int timeout)
+{
+	struct ds_path *dp;
+	double lg_base, lg_rel, map_cost;
+	time_t now;
+	int rc = -1, nr;
+
+	if (!strlen(pp->dev_t))
+		return -1;
+	lg_base = log(get_base_num(args));
+	now = time(NULL);
+
+	pthread_mutex_lock(&ds_lock);
+	pthread_cleanup_push(cleanup_ds_lock, NULL);
+	if (!ds_paths) {
+		ds_paths = vector_alloc();
+		if (!ds_paths)
+			goto out;
+		if (vector_add_index(ds_paths, ds_path_key)) {
+			vector_free(ds_paths);
+			ds_paths = NULL;
+			goto out;
+		}
+		ds_last_expire = now;
+	}
+	if (now - ds_last_expire >= EXPIRE_TIME)
+		expire_ds_paths(now);
+
+	dp = find_ds_path(pp->dev_t);
+	if (!dp) {
+		dp = alloc_ds_path(pp);
+		if (!dp)
+			goto out;
+		if (!vector_alloc_slot(ds_paths)) {
+			free_ds_path(dp);
+			goto out;
+		}
+		vector_set_slot(ds_paths, dp);
+	}
+	dp->last_used = now;
+	if (update_ds_path(dp)) {
+		/* the device may be gone; reopen on the next call */
+		pp_ds_log(2, "%s: cannot read stat", pp->dev);
+		vector_del_slot(ds_paths, find_slot(ds_paths, dp));
+		free_ds_path(dp);
+		goto out;
+	}
+
+	map_cost = map_log_cost(pp, &nr);
+	if (dp->cost <= 0 || !nr) {
+		/* nothing to compare with yet */
+		rc = MID_PRIO;
+		goto out;
+	}
+	lg_rel = (log(dp->cost) - map_cost) / lg_base;
+	rc = MID_PRIO - (int)floor(lg_rel + 0.5);
+	if (rc < 0)
+		rc = 0;
+	else if (rc > MAX_PRIO)
+		rc = MAX_PRIO;
+
+	pp_ds_log(3, "%s: svctm=%.3fms qdepth=%.2f cost=%.3fms "
+		  "map cost=%.3fms (%d paths) prio=%d", pp->dev, dp->svctm,
+		  dp->qdepth, dp->cost, exp(map_cost), nr, rc);
+out:
+	pthread_cleanup_pop(1);
+	return rc;
+}
+
+/* Runs when the prioritizer is unloaded */
+static void __attribute__((destructor)) cleanup_ds_paths(void)
+{
+	struct ds_path *dp;
+	int i;
+
+	if (!ds_paths)
+		return;
+	vector_foreach_slot(ds_paths, dp, i)
+		free_ds_path(dp);
+	vector_free(ds_paths);
+	ds_paths = NULL;
+}
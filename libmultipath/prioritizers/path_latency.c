@@ -8,12 +8,21 @@
  * latency algorithm is dependent on arguments("io_num" and "base_num").
  *
  * The principle of the algorithm as follows:
- * 1. By sending a certain number "io_num" of read IOs to the current path
- *    continuously, the IOs' average latency can be calculated.
+ * 1. A sampler thread sends one read IO to every path it knows about in
+ *    each sampling round, all rounds' IOs in flight together, and keeps
+ *    an exponentially weighted moving average of the logarithm of the
+ *    latency, and its variance. "io_num" is the number of samples the
+ *    average extends over.
  * 2. Max value and min value of average latency are constant. According to
  *    the average latency of each path and the "base_num" of logarithmic
  *    scale, the priority "rc" of each path can be provided.
  *
+ * getprio() registers the path with the sampler and reads the current
+ * estimate, and putprio() unregisters it. Until a path has a few
+ * samples, getprio() takes them itself, so that maps are grouped by
+ * priority right when they are created. Only multipathd's checker thread
+ * doesn't wait for that, and gets the default priority instead.
+ *
  * Author(s): Yang Feng <philip.yang@huawei.com>
  * Revised:   Guan Junxiong <guanjunxiong@huawei.com>
  *
@@ -24,8 +33,12 @@
 #include <stdio.h>
 #include <math.h>
 #include <ctype.h>
+#include <errno.h>
 #include <time.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/ioctl.h>
 #include <linux/fs.h>
 #include <unistd.h>
@@ -35,6 +48,7 @@
 #include "structs.h"
 #include "util.h"
 #include "time-util.h"
+#include "uring.h"
 
 #define pp_pl_log(prio, fmt, args...) condlog(prio, "path_latency prio: " fmt, ##args)
 
@@ -56,73 +70,423 @@
 #define NSEC_PER_USEC		1000LL
 
 #define DEF_BLK_SIZE		4096
+#define DEF_TIMEOUT		30		/* Unit: s */
+
+#define SAMPLE_INTERVAL		200		/* Unit: ms */
+#define WARMUP_INTERVAL		10		/* Unit: ms */
+#define WARMUP_SAMPLES		10
+#define EXPIRE_TIME		300		/* Unit: s */
+/* keeps the estimate of a path which is removed and re-added at once */
+#define REMOVE_GRACE		5		/* Unit: s */
+
+struct lat_path {
+	char dev_t[BLK_DEV_SIZE];
+	char dev[FILE_NAME_SIZE];
+	int fd;
+	int blksize;
+	struct uring_req *req;	/* NULL: no io_uring, read synchronously */
+	char *buf;
+	unsigned int timeout;
+	double alpha;
+	double mean;		/* EWMA of log(latency in us) */
+	double var;		/* and its variance */
+	unsigned long samples;
+	int down;
+	time_t last_used;
+	time_t removed;		/* 0: in use */
+};
+
+/* one path's read in a sampling round */
+struct lat_sample {
+	struct lat_path *lp;
+	unsigned int timeout;
+	int queued;
+	int done;
+	int ok;
+	double us;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	/* signalled when paths are added, or on stop */
+	pthread_cond_t cond;
+	pthread_t thread;
+	int started;
+	int stop;
+	vector paths;
+} sampler = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void cleanup_sampler_lock(void *arg)
+{
+	pthread_mutex_unlock(&sampler.lock);
+}
 
-static int prepare_directio_read(int fd, int *blksz, char **pbuf,
-		int *restore_flags)
+static time_t now_sec(void)
 {
-	unsigned long pgsize = getpagesize();
-	long flags;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
 
-	if (ioctl(fd, BLKBSZGET, blksz) < 0) {
-		pp_pl_log(3,"catnnot get blocksize, set default");
-		*blksz = DEF_BLK_SIZE;
+static const char *lat_path_key(const void *elem, char *buf, size_t len)
+{
+	return ((const struct lat_path *)elem)->dev_t;
+}
+
+static struct lat_path *find_lat_path(const char *dev_t)
+{
+	void *elem;
+
+	if (vector_index_find(sampler.paths, lat_path_key, dev_t, &elem))
+		return NULL;
+	return elem;
+}
+
+static void free_lat_path(struct lat_path *lp)
+{
+	/* a read still in flight is freed by the io_uring engine */
+	if (lp->req)
+		uring_req_free(lp->req);
+	free(lp->buf);
+	if (lp->fd >= 0)
+		close(lp->fd);
+	FREE(lp);
+}
+
+/*
+ * The sampler reads through a file descriptor of its own, opened with
+ * O_DIRECT, so that the flags of the checker's pp->fd stay untouched.
+ */
+static struct lat_path *alloc_lat_path(struct path *pp)
+{
+	struct lat_path *lp;
+	char devnode[PATH_MAX];
+
+	lp = MALLOC(sizeof(*lp));
+	if (!lp)
+		return NULL;
+	strlcpy(lp->dev_t, pp->dev_t, sizeof(lp->dev_t));
+	strlcpy(lp->dev, pp->dev, sizeof(lp->dev));
+	snprintf(devnode, sizeof(devnode), "/dev/%s", pp->dev);
+	lp->fd = open(devnode, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	if (lp->fd < 0) {
+		pp_pl_log(0, "%s: cannot open %s: %s", pp->dev, devnode,
+			  strerror(errno));
+		goto out;
+	}
+	if (ioctl(lp->fd, BLKBSZGET, &lp->blksize) < 0 || lp->blksize <= 0) {
+		pp_pl_log(3, "%s: cannot get blocksize, set default", pp->dev);
+		lp->blksize = DEF_BLK_SIZE;
 	}
-	if (posix_memalign((void **)pbuf, pgsize, *blksz))
-		return -1;
-
-	flags = fcntl(fd, F_GETFL);
-	if (flags < 0)
-		goto free_out;
-	if (!(flags & O_DIRECT)) {
-		flags |= O_DIRECT;
-		if (fcntl(fd, F_SETFL, flags) < 0)
-			goto free_out;
-		*restore_flags = 1;
+	lp->req = uring_req_alloc(lp->blksize);
+	if (!lp->req &&
+	    posix_memalign((void **)&lp->buf, getpagesize(), lp->blksize)) {
+		lp->buf = NULL;
+		goto out;
 	}
+	return lp;
+out:
+	free_lat_path(lp);
+	return NULL;
+}
 
-	return 0;
+/*
+ * Stop sampling paths which have been removed, or which getprio()
+ * hasn't asked for in a while
+ */
+static void expire_lat_paths(void)
+{
+	struct lat_path *lp;
+	time_t now = now_sec();
+	int i;
 
-free_out:
-	free(*pbuf);
+	vector_foreach_slot(sampler.paths, lp, i) {
+		if (lp->removed ? now - lp->removed < REMOVE_GRACE :
+		    now - lp->last_used < EXPIRE_TIME)
+			continue;
+		pp_pl_log(3, "%s: stop sampling", lp->dev);
+		vector_del_slot(sampler.paths, i--);
+		free_lat_path(lp);
+	}
+}
 
-	return -1;
+static double timespec_to_us(const struct timespec *ts)
+{
+	return ts->tv_sec * USEC_PER_SEC + (double)ts->tv_nsec / NSEC_PER_USEC;
 }
 
-static void cleanup_directio_read(int fd, char *buf, int restore_flags)
+/*
+ * Run one sampling round without holding sampler.lock. Only the sampler
+ * thread frees lat_path structures, and only the fields which never
+ * change after alloc_lat_path() are used here. All reads of the round
+ * are waited for together, so a hanging path delays the round by its
+ * timeout at most, and not once for every path.
+ */
+static void sample_paths(struct lat_sample *smp, struct uring_req **reqs,
+			 int nr)
 {
-	long flags;
+	struct timespec before, after, diff;
+	unsigned int timeout = 0;
+	int i, res, queued = 0;
+
+	for (i = 0; i < nr; i++) {
+		struct lat_path *lp = smp[i].lp;
 
+		smp[i].queued = smp[i].done = 0;
+		if (!lp->req)
+			continue;
+		/* a read which timed out earlier may still be in flight */
+		if (uring_req_result(lp->req, &res) == URING_REQ_QUEUED)
+			continue;
+		if (uring_submit_read(lp->req, lp->fd, smp[i].timeout) == 0) {
+			smp[i].queued = 1;
+			reqs[queued++] = lp->req;
+			if (smp[i].timeout > timeout)
+				timeout = smp[i].timeout;
+		}
+	}
+	if (queued)
+		uring_flush();
+
+	/* paths without io_uring are read while the others are in flight */
+	for (i = 0; i < nr; i++) {
+		struct lat_path *lp = smp[i].lp;
+
+		if (lp->req)
+			continue;
+		clock_gettime(CLOCK_MONOTONIC, &before);
+		res = pread(lp->fd, lp->buf, lp->blksize, 0);
+		clock_gettime(CLOCK_MONOTONIC, &after);
+		timespecsub(&after, &before, &diff);
+		smp[i].done = 1;
+		smp[i].ok = (res == lp->blksize);
+		smp[i].us = timespec_to_us(&diff);
+	}
+	if (!queued)
+		return;
+
+	uring_wait_all(reqs, queued, timeout + 1);
+	for (i = 0; i < nr; i++) {
+		struct lat_path *lp = smp[i].lp;
+
+		if (!smp[i].queued)
+			continue;
+		smp[i].done = 1;
+		if (uring_req_result_time(lp->req, &res, &diff) ==
+		    URING_REQ_DONE) {
+			smp[i].ok = (res == lp->blksize);
+			smp[i].us = timespec_to_us(&diff);
+		} else
+			smp[i].ok = 0;
+	}
+}
+
+/*
+ * Read the path @n times in a row for a quick first estimate, stopping at
+ * the first failure, or when @timeout seconds have passed. Called without
+ * sampler.lock, like sample_paths(). Without io_uring, the reads can't
+ * time out.
+ */
+static void warm_up(struct lat_sample *smp, int n, unsigned int timeout)
+{
+	struct lat_path *lp = smp[0].lp;
+	struct timespec start, before, after, diff;
+	struct uring_req *req;
+	char *buf = NULL;
+	int i, res;
+
+	req = uring_req_alloc(lp->blksize);
+	if (!req && posix_memalign((void **)&buf, getpagesize(), lp->blksize))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < n; i++) {
+		if (req) {
+			if (uring_submit_read(req, lp->fd, timeout))
+				break;
+			uring_wait(req, timeout + 1);
+			smp[i].ok = (uring_req_result_time(req, &res, &diff) ==
+				     URING_REQ_DONE && res == lp->blksize);
+			clock_gettime(CLOCK_MONOTONIC, &after);
+		} else {
+			clock_gettime(CLOCK_MONOTONIC, &before);
+			res = pread(lp->fd, buf, lp->blksize, 0);
+			clock_gettime(CLOCK_MONOTONIC, &after);
+			timespecsub(&after, &before, &diff);
+			smp[i].ok = (res == lp->blksize);
+		}
+		smp[i].done = 1;
+		smp[i].us = timespec_to_us(&diff);
+		timespecsub(&after, &start, &diff);
+		if (!smp[i].ok || diff.tv_sec >= timeout)
+			break;
+	}
+	/* a read still in flight is freed by the io_uring engine */
+	if (req)
+		uring_req_free(req);
 	free(buf);
+}
+
+/*
+ * We assume that the latency complies with Log-normal distribution.
+ * The logarithm of latency is in normal distribution, so that's what
+ * the moving average and variance are kept of.
+ */
+static void add_sample(struct lat_path *lp, int ok, double us)
+{
+	double x, d;
 
-	if (!restore_flags)
+	if (!ok) {
+		if (!lp->down)
+			pp_pl_log(2, "%s: read failed", lp->dev);
+		lp->down = 1;
 		return;
-	if ((flags = fcntl(fd, F_GETFL)) >= 0) {
-		int ret __attribute__ ((unused));
-		flags &= ~O_DIRECT;
-		/* No point in checking for errors */
-		ret = fcntl(fd, F_SETFL, flags);
 	}
+	lp->down = 0;
+	/* treat latencies below 1us as the minimum, avoids taking log(0) */
+	x = us > MIN_AVG_LATENCY ? log(us) : log(MIN_AVG_LATENCY);
+	if (!lp->samples) {
+		lp->mean = x;
+		lp->var = 0;
+	} else {
+		d = x - lp->mean;
+		lp->mean += lp->alpha * d;
+		lp->var = (1 - lp->alpha) * (lp->var + lp->alpha * d * d);
+	}
+	lp->samples++;
 }
 
-static int do_directio_read(int fd, unsigned int timeout, char *buf, int sz)
+static void *lat_sampler(void *arg)
 {
-	fd_set read_fds;
-	struct timeval tm = { .tv_sec = timeout };
-	int ret;
-	int num_read;
-
-	if (lseek(fd, 0, SEEK_SET) == -1)
-		return -1;
-	FD_ZERO(&read_fds);
-	FD_SET(fd, &read_fds);
-	ret = select(fd+1, &read_fds, NULL, NULL, &tm);
-	if (ret <= 0)
-		return -1;
-	num_read = read(fd, buf, sz);
-	if (num_read != sz)
-		return -1;
+	struct lat_sample *smp = NULL, *tmp;
+	struct uring_req **reqs = NULL, **rtmp;
+	struct lat_path *lp;
+	struct timespec deadline;
+	int nr, nr_alloc = 0, warming = 0, i, n;
+
+	pthread_mutex_lock(&sampler.lock);
+	while (!sampler.stop) {
+		expire_lat_paths();
+		nr = VECTOR_SIZE(sampler.paths);
+		if (!nr) {
+			pthread_cond_wait(&sampler.cond, &sampler.lock);
+			continue;
+		}
+		if (nr > nr_alloc) {
+			tmp = REALLOC(smp, nr * sizeof(*smp));
+			if (tmp)
+				smp = tmp;
+			rtmp = REALLOC(reqs, nr * sizeof(*reqs));
+			if (rtmp)
+				reqs = rtmp;
+			if (!tmp || !rtmp) {
+				nr = nr_alloc;
+				if (!nr)
+					goto wait;
+			} else
+				nr_alloc = nr;
+		}
+		warming = 0;
+		n = 0;
+		for (i = 0; i < nr; i++) {
+			lp = VECTOR_SLOT(sampler.paths, i);
+			if (lp->removed)
+				continue;
+			smp[n].lp = lp;
+			smp[n].timeout = lp->timeout;
+			n++;
+			if (lp->samples < WARMUP_SAMPLES && !lp->down)
+				warming = 1;
+		}
+		pthread_mutex_unlock(&sampler.lock);
+
+		sample_paths(smp, reqs, n);
+
+		pthread_mutex_lock(&sampler.lock);
+		for (i = 0; i < n; i++)
+			if (smp[i].done)
+				add_sample(smp[i].lp, smp[i].ok, smp[i].us);
+	wait:
+		/* paths waiting for their first samples get them quickly */
+		clock_gettime(CLOCK_MONOTONIC, &deadline);
+		deadline.tv_nsec += (warming ? WARMUP_INTERVAL :
+				     SAMPLE_INTERVAL) * 1000000LL;
+		normalize_timespec(&deadline);
+		while (!sampler.stop &&
+		       pthread_cond_timedwait(&sampler.cond, &sampler.lock,
+					      &deadline) != ETIMEDOUT)
+			;
+	}
+	pthread_mutex_unlock(&sampler.lock);
+	FREE_PTR(reqs);
+	FREE_PTR(smp);
+	return NULL;
+}
 
+/* Start the sampler thread. Call with sampler.lock held. */
+static int start_sampler(void)
+{
+	pthread_condattr_t cattr;
+	pthread_attr_t attr;
+	sigset_t set, old;
+	int r;
+
+	if (sampler.started)
+		return 0;
+	sampler.paths = vector_alloc();
+	if (!sampler.paths)
+		return 1;
+	if (vector_add_index(sampler.paths, lat_path_key))
+		goto out_vec;
+	pthread_condattr_init(&cattr);
+	pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+	pthread_cond_init(&sampler.cond, &cattr);
+	pthread_condattr_destroy(&cattr);
+
+	/* signals are for the threads of the program, not for ours */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, &old);
+	setup_thread_attr(&attr, 64 * 1024, 0);
+	sampler.stop = 0;
+	r = pthread_create(&sampler.thread, &attr, lat_sampler, NULL);
+	pthread_attr_destroy(&attr);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (r) {
+		pp_pl_log(0, "failed to start sampler thread: %s",
+			  strerror(r));
+		pthread_cond_destroy(&sampler.cond);
+		goto out_vec;
+	}
+	sampler.started = 1;
 	return 0;
+out_vec:
+	vector_free(sampler.paths);
+	sampler.paths = NULL;
+	return 1;
+}
+
+/* Runs when the prioritizer is unloaded */
+static void __attribute__((destructor)) stop_sampler(void)
+{
+	struct lat_path *lp;
+	int i;
+
+	pthread_mutex_lock(&sampler.lock);
+	if (!sampler.started) {
+		pthread_mutex_unlock(&sampler.lock);
+		return;
+	}
+	sampler.stop = 1;
+	pthread_cond_broadcast(&sampler.cond);
+	pthread_mutex_unlock(&sampler.lock);
+	pthread_join(sampler.thread, NULL);
+
+	vector_foreach_slot(sampler.paths, lp, i)
+		free_lat_path(lp);
+	vector_free(sampler.paths);
+	sampler.paths = NULL;
+	pthread_cond_destroy(&sampler.cond);
+	sampler.started = 0;
 }
 
 int check_args_valid(int io_num, double base_num)
@@ -210,20 +574,15 @@ int calcPrio(double lg_avglatency, double lg_maxavglatency,
 
 int getprio(struct path *pp, char *args, unsigned int timeout)
 {
-	int rc, temp;
+	int rc = -1;
 	int io_num = 0;
 	double base_num = 0;
 	double lg_avglatency, lg_maxavglatency, lg_minavglatency;
 	double standard_deviation;
-	double lg_toldelay = 0;
-	int blksize;
-	char *buf;
-	int restore_flags = 0;
 	double lg_base;
-	double sum_squares = 0;
-
-	if (pp->fd < 0)
-		return -1;
+	struct lat_path *lp;
+	struct lat_sample smp[WARMUP_SAMPLES];
+	int i, n, cancel_state;
 
 	if (get_ionum_and_basenum(args, &io_num, &base_num) == 0) {
 		io_num = DEF_IO_NUM;
@@ -236,67 +595,96 @@ int getprio(struct path *pp, char *args, unsigned int timeout)
 	lg_base = log(base_num);
 	lg_maxavglatency = log(MAX_AVG_LATENCY) / lg_base;
 	lg_minavglatency = log(MIN_AVG_LATENCY) / lg_base;
+	if (!timeout)
+		timeout = DEF_TIMEOUT;
 
-	prepare_directio_read(pp->fd, &blksize, &buf, &restore_flags);
-
-	temp = io_num;
-	while (temp-- > 0) {
-		struct timespec tv_before, tv_after, tv_diff;
-		double diff, reldiff;
-
-		(void)clock_gettime(CLOCK_MONOTONIC, &tv_before);
-
-		if (do_directio_read(pp->fd, timeout, buf, blksize)) {
-			pp_pl_log(0, "%s: path down", pp->dev);
-			cleanup_directio_read(pp->fd, buf, restore_flags);
-			return -1;
+	pthread_mutex_lock(&sampler.lock);
+	pthread_cleanup_push(cleanup_sampler_lock, NULL);
+	if (start_sampler())
+		goto out;
+	lp = find_lat_path(pp->dev_t);
+	if (!lp) {
+		lp = alloc_lat_path(pp);
+		if (!lp)
+			goto out;
+		if (!vector_alloc_slot(sampler.paths)) {
+			free_lat_path(lp);
+			goto out;
+		}
+		vector_set_slot(sampler.paths, lp);
+		pp_pl_log(3, "%s: start sampling", pp->dev);
+		pthread_cond_broadcast(&sampler.cond);
+	}
+	/* an average over io_num samples, in EWMA terms */
+	lp->alpha = 2. / (io_num + 1);
+	lp->timeout = timeout;
+	lp->last_used = now_sec();
+	lp->removed = 0;
+
+	if (lp->down) {
+		pp_pl_log(0, "%s: path down", pp->dev);
+		goto out;
+	}
+	if (lp->samples < WARMUP_SAMPLES && !prio_nowait()) {
+		n = WARMUP_SAMPLES - lp->samples;
+		for (i = 0; i < n; i++) {
+			smp[i].lp = lp;
+			smp[i].done = 0;
 		}
-
-		(void)clock_gettime(CLOCK_MONOTONIC, &tv_after);
-
-		timespecsub(&tv_after, &tv_before, &tv_diff);
-		diff = tv_diff.tv_sec * 1000 * 1000 + tv_diff.tv_nsec / 1000;
-
-		if (diff == 0)
-			/*
-			 * Avoid taking log(0).
-			 * This unlikely case is treated as minimum -
-			 * the sums don't increase
-			 */
-			continue;
-
-		/* we scale by lg_base here */
-		reldiff = log(diff) / lg_base;
-
 		/*
-		 * We assume that the latency complies with Log-normal
-		 * distribution. The logarithm of latency is in normal
-		 * distribution.
+		 * The sampler only frees paths which are unused for long.
+		 * The cleanup handler unlocks, so no cancelling meanwhile.
 		 */
-		lg_toldelay += reldiff;
-		sum_squares += reldiff * reldiff;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+		pthread_mutex_unlock(&sampler.lock);
+		warm_up(smp, n, timeout);
+		pthread_mutex_lock(&sampler.lock);
+		pthread_setcancelstate(cancel_state, NULL);
+		for (i = 0; i < n && smp[i].done; i++)
+			add_sample(lp, smp[i].ok, smp[i].us);
+		if (lp->down) {
+			pp_pl_log(0, "%s: path down", pp->dev);
+			goto out;
+		}
+	}
+	/* don't hold up the checker, the sampler warms up quickly */
+	if (lp->samples < WARMUP_SAMPLES) {
+		pp_pl_log(3, "%s: %lu samples yet, using default priority",
+			  pp->dev, lp->samples);
+		rc = DEFAULT_PRIORITY;
+		goto out;
 	}
 
-	cleanup_directio_read(pp->fd, buf, restore_flags);
-
-	lg_avglatency = lg_toldelay / (long long)io_num;
+	lg_avglatency = lp->mean / lg_base;
+	standard_deviation = sqrt(lp->var) / lg_base;
 
 	if (lg_avglatency > lg_maxavglatency) {
 		pp_pl_log(2,
 			  "%s: average latency (%lld us) is outside the thresold (%lld us)",
 			  pp->dev, (long long)pow(base_num, lg_avglatency),
 			  (long long)MAX_AVG_LATENCY);
-		return DEFAULT_PRIORITY;
+		rc = DEFAULT_PRIORITY;
+		goto out;
 	}
 
-	standard_deviation = sqrt((sum_squares - lg_toldelay * lg_avglatency)
-				  / (io_num - 1));
-
 	rc = calcPrio(lg_avglatency, lg_maxavglatency, lg_minavglatency);
 
-	pp_pl_log(3, "%s: latency avg=%.2e uncertainty=%.1f prio=%d\n",
-		  pp->dev, exp(lg_avglatency * lg_base),
-		  exp(standard_deviation * lg_base), rc);
-
+	pp_pl_log(3, "%s: latency avg=%.2e uncertainty=%.1f prio=%d "
+		  "samples=%lu\n", pp->dev, exp(lg_avglatency * lg_base),
+		  exp(standard_deviation * lg_base), rc, lp->samples);
+out:
+	pthread_cleanup_pop(1);
 	return rc;
 }
+
+void putprio(struct path *pp)
+{
+	struct lat_path *lp;
+
+	pthread_mutex_lock(&sampler.lock);
+	lp = find_lat_path(pp->dev_t);
+	/* the sampler thread frees it, it may be reading from it */
+	if (lp && !lp->removed)
+		lp->removed = now_sec();
+	pthread_mutex_unlock(&sampler.lock);
+}
@@ -0,0 +1,148 @@
+/*
+ * Growable string buffer, used to render output exactly once instead
+ * of retrying with ever larger fixed-size buffers.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "memory.h"
+#include "strbuf.h"
+
+#define STRBUF_MIN_SIZE 256
+
+void
+init_strbuf (struct strbuf *sb)
+{
+	sb->buf = NULL;
+	sb->size = 0;
+	sb->offs = 0;
+}
+
+void
+reset_strbuf (struct strbuf *sb)
+{
+	if (sb->buf)
+		FREE(sb->buf);
+	init_strbuf(sb);
+}
+
+void
+truncate_strbuf (struct strbuf *sb, size_t offs)
+{
+	if (offs >= sb->offs)
+		return;
+	sb->offs = offs;
+	sb->buf[offs] = '\0';
+}
+
+size_t
+get_strbuf_len (const struct strbuf *sb)
+{
+	return sb->offs;
+}
+
+const char *
+get_strbuf_str (const struct strbuf *sb)
+{
+	return sb->buf ? sb->buf : "";
+}
+
+/*
+ * Hand the string over to the caller, who must FREE() it. The buffer
+ * is empty afterwards. Returns NULL if allocating an empty string fails.
+ */
+char *
+steal_strbuf_str (struct strbuf *sb)
+{
+	char *str = sb->buf;
+
+	if (!str)
+		str = MALLOC(1);
+	init_strbuf(sb);
+	return str;
+}
+
+/* Make room for @len more characters plus the terminating '\0' */
+static int
+expand_strbuf (struct strbuf *sb, size_t len)
+{
+	size_t size;
+	char *buf;
+
+	if (sb->offs + len < sb->size)
+		return 0;
+	size = sb->size ? sb->size : STRBUF_MIN_SIZE;
+	while (size <= sb->offs + len)
+		size *= 2;
+	buf = REALLOC(sb->buf, size);
+	if (!buf)
+		return -ENOMEM;
+	if (!sb->buf)
+		buf[0] = '\0';
+	sb->buf = buf;
+	sb->size = size;
+	return 0;
+}
+
+int
+__append_strbuf_str (struct strbuf *sb, const char *str, size_t slen)
+{
+	if (expand_strbuf(sb, slen))
+		return -ENOMEM;
+	memcpy(sb->buf + sb->offs, str, slen);
+	sb->offs += slen;
+	sb->buf[sb->offs] = '\0';
+	return slen;
+}
+
+int
+append_strbuf_str (struct strbuf *sb, const char *str)
+{
+	return __append_strbuf_str(sb, str, strlen(str));
+}
+
+int
+fill_strbuf (struct strbuf *sb, char c, int slen)
+{
+	if (slen <= 0)
+		return 0;
+	if (expand_strbuf(sb, slen))
+		return -ENOMEM;
+	memset(sb->buf + sb->offs, c, slen);
+	sb->offs += slen;
+	sb->buf[sb->offs] = '\0';
+	return slen;
+}
+
+int
+print_strbuf (struct strbuf *sb, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+	size_t room;
+
+	/* try to print into the space we have, and only grow if needed */
+	room = sb->size > sb->offs ? sb->size - sb->offs : 0;
+	va_start(ap, fmt);
+	ret = vsnprintf(room ? sb->buf + sb->offs : NULL, room, fmt, ap);
+	va_end(ap);
+	if (ret < 0 || (size_t)ret >= room) {
+		/* drop whatever didn't fit */
+		if (sb->buf)
+			sb->buf[sb->offs] = '\0';
+		if (ret < 0)
+			return -EINVAL;
+		if (expand_strbuf(sb, ret))
+			return -ENOMEM;
+		va_start(ap, fmt);
+		ret = vsnprintf(sb->buf + sb->offs, sb->size - sb->offs,
+				fmt, ap);
+		va_end(ap);
+		if (ret < 0)
+			return -EINVAL;
+	}
+	sb->offs += ret;
+	return ret;
+}
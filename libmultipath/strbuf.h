@@ -0,0 +1,33 @@
+#ifndef _STRBUF_H
+#define _STRBUF_H
+
+#include <stddef.h>
+
+/*
+ * Growable, append-only string buffer.
+ *
+ * The append functions return the number of characters added, or
+ * -ENOMEM. The buffer is always '\0' terminated once something has
+ * been added to it.
+ */
+struct strbuf {
+	char *buf;
+	size_t size;
+	size_t offs;
+};
+
+#define STRBUF_INIT { .buf = NULL, .size = 0, .offs = 0, }
+
+void init_strbuf(struct strbuf *sb);
+void reset_strbuf(struct strbuf *sb);
+void truncate_strbuf(struct strbuf *sb, size_t offs);
+size_t get_strbuf_len(const struct strbuf *sb);
+const char *get_strbuf_str(const struct strbuf *sb);
+char *steal_strbuf_str(struct strbuf *sb);
+int __append_strbuf_str(struct strbuf *sb, const char *str, size_t slen);
+int append_strbuf_str(struct strbuf *sb, const char *str);
+int fill_strbuf(struct strbuf *sb, char c, int slen);
+int print_strbuf(struct strbuf *sb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+#endif /* _STRBUF_H */
@@ -4,6 +4,7 @@
  */
 #include <stdio.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <libdevmapper.h>
 #include <libudev.h>
 
@@ -19,6 +20,7 @@
 #include "prio.h"
 #include "prioritizers/alua_spc3.h"
 #include "dm-generic.h"
+#include "path_sched.h"
 
 struct adapter_group *
 alloc_adaptergroup(void)
@@ -100,23 +102,95 @@ alloc_path (void)
 		pp->fd = -1;
 		pp->tpgs = TPGS_UNDEF;
 		pp->priority = PRIO_UNDEF;
+		pp->sched_slot = -1;
 		checker_clear(&pp->checker);
 		dm_path_to_gen(pp)->ops = &dm_gen_path_ops;
+		set_path_tick(pp, 0);
+		/* no latency stats is not worth failing for */
+		pp->lat_stats = MALLOC(sizeof(struct path_lat_stats));
 	}
 	return pp;
 }
 
+/*
+ * multipathd's checker workers run the path checkers without holding
+ * vecs->lock. The paths are pinned from the time they are handed to a
+ * worker until the checker thread has applied the result:
+ * - pp->checking is set while a worker may use the path. Code changing
+ *   what the checkers use (the checker, the fd, the udev device or the
+ *   map) waits for it with wait_path_checked(). The workers never take
+ *   vecs->lock, so this can be done with vecs->lock held.
+ * - pp->pinned keeps the structure itself alive. free_path() releases
+ *   the resources of a pinned path and sets pp->dead, and the last
+ *   unpin_path() frees it.
+ */
+static pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pin_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+cleanup_pin_lock (void *arg)
+{
+	pthread_mutex_unlock(&pin_lock);
+}
+
+void
+pin_path (struct path * pp)
+{
+	pthread_mutex_lock(&pin_lock);
+	pp->pinned++;
+	pp->checking = 1;
+	pthread_mutex_unlock(&pin_lock);
+}
+
+void
+path_checked (struct path * pp)
+{
+	pthread_mutex_lock(&pin_lock);
+	pp->checking = 0;
+	pthread_cond_broadcast(&pin_cond);
+	pthread_mutex_unlock(&pin_lock);
+}
+
+void
+wait_path_checked (struct path * pp)
+{
+	pthread_mutex_lock(&pin_lock);
+	pthread_cleanup_push(cleanup_pin_lock, NULL);
+	while (pp->checking)
+		pthread_cond_wait(&pin_cond, &pin_lock);
+	pthread_cleanup_pop(1);
+}
+
+/* Returns 1 if the path had been freed, and is gone now */
+int
+unpin_path (struct path * pp)
+{
+	int gone;
+
+	pthread_mutex_lock(&pin_lock);
+	gone = (--pp->pinned == 0 && pp->dead);
+	pthread_mutex_unlock(&pin_lock);
+	if (gone)
+		FREE(pp);
+	return gone;
+}
+
 void
 free_path (struct path * pp)
 {
+	int pinned;
+
 	if (!pp)
 		return;
 
+	wait_path_checked(pp);
+	unschedule_path(pp);
+
 	if (checker_selected(&pp->checker))
 		checker_put(&pp->checker);
 
 	if (prio_selected(&pp->prio))
-		prio_put(&pp->prio);
+		prio_put(&pp->prio, pp);
 
 	if (pp->fd >= 0)
 		close(pp->fd);
@@ -126,7 +200,16 @@ free_path (struct path * pp)
 		pp->udev = NULL;
 	}
 
-	FREE(pp);
+	if (pp->lat_stats)
+		FREE(pp->lat_stats);
+
+	pthread_mutex_lock(&pin_lock);
+	pinned = pp->pinned;
+	if (pinned)
+		pp->dead = 1;
+	pthread_mutex_unlock(&pin_lock);
+	if (!pinned)
+		FREE(pp);
 }
 
 void
@@ -286,6 +369,83 @@ free_multipathvec (vector mpvec, enum free_path_mode free_paths)
 	vector_free(mpvec);
 }
 
+/*
+ * Key functions for the hash indexes on path and map vectors.
+ * The map alias may change while the map is in the vector.
+ */
+static const char *
+path_dev_key (const void *elem, char *buf, size_t len)
+{
+	return ((const struct path *)elem)->dev;
+}
+
+static const char *
+path_devt_key (const void *elem, char *buf, size_t len)
+{
+	return ((const struct path *)elem)->dev_t;
+}
+
+static const char *
+mp_wwid_key (const void *elem, char *buf, size_t len)
+{
+	return ((const struct multipath *)elem)->wwid;
+}
+
+static const char *
+mp_alias_key (const void *elem, char *buf, size_t len)
+{
+	return ((const struct multipath *)elem)->alias;
+}
+
+static const char *
+mp_minor_key (const void *elem, char *buf, size_t len)
+{
+	const struct multipath *mpp = elem;
+
+	if (!mpp->dmi)
+		return NULL;
+	snprintf(buf, len, "%d", mpp->dmi->minor);
+	return buf;
+}
+
+/*
+ * Allocate a path vector with indexes by dev and dev_t. Without the
+ * indexes, lookups just scan the vector. dev_t is re-read by pathinfo(),
+ * so callers which refresh the udev device of a stored path must
+ * vector_index_rekey() it.
+ */
+vector
+alloc_indexed_pathvec (void)
+{
+	vector pathvec = vector_alloc();
+
+	if (!pathvec)
+		return NULL;
+	if (vector_add_index(pathvec, path_dev_key) ||
+	    vector_add_index(pathvec, path_devt_key))
+		condlog(2, "failed to index path vector");
+	return pathvec;
+}
+
+/*
+ * Allocate a map vector with indexes by wwid, alias and minor. The wwid
+ * and minor of a stored map are set by setup_multipath(), which rekeys
+ * it; other code changing them must call vector_index_rekey().
+ */
+vector
+alloc_indexed_mpvec (void)
+{
+	vector mpvec = vector_alloc();
+
+	if (!mpvec)
+		return NULL;
+	if (vector_add_index(mpvec, mp_wwid_key) ||
+	    vector_add_index(mpvec, mp_alias_key) ||
+	    vector_add_index(mpvec, mp_minor_key))
+		condlog(2, "failed to index map vector");
+	return mpvec;
+}
+
 int
 store_path (vector pathvec, struct path * pp)
 {
@@ -361,6 +521,15 @@ find_mp_by_minor (vector mpvec, int minor)
 	if (!mpvec)
 		return NULL;
 
+	if (mpvec->index) {
+		char buf[16];
+		void *elem;
+
+		snprintf(buf, sizeof(buf), "%d", minor);
+		if (!vector_index_find(mpvec, mp_minor_key, buf, &elem))
+			return elem;
+	}
+
 	vector_foreach_slot (mpvec, mpp, i) {
 		if (!mpp->dmi)
 			continue;
@@ -380,6 +549,10 @@ find_mp_by_wwid (vector mpvec, char * wwid)
 	if (!mpvec)
 		return NULL;
 
+	if (mpvec->index &&
+	    !vector_index_find(mpvec, mp_wwid_key, wwid, (void **)&mpp))
+		return mpp;
+
 	vector_foreach_slot (mpvec, mpp, i)
 		if (!strncmp(mpp->wwid, wwid, WWID_SIZE))
 			return mpp;
@@ -402,6 +575,10 @@ find_mp_by_alias (vector mpvec, const char * alias)
 	if (!len)
 		return NULL;
 
+	if (mpvec->index &&
+	    !vector_index_find(mpvec, mp_alias_key, alias, (void **)&mpp))
+		return mpp;
+
 	vector_foreach_slot (mpvec, mpp, i) {
 		if (strlen(mpp->alias) == len &&
 		    !strncmp(mpp->alias, alias, len))
@@ -430,6 +607,13 @@ find_path_by_dev (vector pathvec, const char * dev)
 	if (!pathvec)
 		return NULL;
 
+	if (pathvec->index &&
+	    !vector_index_find(pathvec, path_dev_key, dev, (void **)&pp)) {
+		if (!pp)
+			condlog(4, "%s: dev not found in pathvec", dev);
+		return pp;
+	}
+
 	vector_foreach_slot (pathvec, pp, i)
 		if (!strcmp(pp->dev, dev))
 			return pp;
@@ -447,6 +631,13 @@ find_path_by_devt (vector pathvec, const char * dev_t)
 	if (!pathvec)
 		return NULL;
 
+	if (pathvec->index &&
+	    !vector_index_find(pathvec, path_devt_key, dev_t, (void **)&pp)) {
+		if (!pp)
+			condlog(4, "%s: dev_t not found in pathvec", dev_t);
+		return pp;
+	}
+
 	vector_foreach_slot (pathvec, pp, i)
 		if (!strcmp(pp->dev_t, dev_t))
 			return pp;
@@ -3,10 +3,12 @@
 
 #include <sys/types.h>
 #include <inttypes.h>
+#include <time.h>
 
 #include "prio.h"
 #include "byteorder.h"
 #include "generic.h"
+#include "latency_hist.h"
 
 #define WWID_SIZE		128
 #define SERIAL_SIZE		65
@@ -227,7 +229,8 @@ struct path {
 	char tgt_node_name[NODE_NAME_SIZE];
 	unsigned long long size;
 	unsigned int checkint;
-	unsigned int tick;
+	struct timespec next_check;
+	int sched_slot;
 	int bus;
 	int offline;
 	int state;
@@ -255,11 +258,25 @@ struct path {
 	int io_err_disable_reinstate;
 	int io_err_pathfail_cnt;
 	int io_err_pathfail_starttime;
+	struct path_lat_stats *lat_stats;
+	/* see pin_path() */
+	int pinned;
+	int checking;
+	int dead;
 	/* configlet pointers */
 	struct hwentry * hwe;
 	struct gen_path generic_path;
 };
 
+/* time spent in the checker and prioritizer calls of a path */
+struct path_lat_stats {
+	struct latency_hist checker;
+	struct latency_hist prio;
+	/* start of an async check which hasn't completed yet */
+	struct timespec check_start;
+	int check_pending;
+};
+
 typedef int (pgpolicyfn) (struct multipath *);
 
 struct multipath {
@@ -298,6 +315,7 @@ struct multipath {
 	int force_udev_reload;
 	int ghost_delay;
 	int ghost_delay_tick;
+	unsigned long sync_gen; /* checker pass of the last table/status read */
 	unsigned int dev_loss;
 	uid_t uid;
 	gid_t gid;
@@ -364,7 +382,13 @@ struct host_group {
 struct path * alloc_path (void);
 struct pathgroup * alloc_pathgroup (void);
 struct multipath * alloc_multipath (void);
+vector alloc_indexed_pathvec (void);
+vector alloc_indexed_mpvec (void);
 void free_path (struct path *);
+void pin_path (struct path *);
+void path_checked (struct path *);
+void wait_path_checked (struct path *);
+int unpin_path (struct path *);
 void free_pathvec (vector vec, enum free_path_mode free_paths);
 void free_pathgroup (struct pathgroup * pgp, enum free_path_mode free_paths);
 void free_pgvec (vector pgvec, enum free_path_mode free_paths);
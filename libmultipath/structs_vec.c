@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <urcu/uatomic.h>
 
 #include "checkers.h"
 #include "vector.h"
@@ -19,6 +20,22 @@
 #include "configure.h"
 #include "libdevmapper.h"
 #include "io_err_stat.h"
+#include "path_sched.h"
+
+/*
+ * Mark the maps and paths in @vecs as changed. Call it while holding
+ * vecs->lock for the change, or after it. Readers compare the
+ * generation without the lock, to tell whether their copy is outdated.
+ */
+void topology_changed(struct vectors *vecs)
+{
+	uatomic_inc(&vecs->gen);
+}
+
+unsigned long topology_gen(const struct vectors *vecs)
+{
+	return uatomic_read(&vecs->gen);
+}
 
 /*
  * creates or updates mpp->paths reading mpp->pg
@@ -47,7 +64,12 @@ int update_mpp_paths(struct multipath *mpp, vector pathvec)
 	return 0;
 }
 
-int adopt_paths(vector pathvec, struct multipath *mpp)
+/*
+ * Adopt the paths with the map's WWID among the @nr paths in @paths,
+ * which must contain all such paths of @pathvec, in pathvec order.
+ */
+int adopt_path_group(vector pathvec, struct multipath *mpp,
+		     struct path **paths, int nr)
 {
 	int i, ret;
 	struct path * pp;
@@ -59,7 +81,8 @@ int adopt_paths(vector pathvec, struct multipath *mpp)
 	if (update_mpp_paths(mpp, pathvec))
 		return 1;
 
-	vector_foreach_slot (pathvec, pp, i) {
+	for (i = 0; i < nr; i++) {
+		pp = paths[i];
 		if (!strncmp(mpp->wwid, pp->wwid, WWID_SIZE)) {
 			condlog(3, "%s: ownership set to %s",
 				pp->dev, mpp->alias);
@@ -82,14 +105,22 @@ int adopt_paths(vector pathvec, struct multipath *mpp)
 	return 0;
 }
 
+int adopt_paths(vector pathvec, struct multipath *mpp)
+{
+	return adopt_path_group(pathvec, mpp, pathvec ?
+				(struct path **)pathvec->slot : NULL,
+				VECTOR_SIZE(pathvec));
+}
+
 void orphan_path(struct path *pp, const char *reason)
 {
 	condlog(3, "%s: orphan path, %s", pp->dev, reason);
+	wait_path_checked(pp);
 	pp->mpp = NULL;
 	pp->dmstate = PSTATE_UNDEF;
 	pp->uid_attribute = NULL;
 	pp->getuid = NULL;
-	prio_put(&pp->prio);
+	prio_put(&pp->prio, pp);
 	checker_put(&pp->checker);
 	if (pp->fd >= 0)
 		close(pp->fd);
@@ -143,6 +174,7 @@ _remove_map (struct multipath * mpp, struct vectors * vecs,
 	if (purge_vec &&
 	    (i = find_slot(vecs->mpvec, (void *)mpp)) != -1)
 		vector_del_slot(vecs->mpvec, i);
+	topology_changed(vecs);
 
 	/*
 	 * final free
@@ -366,6 +398,8 @@ int __setup_multipath(struct vectors *vecs, struct multipath *mpp,
 		condlog(0, "%s: failed to setup multipath", mpp->alias);
 		goto out;
 	}
+	/* the minor and wwid may have been set or changed */
+	vector_index_rekey(vecs->mpvec, mpp);
 
 	if (reset) {
 		set_no_path_retry(mpp);
@@ -510,8 +544,13 @@ find_existing_alias (struct multipath * mpp,
 		}
 }
 
-struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
-				    int add_vec)
+/*
+ * Create a map for @pp, adopting the paths with its WWID among the @nr
+ * paths in @paths (see adopt_path_group()).
+ */
+struct multipath *add_map_with_path_group(struct vectors *vecs,
+					  struct path *pp, int add_vec,
+					  struct path **paths, int nr)
 {
 	struct multipath * mpp;
 	struct config *conf = NULL;
@@ -533,7 +572,7 @@ struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
 		goto out;
 	mpp->size = pp->size;
 
-	if (adopt_paths(vecs->pathvec, mpp))
+	if (adopt_path_group(vecs->pathvec, mpp, paths, nr))
 		goto out;
 
 	if (add_vec) {
@@ -550,6 +589,14 @@ out:
 	return NULL;
 }
 
+struct multipath *add_map_with_path(struct vectors *vecs, struct path *pp,
+				    int add_vec)
+{
+	return add_map_with_path_group(vecs, pp, add_vec, vecs->pathvec ?
+				       (struct path **)vecs->pathvec->slot :
+				       NULL, VECTOR_SIZE(vecs->pathvec));
+}
+
 int verify_paths(struct multipath *mpp, struct vectors *vecs)
 {
 	struct path * pp;
@@ -602,6 +649,7 @@ int update_multipath (struct vectors *vecs, char *mapname, int reset)
 		return 2;
 	}
 
+	topology_changed(vecs);
 	if (__setup_multipath(vecs, mpp, reset))
 		return 1; /* mpp freed in setup_multipath */
 
@@ -627,8 +675,8 @@ int update_multipath (struct vectors *vecs, char *mapname, int reset)
 				 * if opportune,
 				 * schedule the next check earlier
 				 */
-				if (pp->tick > conf->checkint)
-					pp->tick = conf->checkint;
+				if (get_path_tick(pp) > conf->checkint)
+					set_path_tick(pp, conf->checkint);
 				put_multipath_config(conf);
 			}
 		}
@@ -654,14 +702,33 @@ void update_queue_mode_del_path(struct multipath *mpp)
 	condlog(2, "%s: remaining active paths: %d", mpp->alias, mpp->nr_active);
 }
 
-void update_queue_mode_add_path(struct multipath *mpp)
+void leave_recovery_mode(struct multipath *mpp)
+{
+	dm_queue_if_no_path(mpp->alias, 1);
+	condlog(2, "%s: queue_if_no_path enabled", mpp->alias);
+	condlog(1, "%s: Recovered to normal mode", mpp->alias);
+}
+
+/*
+ * Count a path which has become active. Returns 1 if the map leaves
+ * recovery mode, in which case the caller must call
+ * leave_recovery_mode(), and 0 otherwise.
+ */
+int __update_queue_mode_add_path(struct multipath *mpp)
 {
+	int recovered = 0;
+
 	if (mpp->nr_active++ == 0 && mpp->no_path_retry > 0) {
 		/* come back to normal mode from retry mode */
 		mpp->retry_tick = 0;
-		dm_queue_if_no_path(mpp->alias, 1);
-		condlog(2, "%s: queue_if_no_path enabled", mpp->alias);
-		condlog(1, "%s: Recovered to normal mode", mpp->alias);
+		recovered = 1;
 	}
 	condlog(2, "%s: remaining active paths: %d", mpp->alias, mpp->nr_active);
+	return recovered;
+}
+
+void update_queue_mode_add_path(struct multipath *mpp)
+{
+	if (__update_queue_mode_add_path(mpp))
+		leave_recovery_mode(mpp);
 }
@@ -9,11 +9,18 @@ struct vectors {
 	struct mutex_lock lock; /* defined in lock.h */
 	vector pathvec;
 	vector mpvec;
+	unsigned long gen; /* bumped by topology_changed() */
 };
 
+void topology_changed (struct vectors *vecs);
+unsigned long topology_gen (const struct vectors *vecs);
+
 void enter_recovery_mode(struct multipath *mpp);
+void leave_recovery_mode(struct multipath *mpp);
 
 int adopt_paths (vector pathvec, struct multipath * mpp);
+int adopt_path_group (vector pathvec, struct multipath * mpp,
+		      struct path ** paths, int nr);
 void orphan_paths (vector pathvec, struct multipath * mpp);
 void orphan_path (struct path * pp, const char *reason);
 
@@ -36,8 +43,12 @@ int update_map (struct multipath *mpp, struct vectors *vecs);
 struct multipath * add_map_without_path (struct vectors * vecs, const char * alias);
 struct multipath * add_map_with_path (struct vectors * vecs,
 				struct path * pp, int add_vec);
+struct multipath * add_map_with_path_group (struct vectors * vecs,
+				struct path * pp, int add_vec,
+				struct path ** paths, int nr);
 int update_multipath (struct vectors *vecs, char *mapname, int reset);
 void update_queue_mode_del_path(struct multipath *mpp);
+int __update_queue_mode_add_path(struct multipath *mpp);
 void update_queue_mode_add_path(struct multipath *mpp);
 int update_multipath_table (struct multipath *mpp, vector pathvec,
 			    int is_daemon);
@@ -59,6 +59,7 @@
 #define MIN_BURST_SPEED 10
 
 typedef int (uev_trigger)(struct uevent *, void * trigger_data);
+typedef void (uev_batch_done)(void * trigger_data);
 
 LIST_HEAD(uevq);
 pthread_mutex_t uevq_lock = PTHREAD_MUTEX_INITIALIZER;
@@ -66,6 +67,7 @@ pthread_mutex_t *uevq_lockp = &uevq_lock;
 pthread_cond_t uev_cond = PTHREAD_COND_INITIALIZER;
 pthread_cond_t *uev_condp = &uev_cond;
 uev_trigger *my_uev_trigger;
+uev_batch_done *my_uev_batch_done;
 void * my_trigger_data;
 int servicing_uev;
 
@@ -199,8 +201,7 @@ uevent_can_discard(struct uevent *uev)
 	 * filter paths devices by devnode
 	 */
 	conf = get_multipath_config();
-	if (filter_devnode(conf->blist_devnode, conf->elist_devnode,
-			   uev->kernel) > 0) {
+	if (filter_devnode(conf, uev->kernel) > 0) {
 		put_multipath_config(conf);
 		return true;
 	}
@@ -363,15 +364,246 @@ uevent_merge(struct uevent *later, struct list_head *tmpq)
 	}
 }
 
+/*
+ * Single pass filtering and merging.
+ *
+ * The result is the same as that of calling uevent_filter() and
+ * uevent_merge() for every queued uevent, from the newest to the oldest,
+ * but the older uevents a uevent may filter or merge are found through
+ * chains linking the uevents with the same kernel name, the "change"
+ * uevents with the same kernel name, the uevents with the same wwid, and
+ * the uevents without a wwid. The chains are built in queue order with
+ * hash tables, and are never updated: uevents which have been filtered
+ * or merged are just marked as such.
+ *
+ * Each chain is walked at most once past a given uevent: a "remove"
+ * filters all older uevents of its path, an "add" all older "change"
+ * uevents, which leaves nothing for the older uevents of the path to
+ * filter, and merging stops at the first uevent of the same LUN with
+ * an opposite action.
+ */
+struct uev_entry {
+	struct uevent *uev;
+	int queued;
+	int kprev;		/* older uevent with the same kernel name */
+	int cprev;		/* older "change" uevent, same kernel name */
+	int wprev;		/* older uevent with the same wwid */
+};
+
+struct uev_pass {
+	struct uev_entry *e;
+	int *nowwid;		/* uevents without wwid, in queue order */
+	int nr_nowwid;
+	int *table;
+	unsigned int size;
+};
+
+static unsigned int
+uev_str_hash(const char *str)
+{
+	unsigned int h = 2166136261U;
+
+	while (*str) {
+		h ^= (unsigned char)*str++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Return the table slot of @key: the newest entry with that key so far,
+ * or a free slot. The slots hold entry indexes, -1 is a free slot.
+ */
+static int *
+uev_slot(struct uev_pass *up, const char *key, bool by_wwid)
+{
+	unsigned int slot = uev_str_hash(key) & (up->size - 1);
+	struct uevent *uev;
+
+	while (up->table[slot] != -1) {
+		uev = up->e[up->table[slot]].uev;
+		if (!strcmp(by_wwid ? uev->wwid : uev->kernel, key))
+			break;
+		slot = (slot + 1) & (up->size - 1);
+	}
+	return &up->table[slot];
+}
+
+static void
+uev_build_chains(struct uev_pass *up, int nr)
+{
+	struct uevent *uev;
+	int i, *slot;
+
+	memset(up->table, 0xff, up->size * sizeof(int));
+	for (i = 0; i < nr; i++) {
+		slot = uev_slot(up, up->e[i].uev->kernel, false);
+		up->e[i].kprev = *slot;
+		*slot = i;
+	}
+
+	memset(up->table, 0xff, up->size * sizeof(int));
+	for (i = 0; i < nr; i++) {
+		uev = up->e[i].uev;
+		slot = uev_slot(up, uev->kernel, false);
+		up->e[i].cprev = *slot;
+		if (!strcmp(uev->action, "change"))
+			*slot = i;
+	}
+
+	memset(up->table, 0xff, up->size * sizeof(int));
+	for (i = 0; i < nr; i++) {
+		uev = up->e[i].uev;
+		up->e[i].wprev = -1;
+		if (!uev->wwid)
+			continue;
+		slot = uev_slot(up, uev->wwid, true);
+		up->e[i].wprev = *slot;
+		*slot = i;
+	}
+}
+
+static void
+uev_drop(struct uev_pass *up, int i, struct uevent *later)
+{
+	struct uevent *earlier = up->e[i].uev;
+
+	condlog(2, "uevent: %s-%s has filtered by uevent: %s-%s",
+		earlier->kernel, earlier->action,
+		later->kernel, later->action);
+	up->e[i].queued = 0;
+	list_del_init(&earlier->node);
+	if (earlier->udev)
+		udev_device_unref(earlier->udev);
+	FREE(earlier);
+}
+
+static void
+uev_pass_filter(struct uev_pass *up, int i)
+{
+	struct uevent *later = up->e[i].uev;
+	int j;
+
+	if (!strncmp(later->kernel, "dm-", 3))
+		return;
+
+	if (!strcmp(later->action, "remove")) {
+		for (j = up->e[i].kprev; j >= 0; j = up->e[j].kprev)
+			if (up->e[j].queued)
+				uev_drop(up, j, later);
+	} else if (!strcmp(later->action, "add")) {
+		/*
+		 * If the newest older "change" is gone, a newer "add" has
+		 * filtered all older ones already.
+		 */
+		for (j = up->e[i].cprev; j >= 0 && up->e[j].queued;
+		     j = up->e[j].cprev)
+			uev_drop(up, j, later);
+	}
+}
+
+static void
+uev_pass_merge(struct uev_pass *up, int i, int *nowwid_pos)
+{
+	struct uevent *later = up->e[i].uev, *earlier;
+	int barrier = -1, j;
+
+	/* nothing merges into dm or "change" uevents */
+	if (!strncmp(later->kernel, "dm-", 3) || !later->wwid ||
+	    !strncmp(later->action, "change", 6))
+		return;
+
+	/* merging stops at the newest older uevent without wwid */
+	while (*nowwid_pos >= 0) {
+		j = up->nowwid[*nowwid_pos];
+		if (j < i && up->e[j].queued) {
+			barrier = j;
+			break;
+		}
+		(*nowwid_pos)--;
+	}
+
+	for (j = up->e[i].wprev; j > barrier; j = up->e[j].wprev) {
+		if (!up->e[j].queued)
+			continue;
+		earlier = up->e[j].uev;
+		if (merge_need_stop(earlier, later))
+			break;
+		if (uevent_can_merge(earlier, later)) {
+			condlog(2, "merged uevent: %s-%s-%s with uevent: %s-%s-%s",
+				earlier->action, earlier->kernel, earlier->wwid,
+				later->action, later->kernel, later->wwid);
+			up->e[j].queued = 0;
+			list_move(&earlier->node, &later->merge_node);
+		}
+	}
+}
+
+static int
+merge_uevq_pass(struct list_head *tmpq, bool need_merge)
+{
+	struct uev_pass up;
+	struct uevent *uev;
+	int nr = 0, i, nowwid_pos;
+
+	list_for_each_entry(uev, tmpq, node)
+		nr++;
+	if (!nr)
+		return 0;
+
+	memset(&up, 0, sizeof(up));
+	for (up.size = 64; up.size < 2 * nr; up.size *= 2)
+		;
+	up.e = MALLOC(nr * sizeof(struct uev_entry));
+	up.nowwid = MALLOC(nr * sizeof(int));
+	up.table = MALLOC(up.size * sizeof(int));
+	if (!up.e || !up.nowwid || !up.table) {
+		FREE_PTR(up.e);
+		FREE_PTR(up.nowwid);
+		FREE_PTR(up.table);
+		return 1;
+	}
+
+	i = 0;
+	list_for_each_entry(uev, tmpq, node) {
+		up.e[i].uev = uev;
+		up.e[i].queued = 1;
+		if (!uev->wwid)
+			up.nowwid[up.nr_nowwid++] = i;
+		i++;
+	}
+	uev_build_chains(&up, nr);
+
+	nowwid_pos = up.nr_nowwid - 1;
+	for (i = nr - 1; i >= 0; i--) {
+		if (!up.e[i].queued)
+			continue;
+		uev_pass_filter(&up, i);
+		if (need_merge)
+			uev_pass_merge(&up, i, &nowwid_pos);
+	}
+
+	FREE(up.e);
+	FREE(up.nowwid);
+	FREE(up.table);
+	return 0;
+}
+
 void
 merge_uevq(struct list_head *tmpq)
 {
 	struct uevent *later;
+	bool need_merge;
 
 	uevent_prepare(tmpq);
+	need_merge = uevent_need_merge();
+	if (!merge_uevq_pass(tmpq, need_merge))
+		return;
+
+	/* out of memory: compare every uevent with all older ones */
 	list_for_each_entry_reverse(later, tmpq, node) {
 		uevent_filter(later, tmpq);
-		if(uevent_need_merge())
+		if (need_merge)
 			uevent_merge(later, tmpq);
 	}
 }
@@ -414,10 +646,16 @@ static void monitor_cleanup(void *arg)
 /*
  * Service the uevent queue.
  */
+/*
+ * @batch_done, if set, is called after each batch of queued uevents has
+ * been passed to @uev_trigger.
+ */
 int uevent_dispatch(int (*uev_trigger)(struct uevent *, void * trigger_data),
+		    void (*batch_done)(void * trigger_data),
 		    void * trigger_data)
 {
 	my_uev_trigger = uev_trigger;
+	my_uev_batch_done = batch_done;
 	my_trigger_data = trigger_data;
 
 	mlockall(MCL_CURRENT | MCL_FUTURE);
@@ -441,6 +679,8 @@ int uevent_dispatch(int (*uev_trigger)(struct uevent *, void * trigger_data),
 			break;
 		merge_uevq(&uevq_tmp);
 		service_uevq(&uevq_tmp);
+		if (my_uev_batch_done)
+			my_uev_batch_done(my_trigger_data);
 	}
 	condlog(3, "Terminating uev service queue");
 	uevq_cleanup(&uevq);
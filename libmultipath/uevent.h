@@ -32,6 +32,7 @@ int is_uevent_busy(void);
 
 int uevent_listen(struct udev *udev);
 int uevent_dispatch(int (*store_uev)(struct uevent *, void * trigger_data),
+		    void (*batch_done)(void * trigger_data),
 		    void * trigger_data);
 int uevent_get_major(const struct uevent *uev);
 int uevent_get_minor(const struct uevent *uev);
@@ -0,0 +1,694 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "memory.h"
+#include "debug.h"
+#include "uring.h"
+
+#ifdef USE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "util.h"
+#include "time-util.h"
+
+#define URING_ENTRIES 1024
+
+struct uring_req {
+	int state;
+	int res;
+	int orphan;
+	unsigned int len;
+	unsigned char *buf;
+	struct __kernel_timespec ts;
+	struct timespec queued;
+	struct timespec done;
+};
+
+struct uring_engine {
+	int state;
+	int fd;
+	pthread_t thread;
+	unsigned int inflight;
+	unsigned int queued;
+	/* completions the kernel may still post, at most cq_entries */
+	unsigned int cq_pending;
+	unsigned int cq_entries;
+	unsigned int sq_local_tail;
+	/* submission queue */
+	unsigned int sq_entries;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	struct io_uring_sqe *sqes;
+	/* completion queue */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* mappings */
+	void *sq_ring;
+	size_t sq_ring_sz;
+	void *cq_ring;
+	size_t cq_ring_sz;
+	size_t sqes_sz;
+};
+
+enum {
+	URING_ENGINE_UNINIT,
+	URING_ENGINE_READY,
+	URING_ENGINE_FAILED,
+};
+
+static pthread_mutex_t uring_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t uring_cond;
+static struct uring_engine ue = { .fd = -1 };
+/*
+ * user_data of the NOP which stops the reaper thread. A CQ entry is
+ * reserved for it from the start, so it can always be sent.
+ */
+static int uring_stop_marker;
+
+static void cleanup_uring_lock(void *arg)
+{
+	pthread_mutex_unlock(&uring_lock);
+}
+
+static int
+sys_io_uring_setup (unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int
+sys_io_uring_enter (int fd, unsigned int to_submit,
+		    unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+static int
+sys_io_uring_register (int fd, unsigned int opcode, void *arg,
+		       unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* Check that the kernel knows all the opcodes we need */
+static int
+uring_probe_ops (int fd)
+{
+	static const int needed[] = {
+		IORING_OP_NOP,
+		IORING_OP_READ,
+		IORING_OP_LINK_TIMEOUT,
+		IORING_OP_ASYNC_CANCEL,
+	};
+	struct io_uring_probe *probe;
+	size_t sz = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	unsigned int i;
+	int ret = 0;
+
+	probe = MALLOC(sz);
+	if (!probe)
+		return 1;
+	if (sys_io_uring_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+		ret = 1;
+		goto out;
+	}
+	for (i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+		if (needed[i] > probe->last_op ||
+		    !(probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED)) {
+			ret = 1;
+			break;
+		}
+	}
+out:
+	FREE(probe);
+	return ret;
+}
+
+static void
+uring_unmap (void)
+{
+	if (ue.sqes)
+		munmap(ue.sqes, ue.sqes_sz);
+	if (ue.cq_ring && ue.cq_ring != ue.sq_ring)
+		munmap(ue.cq_ring, ue.cq_ring_sz);
+	if (ue.sq_ring)
+		munmap(ue.sq_ring, ue.sq_ring_sz);
+	ue.sqes = NULL;
+	ue.sq_ring = ue.cq_ring = NULL;
+	if (ue.fd >= 0)
+		close(ue.fd);
+	ue.fd = -1;
+}
+
+static int
+uring_map (struct io_uring_params *p)
+{
+	unsigned int *sq_array, i;
+
+	ue.sq_ring_sz = p->sq_off.array + p->sq_entries * sizeof(unsigned int);
+	ue.cq_ring_sz = p->cq_off.cqes +
+		p->cq_entries * sizeof(struct io_uring_cqe);
+	if (p->features & IORING_FEAT_SINGLE_MMAP) {
+		if (ue.cq_ring_sz > ue.sq_ring_sz)
+			ue.sq_ring_sz = ue.cq_ring_sz;
+		ue.cq_ring_sz = ue.sq_ring_sz;
+	}
+	ue.sq_ring = mmap(NULL, ue.sq_ring_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, ue.fd, IORING_OFF_SQ_RING);
+	if (ue.sq_ring == MAP_FAILED) {
+		ue.sq_ring = NULL;
+		return 1;
+	}
+	if (p->features & IORING_FEAT_SINGLE_MMAP)
+		ue.cq_ring = ue.sq_ring;
+	else {
+		ue.cq_ring = mmap(NULL, ue.cq_ring_sz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, ue.fd,
+				  IORING_OFF_CQ_RING);
+		if (ue.cq_ring == MAP_FAILED) {
+			ue.cq_ring = NULL;
+			return 1;
+		}
+	}
+	ue.sqes_sz = p->sq_entries * sizeof(struct io_uring_sqe);
+	ue.sqes = mmap(NULL, ue.sqes_sz, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, ue.fd, IORING_OFF_SQES);
+	if (ue.sqes == MAP_FAILED) {
+		ue.sqes = NULL;
+		return 1;
+	}
+
+	ue.sq_entries = p->sq_entries;
+	ue.sq_head = ue.sq_ring + p->sq_off.head;
+	ue.sq_tail = ue.sq_ring + p->sq_off.tail;
+	ue.sq_mask = ue.sq_ring + p->sq_off.ring_mask;
+	sq_array = ue.sq_ring + p->sq_off.array;
+	for (i = 0; i < p->sq_entries; i++)
+		sq_array[i] = i;
+	ue.sq_local_tail = *ue.sq_tail;
+
+	ue.cq_head = ue.cq_ring + p->cq_off.head;
+	ue.cq_tail = ue.cq_ring + p->cq_off.tail;
+	ue.cq_mask = ue.cq_ring + p->cq_off.ring_mask;
+	ue.cqes = ue.cq_ring + p->cq_off.cqes;
+	ue.cq_entries = p->cq_entries;
+	return 0;
+}
+
+/*
+ * Reserve room in the CQ ring for the completions of @nr SQEs. Reads
+ * with a timeout and cancellations post completions, too, so these
+ * are counted rather than requests. Call with uring_lock held.
+ */
+static int
+uring_reserve_cqes (unsigned int nr)
+{
+	if (ue.cq_pending + nr > ue.cq_entries)
+		return 1;
+	ue.cq_pending += nr;
+	return 0;
+}
+
+/* Hand all queued SQEs to the kernel. Call with uring_lock held. */
+static void
+uring_submit (void)
+{
+	int ret;
+
+	if (!ue.queued)
+		return;
+	__atomic_store_n(ue.sq_tail, ue.sq_local_tail, __ATOMIC_RELEASE);
+	do {
+		ret = sys_io_uring_enter(ue.fd, ue.queued, 0, 0);
+		if (ret > 0)
+			ue.queued -= ret;
+	} while (ue.queued && (ret > 0 || (ret < 0 && errno == EINTR)));
+	if (ue.queued)
+		condlog(2, "io_uring: failed to submit %u requests: %s",
+			ue.queued, strerror(errno));
+}
+
+/*
+ * Return the next free SQE, making sure that @nr entries are
+ * available. Call with uring_lock held.
+ */
+static struct io_uring_sqe *
+uring_get_sqe (unsigned int nr)
+{
+	unsigned int head = __atomic_load_n(ue.sq_head, __ATOMIC_ACQUIRE);
+	struct io_uring_sqe *sqe;
+
+	if (ue.sq_local_tail - head + nr > ue.sq_entries) {
+		uring_submit();
+		head = __atomic_load_n(ue.sq_head, __ATOMIC_ACQUIRE);
+		if (ue.sq_local_tail - head + nr > ue.sq_entries)
+			return NULL;
+	}
+	sqe = &ue.sqes[ue.sq_local_tail & *ue.sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ue.sq_local_tail++;
+	ue.queued++;
+	return sqe;
+}
+
+static void
+free_req (struct uring_req *req)
+{
+	free(req->buf);
+	FREE(req);
+}
+
+static void *
+uring_reaper (void *arg)
+{
+	unsigned int head, tail;
+	struct timespec now;
+	int stop = 0;
+
+	condlog(3, "io_uring: reaper thread start up");
+	while (!stop) {
+		if (sys_io_uring_enter(ue.fd, 0, 1,
+				       IORING_ENTER_GETEVENTS) < 0 &&
+		    errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+			condlog(0, "io_uring: waiting for completions failed: %s",
+				strerror(errno));
+			sleep(1);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		pthread_mutex_lock(&uring_lock);
+		head = *ue.cq_head;
+		tail = __atomic_load_n(ue.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ue.cqes[head & *ue.cq_mask];
+			struct uring_req *req;
+
+			ue.cq_pending--;
+			if (!cqe->user_data)
+				continue;
+			if (cqe->user_data == (uintptr_t)&uring_stop_marker) {
+				stop = 1;
+				continue;
+			}
+			req = (struct uring_req *)(uintptr_t)cqe->user_data;
+			ue.inflight--;
+			if (req->orphan)
+				free_req(req);
+			else {
+				req->res = cqe->res;
+				req->done = now;
+				req->state = URING_REQ_DONE;
+			}
+		}
+		__atomic_store_n(ue.cq_head, head, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&uring_cond);
+		pthread_mutex_unlock(&uring_lock);
+	}
+	condlog(3, "io_uring: reaper thread exit");
+	return NULL;
+}
+
+/* Set up the ring on first use. Call with uring_lock held. */
+static int
+uring_init (void)
+{
+	struct io_uring_params params;
+	pthread_condattr_t attr;
+	pthread_attr_t thread_attr;
+
+	if (ue.state != URING_ENGINE_UNINIT)
+		return ue.state == URING_ENGINE_READY ? 0 : 1;
+
+	ue.state = URING_ENGINE_FAILED;
+	memset(&params, 0, sizeof(params));
+	ue.fd = sys_io_uring_setup(URING_ENTRIES, &params);
+	if (ue.fd < 0) {
+		condlog(3, "io_uring: setup failed: %s", strerror(errno));
+		return 1;
+	}
+	if (uring_probe_ops(ue.fd)) {
+		condlog(3, "io_uring: kernel lacks required operations");
+		goto out;
+	}
+	if (uring_map(&params)) {
+		condlog(2, "io_uring: failed to map rings: %s",
+			strerror(errno));
+		goto out;
+	}
+
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&uring_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	ue.inflight = ue.queued = 0;
+	ue.cq_pending = 1;
+	setup_thread_attr(&thread_attr, 32 * 1024, 0);
+	if (pthread_create(&ue.thread, &thread_attr, uring_reaper, NULL)) {
+		condlog(0, "io_uring: failed to start reaper thread");
+		pthread_attr_destroy(&thread_attr);
+		pthread_cond_destroy(&uring_cond);
+		goto out;
+	}
+	pthread_attr_destroy(&thread_attr);
+	ue.state = URING_ENGINE_READY;
+	condlog(3, "io_uring: engine ready, %u entries", ue.sq_entries);
+	return 0;
+out:
+	uring_unmap();
+	return 1;
+}
+
+struct uring_req *
+uring_req_alloc (unsigned int len)
+{
+	struct uring_req *req;
+	int ret;
+
+	pthread_mutex_lock(&uring_lock);
+	ret = uring_init();
+	pthread_mutex_unlock(&uring_lock);
+	if (ret)
+		return NULL;
+
+	req = MALLOC(sizeof(struct uring_req));
+	if (!req)
+		return NULL;
+	if (posix_memalign((void **)&req->buf, getpagesize(), len)) {
+		FREE(req);
+		return NULL;
+	}
+	req->len = len;
+	req->state = URING_REQ_IDLE;
+	return req;
+}
+
+void
+uring_req_free (struct uring_req *req)
+{
+	struct io_uring_sqe *sqe;
+
+	if (!req)
+		return;
+	pthread_mutex_lock(&uring_lock);
+	if (req->state != URING_REQ_QUEUED) {
+		pthread_mutex_unlock(&uring_lock);
+		free_req(req);
+		return;
+	}
+	/* The reaper frees the request once the kernel is done with it */
+	req->orphan = 1;
+	uring_submit();
+	/* without room for the cancellation, wait for the timeout */
+	if (uring_reserve_cqes(1))
+		goto out;
+	sqe = uring_get_sqe(1);
+	if (sqe) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)req;
+		uring_submit();
+	} else
+		ue.cq_pending--;
+out:
+	pthread_mutex_unlock(&uring_lock);
+}
+
+/*
+ * Queue a read of the first req->len bytes of @fd, which is cancelled
+ * after @timeout seconds. Returns 0 on success, or a negative errno.
+ */
+int
+uring_submit_read (struct uring_req *req, int fd, unsigned int timeout)
+{
+	struct io_uring_sqe *sqe;
+	unsigned int nr = timeout ? 2 : 1;
+	int ret = 0;
+
+	pthread_mutex_lock(&uring_lock);
+	if (ue.state != URING_ENGINE_READY || req->state != URING_REQ_IDLE) {
+		ret = -EINVAL;
+		goto out;
+	}
+	if (uring_reserve_cqes(nr)) {
+		ret = -EBUSY;
+		goto out;
+	}
+	sqe = uring_get_sqe(nr);
+	if (!sqe) {
+		ue.cq_pending -= nr;
+		ret = -EBUSY;
+		goto out;
+	}
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)req->buf;
+	sqe->len = req->len;
+	sqe->off = 0;
+	sqe->user_data = (uintptr_t)req;
+	if (timeout) {
+		sqe->flags |= IOSQE_IO_LINK;
+		req->ts.tv_sec = timeout;
+		req->ts.tv_nsec = 0;
+		sqe = uring_get_sqe(1);
+		sqe->opcode = IORING_OP_LINK_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)&req->ts;
+		sqe->len = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &req->queued);
+	req->state = URING_REQ_QUEUED;
+	ue.inflight++;
+out:
+	pthread_mutex_unlock(&uring_lock);
+	return ret;
+}
+
+/*
+ * Return the state of @req. If it has completed, store the result of
+ * the read in @res and make the request available for reuse.
+ */
+int
+uring_req_result (struct uring_req *req, int *res)
+{
+	int state;
+
+	pthread_mutex_lock(&uring_lock);
+	state = req->state;
+	if (state == URING_REQ_DONE) {
+		*res = req->res;
+		req->state = URING_REQ_IDLE;
+	}
+	pthread_mutex_unlock(&uring_lock);
+	return state;
+}
+
+/*
+ * Like uring_req_result(), and also store the time from queueing the
+ * read to reaping its completion in @lat.
+ */
+int
+uring_req_result_time (struct uring_req *req, int *res, struct timespec *lat)
+{
+	int state;
+
+	pthread_mutex_lock(&uring_lock);
+	state = req->state;
+	if (state == URING_REQ_DONE) {
+		*res = req->res;
+		timespecsub(&req->done, &req->queued, lat);
+		req->state = URING_REQ_IDLE;
+	}
+	pthread_mutex_unlock(&uring_lock);
+	return state;
+}
+
+static int
+uring_wait_until (struct uring_req *req, const struct timespec *deadline)
+{
+	int state, rc = 0;
+
+	pthread_mutex_lock(&uring_lock);
+	pthread_cleanup_push(cleanup_uring_lock, NULL);
+	uring_submit();
+	while (req->state == URING_REQ_QUEUED && rc != ETIMEDOUT)
+		rc = pthread_cond_timedwait(&uring_cond, &uring_lock,
+					    deadline);
+	state = req->state;
+	pthread_cleanup_pop(1);
+	return state;
+}
+
+/*
+ * Submit everything queued so far and wait up to @timeout seconds
+ * for @req to complete. Returns the state of @req.
+ */
+int
+uring_wait (struct uring_req *req, unsigned int timeout)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout;
+	return uring_wait_until(req, &deadline);
+}
+
+/* Like uring_wait(), with the timeout in milliseconds */
+int
+uring_wait_ms (struct uring_req *req, unsigned int msecs)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += msecs / 1000;
+	deadline.tv_nsec += (msecs % 1000) * 1000000L;
+	normalize_timespec(&deadline);
+	return uring_wait_until(req, &deadline);
+}
+
+/*
+ * Submit everything queued so far and wait up to @timeout seconds
+ * until none of the @nr requests in @reqs is queued any more.
+ * Returns 1 if some of them still are, and 0 otherwise.
+ */
+int
+uring_wait_all (struct uring_req **reqs, unsigned int nr, unsigned int timeout)
+{
+	struct timespec deadline;
+	unsigned int i = 0;
+	int rc = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout;
+
+	pthread_mutex_lock(&uring_lock);
+	pthread_cleanup_push(cleanup_uring_lock, NULL);
+	uring_submit();
+	/* requests only leave the queued state, so don't rescan */
+	for (;;) {
+		while (i < nr && reqs[i]->state != URING_REQ_QUEUED)
+			i++;
+		if (i == nr || rc == ETIMEDOUT)
+			break;
+		rc = pthread_cond_timedwait(&uring_cond, &uring_lock,
+					    &deadline);
+	}
+	pthread_cleanup_pop(1);
+	return i < nr;
+}
+
+void
+uring_flush (void)
+{
+	pthread_mutex_lock(&uring_lock);
+	if (ue.state == URING_ENGINE_READY)
+		uring_submit();
+	pthread_mutex_unlock(&uring_lock);
+}
+
+void
+cleanup_uring_engine (void)
+{
+	struct io_uring_sqe *sqe;
+
+	pthread_mutex_lock(&uring_lock);
+	if (ue.state != URING_ENGINE_READY) {
+		ue.state = URING_ENGINE_UNINIT;
+		pthread_mutex_unlock(&uring_lock);
+		return;
+	}
+	/* uring_get_sqe() submits what's queued to make room */
+	sqe = uring_get_sqe(1);
+	if (!sqe) {
+		/* the reaper may still use the ring, so leave it alone */
+		condlog(0, "io_uring: can't stop reaper thread, SQ ring stuck");
+		ue.state = URING_ENGINE_FAILED;
+		pthread_mutex_unlock(&uring_lock);
+		return;
+	}
+	sqe->opcode = IORING_OP_NOP;
+	sqe->user_data = (uintptr_t)&uring_stop_marker;
+	uring_submit();
+	pthread_mutex_unlock(&uring_lock);
+	pthread_join(ue.thread, NULL);
+
+	pthread_mutex_lock(&uring_lock);
+	if (ue.inflight)
+		condlog(2, "io_uring: %u requests still in flight",
+			ue.inflight);
+	uring_unmap();
+	pthread_cond_destroy(&uring_cond);
+	ue.state = URING_ENGINE_UNINIT;
+	pthread_mutex_unlock(&uring_lock);
+}
+
+#else /* USE_IO_URING */
+
+struct uring_req *
+uring_req_alloc (unsigned int len)
+{
+	return NULL;
+}
+
+void
+uring_req_free (struct uring_req *req)
+{
+}
+
+int
+uring_submit_read (struct uring_req *req, int fd, unsigned int timeout)
+{
+	return -ENOSYS;
+}
+
+int
+uring_req_result (struct uring_req *req, int *res)
+{
+	return URING_REQ_IDLE;
+}
+
+int
+uring_req_result_time (struct uring_req *req, int *res, struct timespec *lat)
+{
+	return URING_REQ_IDLE;
+}
+
+int
+uring_wait (struct uring_req *req, unsigned int timeout)
+{
+	return URING_REQ_IDLE;
+}
+
+int
+uring_wait_ms (struct uring_req *req, unsigned int msecs)
+{
+	return URING_REQ_IDLE;
+}
+
+int
+uring_wait_all (struct uring_req **reqs, unsigned int nr, unsigned int timeout)
+{
+	return 0;
+}
+
+void
+uring_flush (void)
+{
+}
+
+void
+cleanup_uring_engine (void)
+{
+}
+
+#endif /* USE_IO_URING */
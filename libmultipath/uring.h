@@ -0,0 +1,38 @@
+#ifndef _URING_H
+#define _URING_H
+
+/*
+ * Shared io_uring engine for the path checkers and prioritizers.
+ *
+ * Checkers queue their I/O with uring_submit_read(). Queued requests
+ * are handed to the kernel by uring_flush(), or by uring_wait() and
+ * uring_wait_ms(), together with whatever else is queued, and a single
+ * thread reaps all completions. Every read carries a linked timeout, so
+ * a hanging path doesn't need a thread of its own.
+ *
+ * If io_uring isn't available, uring_req_alloc() returns NULL and the
+ * checker has to fall back to its own I/O method.
+ */
+enum uring_req_state {
+	URING_REQ_IDLE,
+	URING_REQ_QUEUED,
+	URING_REQ_DONE,
+};
+
+struct uring_req;
+struct timespec;
+
+struct uring_req *uring_req_alloc(unsigned int len);
+void uring_req_free(struct uring_req *req);
+int uring_submit_read(struct uring_req *req, int fd, unsigned int timeout);
+int uring_req_result(struct uring_req *req, int *res);
+int uring_req_result_time(struct uring_req *req, int *res,
+			  struct timespec *lat);
+int uring_wait(struct uring_req *req, unsigned int timeout);
+int uring_wait_ms(struct uring_req *req, unsigned int msecs);
+int uring_wait_all(struct uring_req **reqs, unsigned int nr,
+		   unsigned int timeout);
+void uring_flush(void);
+void cleanup_uring_engine(void);
+
+#endif /* _URING_H */
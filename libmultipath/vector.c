@@ -34,25 +34,51 @@ vector_alloc(void)
 	return v;
 }
 
-/* allocated one slot */
+/*
+ * Make room for at least n slots in total, without changing the
+ * number of slots in use.
+ */
+int
+vector_reserve(vector v, int n)
+{
+	void *new_slot;
+
+	if (!v || n < 0)
+		return -1;
+	if (n <= v->capacity)
+		return 0;
+
+	if (v->slot)
+		new_slot = REALLOC(v->slot, sizeof (void *) * n);
+	else
+		new_slot = (void *) MALLOC(sizeof (void *) * n);
+	if (!new_slot)
+		return -1;
+
+	v->slot = new_slot;
+	v->capacity = n;
+	return 0;
+}
+
+/*
+ * allocated one slot
+ * The slot array grows geometrically, so that appending is O(1)
+ * amortized.
+ */
 void *
 vector_alloc_slot(vector v)
 {
-	void *new_slot = NULL;
-
 	if (!v)
 		return NULL;
 
-	v->allocated += VECTOR_DEFAULT_SIZE;
-	if (v->slot)
-		new_slot = REALLOC(v->slot, sizeof (void *) * v->allocated);
-	else
-		new_slot = (void *) MALLOC(sizeof (void *) * v->allocated);
+	if (v->allocated >= v->capacity) {
+		int n = v->capacity ? 2 * v->capacity : VECTOR_DEFAULT_SIZE;
 
-	if (!new_slot)
-		v->allocated -= VECTOR_DEFAULT_SIZE;
-	else
-		v->slot = new_slot;
+		if (vector_reserve(v, n))
+			return NULL;
+	}
+	v->slot[v->allocated] = NULL;
+	v->allocated += VECTOR_DEFAULT_SIZE;
 
 	return v->slot;
 }
@@ -85,6 +111,8 @@ vector_insert_slot(vector v, int slot, void *value)
 		v->slot[i + 1] = v->slot[i];
 
 	v->slot[slot] = value;
+	if (v->index)
+		vector_index_insert(v, value);
 
 	return v->slot[slot];
 }
@@ -112,6 +140,9 @@ vector_del_slot(vector v, int slot)
 	if (!v || !v->allocated || slot < 0 || slot > VECTOR_SIZE(v))
 		return;
 
+	if (v->index && slot < VECTOR_SIZE(v))
+		vector_index_remove(v, v->slot[slot]);
+
 	for (i = slot + 1; i < VECTOR_SIZE(v); i++)
 		v->slot[i-1] = v->slot[i];
 
@@ -121,14 +152,16 @@ vector_del_slot(vector v, int slot)
 		FREE(v->slot);
 		v->slot = NULL;
 		v->allocated = 0;
-	} else {
+		v->capacity = 0;
+	} else if (v->allocated <= v->capacity / 4) {
+		/* give memory back once the vector has shrunk a lot */
 		void *new_slot;
 
-		new_slot = REALLOC(v->slot, sizeof (void *) * v->allocated);
-		if (!new_slot)
-			v->allocated += VECTOR_DEFAULT_SIZE;
-		else
+		new_slot = REALLOC(v->slot, sizeof (void *) * v->capacity / 2);
+		if (new_slot) {
 			v->slot = new_slot;
+			v->capacity /= 2;
+		}
 	}
 }
 
@@ -154,8 +187,11 @@ vector_free(vector v)
 
 	if (v->slot)
 		FREE(v->slot);
+	if (v->index)
+		vector_index_free(v);
 
 	v->allocated = 0;
+	v->capacity = 0;
 	v->slot = NULL;
 	FREE(v);
 }
@@ -186,5 +222,9 @@ vector_set_slot(vector v, void *value)
 		return;
 
 	i = VECTOR_SIZE(v) - 1;
+	if (v->index) {
+		vector_index_remove(v, v->slot[i]);
+		vector_index_insert(v, value);
+	}
 	v->slot[i] = value;
 }
@@ -23,10 +23,21 @@
 #ifndef _VECTOR_H
 #define _VECTOR_H
 
-/* vector definition */
+#include <stddef.h>
+
+struct vector_index;
+
+/*
+ * vector definition
+ * "allocated" is the number of slots in use, "capacity" the number of
+ * slots the slot array has room for. "index" is the list of hash
+ * indexes on the elements (see vector_index.c), if any.
+ */
 struct _vector {
 	int allocated;
+	int capacity;
 	void **slot;
+	struct vector_index *index;
 };
 typedef struct _vector *vector;
 
@@ -74,6 +85,7 @@ typedef struct _vector *vector;
 /* Prototypes */
 extern vector vector_alloc(void);
 extern void *vector_alloc_slot(vector v);
+extern int vector_reserve(vector v, int n);
 extern void vector_free(vector v);
 #define vector_free_const(x) vector_free((vector)(long)(x))
 extern void free_strvec(vector strvec);
@@ -85,4 +97,24 @@ extern void vector_repack(vector v);
 extern void vector_dump(vector v);
 extern void dump_strvec(vector strvec);
 extern int vector_move_up(vector v, int src, int dest);
+
+/*
+ * Return the key of @elem, or NULL or "" if it has none (yet).
+ * @buf of size @len may be used to format the key.
+ */
+typedef const char *(vector_key_fn)(const void *elem, char *buf, size_t len);
+
+extern int vector_add_index(vector v, vector_key_fn *key);
+/*
+ * Doesn't modify the index, so it only needs the lock that keeps @v
+ * from being modified, and may run concurrently with other lookups.
+ */
+extern int vector_index_find(vector v, vector_key_fn *key, const char *str,
+			     void **elem);
+/* Used by the vector functions to keep the indexes up to date */
+extern void vector_index_insert(vector v, void *elem);
+extern void vector_index_remove(vector v, void *elem);
+/* To be called when a key of an element in @v has changed */
+extern void vector_index_rekey(vector v, void *elem);
+extern void vector_index_free(vector v);
 #endif
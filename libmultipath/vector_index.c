@@ -0,0 +1,355 @@
+/*
+ * Hash indexes for vectors.
+ *
+ * An index maps the string key of each element (as returned by a
+ * vector_key_fn) to the element. It is updated by the vector
+ * functions whenever an element is added or removed, so it always has
+ * exactly the members of the vector. Keys are read from the elements
+ * at lookup time, so a stale entry can never produce a wrong match.
+ *
+ * Elements whose key is empty are kept on a pending list, which lookups
+ * don't search. If the key of an element changes while it is in the
+ * vector, vector_index_rekey() must be called to file it under the new
+ * key; otherwise lookups by the new key miss it. Lookups never scan the
+ * vector or the pending list, so a miss costs one hash chain. They never
+ * change the index either, and may run concurrently.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "memory.h"
+#include "vector.h"
+
+#define VI_MIN_SIZE 64
+#define VI_KEY_LEN 32
+
+struct vi_entry {
+	void *elem;
+	unsigned int hash;
+	int pending;
+	struct vi_entry *next_key;
+	struct vi_entry *next_elem;
+};
+
+struct vector_index {
+	struct vector_index *next;
+	vector_key_fn *key;
+	unsigned int nr;
+	unsigned int size;
+	struct vi_entry **by_key;
+	struct vi_entry **by_elem;
+	struct vi_entry *pending;
+};
+
+static unsigned int
+vi_str_hash(const char *str)
+{
+	unsigned int h = 2166136261U;
+
+	while (*str) {
+		h ^= (unsigned char)*str++;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+static unsigned int
+vi_elem_hash(const void *elem)
+{
+	return ((uintptr_t)elem >> 4) * 2654435761U;
+}
+
+static const char *
+vi_key(const struct vector_index *idx, const void *elem, char *buf)
+{
+	const char *key = idx->key(elem, buf, VI_KEY_LEN);
+
+	return (key && *key) ? key : NULL;
+}
+
+static void
+vi_file(struct vector_index *idx, struct vi_entry *e)
+{
+	char buf[VI_KEY_LEN];
+	const char *key = vi_key(idx, e->elem, buf);
+	struct vi_entry **head;
+
+	if (!key) {
+		e->pending = 1;
+		head = &idx->pending;
+	} else {
+		e->pending = 0;
+		e->hash = vi_str_hash(key);
+		head = &idx->by_key[e->hash & (idx->size - 1)];
+	}
+	e->next_key = *head;
+	*head = e;
+}
+
+static void
+vi_unfile(struct vector_index *idx, struct vi_entry *e)
+{
+	struct vi_entry **pe;
+
+	if (e->pending)
+		pe = &idx->pending;
+	else
+		pe = &idx->by_key[e->hash & (idx->size - 1)];
+	for (; *pe; pe = &(*pe)->next_key) {
+		if (*pe == e) {
+			*pe = e->next_key;
+			return;
+		}
+	}
+}
+
+static int
+vi_resize(struct vector_index *idx, unsigned int size)
+{
+	struct vi_entry **by_key, **by_elem, *e, *next;
+	unsigned int i, old_size = idx->size;
+
+	by_key = MALLOC(size * sizeof(struct vi_entry *));
+	by_elem = MALLOC(size * sizeof(struct vi_entry *));
+	if (!by_key || !by_elem) {
+		FREE_PTR(by_key);
+		FREE_PTR(by_elem);
+		return -1;
+	}
+	for (i = 0; i < old_size; i++) {
+		for (e = idx->by_elem[i]; e; e = next) {
+			unsigned int slot = vi_elem_hash(e->elem) & (size - 1);
+
+			next = e->next_elem;
+			e->next_elem = by_elem[slot];
+			by_elem[slot] = e;
+			if (!e->pending) {
+				slot = e->hash & (size - 1);
+				e->next_key = by_key[slot];
+				by_key[slot] = e;
+			}
+		}
+	}
+	FREE_PTR(idx->by_key);
+	FREE_PTR(idx->by_elem);
+	idx->by_key = by_key;
+	idx->by_elem = by_elem;
+	idx->size = size;
+	return 0;
+}
+
+static int
+vi_insert(struct vector_index *idx, void *elem)
+{
+	struct vi_entry *e;
+	unsigned int slot;
+
+	if (idx->nr >= idx->size && vi_resize(idx, 2 * idx->size))
+		return -1;
+	e = MALLOC(sizeof(struct vi_entry));
+	if (!e)
+		return -1;
+	e->elem = elem;
+	slot = vi_elem_hash(elem) & (idx->size - 1);
+	e->next_elem = idx->by_elem[slot];
+	idx->by_elem[slot] = e;
+	vi_file(idx, e);
+	idx->nr++;
+	return 0;
+}
+
+static void
+vi_remove(struct vector_index *idx, void *elem)
+{
+	struct vi_entry **pe;
+
+	pe = &idx->by_elem[vi_elem_hash(elem) & (idx->size - 1)];
+	for (; *pe; pe = &(*pe)->next_elem) {
+		struct vi_entry *e = *pe;
+
+		if (e->elem == elem) {
+			*pe = e->next_elem;
+			vi_unfile(idx, e);
+			FREE(e);
+			idx->nr--;
+			return;
+		}
+	}
+}
+
+static void
+vi_free(struct vector_index *idx)
+{
+	struct vi_entry *e, *next;
+	unsigned int i;
+
+	for (i = 0; i < idx->size; i++) {
+		for (e = idx->by_elem[i]; e; e = next) {
+			next = e->next_elem;
+			FREE(e);
+		}
+	}
+	FREE(idx->by_key);
+	FREE(idx->by_elem);
+	FREE(idx);
+}
+
+/*
+ * If one of the indexes can't be updated, it is dropped, and lookups
+ * by that key fall back to scanning the vector.
+ */
+static void
+vi_drop(vector v, struct vector_index *idx)
+{
+	struct vector_index **pi;
+
+	for (pi = &v->index; *pi; pi = &(*pi)->next) {
+		if (*pi == idx) {
+			*pi = idx->next;
+			vi_free(idx);
+			return;
+		}
+	}
+}
+
+void
+vector_index_insert(vector v, void *elem)
+{
+	struct vector_index *idx, *next;
+
+	if (!elem)
+		return;
+	for (idx = v->index; idx; idx = next) {
+		next = idx->next;
+		if (vi_insert(idx, elem))
+			vi_drop(v, idx);
+	}
+}
+
+void
+vector_index_remove(vector v, void *elem)
+{
+	struct vector_index *idx;
+
+	if (!elem)
+		return;
+	for (idx = v->index; idx; idx = idx->next)
+		vi_remove(idx, elem);
+}
+
+static struct vi_entry *
+vi_lookup_elem(const struct vector_index *idx, const void *elem)
+{
+	struct vi_entry *e;
+
+	e = idx->by_elem[vi_elem_hash(elem) & (idx->size - 1)];
+	for (; e; e = e->next_elem)
+		if (e->elem == elem)
+			return e;
+	return NULL;
+}
+
+/*
+ * File @elem, which is in @v, under its current keys. Must be called
+ * whenever a key of an element changes, with the lock protecting @v
+ * held for writing.
+ */
+void
+vector_index_rekey(vector v, void *elem)
+{
+	struct vector_index *idx;
+	struct vi_entry *e;
+
+	if (!v || !elem)
+		return;
+	for (idx = v->index; idx; idx = idx->next) {
+		e = vi_lookup_elem(idx, elem);
+		if (!e)
+			continue;
+		vi_unfile(idx, e);
+		vi_file(idx, e);
+	}
+}
+
+void
+vector_index_free(vector v)
+{
+	struct vector_index *idx, *next;
+
+	for (idx = v->index; idx; idx = next) {
+		next = idx->next;
+		vi_free(idx);
+	}
+	v->index = NULL;
+}
+
+/*
+ * Add an index by the key returned by @key to @v.
+ * Returns 0 on success and -1 on failure.
+ */
+int
+vector_add_index(vector v, vector_key_fn *key)
+{
+	struct vector_index *idx;
+	void *elem;
+	int i;
+
+	if (!v)
+		return -1;
+	idx = MALLOC(sizeof(struct vector_index));
+	if (!idx)
+		return -1;
+	idx->key = key;
+	if (vi_resize(idx, VI_MIN_SIZE)) {
+		FREE(idx);
+		return -1;
+	}
+	vector_foreach_slot(v, elem, i) {
+		if (vi_insert(idx, elem)) {
+			vi_free(idx);
+			return -1;
+		}
+	}
+	idx->next = v->index;
+	v->index = idx;
+	return 0;
+}
+
+/*
+ * Look up the element of @v whose key, as returned by @key, is @str.
+ * Returns -1 if @v has no index by that key, and 0 otherwise, with the
+ * element (or NULL, if there's none) stored in @elem.
+ */
+int
+vector_index_find(vector v, vector_key_fn *key, const char *str, void **elem)
+{
+	const struct vector_index *idx;
+	const struct vi_entry *e;
+	char buf[VI_KEY_LEN];
+	const char *k;
+	unsigned int hash;
+
+	if (!v)
+		return -1;
+	for (idx = v->index; idx; idx = idx->next)
+		if (idx->key == key)
+			break;
+	if (!idx)
+		return -1;
+
+	*elem = NULL;
+	if (!*str)
+		return 0;
+
+	hash = vi_str_hash(str);
+	for (e = idx->by_key[hash & (idx->size - 1)]; e; e = e->next_key) {
+		if (e->hash != hash)
+			continue;
+		k = vi_key(idx, e->elem, buf);
+		if (k && !strcmp(k, str)) {
+			*elem = e->elem;
+			return 0;
+		}
+	}
+	return 0;
+}
@@ -21,6 +21,7 @@
 #include "debug.h"
 #include "lock.h"
 #include "waiter.h"
+#include "dmevents.h"
 
 pthread_attr_t waiter_attr;
 
@@ -50,6 +51,10 @@ void stop_waiter_thread (struct multipath *mpp, struct vectors *vecs)
 {
 	pthread_t thread;
 
+	if (poll_dmevents) {
+		unwatch_dmevents(mpp->alias);
+		return;
+	}
 	if (mpp->waiter == (pthread_t)0) {
 		condlog(3, "%s: event checker thread already stopped",
 			mpp->alias);
@@ -190,6 +195,15 @@ int start_waiter_thread (struct multipath *mpp, struct vectors *vecs)
 	if (!mpp)
 		return 0;
 
+	if (poll_dmevents) {
+		if (watch_dmevents(mpp->alias)) {
+			condlog(0, "%s: failed to watch for dm events",
+				mpp->alias);
+			return 1;
+		}
+		return 0;
+	}
+
 	wp = alloc_waiter();
 
 	if (!wp)
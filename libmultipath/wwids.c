@@ -5,6 +5,7 @@
 #include <limits.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #include "checkers.h"
 #include "vector.h"
@@ -15,44 +16,156 @@
 #include "wwids.h"
 #include "defaults.h"
 #include "config.h"
+#include "memory.h"
+#include "util.h"
 
 /*
  * Copyright (c) 2010 Benjamin Marzinski, Redhat
  */
 
+/*
+ * In-memory copy of the wwids file.
+ *
+ * The file is read once, and looked up through a hash index on the wwids.
+ * wwids we add are appended to the file and to the copy. Modifications by
+ * other processes (multipath -w, -W or -a) are noticed by the change of
+ * the file size or modification time, and trigger a reload.
+ */
+struct wwids_db {
+	pthread_mutex_t lock;
+	char file[PATH_MAX];
+	int valid;
+	struct file_stamp stamp;
+	vector wwids;
+};
+
+static struct wwids_db wwids_db = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static const char *
+wwid_key(const void *elem, char *buf, size_t len)
+{
+	return (const char *)elem;
+}
+
+static void
+free_wwids(vector wwids)
+{
+	char *wwid;
+	int i;
+
+	vector_foreach_slot(wwids, wwid, i)
+		FREE(wwid);
+	vector_free(wwids);
+}
+
 static int
-lookup_wwid(FILE *f, char *wwid) {
-	int c;
-	char buf[LINE_MAX];
-	int count;
-
-	while ((c = fgetc(f)) != EOF){
-		if (c != '/') {
-			if (fgets(buf, LINE_MAX, f) == NULL)
-				return 0;
-			else
-				continue;
-		}
-		count = 0;
-		while ((c = fgetc(f)) != '/') {
-			if (c == EOF)
-				return 0;
-			if (count >= WWID_SIZE - 1)
-				goto next;
-			if (wwid[count] == '\0')
-				goto next;
-			if (c != wwid[count++])
-				goto next;
-		}
-		if (wwid[count] == '\0')
-			return 1;
-next:
-		if (fgets(buf, LINE_MAX, f) == NULL)
-			return 0;
+add_wwid(vector wwids, const char *wwid)
+{
+	char *str;
+
+	str = STRDUP(wwid);
+	if (!str)
+		return -1;
+	if (!vector_alloc_slot(wwids)) {
+		FREE(str);
+		return -1;
 	}
+	vector_set_slot(wwids, str);
 	return 0;
 }
 
+static int
+lookup_wwid(vector wwids, const char *wwid)
+{
+	void *elem;
+
+	return !vector_index_find(wwids, wwid_key, wwid, &elem) &&
+		elem != NULL;
+}
+
+/* Valid lines are "/<wwid>/", anything else is ignored */
+static int
+load_wwids(int fd, const char *file)
+{
+	char *buf, *line, *next, *end;
+	vector wwids;
+	int ret = -1;
+
+	buf = read_file_contents(fd);
+	if (!buf)
+		return -1;
+	wwids = vector_alloc();
+	if (!wwids || vector_add_index(wwids, wwid_key))
+		goto out;
+
+	for (line = buf; line && *line; line = next) {
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		if (*line != '/')
+			continue;
+		end = strchr(++line, '/');
+		if (!end || end == line || end - line >= WWID_SIZE)
+			continue;
+		*end = '\0';
+		if (!lookup_wwid(wwids, line) && add_wwid(wwids, line))
+			goto out;
+	}
+	if (get_file_stamp(fd, &wwids_db.stamp))
+		goto out;
+
+	free_wwids(wwids_db.wwids);
+	wwids_db.wwids = wwids;
+	wwids = NULL;
+	strlcpy(wwids_db.file, file, sizeof(wwids_db.file));
+	wwids_db.valid = 1;
+	condlog(4, "loaded %d wwids from %s", VECTOR_SIZE(wwids_db.wwids),
+		file);
+	ret = 0;
+out:
+	if (wwids)
+		free_wwids(wwids);
+	free(buf);
+	return ret;
+}
+
+/*
+ * Make sure the in-memory copy matches @file, which is open as @fd if
+ * @fd >= 0. Caller must hold wwids_db.lock.
+ */
+static int
+refresh_wwids(char *file, int fd)
+{
+	int can_write, ret;
+
+	if (wwids_db.valid && !strcmp(wwids_db.file, file) &&
+	    !file_stamp_changed(fd, file, &wwids_db.stamp))
+		return 0;
+	if (fd >= 0)
+		return load_wwids(fd, file);
+
+	fd = open_file(file, &can_write, WWIDS_FILE_HEADER);
+	if (fd < 0)
+		return -1;
+	ret = load_wwids(fd, file);
+	close(fd);
+	return ret;
+}
+
+static void
+invalidate_wwids(void)
+{
+	pthread_mutex_lock(&wwids_db.lock);
+	wwids_db.valid = 0;
+	pthread_mutex_unlock(&wwids_db.lock);
+}
+
+static void
+unlock_wwids(void *unused)
+{
+	pthread_mutex_unlock(&wwids_db.lock);
+}
+
 static int
 write_out_wwid(int fd, char *wwid) {
 	int ret;
@@ -130,6 +243,7 @@ replace_wwids(vector mp)
 	ret = 0;
 out_file:
 	close(fd);
+	invalidate_wwids();
 out:
 	return ret;
 }
@@ -218,6 +332,7 @@ remove_wwid(char *wwid) {
 
 out_file:
 	close(fd);
+	invalidate_wwids();
 out:
 	free(str);
 	return ret;
@@ -226,52 +341,53 @@ out:
 int
 check_wwids_file(char *wwid, int write_wwid)
 {
-	int fd, can_write, found, ret;
-	FILE *f;
+	int fd = -1, can_write, ret = -1;
+	char file[PATH_MAX];
 	struct config *conf;
 
 	conf = get_multipath_config();
-	fd = open_file(conf->wwids_file, &can_write, WWIDS_FILE_HEADER);
+	strlcpy(file, conf->wwids_file, sizeof(file));
 	put_multipath_config(conf);
-	if (fd < 0)
-		return -1;
 
-	f = fdopen(fd, "r");
-	if (!f) {
-		condlog(0,"can't fdopen wwids file : %s", strerror(errno));
-		close(fd);
-		return -1;
-	}
-	found = lookup_wwid(f, wwid);
-	if (found) {
+	pthread_mutex_lock(&wwids_db.lock);
+	pthread_cleanup_push(unlock_wwids, NULL);
+	if (refresh_wwids(file, -1))
+		goto out;
+	if (lookup_wwid(wwids_db.wwids, wwid)) {
 		ret = 0;
 		goto out;
 	}
-	if (!write_wwid) {
-		ret = -1;
+	if (!write_wwid)
+		goto out;
+
+	fd = open_file(file, &can_write, WWIDS_FILE_HEADER);
+	if (fd < 0)
+		goto out;
+	/* another process may have added it since */
+	if (refresh_wwids(file, fd))
+		goto out;
+	if (lookup_wwid(wwids_db.wwids, wwid)) {
+		ret = 0;
 		goto out;
 	}
 	if (!can_write) {
 		condlog(0, "wwids file is read-only. Can't write wwid");
-		ret = -1;
-		goto out;
-	}
-
-	if (fflush(f) != 0) {
-		condlog(0, "cannot fflush wwids file stream : %s",
-			strerror(errno));
-		ret = -1;
 		goto out;
 	}
 
 	ret = write_out_wwid(fd, wwid);
+	if (ret == 1 && (add_wwid(wwids_db.wwids, wwid) ||
+			 get_file_stamp(fd, &wwids_db.stamp)))
+		wwids_db.valid = 0;
 out:
-	fclose(f);
+	if (fd >= 0)
+		close(fd);
+	pthread_cleanup_pop(1);
 	return ret;
 }
 
-int
-should_multipath(struct path *pp1, vector pathvec)
+static int
+__should_multipath(struct path *pp1, vector pathvec, int nr_paths)
 {
 	int i, ignore_new_devs;
 	struct path *pp2;
@@ -286,17 +402,22 @@ should_multipath(struct path *pp1, vector pathvec)
 	put_multipath_config(conf);
 
 	condlog(4, "checking if %s should be multipathed", pp1->dev);
-	if (!ignore_new_devs) {
+	if (!ignore_new_devs && nr_paths < 0) {
+		nr_paths = 1;
 		vector_foreach_slot(pathvec, pp2, i) {
 			if (pp1->dev == pp2->dev)
 				continue;
 			if (strncmp(pp1->wwid, pp2->wwid, WWID_SIZE) == 0) {
-				condlog(3, "found multiple paths with wwid %s, "
-					"multipathing %s", pp1->wwid, pp1->dev);
-				return 1;
+				nr_paths++;
+				break;
 			}
 		}
 	}
+	if (!ignore_new_devs && nr_paths > 1) {
+		condlog(3, "found multiple paths with wwid %s, "
+			"multipathing %s", pp1->wwid, pp1->dev);
+		return 1;
+	}
 	if (check_wwids_file(pp1->wwid, 0) < 0) {
 		condlog(3, "wwid %s not in wwids file, skipping %s",
 			pp1->wwid, pp1->dev);
@@ -307,6 +428,22 @@ should_multipath(struct path *pp1, vector pathvec)
 	return 1;
 }
 
+int
+should_multipath(struct path *pp1, vector pathvec)
+{
+	return __should_multipath(pp1, pathvec, -1);
+}
+
+/*
+ * Like should_multipath(), for callers which already know that
+ * @nr_paths paths have the WWID of @pp1.
+ */
+int
+should_multipath_nr(struct path *pp1, int nr_paths)
+{
+	return __should_multipath(pp1, NULL, nr_paths);
+}
+
 int
 remember_wwid(char *wwid)
 {
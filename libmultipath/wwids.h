@@ -13,6 +13,7 @@
 "# Valid WWIDs:\n"
 
 int should_multipath(struct path *pp, vector pathvec);
+int should_multipath_nr(struct path *pp, int nr_paths);
 int remember_wwid(char *wwid);
 int check_wwids_file(char *wwid, int write_wwid);
 int remove_wwid(char *wwid);
@@ -60,6 +60,7 @@
 #include "uxsock.h"
 #include "mpath_cmd.h"
 #include "foreign.h"
+#include "config_snapshot.h"
 
 int logsink;
 struct udev *udev;
@@ -308,7 +309,7 @@ static int check_usable_paths(struct config *conf,
 	}
 
 	/* pathvec is needed for disassemble_map */
-	pathvec = vector_alloc();
+	pathvec = alloc_indexed_pathvec();
 	if (pathvec == NULL)
 		goto free;
 
@@ -371,8 +372,8 @@ configure (struct config *conf, enum mpath_cmds cmd,
 	/*
 	 * allocate core vectors to store paths and multipaths
 	 */
-	curmp = vector_alloc();
-	pathvec = vector_alloc();
+	curmp = alloc_indexed_mpvec();
+	pathvec = alloc_indexed_pathvec();
 
 	if (!curmp || !pathvec) {
 		condlog(0, "can not allocate memory");
@@ -389,8 +390,7 @@ configure (struct config *conf, enum mpath_cmds cmd,
 	if (dev && (dev_type == DEV_DEVNODE ||
 		    dev_type == DEV_UEVENT) &&
 	    cmd != CMD_REMOVE_WWID &&
-	    (filter_devnode(conf->blist_devnode,
-			    conf->elist_devnode, dev) > 0)) {
+	    (filter_devnode(conf, dev) > 0)) {
 		if (cmd == CMD_VALID_PATH)
 			printf("%s is not a valid multipath device path\n",
 			       devpath);
@@ -472,9 +472,6 @@ configure (struct config *conf, enum mpath_cmds cmd,
 	if (conf->verbosity > 2)
 		print_all_paths(pathvec, 1);
 
-	get_path_layout(pathvec, 0);
-	foreign_path_layout();
-
 	if (get_dm_mpvec(cmd, curmp, pathvec, refwwid))
 		goto out;
 
@@ -518,63 +515,15 @@ out:
 static int
 dump_config (struct config *conf)
 {
-	char * c, * tmp = NULL;
-	char * reply;
-	unsigned int maxlen = 256;
-	int again = 1;
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply) {
-			if (tmp)
-				free(tmp);
-			return 1;
-		}
-		c = tmp = reply;
-		c += snprint_defaults(conf, c, reply + maxlen - c);
-		again = ((c - reply) == maxlen);
-		if (again) {
-			reply = REALLOC(reply, maxlen *= 2);
-			continue;
-		}
-		c += snprint_blacklist(conf, c, reply + maxlen - c);
-		again = ((c - reply) == maxlen);
-		if (again) {
-			reply = REALLOC(reply, maxlen *= 2);
-			continue;
-		}
-		c += snprint_blacklist_except(conf, c, reply + maxlen - c);
-		again = ((c - reply) == maxlen);
-		if (again) {
-			reply = REALLOC(reply, maxlen *= 2);
-			continue;
-		}
-		c += snprint_hwtable(conf, c, reply + maxlen - c, conf->hwtable);
-		again = ((c - reply) == maxlen);
-		if (again) {
-			reply = REALLOC(reply, maxlen *= 2);
-			continue;
-		}
-		c += snprint_overrides(conf, c, reply + maxlen - c,
-				       conf->overrides);
-		again = ((c - reply) == maxlen);
-		if (again) {
-			reply = REALLOC(reply, maxlen *= 2);
-			continue;
-		}
-		if (VECTOR_SIZE(conf->mptable) > 0) {
-			c += snprint_mptable(conf, c, reply + maxlen - c,
-					     conf->mptable);
-			again = ((c - reply) == maxlen);
-			if (again)
-				reply = REALLOC(reply, maxlen *= 2);
-		}
-	}
+	struct strbuf reply = STRBUF_INIT;
+	int r = 0;
 
-	printf("%s", reply);
-	FREE(reply);
-	return 0;
+	if (snprint_config(conf, &reply) < 0)
+		r = 1;
+	else
+		printf("%s", get_strbuf_str(&reply));
+	reset_strbuf(&reply);
+	return r;
 }
 
 static int
@@ -652,6 +601,28 @@ out:
 	return r;
 }
 
+/*
+ * "multipath -u" and "-c" run for every uevent of every path device,
+ * they use the config snapshot of multipathd if it is current.
+ */
+static struct config *
+load_main_config (int argc, char *argv[])
+{
+	struct config *conf;
+	int i;
+
+	for (i = 1; i < argc && strcmp(argv[i], "--"); i++) {
+		if (strcmp(argv[i], "-u") && strcmp(argv[i], "-c"))
+			continue;
+		conf = load_config_snapshot(DEFAULT_CONFIGFILE,
+					    DEFAULT_CONFIG_SNAPSHOT);
+		if (conf)
+			return conf;
+		break;
+	}
+	return load_config(DEFAULT_CONFIGFILE);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -667,7 +638,7 @@ main (int argc, char *argv[])
 
 	udev = udev_new();
 	logsink = 0;
-	conf = load_config(DEFAULT_CONFIGFILE);
+	conf = load_main_config(argc, argv);
 	if (!conf)
 		exit(1);
 	multipath_conf = conf;
@@ -11,9 +11,11 @@
 #include "parser.h"
 #include "util.h"
 #include "version.h"
+#include "strbuf.h"
 #include <readline/readline.h>
 
 #include "cli.h"
+#include "snapshot.h"
 
 static vector keys;
 static vector handlers;
@@ -105,6 +107,24 @@ set_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *))
 		return 1;
 	h->fn = fn;
 	h->locked = 1;
+	h->snapshot = 0;
+	return 0;
+}
+
+/*
+ * The handler is called with the vectors of the current topology
+ * snapshot instead of the live ones, and without vecs->lock.
+ */
+int
+set_snapshot_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *))
+{
+	struct handler * h = find_handler(fp);
+
+	if (!h)
+		return 1;
+	h->fn = fn;
+	h->locked = 0;
+	h->snapshot = 1;
 	return 0;
 }
 
@@ -117,6 +137,7 @@ set_unlocked_handler_callback (uint64_t fp,int (*fn)(void *, char **, int *, voi
 		return 1;
 	h->fn = fn;
 	h->locked = 0;
+	h->snapshot = 0;
 	return 0;
 }
 
@@ -212,6 +233,8 @@ load_keys (void)
 	r += add_key(keys, "setprkey", SETPRKEY, 0);
 	r += add_key(keys, "unsetprkey", UNSETPRKEY, 0);
 	r += add_key(keys, "key", KEY, 1);
+	r += add_key(keys, "binary", BINARY, 0);
+	r += add_key(keys, "checkers", CHECKERS, 0);
 
 
 	if (r) {
@@ -349,27 +372,26 @@ alloc_handlers (void)
 }
 
 static int
-genhelp_sprint_aliases (char * reply, int maxlen, vector keys,
+genhelp_sprint_aliases (struct strbuf *reply, vector keys,
 			struct key * refkw)
 {
-	int i, len = 0;
+	int i, r;
 	struct key * kw;
 
 	vector_foreach_slot (keys, kw, i) {
 		if (kw->code == refkw->code && kw != refkw) {
-			len += snprintf(reply + len, maxlen - len,
-					"|%s", kw->str);
-			if (len >= maxlen)
-				return len;
+			r = print_strbuf(reply, "|%s", kw->str);
+			if (r < 0)
+				return r;
 		}
 	}
 
-	return len;
+	return 0;
 }
 
 static int
-do_genhelp(char *reply, int maxlen, const char *cmd, int error) {
-	int len = 0;
+do_genhelp(struct strbuf *reply, const char *cmd, int error) {
+	int r = 0;
 	int i, j;
 	uint64_t fp;
 	struct handler * h;
@@ -377,79 +399,60 @@ do_genhelp(char *reply, int maxlen, const char *cmd, int error) {
 
 	switch(error) {
 	case ENOMEM:
-		len += snprintf(reply + len, maxlen - len,
-				"%s: Not enough memory\n", cmd);
+		r = print_strbuf(reply, "%s: Not enough memory\n", cmd);
 		break;
 	case EAGAIN:
-		len += snprintf(reply + len, maxlen - len,
-				"%s: not found\n", cmd);
+		r = print_strbuf(reply, "%s: not found\n", cmd);
 		break;
 	case EINVAL:
-		len += snprintf(reply + len, maxlen - len,
-				"%s: Missing argument\n", cmd);
+		r = print_strbuf(reply, "%s: Missing argument\n", cmd);
 		break;
 	}
-	if (len >= maxlen)
-		goto out;
-	len += snprintf(reply + len, maxlen - len, VERSION_STRING);
-	if (len >= maxlen)
-		goto out;
-	len += snprintf(reply + len, maxlen - len, "CLI commands reference:\n");
-	if (len >= maxlen)
-		goto out;
+	if (r < 0)
+		return r;
+	if ((r = print_strbuf(reply, VERSION_STRING)) < 0 ||
+	    (r = append_strbuf_str(reply, "CLI commands reference:\n")) < 0)
+		return r;
 
 	vector_foreach_slot (handlers, h, i) {
 		fp = h->fingerprint;
 		vector_foreach_slot (keys, kw, j) {
 			if ((kw->code & fp)) {
 				fp -= kw->code;
-				len += snprintf(reply + len , maxlen - len,
-						" %s", kw->str);
-				if (len >= maxlen)
-					goto out;
-				len += genhelp_sprint_aliases(reply + len,
-							      maxlen - len,
-							      keys, kw);
-				if (len >= maxlen)
-					goto out;
-
-				if (kw->has_param) {
-					len += snprintf(reply + len,
-							maxlen - len,
-							" $%s", kw->str);
-					if (len >= maxlen)
-						goto out;
-				}
+				if ((r = print_strbuf(reply, " %s", kw->str)) < 0 ||
+				    (r = genhelp_sprint_aliases(reply, keys,
+								kw)) < 0)
+					return r;
+
+				if (kw->has_param &&
+				    (r = print_strbuf(reply, " $%s",
+						      kw->str)) < 0)
+					return r;
 			}
 		}
-		len += snprintf(reply + len, maxlen - len, "\n");
-		if (len >= maxlen)
-			goto out;
+		if ((r = append_strbuf_str(reply, "\n")) < 0)
+			return r;
 	}
-out:
-	return len;
+	return 0;
 }
 
 
 static char *
 genhelp_handler (const char *cmd, int error)
 {
-	char * reply;
-	char * p = NULL;
-	int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return NULL;
-		p = reply;
-		p += do_genhelp(reply, maxlen, cmd, error);
-		again = ((p - reply) >= maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
+	struct strbuf reply = STRBUF_INIT;
+
+	if (do_genhelp(&reply, cmd, error) < 0) {
+		reset_strbuf(&reply);
+		return NULL;
 	}
-	return reply;
+	return steal_strbuf_str(&reply);
+}
+
+static void
+cleanup_snapshot (void *arg)
+{
+	put_topology_snapshot((struct topology_snapshot *)arg);
 }
 
 int
@@ -500,8 +503,20 @@ parse_cmd (char * cmd, char ** reply, int * len, void * data, int timeout )
 			locked = 1;
 			pthread_testcancel();
 			r = h->fn(cmdvec, reply, len, data);
+			/* let the show commands see changes right away */
+			if (r == 0 && !(h->fingerprint & LIST)) {
+				topology_changed(vecs);
+				publish_topology(vecs);
+			}
 		}
 		pthread_cleanup_pop(locked);
+	} else if (h->snapshot) {
+		struct topology_snapshot *ts;
+
+		ts = get_topology_snapshot();
+		pthread_cleanup_push(cleanup_snapshot, ts);
+		r = h->fn(cmdvec, reply, len, &ts->vecs);
+		pthread_cleanup_pop(1);
 	} else
 		r = h->fn(cmdvec, reply, len, data);
 	free_keys(cmdvec);
@@ -533,6 +548,10 @@ cli_init (void) {
 	add_handler(LIST+PATHS, NULL);
 	add_handler(LIST+PATHS+FMT, NULL);
 	add_handler(LIST+PATHS+RAW+FMT, NULL);
+	add_handler(LIST+PATHS+STATS, NULL);
+	add_handler(LIST+PATHS+STATS+JSON, NULL);
+	add_handler(LIST+CHECKERS+STATS, NULL);
+	add_handler(LIST+CHECKERS+STATS+JSON, NULL);
 	add_handler(LIST+PATH, NULL);
 	add_handler(LIST+STATUS, NULL);
 	add_handler(LIST+DAEMON, NULL);
@@ -543,6 +562,7 @@ cli_init (void) {
 	add_handler(LIST+MAPS+RAW+FMT, NULL);
 	add_handler(LIST+MAPS+TOPOLOGY, NULL);
 	add_handler(LIST+MAPS+JSON, NULL);
+	add_handler(LIST+MAPS+BINARY, NULL);
 	add_handler(LIST+TOPOLOGY, NULL);
 	add_handler(LIST+MAP+TOPOLOGY, NULL);
 	add_handler(LIST+MAP+JSON, NULL);
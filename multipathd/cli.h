@@ -44,6 +44,8 @@ enum {
 	__SETPRKEY,
 	__UNSETPRKEY,
 	__KEY,
+	__BINARY,
+	__CHECKERS,
 };
 
 #define LIST		(1 << __LIST)
@@ -87,22 +89,8 @@ enum {
 #define SETPRKEY	(1ULL << __SETPRKEY)
 #define UNSETPRKEY	(1ULL << __UNSETPRKEY)
 #define KEY		(1ULL << __KEY)
-
-#define INITIAL_REPLY_LEN	1200
-
-#define REALLOC_REPLY(r, a, m)					\
-	do {							\
-		if ((a)) {					\
-			char *tmp = (r);			\
-			(r) = REALLOC((r), (m) * 2);		\
-			if ((r)) {				\
-				memset((r) + (m), 0, (m));	\
-				(m) *= 2;			\
-			}					\
-			else					\
-				free(tmp);			\
-		}						\
-	} while (0)
+#define BINARY		(1ULL << __BINARY)
+#define CHECKERS	(1ULL << __CHECKERS)
 
 struct key {
 	char * str;
@@ -114,12 +102,14 @@ struct key {
 struct handler {
 	uint64_t fingerprint;
 	int locked;
+	int snapshot;
 	int (*fn)(void *, char **, int *, void *);
 };
 
 int alloc_handlers (void);
 int add_handler (uint64_t fp, int (*fn)(void *, char **, int *, void *));
 int set_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *));
+int set_snapshot_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *));
 int set_unlocked_handler_callback (uint64_t fp, int (*fn)(void *, char **, int *, void *));
 int parse_cmd (char * cmd, char ** reply, int * len, void *, int);
 int load_keys (void);
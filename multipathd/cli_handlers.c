@@ -28,278 +28,157 @@
 #include "cli.h"
 #include "uevent.h"
 #include "foreign.h"
+#include "strbuf.h"
+
+/*
+ * Hand the rendered output over as the reply. On error, the buffer is
+ * freed and no reply is set.
+ */
+static int
+set_reply (char ** r, int * len, struct strbuf * buf, int ret)
+{
+	if (ret < 0) {
+		reset_strbuf(buf);
+		return 1;
+	}
+	*len = (int)get_strbuf_len(buf) + 1;
+	*r = steal_strbuf_str(buf);
+	return *r ? 0 : 1;
+}
 
 int
 show_paths (char ** r, int * len, struct vectors * vecs, char * style,
 	    int pretty)
 {
-	int i;
+	int i, ret = 0;
 	struct path * pp;
-	char * c;
-	char * reply, * header;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	get_path_layout(vecs->pathvec, 1);
-	foreign_path_layout();
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
-
-		if (pretty)
-			c += snprint_path_header(c, reply + maxlen - c,
-						 style);
-		header = c;
-
-		vector_foreach_slot(vecs->pathvec, pp, i)
-			c += snprint_path(c, reply + maxlen - c,
-					  style, pp, pretty);
-
-		c += snprint_foreign_paths(c, reply + maxlen - c,
-					   style, pretty);
-
-		again = ((c - reply) == (maxlen - 1));
+	struct strbuf reply = STRBUF_INIT;
+	size_t header_len = 0;
+	fieldwidth_t *width = NULL;
+
+	if (pretty) {
+		width = alloc_path_layout();
+		get_path_layout(vecs->pathvec, 1, width);
+		foreign_path_layout(width);
+		ret = snprint_path_header(&reply, style, width);
+		header_len = get_strbuf_len(&reply);
+	}
 
-		REALLOC_REPLY(reply, again, maxlen);
+	vector_foreach_slot(vecs->pathvec, pp, i) {
+		if (ret < 0)
+			break;
+		ret = snprint_path(&reply, style, pp, width);
 	}
 
-	if (pretty && c == header) {
+	if (ret >= 0)
+		ret = snprint_foreign_paths(&reply, style, width);
+
+	if (pretty && get_strbuf_len(&reply) == header_len)
 		/* No output - clear header */
-		*reply = '\0';
-		c = reply;
-	}
+		truncate_strbuf(&reply, 0);
 
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	FREE_PTR(width);
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_path (char ** r, int * len, struct vectors * vecs, struct path *pp,
 	   char * style)
 {
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	get_path_layout(vecs->pathvec, 1);
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
-
-		c += snprint_path(c, reply + maxlen - c, style, pp, 0);
+	struct strbuf reply = STRBUF_INIT;
+	int ret;
 
-		again = ((c - reply) == (maxlen - 1));
+	ret = snprint_path(&reply, style, pp, NULL);
 
-		REALLOC_REPLY(reply, again, maxlen);
-	}
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_map_topology (char ** r, int * len, struct multipath * mpp,
 		   struct vectors * vecs)
 {
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	if (update_multipath(vecs, mpp->alias, 0))
-		return 1;
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
+	struct strbuf reply = STRBUF_INIT;
+	fieldwidth_t *p_width;
+	int ret;
 
-		c += snprint_multipath_topology(c, reply + maxlen - c, mpp, 2);
-		again = ((c - reply) == (maxlen - 1));
+	p_width = alloc_path_layout();
+	get_path_layout(vecs->pathvec, 0, p_width);
+	ret = snprint_multipath_topology(&reply, mpp, 2, p_width);
 
-		REALLOC_REPLY(reply, again, maxlen);
-	}
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	FREE_PTR(p_width);
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_maps_topology (char ** r, int * len, struct vectors * vecs)
 {
-	int i;
+	int i, ret = 0;
 	struct multipath * mpp;
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	get_path_layout(vecs->pathvec, 0);
-	foreign_path_layout();
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
-
-		vector_foreach_slot(vecs->mpvec, mpp, i) {
-			if (update_multipath(vecs, mpp->alias, 0)) {
-				i--;
-				continue;
-			}
-			c += snprint_multipath_topology(c, reply + maxlen - c,
-							mpp, 2);
-		}
-		c += snprint_foreign_topology(c, reply + maxlen - c, 2);
+	struct strbuf reply = STRBUF_INIT;
+	fieldwidth_t *p_width;
 
-		again = ((c - reply) == (maxlen - 1));
+	p_width = alloc_path_layout();
+	get_path_layout(vecs->pathvec, 0, p_width);
+	foreign_path_layout(p_width);
 
-		REALLOC_REPLY(reply, again, maxlen);
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		ret = snprint_multipath_topology(&reply, mpp, 2, p_width);
+		if (ret < 0)
+			break;
 	}
+	if (ret >= 0)
+		ret = snprint_foreign_topology(&reply, 2, p_width);
 
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	FREE_PTR(p_width);
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_maps_json (char ** r, int * len, struct vectors * vecs)
 {
-	int i;
-	struct multipath * mpp;
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	if (VECTOR_SIZE(vecs->mpvec) > 0)
-		maxlen *= PRINT_JSON_MULTIPLIER * VECTOR_SIZE(vecs->mpvec);
-
-	vector_foreach_slot(vecs->mpvec, mpp, i) {
-		if (update_multipath(vecs, mpp->alias, 0)) {
-			return 1;
-		}
-	}
+	struct strbuf reply = STRBUF_INIT;
+	int ret;
 
-	reply = MALLOC(maxlen);
+	ret = snprint_multipath_topology_json(&reply, vecs);
 
-	while (again) {
-		if (!reply)
-			return 1;
+	return set_reply(r, len, &reply, ret);
+}
 
-		c = reply;
+int
+show_maps_binary (char ** r, int * len, struct vectors * vecs)
+{
+	struct strbuf reply = STRBUF_INIT;
+	int ret;
 
-		c += snprint_multipath_topology_json(c, maxlen, vecs);
-		again = ((c - reply) == maxlen);
+	ret = snprint_multipath_topology_binary(&reply, vecs);
 
-		REALLOC_REPLY(reply, again, maxlen);
-	}
-	*r = reply;
-	*len = (int)(c - reply);
-	return 0;
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_map_json (char ** r, int * len, struct multipath * mpp,
 		   struct vectors * vecs)
 {
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	if (update_multipath(vecs, mpp->alias, 0))
-		return 1;
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
+	struct strbuf reply = STRBUF_INIT;
+	int ret;
 
-		c += snprint_multipath_map_json(c, maxlen, mpp, 1);
-		again = ((c - reply) == maxlen);
+	ret = snprint_multipath_map_json(&reply, mpp);
 
-		REALLOC_REPLY(reply, again, maxlen);
-	}
-	*r = reply;
-	*len = (int)(c - reply);
-	return 0;
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_config (char ** r, int * len)
 {
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
+	struct strbuf reply = STRBUF_INIT;
 	struct config *conf;
-
-	c = reply = MALLOC(maxlen);
+	int ret;
 
 	conf = get_multipath_config();
-	while (again) {
-		if (!reply) {
-			put_multipath_config(conf);
-			return 1;
-		}
-		c = reply;
-		c += snprint_defaults(conf, c, reply + maxlen - c);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-		if (again)
-			continue;
-		c += snprint_blacklist(conf, c, reply + maxlen - c);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-		if (again)
-			continue;
-		c += snprint_blacklist_except(conf, c, reply + maxlen - c);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-		if (again)
-			continue;
-		c += snprint_hwtable(conf, c, reply + maxlen - c,
-				     conf->hwtable);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-		if (again)
-			continue;
-		c += snprint_overrides(conf, c, reply + maxlen - c,
-				       conf->overrides);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-		if (again)
-			continue;
-		if (VECTOR_SIZE(conf->mptable) > 0) {
-			c += snprint_mptable(conf, c, reply + maxlen - c,
-					     conf->mptable);
-			again = ((c - reply) == maxlen);
-			REALLOC_REPLY(reply, again, maxlen);
-		}
-	}
+	ret = snprint_config(conf, &reply);
 	put_multipath_config(conf);
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+
+	return set_reply(r, len, &reply, ret);
 }
 
 void
@@ -376,7 +255,6 @@ cli_list_map_topology (void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -405,7 +283,6 @@ cli_list_map_json (void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -427,140 +304,127 @@ cli_list_maps_json (void * v, char ** reply, int * len, void * data)
 }
 
 int
-cli_list_wildcards (void * v, char ** reply, int * len, void * data)
+cli_list_maps_binary (void * v, char ** reply, int * len, void * data)
 {
-	char * c;
+	struct vectors * vecs = (struct vectors *)data;
 
-	*reply = MALLOC(INITIAL_REPLY_LEN);
+	condlog(3, "list multipaths binary (operator)");
 
-	if (!*reply)
-		return 1;
+	return show_maps_binary(reply, len, vecs);
+}
 
-	c = *reply;
-	c += snprint_wildcards(c, INITIAL_REPLY_LEN);
+int
+cli_list_wildcards (void * v, char ** reply, int * len, void * data)
+{
+	struct strbuf buf = STRBUF_INIT;
 
-	*len = INITIAL_REPLY_LEN;
-	return 0;
+	return set_reply(reply, len, &buf, snprint_wildcards(&buf));
 }
 
 int
 show_status (char ** r, int *len, struct vectors * vecs)
 {
-	char * c;
-	char * reply;
-
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	reply = MALLOC(maxlen);
-
-	if (!reply)
-		return 1;
-
-	c = reply;
-	c += snprint_status(c, reply + maxlen - c, vecs);
+	struct strbuf reply = STRBUF_INIT;
 
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	return set_reply(r, len, &reply, snprint_status(&reply, vecs));
 }
 
 int
 show_daemon (char ** r, int *len)
 {
-	char * c;
-	char * reply;
-
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	reply = MALLOC(maxlen);
-
-	if (!reply)
-		return 1;
-
-	c = reply;
-	c += snprintf(c, INITIAL_REPLY_LEN, "pid %d %s\n",
-		      daemon_pid, daemon_status());
+	struct strbuf reply = STRBUF_INIT;
+	struct discovery_stats ds;
+	struct path_msg_stats ms;
+	struct uev_batch_stats us;
+	int ret;
 
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	ret = print_strbuf(&reply, "pid %d %s\n",
+			   daemon_pid, daemon_status());
+	get_discovery_stats(&ds);
+	if (ret >= 0 && (ds.total.tv_sec || ds.total.tv_nsec)) {
+		ret = print_strbuf(&reply, "path discovery %u/%u paths, "
+				   "%u threads, %ld.%03lds\n",
+				   ds.paths, ds.devices, ds.threads,
+				   (long)ds.total.tv_sec,
+				   ds.total.tv_nsec / 1000000);
+		if (ret >= 0)
+			ret = print_strbuf(&reply, "  enumerate %ld.%03lds "
+					   "pathinfo %ld.%03lds "
+					   "merge %ld.%03lds\n",
+					   (long)ds.enumerate.tv_sec,
+					   ds.enumerate.tv_nsec / 1000000,
+					   (long)ds.pathinfo.tv_sec,
+					   ds.pathinfo.tv_nsec / 1000000,
+					   (long)ds.merge.tv_sec,
+					   ds.merge.tv_nsec / 1000000);
+	}
+	get_path_msg_stats(&ms);
+	if (ret >= 0 && ms.batches)
+		ret = print_strbuf(&reply, "path state messages %lu in %lu "
+				   "batches to %lu maps, largest %u, "
+				   "%lu failed, %lu reloads\n",
+				   ms.messages, ms.batches, ms.maps,
+				   ms.max_batch, ms.failed, ms.reloads);
+	get_uev_batch_stats(&us);
+	if (ret >= 0 && us.batches)
+		ret = print_strbuf(&reply, "path uevents %lu in %lu batches, "
+				   "%lu map reloads, %lu reloads avoided\n",
+				   us.paths, us.batches, us.reloads,
+				   us.avoided);
+
+	return set_reply(r, len, &reply, ret);
 }
 
 int
-show_map (char ** r, int *len, struct multipath * mpp, char * style,
-	  int pretty)
+show_map (char ** r, int *len, struct vectors * vecs, struct multipath * mpp,
+	  char * style, int pretty)
 {
-	char * c;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	reply = MALLOC(maxlen);
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
-		c += snprint_multipath(c, reply + maxlen - c, style,
-				       mpp, pretty);
-
-		again = ((c - reply) == (maxlen - 1));
+	struct strbuf reply = STRBUF_INIT;
+	fieldwidth_t *width = NULL;
+	int ret;
 
-		REALLOC_REPLY(reply, again, maxlen);
+	if (pretty) {
+		width = alloc_multipath_layout();
+		get_multipath_layout(vecs->mpvec, 1, width);
 	}
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+	ret = snprint_multipath(&reply, style, mpp, width);
+
+	FREE_PTR(width);
+	return set_reply(r, len, &reply, ret);
 }
 
 int
 show_maps (char ** r, int *len, struct vectors * vecs, char * style,
 	   int pretty)
 {
-	int i;
+	int i, ret = 0;
 	struct multipath * mpp;
-	char * c, *header;
-	char * reply;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-
-	get_multipath_layout(vecs->mpvec, 1);
-	foreign_multipath_layout();
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply)
-			return 1;
-
-		c = reply;
-		if (pretty)
-			c += snprint_multipath_header(c, reply + maxlen - c,
-						      style);
-		header = c;
-
-		vector_foreach_slot(vecs->mpvec, mpp, i) {
-			if (update_multipath(vecs, mpp->alias, 0)) {
-				i--;
-				continue;
-			}
-			c += snprint_multipath(c, reply + maxlen - c,
-					       style, mpp, pretty);
-
-		}
-		c += snprint_foreign_multipaths(c, reply + maxlen - c,
-						style, pretty);
-		again = ((c - reply) == (maxlen - 1));
+	struct strbuf reply = STRBUF_INIT;
+	size_t header_len = 0;
+	fieldwidth_t *width = NULL;
+
+	if (pretty) {
+		width = alloc_multipath_layout();
+		get_multipath_layout(vecs->mpvec, 1, width);
+		foreign_multipath_layout(width);
+		ret = snprint_multipath_header(&reply, style, width);
+		header_len = get_strbuf_len(&reply);
+	}
 
-		REALLOC_REPLY(reply, again, maxlen);
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		if (ret < 0)
+			break;
+		ret = snprint_multipath(&reply, style, mpp, width);
 	}
+	if (ret >= 0)
+		ret = snprint_foreign_multipaths(&reply, style, width);
 
-	if (pretty && c == header) {
+	if (pretty && get_strbuf_len(&reply) == header_len)
 		/* No output - clear header */
-		*reply = '\0';
-		c = reply;
-	}
-	*r = reply;
-	*len = (int)(c - reply + 1);
-	return 0;
+		truncate_strbuf(&reply, 0);
+
+	FREE_PTR(width);
+	return set_reply(r, len, &reply, ret);
 }
 
 int
@@ -594,15 +458,13 @@ cli_list_map_fmt (void * v, char ** reply, int * len, void * data)
 	char * fmt = get_keyparam(v, FMT);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
-	get_multipath_layout(vecs->mpvec, 1);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 	if (!mpp)
 		return 1;
 
 	condlog(3, "list map %s fmt %s (operator)", param, fmt);
 
-	return show_map(reply, len, mpp, fmt, 1);
+	return show_map(reply, len, vecs, mpp, fmt, 1);
 }
 
 int
@@ -614,15 +476,13 @@ cli_list_map_raw (void * v, char ** reply, int * len, void * data)
 	char * fmt = get_keyparam(v, FMT);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
-	get_multipath_layout(vecs->mpvec, 1);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 	if (!mpp)
 		return 1;
 
 	condlog(3, "list map %s fmt %s (operator)", param, fmt);
 
-	return show_map(reply, len, mpp, fmt, 0);
+	return show_map(reply, len, vecs, mpp, fmt, 0);
 }
 
 int
@@ -665,6 +525,54 @@ cli_list_maps_stats (void * v, char ** reply, int * len, void * data)
 	return show_maps(reply, len, vecs, PRINT_MAP_STATS, 1);
 }
 
+int
+cli_list_paths_stats (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	struct strbuf buf = STRBUF_INIT;
+
+	condlog(3, "list paths stats (operator)");
+
+	return set_reply(reply, len, &buf, snprint_path_stats(&buf, vecs));
+}
+
+int
+cli_list_paths_stats_json (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	struct strbuf buf = STRBUF_INIT;
+
+	condlog(3, "list paths stats json (operator)");
+
+	return set_reply(reply, len, &buf,
+			 snprint_path_stats_json(&buf, vecs));
+}
+
+int
+cli_list_checkers_stats (void * v, char ** reply, int * len, void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	struct strbuf buf = STRBUF_INIT;
+
+	condlog(3, "list checkers stats (operator)");
+
+	return set_reply(reply, len, &buf,
+			 snprint_checker_stats(&buf, vecs));
+}
+
+int
+cli_list_checkers_stats_json (void * v, char ** reply, int * len,
+			      void * data)
+{
+	struct vectors * vecs = (struct vectors *)data;
+	struct strbuf buf = STRBUF_INIT;
+
+	condlog(3, "list checkers stats json (operator)");
+
+	return set_reply(reply, len, &buf,
+			 snprint_checker_stats_json(&buf, vecs));
+}
+
 int
 cli_list_daemon (void * v, char ** reply, int * len, void * data)
 {
@@ -718,8 +626,7 @@ cli_add_path (void * v, char ** reply, int * len, void * data)
 	param = convert_dev(param, 1);
 	condlog(2, "%s: add path (operator)", param);
 	conf = get_multipath_config();
-	if (filter_devnode(conf->blist_devnode, conf->elist_devnode,
-			   param) > 0) {
+	if (filter_devnode(conf, param) > 0) {
 		put_multipath_config(conf);
 		goto blacklisted;
 	}
@@ -790,7 +697,7 @@ cli_add_map (void * v, char ** reply, int * len, void * data)
 	condlog(2, "%s: add map (operator)", param);
 
 	conf = get_multipath_config();
-	if (filter_wwid(conf->blist_wwid, conf->elist_wwid, param, NULL) > 0) {
+	if (filter_wwid(conf, param, NULL) > 0) {
 		put_multipath_config(conf);
 		*reply = strdup("blacklisted\n");
 		*len = strlen(*reply) + 1;
@@ -1161,6 +1068,7 @@ cli_suspend(void * v, char ** reply, int * len, void * data)
 		return 1;
 
 	dm_get_info(param, &mpp->dmi);
+	vector_index_rekey(vecs->mpvec, mpp);
 	return 0;
 }
 
@@ -1193,6 +1101,7 @@ cli_resume(void * v, char ** reply, int * len, void * data)
 		return 1;
 
 	dm_get_info(param, &mpp->dmi);
+	vector_index_rekey(vecs->mpvec, mpp);
 	return 0;
 }
 
@@ -1275,31 +1184,15 @@ cli_fail(void * v, char ** reply, int * len, void * data)
 int
 show_blacklist (char ** r, int * len)
 {
-	char *c = NULL;
-	char *reply = NULL;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-	struct config *conf = get_multipath_config();
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply) {
-			put_multipath_config(conf);
-			return 1;
-		}
-
-		c = reply;
-		c += snprint_blacklist_report(conf, c, maxlen);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-	}
+	struct strbuf reply = STRBUF_INIT;
+	struct config *conf;
+	int ret;
 
-	*r = reply;
-	*len = (int)(c - reply + 1);
+	conf = get_multipath_config();
+	ret = snprint_blacklist_report(conf, &reply);
 	put_multipath_config(conf);
 
-	return 0;
+	return set_reply(r, len, &reply, ret);
 }
 
 int
@@ -1313,31 +1206,15 @@ cli_list_blacklist (void * v, char ** reply, int * len, void * data)
 int
 show_devices (char ** r, int * len, struct vectors *vecs)
 {
-	char *c = NULL;
-	char *reply = NULL;
-	unsigned int maxlen = INITIAL_REPLY_LEN;
-	int again = 1;
-	struct config *conf = get_multipath_config();
-
-	reply = MALLOC(maxlen);
-
-	while (again) {
-		if (!reply) {
-			put_multipath_config(conf);
-			return 1;
-		}
-
-		c = reply;
-		c += snprint_devices(conf, c, maxlen, vecs);
-		again = ((c - reply) == maxlen);
-		REALLOC_REPLY(reply, again, maxlen);
-	}
+	struct strbuf reply = STRBUF_INIT;
+	struct config *conf;
+	int ret;
 
-	*r = reply;
-	*len = (int)(c - reply + 1);
+	conf = get_multipath_config();
+	ret = snprint_devices(conf, &reply, vecs);
 	put_multipath_config(conf);
 
-	return 0;
+	return set_reply(r, len, &reply, ret);
 }
 
 int
@@ -1372,7 +1249,6 @@ cli_getprstatus (void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -1397,7 +1273,6 @@ cli_setprstatus(void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -1420,7 +1295,6 @@ cli_unsetprstatus(void * v, char ** reply, int * len, void * data)
 	char * param = get_keyparam(v, MAP);
 
 	param = convert_dev(param, 0);
-	get_path_layout(vecs->pathvec, 0);
 	mpp = find_mp_by_str(vecs->mpvec, param);
 
 	if (!mpp)
@@ -11,10 +11,17 @@ int cli_list_map_fmt (void * v, char ** reply, int * len, void * data);
 int cli_list_map_raw (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_status (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_stats (void * v, char ** reply, int * len, void * data);
+int cli_list_paths_stats (void * v, char ** reply, int * len, void * data);
+int cli_list_paths_stats_json (void * v, char ** reply, int * len,
+			       void * data);
+int cli_list_checkers_stats (void * v, char ** reply, int * len, void * data);
+int cli_list_checkers_stats_json (void * v, char ** reply, int * len,
+				  void * data);
 int cli_list_map_topology (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_topology (void * v, char ** reply, int * len, void * data);
 int cli_list_map_json (void * v, char ** reply, int * len, void * data);
 int cli_list_maps_json (void * v, char ** reply, int * len, void * data);
+int cli_list_maps_binary (void * v, char ** reply, int * len, void * data);
 int cli_list_config (void * v, char ** reply, int * len, void * data);
 int cli_list_blacklist (void * v, char ** reply, int * len, void * data);
 int cli_list_devices (void * v, char ** reply, int * len, void * data);
@@ -18,6 +18,7 @@
 #include <linux/oom.h>
 #include <libudev.h>
 #include <urcu.h>
+#include <urcu/uatomic.h>
 #ifdef USE_SYSTEMD
 #include <systemd/sd-daemon.h>
 #endif
@@ -29,6 +30,8 @@
  * libmultipath
  */
 #include "time-util.h"
+#include "path_sched.h"
+#include "uring.h"
 
 /*
  * libcheckers
@@ -80,11 +83,14 @@ static int use_watchdog;
 #include "uxclnt.h"
 #include "cli.h"
 #include "cli_handlers.h"
+#include "snapshot.h"
 #include "lock.h"
 #include "waiter.h"
+#include "dmevents.h"
 #include "io_err_stat.h"
 #include "wwids.h"
 #include "foreign.h"
+#include "config_snapshot.h"
 #include "../third-party/valgrind/drd.h"
 
 #define FILE_NAME_SIZE 256
@@ -288,7 +294,8 @@ static void
 switch_pathgroup (struct multipath * mpp)
 {
 	mpp->stat_switchgroup++;
-	dm_switchgroup(mpp->alias, mpp->bestpg);
+	if (!dm_switchgroup(mpp->alias, mpp->bestpg))
+		mpp->nextpg = mpp->bestpg;
 	condlog(2, "%s: switch to path group #%i",
 		 mpp->alias, mpp->bestpg);
 }
@@ -544,11 +551,51 @@ ev_remove_map (char * devname, char * alias, int minor, struct vectors * vecs)
 	return flush_map(mpp, vecs, 0);
 }
 
+/*
+ * Called with vecs->lock held, for an add uevent of a path which is
+ * already in the pathvec. If the path never got a WWID, run pathinfo
+ * again, and drop it if it turns out to be blacklisted.
+ * returns:
+ * PATHINFO_OK: path must be added with ev_add_path()
+ * PATHINFO_SKIPPED: nothing to do
+ * PATHINFO_FAILED: error
+ */
+static int
+reinit_spurious_path (struct uevent *uev, struct path *pp,
+		      struct vectors *vecs)
+{
+	struct config *conf;
+	int r, i;
+
+	condlog(2, "%s: spurious uevent, path already in pathvec",
+		uev->kernel);
+	if (pp->mpp || strlen(pp->wwid))
+		return PATHINFO_SKIPPED;
+
+	condlog(3, "%s: reinitialize path", uev->kernel);
+	wait_path_checked(pp);
+	udev_device_unref(pp->udev);
+	pp->udev = udev_device_ref(uev->udev);
+	conf = get_multipath_config();
+	r = pathinfo(pp, conf, DI_ALL | DI_BLACKLIST);
+	put_multipath_config(conf);
+	vector_index_rekey(vecs->pathvec, pp);
+	if (r == PATHINFO_SKIPPED) {
+		condlog(3, "%s: remove blacklisted path", uev->kernel);
+		i = find_slot(vecs->pathvec, (void *)pp);
+		if (i != -1)
+			vector_del_slot(vecs->pathvec, i);
+		free_path(pp);
+	} else if (r != PATHINFO_OK)
+		condlog(0, "%s: failed to reinitialize path", uev->kernel);
+	return r;
+}
+
 static int
 uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 {
 	struct path *pp;
-	int ret = 0, i;
+	int ret = 0;
 	struct config *conf;
 
 	condlog(2, "%s: add path (uevent)", uev->kernel);
@@ -565,33 +612,11 @@ uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 	pthread_testcancel();
 	pp = find_path_by_dev(vecs->pathvec, uev->kernel);
 	if (pp) {
-		int r;
-
-		condlog(2, "%s: spurious uevent, path already in pathvec",
-			uev->kernel);
-		if (!pp->mpp && !strlen(pp->wwid)) {
-			condlog(3, "%s: reinitialize path", uev->kernel);
-			udev_device_unref(pp->udev);
-			pp->udev = udev_device_ref(uev->udev);
-			conf = get_multipath_config();
-			r = pathinfo(pp, conf,
-				     DI_ALL | DI_BLACKLIST);
-			put_multipath_config(conf);
-			if (r == PATHINFO_OK)
-				ret = ev_add_path(pp, vecs, need_do_map);
-			else if (r == PATHINFO_SKIPPED) {
-				condlog(3, "%s: remove blacklisted path",
-					uev->kernel);
-				i = find_slot(vecs->pathvec, (void *)pp);
-				if (i != -1)
-					vector_del_slot(vecs->pathvec, i);
-				free_path(pp);
-			} else {
-				condlog(0, "%s: failed to reinitialize path",
-					uev->kernel);
-				ret = 1;
-			}
-		}
+		ret = reinit_spurious_path(uev, pp, vecs);
+		if (ret == PATHINFO_OK)
+			ret = ev_add_path(pp, vecs, need_do_map);
+		else
+			ret = (ret == PATHINFO_FAILED);
 	}
 	lock_cleanup_pop(vecs->lock);
 	if (pp)
@@ -618,6 +643,7 @@ uev_add_path (struct uevent *uev, struct vectors * vecs, int need_do_map)
 		conf = get_multipath_config();
 		pp->checkint = conf->checkint;
 		put_multipath_config(conf);
+		schedule_path(pp);
 		ret = ev_add_path(pp, vecs, need_do_map);
 	} else {
 		condlog(0, "%s: failed to store path info, "
@@ -903,6 +929,257 @@ fail:
 	return 1;
 }
 
+static struct uev_batch_stats uev_batch_stats;
+static pthread_mutex_t uev_batch_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+get_uev_batch_stats (struct uev_batch_stats *stats)
+{
+	pthread_mutex_lock(&uev_batch_stats_lock);
+	*stats = uev_batch_stats;
+	pthread_mutex_unlock(&uev_batch_stats_lock);
+}
+
+static void
+count_uev_batch (unsigned int paths, unsigned int reloads)
+{
+	if (!paths)
+		return;
+	pthread_mutex_lock(&uev_batch_stats_lock);
+	uev_batch_stats.batches++;
+	uev_batch_stats.paths += paths;
+	uev_batch_stats.reloads += reloads;
+	if (paths > reloads)
+		uev_batch_stats.avoided += paths - reloads;
+	pthread_mutex_unlock(&uev_batch_stats_lock);
+}
+
+struct uev_path {
+	struct uevent *uev;
+	struct path *pp;
+	int known;	/* add: the path was in the pathvec already */
+};
+
+struct uev_paths {
+	struct uev_path *p;
+	int nr;
+};
+
+static void
+cleanup_uev_paths (void *arg)
+{
+	struct uev_paths *up = arg;
+	int i;
+
+	for (i = 0; i < up->nr; i++)
+		if (up->p[i].pp)
+			free_path(up->p[i].pp);
+	FREE(up->p);
+}
+
+/*
+ * Fill @up with the head uevent @uev and the uevents merged into it,
+ * oldest first.
+ */
+static int
+get_uev_paths (struct uevent *uev, struct uev_paths *up)
+{
+	struct uevent *merge_uev;
+	int n = 1;
+
+	list_for_each_entry(merge_uev, &uev->merge_node, node)
+		n++;
+	up->nr = 0;
+	up->p = MALLOC(n * sizeof(*up->p));
+	if (!up->p)
+		return 1;
+	list_for_each_entry(merge_uev, &uev->merge_node, node)
+		up->p[up->nr++].uev = merge_uev;
+	up->p[up->nr++].uev = uev;
+	return 0;
+}
+
+/*
+ * All uevents of a merged group are adds for paths with the same WWID.
+ * Look up which of the paths are known already, under a short hold of
+ * vecs->lock, and run pathinfo for the new ones without holding it.
+ * Then store and adopt them under one acquisition of the lock, and push
+ * the map to the device-mapper once, for the last path added.
+ */
+static int
+uev_add_paths (struct uevent *uev, struct vectors *vecs)
+{
+	struct uev_paths up;
+	struct config *conf;
+	struct path *pp;
+	int i, ret, r = 0, nr_add = 0, nr_retry = 0;
+
+	if (get_uev_paths(uev, &up)) {
+		struct uevent *merge_uev, *tmp;
+
+		list_for_each_entry_safe(merge_uev, tmp, &uev->merge_node, node)
+			r += uev_add_path(merge_uev, vecs, 0);
+		return r + uev_add_path(uev, vecs, 1);
+	}
+	pthread_cleanup_push(cleanup_uev_paths, &up);
+
+	for (i = 0; i < up.nr; i++) {
+		struct uevent *u = up.p[i].uev;
+
+		condlog(2, "%s: add path (uevent batch of %d)",
+			u->kernel, up.nr);
+		if (strstr(u->kernel, "..") != NULL) {
+			condlog(0, "%s: path name is invalid", u->kernel);
+			up.p[i].uev = NULL;
+			r++;
+		}
+	}
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	for (i = 0; i < up.nr; i++)
+		up.p[i].known = up.p[i].uev &&
+			find_path_by_dev(vecs->pathvec, up.p[i].uev->kernel);
+	lock_cleanup_pop(vecs->lock);
+
+	for (i = 0; i < up.nr; i++) {
+		struct uevent *u = up.p[i].uev;
+
+		if (!u || up.p[i].known)
+			continue;
+		conf = get_multipath_config();
+		ret = alloc_path_with_pathinfo(conf, u->udev, u->wwid,
+					       DI_ALL, &up.p[i].pp);
+		put_multipath_config(conf);
+		if (!up.p[i].pp && ret != PATHINFO_SKIPPED) {
+			condlog(3, "%s: failed to get path info", u->kernel);
+			r++;
+		}
+	}
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	/*
+	 * Once stored, the pathvec owns the paths; collect them in a local
+	 * array so that the cleanup handler leaves them be.
+	 */
+	{
+		struct path *add[up.nr];
+
+		for (i = 0; i < up.nr; i++) {
+			struct uevent *u = up.p[i].uev;
+
+			if (!up.p[i].pp && !up.p[i].known)
+				continue;
+			pp = find_path_by_dev(vecs->pathvec, u->kernel);
+			if (pp) {
+				if (up.p[i].pp) {
+					/* added in the meantime */
+					free_path(up.p[i].pp);
+					up.p[i].pp = NULL;
+				}
+				ret = reinit_spurious_path(u, pp, vecs);
+				if (ret == PATHINFO_OK)
+					add[nr_add++] = pp;
+				else if (ret == PATHINFO_FAILED)
+					r++;
+				continue;
+			}
+			if (up.p[i].known) {
+				/*
+				 * Removed in the meantime, add it afresh
+				 * below. The entries up to i are done with.
+				 */
+				up.p[nr_retry++].uev = u;
+				continue;
+			}
+			pp = up.p[i].pp;
+			up.p[i].pp = NULL;
+			if (store_path(vecs->pathvec, pp)) {
+				condlog(0, "%s: failed to store path info, "
+					"dropping event", u->kernel);
+				free_path(pp);
+				r++;
+				continue;
+			}
+			conf = get_multipath_config();
+			pp->checkint = conf->checkint;
+			put_multipath_config(conf);
+			schedule_path(pp);
+			add[nr_add++] = pp;
+		}
+		for (i = 0; i < nr_add; i++)
+			r += ev_add_path(add[i], vecs, i == nr_add - 1);
+	}
+	lock_cleanup_pop(vecs->lock);
+	for (i = 0; i < nr_retry; i++)
+		r += uev_add_path(up.p[i].uev, vecs, 1);
+	pthread_cleanup_pop(1);
+	count_uev_batch(nr_add, nr_add > 0);
+	return r;
+}
+
+/*
+ * All uevents of a merged group are removals of paths with the same
+ * WWID. Remove them under one acquisition of vecs->lock, and reload the
+ * map once, for the last path which still belongs to it.
+ */
+static int
+uev_remove_paths (struct uevent *uev, struct vectors *vecs)
+{
+	struct uev_paths up;
+	struct path *pp;
+	int i, r = 0, nr_del = 0, last = -1;
+
+	if (get_uev_paths(uev, &up)) {
+		struct uevent *merge_uev, *tmp;
+
+		list_for_each_entry_safe(merge_uev, tmp, &uev->merge_node, node)
+			r += uev_remove_path(merge_uev, vecs, 0);
+		return r + uev_remove_path(uev, vecs, 1);
+	}
+	pthread_cleanup_push(cleanup_uev_paths, &up);
+
+	for (i = 0; i < up.nr; i++) {
+		condlog(2, "%s: remove path (uevent batch of %d)",
+			up.p[i].uev->kernel, up.nr);
+		delete_foreign(up.p[i].uev->udev);
+	}
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	/*
+	 * up.p[].pp doesn't own the paths here, the pathvec does; collect
+	 * them in a local array so that the cleanup handler leaves them be.
+	 */
+	{
+		struct path *del[up.nr];
+
+		for (i = 0; i < up.nr; i++) {
+			pp = find_path_by_dev(vecs->pathvec,
+					      up.p[i].uev->kernel);
+			if (!pp) {
+				/* Not an error; path might have been purged earlier */
+				condlog(0, "%s: path already removed",
+					up.p[i].uev->kernel);
+				continue;
+			}
+			if (pp->mpp)
+				last = nr_del;
+			del[nr_del++] = pp;
+		}
+		for (i = 0; i < nr_del; i++)
+			r += ev_remove_path(del[i], vecs, i == last);
+	}
+	lock_cleanup_pop(vecs->lock);
+	pthread_cleanup_pop(1);
+	count_uev_batch(nr_del, last >= 0);
+	return r;
+}
+
 static int
 uev_update_path (struct uevent *uev, struct vectors * vecs)
 {
@@ -955,7 +1232,7 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 				strcpy(pp->wwid, wwid);
 				if (!pp->wwid_changed) {
 					pp->wwid_changed = 1;
-					pp->tick = 1;
+					set_path_tick(pp, 1);
 					if (pp->mpp)
 						dm_fail_path(pp->mpp->alias, pp->dev_t);
 				}
@@ -965,6 +1242,7 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 			else
 				pp->wwid_changed = 0;
 		} else {
+			wait_path_checked(pp);
 			udev_device_unref(pp->udev);
 			pp->udev = udev_device_ref(uev->udev);
 			conf = get_multipath_config();
@@ -972,6 +1250,7 @@ uev_update_path (struct uevent *uev, struct vectors * vecs)
 				condlog(1, "%s: pathinfo failed after change uevent",
 					uev->kernel);
 			put_multipath_config(conf);
+			vector_index_rekey(vecs->pathvec, pp);
 		}
 
 		if (pp->initialized == INIT_REQUESTED_UDEV)
@@ -1119,7 +1398,6 @@ uev_trigger (struct uevent * uev, void * trigger_data)
 {
 	int r = 0;
 	struct vectors * vecs;
-	struct uevent *merge_uev, *tmp;
 
 	vecs = (struct vectors *)trigger_data;
 
@@ -1163,13 +1441,15 @@ uev_trigger (struct uevent * uev, void * trigger_data)
 	}
 
 	/*
-	 * path add/remove/change event, add/remove maybe merged
+	 * path add/remove/change event, add/remove maybe merged.
+	 * Merged uevents share the WWID and the action of @uev.
 	 */
-	list_for_each_entry_safe(merge_uev, tmp, &uev->merge_node, node) {
-		if (!strncmp(merge_uev->action, "add", 3))
-			r += uev_add_path(merge_uev, vecs, 0);
-		if (!strncmp(merge_uev->action, "remove", 6))
-			r += uev_remove_path(merge_uev, vecs, 0);
+	if (!list_empty(&uev->merge_node)) {
+		if (!strncmp(uev->action, "add", 3))
+			r = uev_add_paths(uev, vecs);
+		else if (!strncmp(uev->action, "remove", 6))
+			r = uev_remove_paths(uev, vecs);
+		goto out;
 	}
 
 	if (!strncmp(uev->action, "add", 3))
@@ -1180,9 +1460,24 @@ uev_trigger (struct uevent * uev, void * trigger_data)
 		r += uev_update_path(uev, vecs);
 
 out:
+	/* the topology snapshot is republished after the batch */
+	topology_changed(vecs);
 	return r;
 }
 
+/* publish the topology changed by a batch of uevents */
+static void
+uev_batch_done (void * trigger_data)
+{
+	struct vectors * vecs = (struct vectors *)trigger_data;
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	publish_topology(vecs);
+	lock_cleanup_pop(vecs->lock);
+}
+
 static void rcu_unregister(void *param)
 {
 	rcu_unregister_thread();
@@ -1206,7 +1501,7 @@ uevqloop (void * ap)
 {
 	pthread_cleanup_push(rcu_unregister, NULL);
 	rcu_register_thread();
-	if (uevent_dispatch(&uev_trigger, ap))
+	if (uevent_dispatch(&uev_trigger, &uev_batch_done, ap))
 		condlog(0, "error starting uevent dispatcher");
 	pthread_cleanup_pop(1);
 	return NULL;
@@ -1220,24 +1515,31 @@ uxlsnrloop (void * ap)
 	}
 	pthread_cleanup_push(rcu_unregister, NULL);
 	rcu_register_thread();
-	set_handler_callback(LIST+PATHS, cli_list_paths);
-	set_handler_callback(LIST+PATHS+FMT, cli_list_paths_fmt);
-	set_handler_callback(LIST+PATHS+RAW+FMT, cli_list_paths_raw);
-	set_handler_callback(LIST+PATH, cli_list_path);
-	set_handler_callback(LIST+MAPS, cli_list_maps);
-	set_handler_callback(LIST+STATUS, cli_list_status);
+	set_snapshot_handler_callback(LIST+PATHS, cli_list_paths);
+	set_snapshot_handler_callback(LIST+PATHS+FMT, cli_list_paths_fmt);
+	set_snapshot_handler_callback(LIST+PATHS+RAW+FMT, cli_list_paths_raw);
+	set_snapshot_handler_callback(LIST+PATH, cli_list_path);
+	set_handler_callback(LIST+PATHS+STATS, cli_list_paths_stats);
+	set_handler_callback(LIST+PATHS+STATS+JSON,
+			     cli_list_paths_stats_json);
+	set_handler_callback(LIST+CHECKERS+STATS, cli_list_checkers_stats);
+	set_handler_callback(LIST+CHECKERS+STATS+JSON,
+			     cli_list_checkers_stats_json);
+	set_snapshot_handler_callback(LIST+MAPS, cli_list_maps);
+	set_snapshot_handler_callback(LIST+STATUS, cli_list_status);
 	set_unlocked_handler_callback(LIST+DAEMON, cli_list_daemon);
-	set_handler_callback(LIST+MAPS+STATUS, cli_list_maps_status);
-	set_handler_callback(LIST+MAPS+STATS, cli_list_maps_stats);
-	set_handler_callback(LIST+MAPS+FMT, cli_list_maps_fmt);
-	set_handler_callback(LIST+MAPS+RAW+FMT, cli_list_maps_raw);
-	set_handler_callback(LIST+MAPS+TOPOLOGY, cli_list_maps_topology);
-	set_handler_callback(LIST+TOPOLOGY, cli_list_maps_topology);
-	set_handler_callback(LIST+MAPS+JSON, cli_list_maps_json);
-	set_handler_callback(LIST+MAP+TOPOLOGY, cli_list_map_topology);
-	set_handler_callback(LIST+MAP+FMT, cli_list_map_fmt);
-	set_handler_callback(LIST+MAP+RAW+FMT, cli_list_map_fmt);
-	set_handler_callback(LIST+MAP+JSON, cli_list_map_json);
+	set_snapshot_handler_callback(LIST+MAPS+STATUS, cli_list_maps_status);
+	set_snapshot_handler_callback(LIST+MAPS+STATS, cli_list_maps_stats);
+	set_snapshot_handler_callback(LIST+MAPS+FMT, cli_list_maps_fmt);
+	set_snapshot_handler_callback(LIST+MAPS+RAW+FMT, cli_list_maps_raw);
+	set_snapshot_handler_callback(LIST+MAPS+TOPOLOGY, cli_list_maps_topology);
+	set_snapshot_handler_callback(LIST+TOPOLOGY, cli_list_maps_topology);
+	set_snapshot_handler_callback(LIST+MAPS+JSON, cli_list_maps_json);
+	set_snapshot_handler_callback(LIST+MAPS+BINARY, cli_list_maps_binary);
+	set_snapshot_handler_callback(LIST+MAP+TOPOLOGY, cli_list_map_topology);
+	set_snapshot_handler_callback(LIST+MAP+FMT, cli_list_map_fmt);
+	set_snapshot_handler_callback(LIST+MAP+RAW+FMT, cli_list_map_fmt);
+	set_snapshot_handler_callback(LIST+MAP+JSON, cli_list_map_json);
 	set_handler_callback(LIST+CONFIG, cli_list_config);
 	set_handler_callback(LIST+BLACKLIST, cli_list_blacklist);
 	set_handler_callback(LIST+DEVICES, cli_list_devices);
@@ -1284,6 +1586,213 @@ exit_daemon (void)
 	post_config_state(DAEMON_SHUTDOWN);
 }
 
+/*
+ * Path state messages of a checker pass.
+ *
+ * During a pass, fail_path() and reinstate_path() update our state at
+ * once, but only queue their dm message. The queued messages are sent
+ * map by map when the pass ends, and before anything else is sent to a
+ * map or a map is reloaded, so the kernel sees them in the same order.
+ * If a reinstate takes a map out of recovery mode, queue_if_no_path is
+ * queued behind it. A failed reinstate is taken out of the active path
+ * count again, and reloads the map, once per map, at the end of the
+ * pass.
+ */
+enum path_msg_type {
+	PATH_MSG_FAIL,
+	PATH_MSG_REINSTATE,
+	PATH_MSG_QUEUE_MODE,
+};
+
+struct path_msg {
+	struct path *pp;
+	struct multipath *mpp;
+	unsigned int seq;
+	enum path_msg_type type;
+	int add_active;		/* REINSTATE: counted in mpp->nr_active */
+	int retry_tick;		/* QUEUE_MODE: mpp->retry_tick before */
+};
+
+struct path_msg_batch {
+	bool active;
+	struct path_msg *msgs;
+	unsigned int nr;
+	unsigned int size;
+	vector reload;		/* paths whose reinstate failed */
+};
+
+static struct path_msg_batch path_msgs;
+static struct path_msg_stats path_msg_stats;
+static pthread_mutex_t path_msg_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void
+get_path_msg_stats (struct path_msg_stats *stats)
+{
+	pthread_mutex_lock(&path_msg_stats_lock);
+	*stats = path_msg_stats;
+	pthread_mutex_unlock(&path_msg_stats_lock);
+}
+
+/*
+ * Returns the queued message, which stays valid until the next one is
+ * queued, or NULL if the message must be sent right away.
+ */
+static struct path_msg *
+queue_path_msg (struct path * pp, enum path_msg_type type)
+{
+	struct path_msg_batch *pb = &path_msgs;
+	struct path_msg *msg;
+
+	if (!pb->active)
+		return NULL;
+	if (pb->nr == pb->size) {
+		unsigned int size = pb->size ? 2 * pb->size : 64;
+
+		msg = REALLOC(pb->msgs, size * sizeof(struct path_msg));
+		if (!msg)
+			return NULL;
+		pb->msgs = msg;
+		pb->size = size;
+	}
+	msg = &pb->msgs[pb->nr];
+	msg->pp = pp;
+	msg->mpp = pp->mpp;
+	msg->seq = pb->nr++;
+	msg->type = type;
+	msg->add_active = 0;
+	msg->retry_tick = 0;
+	return msg;
+}
+
+static int
+path_msg_cmp (const void *a, const void *b)
+{
+	const struct path_msg *ma = a, *mb = b;
+
+	if (ma->mpp != mb->mpp)
+		return (uintptr_t)ma->mpp < (uintptr_t)mb->mpp ? -1 : 1;
+	return ma->seq < mb->seq ? -1 : ma->seq > mb->seq;
+}
+
+/*
+ * Send the queued path state messages, grouped by map.
+ * Caller must hold vecs->lock.
+ */
+static void
+send_path_msgs (void)
+{
+	struct path_msg_batch *pb = &path_msgs;
+	struct path_msg *msg;
+	struct multipath *mpp = NULL;
+	unsigned long maps = 0, sent = 0, failed = 0;
+	unsigned int i;
+
+	if (!pb->nr)
+		return;
+
+	qsort(pb->msgs, pb->nr, sizeof(struct path_msg), path_msg_cmp);
+	for (i = 0; i < pb->nr; i++) {
+		msg = &pb->msgs[i];
+		/* the path left the map since, the reload took care of it */
+		if (msg->pp->mpp != msg->mpp)
+			continue;
+		if (msg->mpp != mpp) {
+			mpp = msg->mpp;
+			maps++;
+		}
+		if (msg->type == PATH_MSG_QUEUE_MODE) {
+			if (mpp->nr_active > 0) {
+				leave_recovery_mode(mpp);
+				sent++;
+			} else if (!mpp->retry_tick)
+				/* the reinstate failed, still recovering */
+				mpp->retry_tick = msg->retry_tick;
+			continue;
+		}
+		sent++;
+		if (msg->type == PATH_MSG_FAIL) {
+			if (!dm_fail_path(mpp->alias, msg->pp->dev_t))
+				continue;
+			/* try again on the next check */
+			msg->pp->dmstate = PSTATE_UNDEF;
+		} else {
+			if (!dm_reinstate_path(mpp->alias, msg->pp->dev_t))
+				continue;
+			condlog(0, "%s: reinstate failed", msg->pp->dev_t);
+			msg->pp->dmstate = PSTATE_UNDEF;
+			if (msg->add_active) {
+				mpp->nr_active--;
+				condlog(2, "%s: remaining active paths: %d",
+					mpp->alias, mpp->nr_active);
+			}
+			set_path_tick(msg->pp, 1);
+			if (!pb->reload)
+				pb->reload = vector_alloc();
+			if (pb->reload && vector_alloc_slot(pb->reload))
+				vector_set_slot(pb->reload, msg->pp);
+		}
+		failed++;
+	}
+
+	pthread_mutex_lock(&path_msg_stats_lock);
+	path_msg_stats.batches++;
+	path_msg_stats.messages += sent;
+	path_msg_stats.maps += maps;
+	path_msg_stats.failed += failed;
+	if (pb->nr > path_msg_stats.max_batch)
+		path_msg_stats.max_batch = pb->nr;
+	pthread_mutex_unlock(&path_msg_stats_lock);
+	pb->nr = 0;
+}
+
+static void
+start_path_msgs (void)
+{
+	path_msgs.nr = 0;
+	path_msgs.active = true;
+}
+
+/*
+ * End of the checker pass: send the queued messages, and reload the maps
+ * in which a path couldn't be reinstated.
+ * Caller must hold vecs->lock.
+ */
+static void
+flush_path_msgs (struct vectors * vecs)
+{
+	struct path_msg_batch *pb = &path_msgs;
+	struct multipath *mpp;
+	struct path *pp, *pp1;
+	unsigned long reloads = 0;
+	int i, j;
+
+	send_path_msgs();
+	pb->active = false;
+	if (!pb->reload)
+		return;
+
+	for (i = 0; i < VECTOR_SIZE(pb->reload); i++) {
+		pp = VECTOR_SLOT(pb->reload, i);
+		if (!pp || !(mpp = pp->mpp))
+			continue;
+		/* one reload per map */
+		for (j = i + 1; j < VECTOR_SIZE(pb->reload); j++) {
+			pp1 = VECTOR_SLOT(pb->reload, j);
+			if (pp1 && pp1->mpp == mpp)
+				pb->reload->slot[j] = NULL;
+		}
+		condlog(3, "%s: reload map", pp->dev);
+		ev_add_path(pp, vecs, 1);
+		reloads++;
+	}
+	vector_free(pb->reload);
+	pb->reload = NULL;
+
+	pthread_mutex_lock(&path_msg_stats_lock);
+	path_msg_stats.reloads += reloads;
+	pthread_mutex_unlock(&path_msg_stats_lock);
+}
+
 static void
 fail_path (struct path * pp, int del_active)
 {
@@ -1293,7 +1802,9 @@ fail_path (struct path * pp, int del_active)
 	condlog(2, "checker failed path %s in map %s",
 		 pp->dev_t, pp->mpp->alias);
 
-	dm_fail_path(pp->mpp->alias, pp->dev_t);
+	if (queue_path_msg(pp, PATH_MSG_FAIL) ||
+	    !dm_fail_path(pp->mpp->alias, pp->dev_t))
+		pp->dmstate = PSTATE_FAILED;
 	if (del_active)
 		update_queue_mode_del_path(pp->mpp);
 }
@@ -1304,16 +1815,39 @@ fail_path (struct path * pp, int del_active)
 static int
 reinstate_path (struct path * pp, int add_active)
 {
+	struct path_msg *msg;
 	int ret = 0;
 
 	if (!pp->mpp)
 		return 0;
 
-	if (dm_reinstate_path(pp->mpp->alias, pp->dev_t)) {
+	if ((msg = queue_path_msg(pp, PATH_MSG_REINSTATE))) {
+		int retry_tick = pp->mpp->retry_tick;
+
+		condlog(2, "%s: reinstating", pp->dev_t);
+		pp->dmstate = PSTATE_ACTIVE;
+		if (add_active) {
+			msg->add_active = 1;
+			if (!__update_queue_mode_add_path(pp->mpp))
+				return 0;
+			/* queue_if_no_path must follow the reinstate */
+			msg = queue_path_msg(pp, PATH_MSG_QUEUE_MODE);
+			if (msg)
+				msg->retry_tick = retry_tick;
+			else {
+				send_path_msgs();
+				if (pp->mpp->nr_active > 0)
+					leave_recovery_mode(pp->mpp);
+				else
+					pp->mpp->retry_tick = retry_tick;
+			}
+		}
+	} else if (dm_reinstate_path(pp->mpp->alias, pp->dev_t)) {
 		condlog(0, "%s: reinstate failed", pp->dev_t);
 		ret = 1;
 	} else {
 		condlog(2, "%s: reinstated", pp->dev_t);
+		pp->dmstate = PSTATE_ACTIVE;
 		if (add_active)
 			update_queue_mode_add_path(pp->mpp);
 	}
@@ -1339,7 +1873,9 @@ enable_group(struct path * pp)
 
 	if (pgp->status == PGSTATE_DISABLED) {
 		condlog(2, "%s: enable group #%i", pp->mpp->alias, pp->pgindex);
-		dm_enablegroup(pp->mpp->alias, pp->pgindex);
+		send_path_msgs();
+		if (!dm_enablegroup(pp->mpp->alias, pp->pgindex))
+			pgp->status = PGSTATE_ENABLED;
 	}
 }
 
@@ -1398,6 +1934,7 @@ missing_uev_wait_tick(struct vectors *vecs)
 	vector_foreach_slot (vecs->mpvec, mpp, i) {
 		if (mpp->wait_for_udev && --mpp->uev_wait_tick <= 0) {
 			timed_out = 1;
+			topology_changed(vecs);
 			condlog(0, "%s: timeout waiting on creation uevent. enabling reloads", mpp->alias);
 			if (mpp->wait_for_udev > 1 && update_map(mpp, vecs)) {
 				/* update_map removed map */
@@ -1430,6 +1967,7 @@ ghost_delay_tick(struct vectors *vecs)
 		if (--mpp->ghost_delay_tick <= 0) {
 			condlog(0, "%s: timed out waiting for active path",
 				mpp->alias);
+			topology_changed(vecs);
 			mpp->force_udev_reload = 1;
 			if (update_map(mpp, vecs) != 0) {
 				/* update_map removed map */
@@ -1441,17 +1979,18 @@ ghost_delay_tick(struct vectors *vecs)
 }
 
 static void
-defered_failback_tick (vector mpvec)
+defered_failback_tick (struct vectors * vecs)
 {
 	struct multipath * mpp;
 	unsigned int i;
 
-	vector_foreach_slot (mpvec, mpp, i) {
+	vector_foreach_slot (vecs->mpvec, mpp, i) {
 		/*
 		 * deferred failback getting sooner
 		 */
 		if (mpp->pgfailback > 0 && mpp->failback_tick > 0) {
 			mpp->failback_tick--;
+			topology_changed(vecs);
 
 			if (!mpp->failback_tick && need_switch_pathgroup(mpp, 1))
 				switch_pathgroup(mpp);
@@ -1460,13 +1999,14 @@ defered_failback_tick (vector mpvec)
 }
 
 static void
-retry_count_tick(vector mpvec)
+retry_count_tick(struct vectors *vecs)
 {
 	struct multipath *mpp;
 	unsigned int i;
 
-	vector_foreach_slot (mpvec, mpp, i) {
+	vector_foreach_slot (vecs->mpvec, mpp, i) {
 		if (mpp->retry_tick > 0) {
+			topology_changed(vecs);
 			mpp->stat_total_queueing_time++;
 			condlog(4, "%s: Retrying.. No active path", mpp->alias);
 			if(--mpp->retry_tick == 0) {
@@ -1533,35 +2073,34 @@ void repair_path(struct path * pp)
 }
 
 /*
- * Returns '1' if the path has been checked, '-1' if it was blacklisted
+ * Called for paths whose check deadline has passed.
+ * Returns '1' if the path checker should run for this path,
  * and '0' otherwise
  */
-int
-check_path (struct vectors * vecs, struct path * pp, int ticks)
+static int
+check_path_due (struct path * pp)
 {
-	int newstate;
-	int new_path_up = 0;
-	int chkr_new_path_up = 0;
-	int add_active;
-	int disable_reinstate = 0;
-	int oldchkrstate = pp->chkrstate;
 	int retrigger_tries, checkint;
 	struct config *conf;
-	int ret;
-
-	if ((pp->initialized == INIT_OK ||
-	     pp->initialized == INIT_REQUESTED_UDEV) && !pp->mpp)
-		return 0;
-
-	if (pp->tick)
-		pp->tick -= (pp->tick > ticks) ? ticks : pp->tick;
-	if (pp->tick)
-		return 0; /* don't check this path yet */
 
 	conf = get_multipath_config();
 	retrigger_tries = conf->retrigger_tries;
 	checkint = conf->checkint;
 	put_multipath_config(conf);
+
+	/*
+	 * provision a next check soonest,
+	 * in case we exit abnormaly from here.
+	 * Paths which are not checked now are looked at again
+	 * after checkint, too.
+	 */
+	set_path_tick(pp, checkint);
+	schedule_path(pp);
+
+	if ((pp->initialized == INIT_OK ||
+	     pp->initialized == INIT_REQUESTED_UDEV) && !pp->mpp)
+		return 0;
+
 	if (!pp->mpp && pp->initialized == INIT_MISSING_UDEV &&
 	    pp->retriggers < retrigger_tries) {
 		condlog(2, "%s: triggering change event to reinitialize",
@@ -1573,11 +2112,18 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 		return 0;
 	}
 
-	/*
-	 * provision a next check soonest,
-	 * in case we exit abnormaly from here
-	 */
-	pp->tick = checkint;
+	return 1;
+}
+
+/*
+ * Run the path checker. This only touches the path itself (and the
+ * checker context of its map), so it may run in a checker worker thread.
+ */
+static int
+get_new_path_state (struct path * pp)
+{
+	int newstate;
+	struct config *conf;
 
 	newstate = path_offline(pp);
 	/*
@@ -1595,6 +2141,45 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 	} else
 		checker_clear_message(&pp->checker);
 
+	return newstate;
+}
+
+/*
+ * Generation of the current checker pass. The table and status of a map
+ * are read at most once per pass, and shared by all its paths checked in
+ * that pass. The messages we send to the map (fail, reinstate, switch and
+ * enable group) update the in-memory copy as they succeed, and reloads
+ * re-read it, so it stays in sync with the kernel for the whole pass.
+ */
+static unsigned long check_gen;
+
+static int
+update_map_strings_once (struct vectors * vecs, struct multipath * mpp)
+{
+	if (mpp->sync_gen == check_gen)
+		return 0;
+	if (update_multipath_strings(mpp, vecs->pathvec, 1))
+		return 1;
+	mpp->sync_gen = check_gen;
+	return 0;
+}
+
+/*
+ * Apply the checker result to the path and its map.
+ * Returns '1' if the path has been checked, '-1' if it was blacklisted
+ * and '0' otherwise
+ */
+static int
+update_path_state (struct vectors * vecs, struct path * pp, int newstate)
+{
+	int new_path_up = 0;
+	int chkr_new_path_up = 0;
+	int add_active;
+	int disable_reinstate = 0;
+	int oldchkrstate = pp->chkrstate;
+	struct config *conf;
+	int ret;
+
 	if (pp->wwid_changed) {
 		condlog(2, "%s: path wwid has changed. Refusing to use",
 			pp->dev);
@@ -1615,8 +2200,9 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 			conf = get_multipath_config();
 			ret = pathinfo(pp, conf, DI_ALL | DI_BLACKLIST);
 			if (ret == PATHINFO_OK) {
+				set_path_tick(pp, 1);
+				send_path_msgs();
 				ev_add_path(pp, vecs, 1);
-				pp->tick = 1;
 			} else if (ret == PATHINFO_SKIPPED) {
 				put_multipath_config(conf);
 				return -1;
@@ -1630,13 +2216,13 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 	 * and reschedule as soon as possible
 	 */
 	if (newstate == PATH_PENDING) {
-		pp->tick = 1;
+		set_path_tick(pp, 1);
 		return 0;
 	}
 	/*
 	 * Synchronize with kernel state
 	 */
-	if (update_multipath_strings(pp->mpp, vecs->pathvec, 1)) {
+	if (update_map_strings_once(vecs, pp->mpp)) {
 		condlog(1, "%s: Could not synchronize with kernel state",
 			pp->dev);
 		pp->dmstate = PSTATE_UNDEF;
@@ -1651,7 +2237,7 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 		 * to reschedule as soon as possible,so that this path can
 		 * be recoverd in time
 		 */
-		pp->tick = 1;
+		set_path_tick(pp, 1);
 		return 1;
 	}
 
@@ -1741,8 +2327,9 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 		}
 		if (!disable_reinstate && reinstate_path(pp, add_active)) {
 			condlog(3, "%s: reload map", pp->dev);
+			set_path_tick(pp, 1);
+			send_path_msgs();
 			ev_add_path(pp, vecs, 1);
-			pp->tick = 1;
 			return 0;
 		}
 		new_path_up = 1;
@@ -1764,8 +2351,9 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 			/* Clear IO errors */
 			if (reinstate_path(pp, 0)) {
 				condlog(3, "%s: reload map", pp->dev);
+				set_path_tick(pp, 1);
+				send_path_msgs();
 				ev_add_path(pp, vecs, 1);
-				pp->tick = 1;
 				return 0;
 			}
 		} else {
@@ -1789,7 +2377,7 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 			}
 			if (pp->watch_checks > 0)
 				pp->watch_checks--;
-			pp->tick = pp->checkint;
+			set_path_tick(pp, pp->checkint);
 		}
 	}
 	else if (newstate != PATH_UP && newstate != PATH_GHOST) {
@@ -1821,16 +2409,19 @@ check_path (struct vectors * vecs, struct path * pp, int ticks)
 
 	if (update_prio(pp, new_path_up) &&
 	    (pp->mpp->pgpolicyfn == (pgpolicyfn *)group_by_prio) &&
-	     pp->mpp->pgfailback == -FAILBACK_IMMEDIATE)
+	     pp->mpp->pgfailback == -FAILBACK_IMMEDIATE) {
+		send_path_msgs();
 		update_path_groups(pp->mpp, vecs, !new_path_up);
-	else if (need_switch_pathgroup(pp->mpp, 0)) {
+	} else if (need_switch_pathgroup(pp->mpp, 0)) {
 		if (pp->mpp->pgfailback > 0 &&
 		    (new_path_up || pp->mpp->failback_tick <= 0))
 			pp->mpp->failback_tick =
 				pp->mpp->pgfailback + 1;
 		else if (pp->mpp->pgfailback == -FAILBACK_IMMEDIATE ||
-			 (chkr_new_path_up && followover_should_failback(pp)))
+			 (chkr_new_path_up && followover_should_failback(pp))) {
+			send_path_msgs();
 			switch_pathgroup(pp->mpp);
+		}
 	}
 	return 1;
 }
@@ -1848,20 +2439,366 @@ static void init_path_check_interval(struct vectors *vecs)
 	}
 }
 
+/*
+ * Checker worker pool.
+ *
+ * With checker_threads > 0, the path checkers of all paths due in a tick
+ * are run by a pool of worker threads, and only the resulting state
+ * transitions are applied serially by the checker thread. Paths are
+ * sharded by map, so that paths sharing a map checker context are
+ * always checked by the same worker.
+ *
+ * vecs->lock is released while the workers run. The due paths are pinned
+ * (see pin_path()) so that they can't be freed, and so that orphaning
+ * them or replacing their udev device waits until their check is done.
+ * Paths which were freed meanwhile are skipped when the results are
+ * applied.
+ */
+
+struct checker_work {
+	struct path *pp;
+	unsigned int shard;
+	int newstate;
+};
+
+struct checker_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t start_cond;
+	pthread_cond_t done_cond;
+	pthread_t *threads;
+	unsigned int nr_threads;
+	unsigned int generation;
+	unsigned int pending;
+	int abort;
+	struct checker_work *work;
+	unsigned int nr_work;
+	unsigned int work_size;
+};
+
+static struct checker_pool checker_pool = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start_cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+};
+
+struct checker_worker_arg {
+	unsigned int id;
+};
+
+static void cleanup_mutex(void *arg)
+{
+	pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+static void *
+checker_worker (void *arg)
+{
+	struct checker_pool *cp = &checker_pool;
+	unsigned int id = ((struct checker_worker_arg *)arg)->id;
+	unsigned int generation = 0, i;
+	int oldstate;
+
+	FREE(arg);
+	pthread_cleanup_push(rcu_unregister, NULL);
+	rcu_register_thread();
+	while (1) {
+		pthread_mutex_lock(&cp->lock);
+		pthread_cleanup_push(cleanup_mutex, &cp->lock);
+		while (cp->generation == generation)
+			pthread_cond_wait(&cp->start_cond, &cp->lock);
+		generation = cp->generation;
+		pthread_cleanup_pop(1);
+
+		/*
+		 * Every path of this worker must be marked checked, or
+		 * freeing it would wait forever. So never stop in the
+		 * middle of a batch.
+		 */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+		for (i = 0; i < cp->nr_work; i++) {
+			struct checker_work *cw = &cp->work[i];
+
+			if (cw->shard != id)
+				continue;
+			if (!uatomic_read(&cp->abort))
+				cw->newstate = get_new_path_state(cw->pp);
+			path_checked(cw->pp);
+		}
+		pthread_mutex_lock(&cp->lock);
+		if (--cp->pending == 0)
+			pthread_cond_signal(&cp->done_cond);
+		pthread_mutex_unlock(&cp->lock);
+		pthread_setcancelstate(oldstate, NULL);
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static void
+stop_checker_pool (void)
+{
+	struct checker_pool *cp = &checker_pool;
+	unsigned int i;
+
+	for (i = 0; i < cp->nr_threads; i++)
+		pthread_cancel(cp->threads[i]);
+	for (i = 0; i < cp->nr_threads; i++)
+		pthread_join(cp->threads[i], NULL);
+	FREE(cp->threads);
+	cp->threads = NULL;
+	cp->nr_threads = 0;
+	FREE(cp->work);
+	cp->work = NULL;
+	cp->work_size = 0;
+	cp->nr_work = 0;
+}
+
+static void
+cleanup_checker_pool (void *arg)
+{
+	stop_checker_pool();
+}
+
+static int
+start_checker_pool (unsigned int nr_threads)
+{
+	struct checker_pool *cp = &checker_pool;
+	struct checker_worker_arg *wa;
+	pthread_attr_t attr;
+	unsigned int i;
+
+	cp->threads = MALLOC(nr_threads * sizeof(pthread_t));
+	if (!cp->threads)
+		return 1;
+
+	cp->generation = 0;
+	cp->pending = 0;
+	cp->abort = 0;
+	setup_thread_attr(&attr, 64 * 1024, 0);
+	for (i = 0; i < nr_threads; i++) {
+		wa = MALLOC(sizeof(*wa));
+		if (!wa)
+			break;
+		wa->id = i;
+		if (pthread_create(&cp->threads[i], &attr, checker_worker, wa)) {
+			FREE(wa);
+			break;
+		}
+		cp->nr_threads++;
+	}
+	pthread_attr_destroy(&attr);
+	if (cp->nr_threads < nr_threads) {
+		condlog(0, "failed to start checker worker threads");
+		stop_checker_pool();
+		return 1;
+	}
+	condlog(2, "started %u checker worker threads", nr_threads);
+	return 0;
+}
+
+static void
+update_checker_pool (unsigned int nr_threads)
+{
+	if (checker_pool.nr_threads == nr_threads)
+		return;
+
+	stop_checker_pool();
+	if (nr_threads)
+		start_checker_pool(nr_threads);
+}
+
+static void
+abort_checker_work (void *arg)
+{
+	struct checker_pool *cp = arg;
+
+	/*
+	 * Cancelled while waiting for the workers. Let them skip the
+	 * remaining checks, but wait for them, they still use cp->work.
+	 */
+	uatomic_set(&cp->abort, 1);
+	while (cp->pending)
+		pthread_cond_wait(&cp->done_cond, &cp->lock);
+	pthread_mutex_unlock(&cp->lock);
+}
+
+static void
+unpin_checker_work (void *arg)
+{
+	struct checker_pool *cp = arg;
+	unsigned int i;
+
+	for (i = 0; i < cp->nr_work; i++)
+		unpin_path(cp->work[i].pp);
+	cp->nr_work = 0;
+}
+
+static void
+run_checker_work (struct checker_pool *cp)
+{
+	pthread_mutex_lock(&cp->lock);
+	pthread_cleanup_push(abort_checker_work, cp);
+	cp->pending = cp->nr_threads;
+	cp->generation++;
+	pthread_cond_broadcast(&cp->start_cond);
+	while (cp->pending)
+		pthread_cond_wait(&cp->done_cond, &cp->lock);
+	pthread_cleanup_pop(0);
+	pthread_mutex_unlock(&cp->lock);
+}
+
+static unsigned int
+checker_shard (struct path * pp, unsigned int nr_shards)
+{
+	uintptr_t key = pp->mpp ? (uintptr_t)pp->mpp : (uintptr_t)pp;
+
+	/* drop the low bits, which are the same for all allocations */
+	return (unsigned int)((key >> 4) % nr_shards);
+}
+
+static void
+remove_checked_path (struct vectors * vecs, struct path * pp)
+{
+	int slot = find_slot(vecs->pathvec, (void *)pp);
+
+	if (slot != -1)
+		vector_del_slot(vecs->pathvec, slot);
+	free_path(pp);
+}
+
+/*
+ * Apply the result of a path check, like update_path_state(), and
+ * remove the path if it's gone. The topology is only marked as changed
+ * if something the show commands print has changed, so that a quiet
+ * checker pass doesn't cause the snapshot to be copied again.
+ */
+static int
+apply_path_state (struct vectors * vecs, struct path * pp, int newstate)
+{
+	struct multipath *mpp = pp->mpp;
+	int state = pp->state, dmstate = pp->dmstate;
+	int priority = pp->priority;
+	int rc;
+
+	rc = update_path_state(vecs, pp, newstate);
+	if (rc < 0) {
+		remove_checked_path(vecs, pp);
+		topology_changed(vecs);
+		return 0;
+	}
+	if (pp->mpp != mpp || pp->state != state || pp->dmstate != dmstate ||
+	    pp->priority != priority)
+		topology_changed(vecs);
+	return rc;
+}
+
+/*
+ * Take the paths whose check deadline is not after @now off the
+ * schedule, and pin them for the checker workers. Paths rescheduled with
+ * a zero interval are due again at once, so at most @left paths are
+ * taken. Caller must hold vecs->lock.
+ */
+static void
+get_checker_work (struct checker_pool *cp, const struct timespec *now,
+		  unsigned int left)
+{
+	struct checker_work *cw;
+	struct path *pp;
+	unsigned int size;
+
+	cp->nr_work = 0;
+	for (; left > 0; left--) {
+		if (cp->nr_work == cp->work_size) {
+			/* the rest is checked in the next pass */
+			size = cp->work_size ? 2 * cp->work_size : 64;
+			cw = REALLOC(cp->work, size * sizeof(*cw));
+			if (!cw)
+				break;
+			cp->work = cw;
+			cp->work_size = size;
+		}
+		if (!(pp = get_due_path(now)))
+			break;
+		if (!check_path_due(pp))
+			continue;
+		pin_path(pp);
+		cw = &cp->work[cp->nr_work++];
+		cw->pp = pp;
+		cw->shard = checker_shard(pp, cp->nr_threads);
+		cw->newstate = PATH_UNCHECKED;
+	}
+}
+
+/*
+ * Check the paths whose check deadline is not after @now, either
+ * serially, or with the checker worker pool without holding vecs->lock.
+ * This is one checker pass; the topology snapshot is republished at its
+ * end. Returns the number of paths checked.
+ */
+static int
+check_due_paths (struct vectors * vecs, const struct timespec *now)
+{
+	struct checker_pool *cp = &checker_pool;
+	struct path *pp;
+	unsigned int i, left;
+	int num_paths = 0;
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	check_gen++;
+	left = VECTOR_SIZE(vecs->pathvec);
+	if (!cp->nr_threads) {
+		start_path_msgs();
+		for (; left > 0 && (pp = get_due_path(now)); left--) {
+			if (!check_path_due(pp))
+				continue;
+			num_paths += apply_path_state(vecs, pp,
+						      get_new_path_state(pp));
+		}
+		flush_path_msgs(vecs);
+		publish_topology(vecs);
+	} else
+		get_checker_work(cp, now, left);
+	lock_cleanup_pop(vecs->lock);
+	if (!cp->nr_work)
+		return num_paths;
+
+	pthread_cleanup_push(unpin_checker_work, cp);
+	run_checker_work(cp);
+
+	pthread_cleanup_push(cleanup_lock, &vecs->lock);
+	lock(&vecs->lock);
+	pthread_testcancel();
+	start_path_msgs();
+	for (i = 0; i < cp->nr_work; i++) {
+		pp = cp->work[i].pp;
+		/* removed while it was checked */
+		if (pp->dead)
+			continue;
+		num_paths += apply_path_state(vecs, pp, cp->work[i].newstate);
+	}
+	flush_path_msgs(vecs);
+	publish_topology(vecs);
+	lock_cleanup_pop(vecs->lock);
+	pthread_cleanup_pop(1);
+	return num_paths;
+}
+
 static void *
 checkerloop (void *ap)
 {
 	struct vectors *vecs;
-	struct path *pp;
 	int count = 0;
-	unsigned int i;
-	struct itimerval timer_tick_it;
-	struct timespec last_time;
+	struct timespec last_time, next_tick;
 	struct config *conf;
 
 	pthread_cleanup_push(rcu_unregister, NULL);
 	rcu_register_thread();
+	pthread_cleanup_push(cleanup_checker_pool, NULL);
 	mlockall(MCL_CURRENT | MCL_FUTURE);
+	/* prioritizers mustn't delay the path checks */
+	prio_set_nowait(1);
 	vecs = (struct vectors *)ap;
 	condlog(2, "path checkers start up");
 
@@ -1870,72 +2807,80 @@ checkerloop (void *ap)
 		last_time.tv_sec = 0;
 	else
 		last_time.tv_sec -= 1;
+	next_tick.tv_sec = next_tick.tv_nsec = 0;
 
 	while (1) {
 		struct timespec diff_time, start_time, end_time;
-		int num_paths = 0, ticks = 0, signo, strict_timing, rc = 0;
-		sigset_t mask;
+		struct timespec deadline, path_deadline;
+		int num_paths = 0, strict_timing, rc = 0;
+		unsigned int checker_threads;
+		bool new_tick;
 
 		if (clock_gettime(CLOCK_MONOTONIC, &start_time) != 0)
-			start_time.tv_sec = 0;
-		if (start_time.tv_sec && last_time.tv_sec) {
-			timespecsub(&start_time, &last_time, &diff_time);
-			condlog(4, "tick (%lu.%06lu secs)",
-				diff_time.tv_sec, diff_time.tv_nsec / 1000);
+			start_time.tv_sec = start_time.tv_nsec = 0;
+		/*
+		 * The per-map timers are still counted in ticks of one
+		 * second. Path checks run whenever a path is due.
+		 */
+		new_tick = !start_time.tv_sec ||
+			timespeccmp(&start_time, &next_tick) >= 0;
+		if (new_tick) {
+			if (start_time.tv_sec && last_time.tv_sec) {
+				timespecsub(&start_time, &last_time,
+					    &diff_time);
+				condlog(4, "tick (%lu.%06lu secs)",
+					diff_time.tv_sec,
+					diff_time.tv_nsec / 1000);
+			}
 			last_time = start_time;
-			ticks = diff_time.tv_sec;
-		} else {
-			ticks = 1;
-			condlog(4, "tick (%d ticks)", ticks);
-		}
 #ifdef USE_SYSTEMD
-		if (use_watchdog)
-			sd_notify(0, "WATCHDOG=1");
+			if (use_watchdog)
+				sd_notify(0, "WATCHDOG=1");
 #endif
+		}
 		rc = set_config_state(DAEMON_RUNNING);
 		if (rc == ETIMEDOUT) {
 			condlog(4, "timeout waiting for DAEMON_IDLE");
 			continue;
 		}
 
-		pthread_cleanup_push(cleanup_lock, &vecs->lock);
-		lock(&vecs->lock);
-		pthread_testcancel();
-		vector_foreach_slot (vecs->pathvec, pp, i) {
-			rc = check_path(vecs, pp, ticks);
-			if (rc < 0) {
-				vector_del_slot(vecs->pathvec, i);
-				free_path(pp);
-				i--;
-			} else
-				num_paths += rc;
-		}
-		lock_cleanup_pop(vecs->lock);
-
-		pthread_cleanup_push(cleanup_lock, &vecs->lock);
-		lock(&vecs->lock);
-		pthread_testcancel();
-		defered_failback_tick(vecs->mpvec);
-		retry_count_tick(vecs->mpvec);
-		missing_uev_wait_tick(vecs);
-		ghost_delay_tick(vecs);
-		lock_cleanup_pop(vecs->lock);
-
-		if (count)
-			count--;
-		else {
+		conf = get_multipath_config();
+		checker_threads = conf->checker_threads > 0 ?
+			conf->checker_threads : 0;
+		put_multipath_config(conf);
+		update_checker_pool(checker_threads);
+
+		num_paths = check_due_paths(vecs, &start_time);
+
+		if (new_tick) {
 			pthread_cleanup_push(cleanup_lock, &vecs->lock);
 			lock(&vecs->lock);
 			pthread_testcancel();
-			condlog(4, "map garbage collection");
-			mpvec_garbage_collector(vecs);
-			count = MAPGCINT;
+			defered_failback_tick(vecs);
+			retry_count_tick(vecs);
+			missing_uev_wait_tick(vecs);
+			ghost_delay_tick(vecs);
+			/* also publishes changes made by the dm event waiters */
+			publish_topology(vecs);
 			lock_cleanup_pop(vecs->lock);
+
+			if (count)
+				count--;
+			else {
+				pthread_cleanup_push(cleanup_lock, &vecs->lock);
+				lock(&vecs->lock);
+				pthread_testcancel();
+				condlog(4, "map garbage collection");
+				mpvec_garbage_collector(vecs);
+				publish_topology(vecs);
+				count = MAPGCINT;
+				lock_cleanup_pop(vecs->lock);
+			}
 		}
 
-		diff_time.tv_nsec = 0;
-		if (start_time.tv_sec &&
-		    clock_gettime(CLOCK_MONOTONIC, &end_time) == 0) {
+		if (clock_gettime(CLOCK_MONOTONIC, &end_time) != 0)
+			end_time.tv_sec = end_time.tv_nsec = 0;
+		if (start_time.tv_sec && end_time.tv_sec) {
 			timespecsub(&end_time, &start_time, &diff_time);
 			if (num_paths) {
 				unsigned int max_checkint;
@@ -1954,42 +2899,40 @@ checkerloop (void *ap)
 						diff_time.tv_sec);
 			}
 		}
-		check_foreign();
+		if (new_tick)
+			check_foreign();
 		post_config_state(DAEMON_IDLE);
 		conf = get_multipath_config();
 		strict_timing = conf->strict_timing;
 		put_multipath_config(conf);
-		if (!strict_timing)
+
+		/*
+		 * With strict timing, the next tick starts exactly one
+		 * second after this one; otherwise one second after the
+		 * checks have finished. Paths falling due before that
+		 * wake us up early.
+		 */
+		if (new_tick) {
+			next_tick = strict_timing ? start_time : end_time;
+			next_tick.tv_sec++;
+		}
+		deadline = next_tick;
+		if (!get_next_path_deadline(&path_deadline) &&
+		    timespeccmp(&path_deadline, &deadline) < 0)
+			deadline = path_deadline;
+
+		condlog(4, "waiting until %lu.%06lu", deadline.tv_sec,
+			deadline.tv_nsec / 1000);
+		while ((rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					     &deadline, NULL)) == EINTR)
+			;
+		if (rc) {
+			condlog(3, "clock_nanosleep failed with error %d", rc);
 			sleep(1);
-		else {
-			timer_tick_it.it_interval.tv_sec = 0;
-			timer_tick_it.it_interval.tv_usec = 0;
-			if (diff_time.tv_nsec) {
-				timer_tick_it.it_value.tv_sec = 0;
-				timer_tick_it.it_value.tv_usec =
-				     1000UL * 1000 * 1000 - diff_time.tv_nsec;
-			} else {
-				timer_tick_it.it_value.tv_sec = 1;
-				timer_tick_it.it_value.tv_usec = 0;
-			}
-			setitimer(ITIMER_REAL, &timer_tick_it, NULL);
-
-			sigemptyset(&mask);
-			sigaddset(&mask, SIGALRM);
-			condlog(3, "waiting for %lu.%06lu secs",
-				timer_tick_it.it_value.tv_sec,
-				timer_tick_it.it_value.tv_usec);
-			if (sigwait(&mask, &signo) != 0) {
-				condlog(3, "sigwait failed with error %d",
-					errno);
-				conf = get_multipath_config();
-				conf->strict_timing = 0;
-				put_multipath_config(conf);
-				break;
-			}
 		}
 	}
 	pthread_cleanup_pop(1);
+	pthread_cleanup_pop(1);
 	return NULL;
 }
 
@@ -2003,17 +2946,17 @@ configure (struct vectors * vecs)
 	struct config *conf;
 	static int force_reload = FORCE_RELOAD_WEAK;
 
-	if (!vecs->pathvec && !(vecs->pathvec = vector_alloc())) {
+	if (!vecs->pathvec && !(vecs->pathvec = alloc_indexed_pathvec())) {
 		condlog(0, "couldn't allocate path vec in configure");
 		return 1;
 	}
 
-	if (!vecs->mpvec && !(vecs->mpvec = vector_alloc())) {
+	if (!vecs->mpvec && !(vecs->mpvec = alloc_indexed_mpvec())) {
 		condlog(0, "couldn't allocate multipath vec in configure");
 		return 1;
 	}
 
-	if (!(mpvec = vector_alloc())) {
+	if (!(mpvec = alloc_indexed_mpvec())) {
 		condlog(0, "couldn't allocate new maps vec in configure");
 		return 1;
 	}
@@ -2128,10 +3071,14 @@ int
 reconfigure (struct vectors * vecs)
 {
 	struct config * old, *conf;
+	time_t loaded = time(NULL);
 
 	conf = load_config(DEFAULT_CONFIGFILE);
 	if (!conf)
 		return 1;
+	/* before the command line overrides, for "multipath -u" */
+	write_config_snapshot(conf, DEFAULT_CONFIGFILE,
+			      DEFAULT_CONFIG_SNAPSHOT, loaded);
 
 	/*
 	 * free old map and path vectors ... they use old conf state
@@ -2337,7 +3284,7 @@ set_oom_adj (void)
 static int
 child (void * param)
 {
-	pthread_t check_thr, uevent_thr, uxlsnr_thr, uevq_thr;
+	pthread_t check_thr, uevent_thr, uxlsnr_thr, uevq_thr, dmevent_thr;
 	pthread_attr_t log_attr, misc_attr, uevent_attr;
 	struct vectors * vecs;
 	struct multipath * mpp;
@@ -2350,6 +3297,7 @@ child (void * param)
 	int pid_fd = -1;
 	struct config *conf;
 	char *envp;
+	time_t loaded;
 
 	mlockall(MCL_CURRENT | MCL_FUTURE);
 	signal_init();
@@ -2378,9 +3326,12 @@ child (void * param)
 	condlog(2, "--------start up--------");
 	condlog(2, "read " DEFAULT_CONFIGFILE);
 
+	loaded = time(NULL);
 	conf = load_config(DEFAULT_CONFIGFILE);
 	if (!conf)
 		goto failed;
+	write_config_snapshot(conf, DEFAULT_CONFIGFILE,
+			      DEFAULT_CONFIG_SNAPSHOT, loaded);
 
 	if (verbosity)
 		conf->verbosity = verbosity;
@@ -2437,6 +3388,16 @@ child (void * param)
 	vecs = gvecs = init_vecs();
 	if (!vecs)
 		goto failed;
+	start_path_scheduler();
+
+	if (dmevent_poll_supported()) {
+		if (init_dmevent_waiter(vecs))
+			goto failed;
+		poll_dmevents = 1;
+		condlog(3, "polling for dm events");
+	} else
+		condlog(2, "dm event polling not supported, "
+			"using one event waiter thread per map");
 
 	setscheduler();
 	set_oom_adj();
@@ -2492,6 +3453,12 @@ child (void * param)
 		condlog(0, "failed to create uevent dispatcher: %d", rc);
 		goto failed;
 	}
+	if (poll_dmevents &&
+	    (rc = pthread_create(&dmevent_thr, &misc_attr, wait_dmevents,
+				 NULL))) {
+		condlog(0, "failed to create dmevent waiter thread: %d", rc);
+		goto failed;
+	}
 	pthread_attr_destroy(&misc_attr);
 
 	while (running_state != DAEMON_SHUTDOWN) {
@@ -2508,6 +3475,8 @@ child (void * param)
 			pthread_testcancel();
 			if (!need_to_delay_reconfig(vecs)) {
 				reconfigure(vecs);
+				topology_changed(vecs);
+				publish_topology(vecs);
 			} else {
 				conf = get_multipath_config();
 				conf->delayed_reconfig = 1;
@@ -2537,11 +3506,17 @@ child (void * param)
 	pthread_cancel(uevent_thr);
 	pthread_cancel(uxlsnr_thr);
 	pthread_cancel(uevq_thr);
+	if (poll_dmevents)
+		pthread_cancel(dmevent_thr);
 
 	pthread_join(check_thr, NULL);
 	pthread_join(uevent_thr, NULL);
 	pthread_join(uxlsnr_thr, NULL);
 	pthread_join(uevq_thr, NULL);
+	if (poll_dmevents) {
+		pthread_join(dmevent_thr, NULL);
+		cleanup_dmevent_waiter();
+	}
 
 	stop_io_err_stat_thread();
 
@@ -2549,14 +3524,17 @@ child (void * param)
 	free_pathvec(vecs->pathvec, FREE_PATHS);
 	vecs->pathvec = NULL;
 	unlock(&vecs->lock);
+	stop_path_scheduler();
+	free_topology_snapshot();
 
 	pthread_mutex_destroy(&vecs->lock.mutex);
 	FREE(vecs);
 	vecs = NULL;
 
 	cleanup_foreign();
-	cleanup_checkers();
+	/* prioritizers may have I/O on the checkers' io_uring engine */
 	cleanup_prio();
+	cleanup_checkers();
 
 	dm_lib_release();
 	dm_lib_exit();
@@ -15,6 +15,24 @@ enum daemon_status {
 struct prout_param_descriptor;
 struct prin_resp;
 
+/* path state messages sent in batches by the checker */
+struct path_msg_stats {
+	unsigned long batches;
+	unsigned long messages;
+	unsigned long maps;
+	unsigned long failed;
+	unsigned long reloads;
+	unsigned int max_batch;
+};
+
+/* merged path uevents handled as one batch per WWID */
+struct uev_batch_stats {
+	unsigned long batches;
+	unsigned long paths;
+	unsigned long reloads;
+	unsigned long avoided;
+};
+
 extern pid_t daemon_pid;
 extern int uxsock_timeout;
 
@@ -39,5 +57,7 @@ void * mpath_pr_event_handler_fn (void * );
 int update_map_pr(struct multipath *mpp);
 void * mpath_pr_event_handler_fn (void * pathp );
 void handle_signals(bool);
+void get_path_msg_stats(struct path_msg_stats *stats);
+void get_uev_batch_stats(struct uev_batch_stats *stats);
 
 #endif /* MAIN_H */
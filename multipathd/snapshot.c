@@ -0,0 +1,294 @@
+/*
+ * Read-only topology snapshots for the show commands.
+ *
+ * publish_topology() copies the maps, path groups and paths under
+ * vecs->lock. The copies only keep what print.c needs; everything they
+ * don't own (udev devices, checker and prioritizer state, configlet
+ * pointers) is cleared, so a snapshot stays valid after the objects it
+ * was taken from are gone. Readers get the current snapshot with
+ * get_topology_snapshot(), and old snapshots are freed by call_rcu()
+ * once no reader can see them anymore.
+ *
+ * The snapshot records the topology generation of @vecs it was taken
+ * at. Writers bump the generation with topology_changed(), and the
+ * checker thread, the uevent dispatcher and the cli handlers call
+ * publish_topology() at the end of each checker pass, uevent batch or
+ * command, which copies the topology if the generation has changed
+ * since the last snapshot. Readers never take vecs->lock, so the show
+ * commands don't contend with the checker and uevent threads.
+ */
+#include <string.h>
+#include <libdevmapper.h>
+#include <urcu.h>
+
+#include "memory.h"
+#include "vector.h"
+#include "checkers.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "debug.h"
+
+#include "snapshot.h"
+
+static struct topology_snapshot *topology;
+
+/* returned if no snapshot could be published */
+static struct topology_snapshot empty_topology;
+
+static struct path *
+copy_path (const struct path *pp)
+{
+	struct path *cp;
+
+	cp = MALLOC(sizeof(struct path));
+	if (!cp)
+		return NULL;
+	memcpy(cp, pp, sizeof(struct path));
+	cp->udev = NULL;
+	cp->uid_attribute = NULL;
+	cp->getuid = NULL;
+	cp->prio_args = NULL;
+	memset(&cp->prio, 0, sizeof(cp->prio));
+	INIT_LIST_HEAD(&cp->prio.node);
+	strcpy(cp->prio.name, pp->prio.name);
+	strcpy(cp->prio.args, pp->prio.args);
+	memset(&cp->checker, 0, sizeof(cp->checker));
+	strcpy(cp->checker.name, pp->checker.name);
+	/* a checker worker may be writing it, don't run past the end */
+	memcpy(cp->checker.message, pp->checker.message,
+	       sizeof(cp->checker.message));
+	cp->checker.message[sizeof(cp->checker.message) - 1] = '\0';
+	cp->checker.fd = -1;
+	cp->sched_slot = -1;
+	cp->mpp = NULL;
+	cp->hwe = NULL;
+	cp->lat_stats = NULL;
+	return cp;
+}
+
+/*
+ * Replace the paths in @paths by their copies in @pathvec, and point
+ * them at @mpp.
+ */
+static vector
+copy_path_refs (const struct _vector *paths, vector pathvec,
+		struct multipath *mpp)
+{
+	struct path *pp, *cp;
+	vector v;
+	int i;
+
+	v = vector_alloc();
+	if (!v || vector_reserve(v, VECTOR_SIZE(paths))) {
+		vector_free(v);
+		return NULL;
+	}
+	vector_foreach_slot(paths, pp, i) {
+		cp = find_path_by_dev(pathvec, pp->dev);
+		if (!cp) {
+			condlog(3, "%s: path %s not in pathvec, skipping",
+				mpp->alias, pp->dev);
+			continue;
+		}
+		cp->mpp = mpp;
+		vector_alloc_slot(v);
+		vector_set_slot(v, cp);
+	}
+	return v;
+}
+
+static void
+free_multipath_copy (struct multipath *mpp)
+{
+	struct pathgroup *pgp;
+	int i;
+
+	vector_foreach_slot(mpp->pg, pgp, i) {
+		vector_free(pgp->paths);
+		FREE(pgp);
+	}
+	vector_free(mpp->pg);
+	vector_free(mpp->paths);
+	FREE_PTR(mpp->dmi);
+	FREE_PTR(mpp->alias);
+	FREE_PTR(mpp->selector);
+	FREE_PTR(mpp->features);
+	FREE_PTR(mpp->hwhandler);
+	FREE(mpp);
+}
+
+static struct multipath *
+copy_multipath (const struct multipath *mpp, vector pathvec)
+{
+	struct multipath *cp;
+	struct pathgroup *pgp, *cpgp;
+	int i;
+
+	cp = MALLOC(sizeof(struct multipath));
+	if (!cp)
+		return NULL;
+	memcpy(cp, mpp, sizeof(struct multipath));
+	cp->pgpolicyfn = NULL;
+	cp->paths = cp->pg = NULL;
+	cp->dmi = NULL;
+	cp->alias = cp->alias_prefix = cp->selector = NULL;
+	cp->features = cp->hwhandler = NULL;
+	cp->mpe = NULL;
+	cp->hwe = NULL;
+	cp->waiter = 0;
+	cp->mpcontext = NULL;
+
+	if (mpp->dmi) {
+		cp->dmi = MALLOC(sizeof(struct dm_info));
+		if (!cp->dmi)
+			goto out;
+		memcpy(cp->dmi, mpp->dmi, sizeof(struct dm_info));
+	}
+	if ((mpp->alias && !(cp->alias = STRDUP(mpp->alias))) ||
+	    (mpp->selector && !(cp->selector = STRDUP(mpp->selector))) ||
+	    (mpp->features && !(cp->features = STRDUP(mpp->features))) ||
+	    (mpp->hwhandler && !(cp->hwhandler = STRDUP(mpp->hwhandler))))
+		goto out;
+
+	if (mpp->paths &&
+	    !(cp->paths = copy_path_refs(mpp->paths, pathvec, cp)))
+		goto out;
+	if (mpp->pg) {
+		cp->pg = vector_alloc();
+		if (!cp->pg || vector_reserve(cp->pg, VECTOR_SIZE(mpp->pg)))
+			goto out;
+		vector_foreach_slot(mpp->pg, pgp, i) {
+			cpgp = MALLOC(sizeof(struct pathgroup));
+			if (!cpgp)
+				goto out;
+			memcpy(cpgp, pgp, sizeof(struct pathgroup));
+			cpgp->mpp = cp;
+			vector_alloc_slot(cp->pg);
+			vector_set_slot(cp->pg, cpgp);
+			cpgp->paths = copy_path_refs(pgp->paths, pathvec, cp);
+			if (!cpgp->paths)
+				goto out;
+		}
+	}
+	return cp;
+out:
+	free_multipath_copy(cp);
+	return NULL;
+}
+
+static void
+free_snapshot (struct topology_snapshot *ts)
+{
+	struct multipath *mpp;
+	struct path *pp;
+	int i;
+
+	vector_foreach_slot(ts->vecs.mpvec, mpp, i)
+		free_multipath_copy(mpp);
+	vector_free(ts->vecs.mpvec);
+	vector_foreach_slot(ts->vecs.pathvec, pp, i)
+		FREE(pp);
+	vector_free(ts->vecs.pathvec);
+	FREE(ts);
+}
+
+static void
+rcu_free_snapshot (struct rcu_head *head)
+{
+	free_snapshot(container_of(head, struct topology_snapshot, rcu));
+}
+
+static struct topology_snapshot *
+take_snapshot (const struct vectors *vecs)
+{
+	struct topology_snapshot *ts;
+	struct multipath *mpp, *cmpp;
+	struct path *pp, *cpp;
+	int i;
+
+	ts = MALLOC(sizeof(struct topology_snapshot));
+	if (!ts)
+		return NULL;
+	/* indexed like the originals, for the lookups of the handlers */
+	ts->vecs.pathvec = alloc_indexed_pathvec();
+	ts->vecs.mpvec = alloc_indexed_mpvec();
+	if (!ts->vecs.pathvec || !ts->vecs.mpvec ||
+	    vector_reserve(ts->vecs.pathvec, VECTOR_SIZE(vecs->pathvec)) ||
+	    vector_reserve(ts->vecs.mpvec, VECTOR_SIZE(vecs->mpvec)))
+		goto out;
+
+	vector_foreach_slot(vecs->pathvec, pp, i) {
+		cpp = copy_path(pp);
+		if (!cpp)
+			goto out;
+		vector_alloc_slot(ts->vecs.pathvec);
+		vector_set_slot(ts->vecs.pathvec, cpp);
+	}
+	vector_foreach_slot(vecs->mpvec, mpp, i) {
+		cmpp = copy_multipath(mpp, ts->vecs.pathvec);
+		if (!cmpp)
+			goto out;
+		vector_alloc_slot(ts->vecs.mpvec);
+		vector_set_slot(ts->vecs.mpvec, cmpp);
+	}
+	return ts;
+out:
+	free_snapshot(ts);
+	return NULL;
+}
+
+/*
+ * Replace the current snapshot by a copy of @vecs, unless it's up to
+ * date. Call with vecs->lock held.
+ */
+void
+publish_topology (struct vectors *vecs)
+{
+	struct topology_snapshot *ts, *old;
+	unsigned long gen = topology_gen(vecs);
+
+	/* publishers are serialized by vecs->lock */
+	old = rcu_dereference(topology);
+	if (old && old->gen == gen)
+		return;
+	ts = take_snapshot(vecs);
+	if (!ts) {
+		condlog(1, "failed to take topology snapshot, keeping the old one");
+		return;
+	}
+	ts->gen = gen;
+	rcu_assign_pointer(topology, ts);
+	if (old)
+		call_rcu(&old->rcu, rcu_free_snapshot);
+}
+
+/*
+ * Return the current snapshot. It stays valid until
+ * put_topology_snapshot() is called. Readers only hold the RCU read
+ * lock, so they run concurrently with each other and with the writers.
+ */
+struct topology_snapshot *
+get_topology_snapshot (void)
+{
+	struct topology_snapshot *ts;
+
+	rcu_read_lock();
+	ts = rcu_dereference(topology);
+	return ts ? ts : &empty_topology;
+}
+
+void
+put_topology_snapshot (struct topology_snapshot *ts)
+{
+	rcu_read_unlock();
+}
+
+void
+free_topology_snapshot (void)
+{
+	struct topology_snapshot *old;
+
+	old = rcu_xchg_pointer(&topology, NULL);
+	if (old)
+		call_rcu(&old->rcu, rcu_free_snapshot);
+}
@@ -0,0 +1,25 @@
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <urcu.h>
+#include "structs_vec.h"
+
+/*
+ * A read-only copy of the maps, path groups and paths, published with
+ * RCU. The show commands print from the snapshot instead of holding
+ * vecs->lock, so they don't delay the checker and uevent handlers. The
+ * snapshot is republished by the writers, under vecs->lock. The
+ * vecs->lock of the snapshot is unused.
+ */
+struct topology_snapshot {
+	struct vectors vecs;
+	unsigned long gen;
+	struct rcu_head rcu;
+};
+
+void publish_topology(struct vectors *vecs);
+struct topology_snapshot *get_topology_snapshot(void);
+void put_topology_snapshot(struct topology_snapshot *ts);
+void free_topology_snapshot(void);
+
+#endif /* _SNAPSHOT_H */
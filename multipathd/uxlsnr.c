@@ -19,10 +19,13 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <urcu.h>
 #include "checkers.h"
 #include "memory.h"
 #include "debug.h"
@@ -34,23 +37,72 @@
 #include "config.h"
 #include "mpath_cmd.h"
 #include "time-util.h"
+#include "util.h"
 
 #include "main.h"
 #include "cli.h"
 #include "uxlsnr.h"
 
-struct timespec sleep_time = {5, 0};
+/* timeout of epoll_pwait() in ms, to check for signals */
+#define EPOLL_TIMEOUT 5000
+#define MAX_EVENTS 64
+#define UXSOCK_WORKERS 4
+
+enum client_state {
+	CLT_RECV_LEN,
+	CLT_RECV_DATA,
+	CLT_WORK,
+	CLT_SEND,
+};
 
 struct client {
 	struct list_head node;
+	struct list_head work;
 	int fd;
+	enum client_state state;
+	bool is_root;
+	/* length of the request while receiving, of the reply while sending */
+	size_t len;
+	size_t done;
+	char *cmd;
+	char *reply;
+	int rlen;
+	struct timespec start_time;
 };
 
-#define MIN_POLLS 1023
-
 LIST_HEAD(clients);
 pthread_mutex_t client_lock = PTHREAD_MUTEX_INITIALIZER;
-struct pollfd *polls;
+
+/*
+ * Commands are run by a small pool of workers, so that a slow command
+ * or a slow client doesn't hold up the others. Read-only commands run
+ * concurrently; everything else is serialized by cmd_lock, as before.
+ */
+struct uxsock_workers {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct list_head queue;
+	struct list_head done;
+	pthread_t threads[UXSOCK_WORKERS];
+	int nr_threads;
+	int wake_fd;
+	uxsock_trigger_fn *trigger;
+	void *trigger_data;
+};
+
+static struct uxsock_workers workers = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.queue = LIST_HEAD_INIT(workers.queue),
+	.done = LIST_HEAD_INIT(workers.done),
+	.wake_fd = -1,
+};
+static pthread_mutex_t cmd_lock = PTHREAD_MUTEX_INITIALIZER;
+static int epfd = -1;
+
+/* epoll data for the listening socket and the wakeup eventfd */
+static char ux_sock_tag;
+static char wake_fd_tag;
 
 static bool _socket_client_is_root(int fd);
 
@@ -69,6 +121,24 @@ static bool _socket_client_is_root(int fd)
 	return false;
 }
 
+static bool is_read_only(const char *cmd)
+{
+	return !strncmp(cmd, "list", strlen("list")) ||
+		!strncmp(cmd, "show", strlen("show"));
+}
+
+static int watch_fd(int op, int fd, void *ptr, uint32_t events)
+{
+	struct epoll_event ev = { .events = events };
+
+	ev.data.ptr = ptr;
+	if (epoll_ctl(epfd, op, fd, &ev) == -1) {
+		condlog(1, "uxsock: epoll_ctl failed for fd %d: %d", fd, errno);
+		return 1;
+	}
+	return 0;
+}
+
 /*
  * handle a new client joining
  */
@@ -79,7 +149,7 @@ static void new_client(int ux_sock)
 	socklen_t len = sizeof(addr);
 	int fd;
 
-	fd = accept(ux_sock, &addr, &len);
+	fd = accept4(ux_sock, &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
 
 	if (fd == -1)
 		return;
@@ -91,7 +161,16 @@ static void new_client(int ux_sock)
 	}
 	memset(c, 0, sizeof(*c));
 	INIT_LIST_HEAD(&c->node);
+	INIT_LIST_HEAD(&c->work);
 	c->fd = fd;
+	c->state = CLT_RECV_LEN;
+	c->is_root = _socket_client_is_root(fd);
+
+	if (watch_fd(EPOLL_CTL_ADD, fd, c, EPOLLIN)) {
+		FREE(c);
+		close(fd);
+		return;
+	}
 
 	/* put it in our linked list */
 	pthread_mutex_lock(&client_lock);
@@ -107,7 +186,10 @@ static void _dead_client(struct client *c)
 	int fd = c->fd;
 	list_del_init(&c->node);
 	c->fd = -1;
+	FREE_PTR(c->cmd);
+	FREE_PTR(c->reply);
 	FREE(c);
+	/* closing the fd removes it from the epoll set */
 	close(fd);
 }
 
@@ -119,12 +201,6 @@ static void dead_client(struct client *c)
 	pthread_cleanup_pop(1);
 }
 
-void free_polls (void)
-{
-	if (polls)
-		FREE(polls);
-}
-
 void check_timeout(struct timespec start_time, char *inbuf,
 		   unsigned int timeout)
 {
@@ -144,22 +220,303 @@ void check_timeout(struct timespec start_time, char *inbuf,
 	}
 }
 
+static void cleanup_mutex(void *arg)
+{
+	pthread_mutex_unlock((pthread_mutex_t *)arg);
+}
+
+static void run_command(struct client *c)
+{
+	bool serialize = !is_read_only(c->cmd);
+
+	if (serialize) {
+		pthread_mutex_lock(&cmd_lock);
+		pthread_cleanup_push(cleanup_mutex, &cmd_lock);
+		workers.trigger(c->cmd, &c->reply, &c->rlen, c->is_root,
+				workers.trigger_data);
+		pthread_cleanup_pop(1);
+	} else
+		workers.trigger(c->cmd, &c->reply, &c->rlen, c->is_root,
+				workers.trigger_data);
+}
+
+static void rcu_unregister(void *param)
+{
+	rcu_unregister_thread();
+}
+
+static void *uxsock_worker(void *arg)
+{
+	struct client *c;
+	uint64_t one = 1;
+
+	pthread_cleanup_push(rcu_unregister, NULL);
+	rcu_register_thread();
+	while (1) {
+		pthread_mutex_lock(&workers.lock);
+		pthread_cleanup_push(cleanup_mutex, &workers.lock);
+		while (list_empty(&workers.queue))
+			pthread_cond_wait(&workers.cond, &workers.lock);
+		c = list_entry(workers.queue.next, struct client, work);
+		list_del_init(&c->work);
+		pthread_cleanup_pop(1);
+
+		run_command(c);
+
+		pthread_mutex_lock(&workers.lock);
+		list_add_tail(&c->work, &workers.done);
+		pthread_mutex_unlock(&workers.lock);
+		if (write(workers.wake_fd, &one, sizeof(one)) != sizeof(one))
+			condlog(1, "uxsock: failed to wake up listener: %d",
+				errno);
+	}
+	pthread_cleanup_pop(1);
+	return NULL;
+}
+
+static void stop_workers(void)
+{
+	int i;
+
+	for (i = 0; i < workers.nr_threads; i++)
+		pthread_cancel(workers.threads[i]);
+	for (i = 0; i < workers.nr_threads; i++)
+		pthread_join(workers.threads[i], NULL);
+	workers.nr_threads = 0;
+	if (workers.wake_fd != -1)
+		close(workers.wake_fd);
+	workers.wake_fd = -1;
+}
+
+static int start_workers(uxsock_trigger_fn *trigger, void *trigger_data)
+{
+	pthread_attr_t attr;
+	int i;
+
+	workers.trigger = trigger;
+	workers.trigger_data = trigger_data;
+	workers.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (workers.wake_fd == -1) {
+		condlog(0, "uxsock: failed to create eventfd: %d", errno);
+		return 1;
+	}
+	setup_thread_attr(&attr, 64 * 1024, 0);
+	for (i = 0; i < UXSOCK_WORKERS; i++) {
+		if (pthread_create(&workers.threads[i], &attr,
+				   uxsock_worker, NULL)) {
+			condlog(0, "uxsock: failed to create worker thread");
+			break;
+		}
+		workers.nr_threads++;
+	}
+	pthread_attr_destroy(&attr);
+	if (!workers.nr_threads) {
+		stop_workers();
+		return 1;
+	}
+	return 0;
+}
+
 void uxsock_cleanup(void *arg)
 {
 	struct client *client_loop;
 	struct client *client_tmp;
 	long ux_sock = (long)arg;
 
+	stop_workers();
 	close(ux_sock);
+	if (epfd != -1)
+		close(epfd);
+	epfd = -1;
 
 	pthread_mutex_lock(&client_lock);
 	list_for_each_entry_safe(client_loop, client_tmp, &clients, node) {
 		_dead_client(client_loop);
 	}
 	pthread_mutex_unlock(&client_lock);
+	INIT_LIST_HEAD(&workers.queue);
+	INIT_LIST_HEAD(&workers.done);
 
 	cli_exit();
-	free_polls();
+}
+
+/*
+ * Read as much of the request as is available.
+ * Returns 1 if the request is complete, 0 if more data is needed,
+ * and -1 if the client is gone or misbehaving.
+ */
+static int recv_request(struct client *c)
+{
+	ssize_t n;
+
+	while (1) {
+		if (c->state == CLT_RECV_LEN) {
+			n = recv(c->fd, (char *)&c->len + c->done,
+				 sizeof(c->len) - c->done, 0);
+		} else
+			n = recv(c->fd, c->cmd + c->done, c->len - c->done, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		if (n == 0)
+			return -1;
+		c->done += n;
+
+		if (c->state == CLT_RECV_LEN) {
+			if (c->done < sizeof(c->len))
+				continue;
+			c->done = 0;
+			if (c->len == 0) {
+				condlog(4, "cli[%d]: got null request", c->fd);
+				continue;
+			}
+			if (c->len > _MAX_CMD_LEN) {
+				condlog(1, "cli[%d]: request too long (%zu)",
+					c->fd, c->len);
+				return -1;
+			}
+			c->cmd = MALLOC(c->len);
+			if (!c->cmd)
+				return -1;
+			if (clock_gettime(CLOCK_MONOTONIC, &c->start_time) != 0)
+				c->start_time.tv_sec = 0;
+			c->state = CLT_RECV_DATA;
+		} else if (c->done == c->len) {
+			c->cmd[c->len - 1] = '\0';
+			return 1;
+		}
+	}
+}
+
+/*
+ * Send as much of the reply as the socket takes.
+ * Returns 1 if the reply is complete, 0 if the socket is full,
+ * and -1 on error.
+ */
+static int send_reply(struct client *c)
+{
+	size_t hdr = sizeof(c->len);
+
+	while (c->done < hdr + c->len) {
+		struct iovec iov[2];
+		struct msghdr msg;
+		ssize_t n;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		if (c->done < hdr) {
+			iov[0].iov_base = (char *)&c->len + c->done;
+			iov[0].iov_len = hdr - c->done;
+			iov[1].iov_base = c->reply;
+			iov[1].iov_len = c->len;
+			msg.msg_iovlen = 2;
+		} else {
+			iov[0].iov_base = c->reply + c->done - hdr;
+			iov[0].iov_len = hdr + c->len - c->done;
+			msg.msg_iovlen = 1;
+		}
+		n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		c->done += n;
+	}
+	return 1;
+}
+
+static void finish_request(struct client *c)
+{
+	check_timeout(c->start_time, c->cmd, uxsock_timeout);
+	FREE(c->cmd);
+	FREE_PTR(c->reply);
+	c->len = c->done = 0;
+	c->state = CLT_RECV_LEN;
+}
+
+static void handle_send(struct client *c, bool watched)
+{
+	int r = send_reply(c);
+
+	if (r < 0) {
+		dead_client(c);
+		return;
+	}
+	if (r == 0) {
+		/* wait until the socket is writable again */
+		if (watch_fd(watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+			     c->fd, c, EPOLLOUT))
+			dead_client(c);
+		return;
+	}
+	condlog(4, "cli[%d]: Reply [%d bytes]", c->fd, c->rlen);
+	finish_request(c);
+	if (watch_fd(watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+		     c->fd, c, EPOLLIN))
+		dead_client(c);
+}
+
+static void handle_recv(struct client *c)
+{
+	int r = recv_request(c);
+
+	if (r < 0) {
+		dead_client(c);
+		return;
+	}
+	if (r == 0)
+		return;
+
+	condlog(4, "cli[%d]: Got request [%s]", c->fd, c->cmd);
+	/* don't watch the client while the command is running */
+	if (watch_fd(EPOLL_CTL_DEL, c->fd, NULL, 0)) {
+		dead_client(c);
+		return;
+	}
+	c->state = CLT_WORK;
+	pthread_mutex_lock(&workers.lock);
+	list_add_tail(&c->work, &workers.queue);
+	pthread_cond_signal(&workers.cond);
+	pthread_mutex_unlock(&workers.lock);
+}
+
+/*
+ * Start sending the replies of the commands the workers have finished.
+ */
+static void handle_done(void)
+{
+	struct client *c, *tmp;
+	uint64_t val;
+	LIST_HEAD(done);
+
+	if (read(workers.wake_fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+		condlog(1, "uxsock: failed to read eventfd: %d", errno);
+
+	pthread_mutex_lock(&workers.lock);
+	list_splice_init(&workers.done, &done);
+	pthread_mutex_unlock(&workers.lock);
+
+	list_for_each_entry_safe(c, tmp, &done, work) {
+		list_del_init(&c->work);
+		if (!c->reply) {
+			finish_request(c);
+			if (watch_fd(EPOLL_CTL_ADD, c->fd, c, EPOLLIN))
+				dead_client(c);
+			continue;
+		}
+		c->state = CLT_SEND;
+		/* not every reply is a string, see "show maps binary" */
+		c->len = c->rlen > 0 ? c->rlen : strlen(c->reply) + 1;
+		c->done = 0;
+		handle_send(c, false);
+	}
 }
 
 /*
@@ -168,11 +525,8 @@ void uxsock_cleanup(void *arg)
 void * uxsock_listen(uxsock_trigger_fn uxsock_trigger, void * trigger_data)
 {
 	long ux_sock;
-	int rlen;
-	char *inbuf;
-	char *reply;
 	sigset_t mask;
-	int old_clients = MIN_POLLS;
+	struct epoll_event events[MAX_EVENTS];
 
 	ux_sock = ux_socket_listen(DEFAULT_SOCKET);
 
@@ -184,143 +538,65 @@ void * uxsock_listen(uxsock_trigger_fn uxsock_trigger, void * trigger_data)
 	pthread_cleanup_push(uxsock_cleanup, (void *)ux_sock);
 
 	condlog(3, "uxsock: startup listener");
-	polls = (struct pollfd *)MALLOC((MIN_POLLS + 1) * sizeof(struct pollfd));
-	if (!polls) {
-		condlog(0, "uxsock: failed to allocate poll fds");
-		return NULL;
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		condlog(0, "uxsock: failed to create epoll fd: %d", errno);
+		goto out;
 	}
+	if (start_workers(uxsock_trigger, trigger_data))
+		goto out;
+	if (watch_fd(EPOLL_CTL_ADD, ux_sock, &ux_sock_tag, EPOLLIN) ||
+	    watch_fd(EPOLL_CTL_ADD, workers.wake_fd, &wake_fd_tag, EPOLLIN))
+		goto out;
+
 	sigfillset(&mask);
 	sigdelset(&mask, SIGINT);
 	sigdelset(&mask, SIGTERM);
 	sigdelset(&mask, SIGHUP);
 	sigdelset(&mask, SIGUSR1);
 	while (1) {
-		struct client *c, *tmp;
-		int i, poll_count, num_clients;
-
-		/* setup for a poll */
-		pthread_mutex_lock(&client_lock);
-		num_clients = 0;
-		list_for_each_entry(c, &clients, node) {
-			num_clients++;
-		}
-		if (num_clients != old_clients) {
-			struct pollfd *new;
-			if (num_clients <= MIN_POLLS && old_clients > MIN_POLLS) {
-				new = REALLOC(polls, (1 + MIN_POLLS) *
-						sizeof(struct pollfd));
-			} else if (num_clients <= MIN_POLLS && old_clients <= MIN_POLLS) {
-				new = polls;
-			} else {
-				new = REALLOC(polls, (1+num_clients) *
-						sizeof(struct pollfd));
-			}
-			if (!new) {
-				pthread_mutex_unlock(&client_lock);
-				condlog(0, "%s: failed to realloc %d poll fds",
-					"uxsock", 1 + num_clients);
-				sched_yield();
-				continue;
-			}
-			old_clients = num_clients;
-			polls = new;
-		}
-		polls[0].fd = ux_sock;
-		polls[0].events = POLLIN;
-
-		/* setup the clients */
-		i = 1;
-		list_for_each_entry(c, &clients, node) {
-			polls[i].fd = c->fd;
-			polls[i].events = POLLIN;
-			i++;
-		}
-		pthread_mutex_unlock(&client_lock);
+		int i, n;
 
 		/* most of our life is spent in this call */
-		poll_count = ppoll(polls, i, &sleep_time, &mask);
+		n = epoll_pwait(epfd, events, MAX_EVENTS, EPOLL_TIMEOUT, &mask);
 
 		handle_signals(false);
-		if (poll_count == -1) {
+		if (n == -1) {
 			if (errno == EINTR) {
 				handle_signals(true);
 				continue;
 			}
 
 			/* something went badly wrong! */
-			condlog(0, "uxsock: poll failed with %d", errno);
+			condlog(0, "uxsock: epoll_pwait failed with %d", errno);
 			break;
 		}
 
-		if (poll_count == 0) {
-			handle_signals(true);
-			continue;
-		}
+		for (i = 0; i < n; i++) {
+			void *ptr = events[i].data.ptr;
+			struct client *c;
 
-		/* see if a client wants to speak to us */
-		for (i = 1; i < num_clients + 1; i++) {
-			if (polls[i].revents & POLLIN) {
-				struct timespec start_time;
-
-				c = NULL;
-				pthread_mutex_lock(&client_lock);
-				list_for_each_entry(tmp, &clients, node) {
-					if (tmp->fd == polls[i].fd) {
-						c = tmp;
-						break;
-					}
-				}
-				pthread_mutex_unlock(&client_lock);
-				if (!c) {
-					condlog(4, "cli%d: new fd %d",
-						i, polls[i].fd);
-					continue;
-				}
-				if (clock_gettime(CLOCK_MONOTONIC, &start_time)
-				    != 0)
-					start_time.tv_sec = 0;
-				if (recv_packet_from_client(c->fd, &inbuf,
-							    uxsock_timeout)
-				    != 0) {
-					dead_client(c);
-					continue;
-				}
-				if (!inbuf) {
-					condlog(4, "recv_packet_from_client "
-						"get null request");
-					continue;
-				}
-				condlog(4, "cli[%d]: Got request [%s]",
-					i, inbuf);
-				uxsock_trigger(inbuf, &reply, &rlen,
-					       _socket_client_is_root(c->fd),
-					       trigger_data);
-				if (reply) {
-					if (send_packet(c->fd,
-							reply) != 0) {
-						dead_client(c);
-					} else {
-						condlog(4, "cli[%d]: "
-							"Reply [%d bytes]",
-							i, rlen);
-					}
-					FREE(reply);
-					reply = NULL;
-				}
-				check_timeout(start_time, inbuf,
-					      uxsock_timeout);
-				FREE(inbuf);
+			if (ptr == &ux_sock_tag) {
+				/* see if we got a new client */
+				new_client(ux_sock);
+				continue;
+			}
+			if (ptr == &wake_fd_tag) {
+				handle_done();
+				continue;
 			}
+			c = ptr;
+			if (c->state == CLT_SEND)
+				handle_send(c, true);
+			else if (events[i].events & (EPOLLIN | EPOLLHUP |
+						     EPOLLERR))
+				handle_recv(c);
 		}
+
 		/* see if we got a non-fatal signal */
 		handle_signals(true);
-
-		/* see if we got a new client */
-		if (polls[0].revents & POLLIN) {
-			new_client(ux_sock);
-		}
 	}
-
+out:
 	pthread_cleanup_pop(1);
 	return NULL;
 }
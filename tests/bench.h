@@ -0,0 +1,36 @@
+/*
+ * Timing helpers for the benchmark tests.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+#ifndef _TESTS_BENCH_H
+#define _TESTS_BENCH_H
+
+#include <time.h>
+#include "time-util.h"
+
+static inline void bench_start(struct timespec *start)
+{
+	clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+/* seconds since bench_start(@start) */
+static inline double bench_elapsed(const struct timespec *start)
+{
+	struct timespec now, diff;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	timespecsub(&now, start, &diff);
+	return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+#endif
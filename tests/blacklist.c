@@ -0,0 +1,285 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include "memory.h"
+#include "vector.h"
+#include "structs.h"
+#include "config.h"
+#include "blacklist.h"
+#include "bench.h"
+
+#include "globals.c"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+#define BENCH_DEVNODES 20000
+
+/*
+ * A blacklist like those found on large hosts: the built-in defaults,
+ * device types nobody wants to multipath, and a few local rules.
+ */
+static const char *devnode_rules[] = {
+	"^(ram|raw|loop|fd|md|dm-|sr|scd|st|dcssblk)[0-9]",
+	"^(td|hd|vd)[a-z]",
+	"^hd[a-z]",
+	"^cciss!c[0-9]d[0-9]*",
+	"^nbd[0-9]+",
+	"^rbd[0-9]+",
+	"^zram[0-9]+",
+	"^xvd[a-z]+",
+	"^mmcblk[0-9]+",
+	"^pmem[0-9]+",
+	"^nullb[0-9]+",
+	"^ubd[a-z]",
+	"^emcpower",
+	"^scini",
+	"^drbd",
+	"^bcache",
+	"^zd",
+	"^vdisk",
+	"^sgi",
+	"^ndblk",
+	"^sda$",
+	"^sdb$",
+	"^sdc[0-9]*$",
+	"^sd[a-c][a-z]$",
+	"^nvme0n[0-9]+$",
+	"^nvme1n1$",
+	"^rssd[a-z]",
+	"^aoe",
+	"^ataraid",
+	"^ida!c[0-9]d[0-9]",
+	"^rd!c[0-9]d[0-9]",
+	"^dasd[a-z]+[0-9]*$",
+	"^vtms",
+	"^mtd[0-9]+",
+	"^ps3d[a-z]",
+	"^ubi[0-9]+_[0-9]+",
+	"^xsv",
+	"^skd[0-9]",
+	"^rsxx[0-9]",
+	"^mspblk[0-9]",
+	"^memstick",
+	"^gnbd[0-9]+",
+	"^ubblock",
+	"^virtblk",
+	"^cdrom",
+	"^floppy",
+	"^tape",
+	"^vmd",
+	"localdisk",
+	"^([a-z])\\1x",
+};
+
+static const char *devnode_exceptions[] = {
+	"^sdaa$",
+	"^sdc1$",
+	"^nvme0n7$",
+	"^vda$",
+	"^dasdz",
+};
+
+static const char *devnode_prefixes[] = {
+	"sd", "nvme%dn", "dm-", "loop", "ram", "vd", "xvd", "dasd",
+	"nbd", "sr", "rbd", "emcpower", "hd", "mmcblk", "zram", "aax",
+};
+
+static void make_devnode(int i, char *buf, size_t len)
+{
+	const char *pfx = devnode_prefixes[i % ARRAY_SIZE(devnode_prefixes)];
+	int n = i / ARRAY_SIZE(devnode_prefixes);
+
+	if (!strcmp(pfx, "nvme%dn"))
+		snprintf(buf, len, "nvme%dn%d", n % 4, n / 4);
+	else if (!strcmp(pfx, "sd") || !strcmp(pfx, "vd") ||
+		 !strcmp(pfx, "xvd") || !strcmp(pfx, "dasd") ||
+		 !strcmp(pfx, "hd"))
+		snprintf(buf, len, "%s%c%c", pfx, 'a' + n % 26,
+			 'a' + (n / 26) % 26);
+	else
+		snprintf(buf, len, "%s%d", pfx, n);
+}
+
+static void setup_blist(struct config *c)
+{
+	unsigned int i;
+
+	memset(c, 0, sizeof(*c));
+	c->blist_devnode = vector_alloc();
+	c->elist_devnode = vector_alloc();
+	c->blist_wwid = vector_alloc();
+	c->elist_wwid = vector_alloc();
+	c->blist_property = vector_alloc();
+	c->elist_property = vector_alloc();
+	assert_non_null(c->elist_property);
+	for (i = 0; i < ARRAY_SIZE(devnode_rules); i++)
+		assert_int_equal(store_ble(c->blist_devnode,
+					   STRDUP(devnode_rules[i]),
+					   ORIGIN_CONFIG), 0);
+	for (i = 0; i < ARRAY_SIZE(devnode_exceptions); i++)
+		assert_int_equal(store_ble(c->elist_devnode,
+					   STRDUP(devnode_exceptions[i]),
+					   ORIGIN_CONFIG), 0);
+	assert_int_equal(store_ble(c->blist_wwid, STRDUP("^3600508b1"),
+				   ORIGIN_CONFIG), 0);
+	assert_int_equal(store_ble(c->blist_wwid, STRDUP(".*"),
+				   ORIGIN_CONFIG), 0);
+	assert_int_equal(store_ble(c->elist_wwid, STRDUP("^36005076"),
+				   ORIGIN_CONFIG), 0);
+}
+
+static void teardown_blist(struct config *c)
+{
+	free_blacklist(c->blist_devnode);
+	free_blacklist(c->elist_devnode);
+	free_blacklist(c->blist_wwid);
+	free_blacklist(c->elist_wwid);
+	free_blacklist(c->blist_property);
+	free_blacklist(c->elist_property);
+	free_blacklist_matchers(c->blist_match);
+}
+
+static void test_devnode(void **state)
+{
+	struct config c;
+
+	setup_blist(&c);
+	assert_int_equal(compile_blacklists(&c), 0);
+	assert_non_null(c.blist_match);
+
+	assert_int_equal(filter_devnode(&c, "sdd"), MATCH_NOTHING);
+	assert_int_equal(filter_devnode(&c, "sda"), MATCH_DEVNODE_BLIST);
+	assert_int_equal(filter_devnode(&c, "sdaa"),
+			 MATCH_DEVNODE_BLIST_EXCEPT);
+	assert_int_equal(filter_devnode(&c, "loop0"), MATCH_DEVNODE_BLIST);
+	assert_int_equal(filter_devnode(&c, "loop"), MATCH_NOTHING);
+	assert_int_equal(filter_devnode(&c, "emcpowera"), MATCH_DEVNODE_BLIST);
+	assert_int_equal(filter_devnode(&c, "my-localdisk"),
+			 MATCH_DEVNODE_BLIST);
+	/* back-reference */
+	assert_int_equal(filter_devnode(&c, "aax1"), MATCH_DEVNODE_BLIST);
+	assert_int_equal(filter_devnode(&c, "abx1"), MATCH_NOTHING);
+	/* cached verdicts */
+	assert_int_equal(filter_devnode(&c, "sda"), MATCH_DEVNODE_BLIST);
+	assert_int_equal(filter_devnode(&c, "sdd"), MATCH_NOTHING);
+
+	assert_int_equal(filter_wwid(&c, "3600508b1001c", NULL),
+			 MATCH_WWID_BLIST);
+	assert_int_equal(filter_wwid(&c, "360050768", NULL),
+			 MATCH_WWID_BLIST_EXCEPT);
+	teardown_blist(&c);
+}
+
+/* The compiled matcher must agree with matching rule by rule */
+static void test_equivalence(void **state)
+{
+	struct config c;
+	char dev[32];
+	int *ref;
+	int i;
+
+	ref = MALLOC(BENCH_DEVNODES * sizeof(int));
+	assert_non_null(ref);
+	setup_blist(&c);
+	for (i = 0; i < BENCH_DEVNODES; i++) {
+		make_devnode(i, dev, sizeof(dev));
+		ref[i] = filter_devnode(&c, dev);
+	}
+	assert_int_equal(compile_blacklists(&c), 0);
+	for (i = 0; i < BENCH_DEVNODES; i++) {
+		make_devnode(i, dev, sizeof(dev));
+		assert_int_equal(filter_devnode(&c, dev), ref[i]);
+	}
+	/* again, from the verdict cache */
+	for (i = 0; i < BENCH_DEVNODES; i++) {
+		make_devnode(i, dev, sizeof(dev));
+		assert_int_equal(filter_devnode(&c, dev), ref[i]);
+	}
+	teardown_blist(&c);
+	FREE(ref);
+}
+
+/*
+ * Benchmark: filter BENCH_DEVNODES devnodes against the
+ * ARRAY_SIZE(devnode_rules) rule blacklist, entry by entry, with the
+ * compiled matcher, and from the verdict cache.
+ */
+static void test_bench(void **state)
+{
+	struct timespec start;
+	struct config c;
+	char (*devs)[32];
+	double t_list, t_compiled, t_cached;
+	int i, blacklisted = 0;
+
+	devs = MALLOC(BENCH_DEVNODES * sizeof(*devs));
+	assert_non_null(devs);
+	for (i = 0; i < BENCH_DEVNODES; i++)
+		make_devnode(i, devs[i], sizeof(devs[i]));
+	setup_blist(&c);
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_DEVNODES; i++)
+		if (filter_devnode(&c, devs[i]) > 0)
+			blacklisted++;
+	t_list = bench_elapsed(&start);
+
+	assert_int_equal(compile_blacklists(&c), 0);
+	bench_start(&start);
+	for (i = 0; i < BENCH_DEVNODES; i++)
+		filter_devnode(&c, devs[i]);
+	t_compiled = bench_elapsed(&start);
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_DEVNODES; i++)
+		filter_devnode(&c, devs[i]);
+	t_cached = bench_elapsed(&start);
+
+	printf("%d devnodes, %d rules, %d blacklisted: list %.6fs, "
+	       "compiled %.6fs, cached %.6fs\n",
+	       BENCH_DEVNODES, (int)ARRAY_SIZE(devnode_rules), blacklisted,
+	       t_list, t_compiled, t_cached);
+	teardown_blist(&c);
+	FREE(devs);
+}
+
+static int setup(void **state)
+{
+	/* keep log_filter() quiet */
+	conf.verbosity = 0;
+	return 0;
+}
+
+int test_blacklist(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_devnode),
+		cmocka_unit_test(test_equivalence),
+		cmocka_unit_test(test_bench),
+	};
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_blacklist();
+	return ret;
+}
@@ -0,0 +1,253 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cmocka.h>
+#include "memory.h"
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "config.h"
+#include "discovery.h"
+#include "configure.h"
+#include "bench.h"
+
+#include "globals.c"
+
+#define BENCH_PATHS 16384
+#define PATHS_PER_MAP 4
+#define PATH_SIZE_SECTORS 2097152ULL
+
+/*
+ * Keep coalesce_paths() away from real devices: these replace the
+ * libmultipath functions which would do I/O or talk to the kernel.
+ *
+ * This relies on ELF symbol interposition: libmultipath.so calls its
+ * own exported functions through the PLT, so the definitions in the
+ * test binary win. -Wl,--wrap can't do this, it only redirects the
+ * references of the objects being linked, not those inside the
+ * already linked library. If libmultipath is ever built with
+ * -Bsymbolic or hidden visibility, the stubs stop being called;
+ * test_coalesce() checks domap_calls to catch that.
+ */
+static int domap_calls;
+
+int pathinfo(struct path *pp, struct config *c, int mask)
+{
+	return PATHINFO_OK;
+}
+
+int sysfs_attr_get_value(struct udev_device *dev, const char *attr_name,
+			 char *value, size_t value_len)
+{
+	/* verify_paths() reads "dev" into pp->dev_t, which is set */
+	return strlen(value);
+}
+
+int domap(struct multipath *mpp, char *params, int is_daemon)
+{
+	domap_calls++;
+	if (mpp->action == ACT_REJECT)
+		return DOMAP_EXIST;
+	mpp->action = ACT_NOTHING;
+	return DOMAP_OK;
+}
+
+/*
+ * @nr paths for @nr / PATHS_PER_MAP maps, with the paths of a map spread
+ * over the whole pathvec, like paths discovered one HBA after another.
+ */
+static void make_paths(struct vectors *vecs, int nr)
+{
+	int nr_maps = nr / PATHS_PER_MAP;
+	struct path *pp;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		pp = alloc_path();
+		assert_non_null(pp);
+		snprintf(pp->dev, sizeof(pp->dev), "sd%d", i);
+		snprintf(pp->dev_t, sizeof(pp->dev_t), "%d:%d",
+			 8 + i / 256, i % 256);
+		snprintf(pp->wwid, sizeof(pp->wwid), "36005076%08d",
+			 i % nr_maps);
+		pp->state = PATH_UP;
+		pp->priority = 1;
+		pp->size = PATH_SIZE_SECTORS;
+		assert_int_equal(store_path(vecs->pathvec, pp), 0);
+	}
+}
+
+static void setup_vecs(struct vectors *vecs)
+{
+	memset(vecs, 0, sizeof(*vecs));
+	vecs->pathvec = alloc_indexed_pathvec();
+	vecs->mpvec = alloc_indexed_mpvec();
+	assert_non_null(vecs->pathvec);
+	assert_non_null(vecs->mpvec);
+}
+
+static void teardown_vecs(struct vectors *vecs, vector newmp)
+{
+	struct multipath *mpp;
+	struct path *pp;
+	int i;
+
+	vector_foreach_slot(newmp, mpp, i)
+		free_multipath(mpp, KEEP_PATHS);
+	vector_free(newmp);
+	vector_free(vecs->mpvec);
+	vector_foreach_slot(vecs->pathvec, pp, i)
+		free_path(pp);
+	vector_free(vecs->pathvec);
+}
+
+static int count_map_paths(struct multipath *mpp)
+{
+	struct pathgroup *pgp;
+	int i, nr = 0;
+
+	vector_foreach_slot(mpp->pg, pgp, i)
+		nr += VECTOR_SIZE(pgp->paths);
+	return nr;
+}
+
+/*
+ * The maps built must be those of the one-path-at-a-time algorithm:
+ * every path not yet in a map starts a map with all paths of its WWID.
+ * The map is rejected if a later path of the WWID has a different size,
+ * and the next free path of the WWID tries again.
+ */
+static void check_maps(struct vectors *vecs, vector newmp)
+{
+	struct multipath *mpp;
+	struct path *pp1, *pp2;
+	int *used;
+	int i, j, n = 0, nr, reject;
+
+	used = MALLOC(VECTOR_SIZE(vecs->pathvec) * sizeof(int));
+	assert_non_null(used);
+	vector_foreach_slot(vecs->pathvec, pp1, i) {
+		if (used[i] || !strlen(pp1->wwid))
+			continue;
+		reject = 0;
+		nr = 0;
+		vector_foreach_slot(vecs->pathvec, pp2, j) {
+			if (strcmp(pp1->wwid, pp2->wwid))
+				continue;
+			if (j > i && pp2->size != pp1->size)
+				reject = 1;
+			nr++;
+		}
+		if (reject)
+			continue;
+
+		/* setup_map() has moved the paths into the path groups */
+		mpp = VECTOR_SLOT(newmp, n);
+		assert_non_null(mpp);
+		n++;
+		assert_string_equal(mpp->wwid, pp1->wwid);
+		assert_int_equal(count_map_paths(mpp), nr);
+		vector_foreach_slot(vecs->pathvec, pp2, j) {
+			if (strcmp(pp1->wwid, pp2->wwid))
+				continue;
+			assert_ptr_equal(pp2->mpp, mpp);
+			used[j] = 1;
+		}
+	}
+	assert_int_equal(VECTOR_SIZE(newmp), n);
+	FREE(used);
+}
+
+static void test_coalesce(void **state)
+{
+	struct vectors vecs;
+	vector newmp;
+	struct path *pp;
+
+	setup_vecs(&vecs);
+	make_paths(&vecs, 64);
+	/* a path without WWID, a single path map, a size mismatch */
+	pp = VECTOR_SLOT(vecs.pathvec, 5);
+	pp->wwid[0] = '\0';
+	pp = VECTOR_SLOT(vecs.pathvec, 7);
+	snprintf(pp->wwid, sizeof(pp->wwid), "3600a0b80000single");
+	pp = VECTOR_SLOT(vecs.pathvec, 40);
+	pp->size = PATH_SIZE_SECTORS / 2;
+
+	newmp = vector_alloc();
+	assert_non_null(newmp);
+	domap_calls = 0;
+	assert_int_equal(coalesce_paths(&vecs, newmp, NULL,
+					FORCE_RELOAD_NONE, CMD_CREATE), 0);
+	/* the stubs must have replaced the library's own domap() */
+	assert_true(domap_calls >= VECTOR_SIZE(newmp));
+	check_maps(&vecs, newmp);
+	teardown_vecs(&vecs, newmp);
+}
+
+/* Benchmark: coalesce BENCH_PATHS paths into BENCH_PATHS / 4 maps */
+static void test_coalesce_bench(void **state)
+{
+	struct timespec start;
+	struct vectors vecs;
+	vector newmp;
+	double t;
+
+	setup_vecs(&vecs);
+	make_paths(&vecs, BENCH_PATHS);
+	newmp = vector_alloc();
+	assert_non_null(newmp);
+
+	bench_start(&start);
+	assert_int_equal(coalesce_paths(&vecs, newmp, NULL,
+					FORCE_RELOAD_NONE, CMD_CREATE), 0);
+	t = bench_elapsed(&start);
+
+	printf("%d paths, %d maps: coalesce_paths %.6fs\n", BENCH_PATHS,
+	       VECTOR_SIZE(newmp), t);
+	check_maps(&vecs, newmp);
+	teardown_vecs(&vecs, newmp);
+}
+
+static int setup(void **state)
+{
+	/* quiet, and no multipathd or wwids file needed */
+	conf.verbosity = 0;
+	conf.allow_queueing = 1;
+	conf.find_multipaths = 0;
+	return 0;
+}
+
+int test_coalesce_paths(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_coalesce),
+		cmocka_unit_test(test_coalesce_bench),
+	};
+	return cmocka_run_group_tests(tests, setup, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_coalesce_paths();
+	return ret;
+}
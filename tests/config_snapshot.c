@@ -0,0 +1,272 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cmocka.h>
+#include "vector.h"
+#include "structs.h"
+#include "structs_vec.h"
+#include "config.h"
+#include "blacklist.h"
+#include "strbuf.h"
+#include "print.h"
+#include "config_snapshot.h"
+
+#include "globals.c"
+
+/* snapshots of files modified within the last second aren't written */
+#define OLD_MTIME (time(NULL) - 3600)
+
+static char dir[] = "/tmp/mpsnap-XXXXXX";
+static char conf_file[PATH_MAX];
+static char conf_dir[PATH_MAX];
+static char local_conf[PATH_MAX];
+static char new_conf[PATH_MAX];
+static char snapshot[PATH_MAX];
+
+static const char conf_text[] =
+	"defaults {\n"
+	"	user_friendly_names yes\n"
+	"	config_dir %s\n"
+	"	uid_attrs \"sd:ID_SERIAL\"\n"
+	"	prio_args \"foo=bar\"\n"
+	"}\n"
+	"blacklist {\n"
+	"	devnode \"^sd[a-c]$\"\n"
+	"	wwid \"^3600508b1\"\n"
+	"	device {\n"
+	"		vendor \"HP\"\n"
+	"		product \"LOGICAL\"\n"
+	"	}\n"
+	"	property \"ID_XYZ\"\n"
+	"}\n"
+	"blacklist_exceptions {\n"
+	"	devnode \"^sdb$\"\n"
+	"	property \"(SCSI_IDENT_|ID_WWN)\"\n"
+	"	device {\n"
+	"		vendor \"IBM\"\n"
+	"	}\n"
+	"}\n"
+	"overrides {\n"
+	"	no_path_retry 12\n"
+	"}\n"
+	"devices {\n"
+	"	device {\n"
+	"		vendor \"ACME\"\n"
+	"		product \"Wid.*\"\n"
+	"		path_grouping_policy multibus\n"
+	"		prio \"const\"\n"
+	"	}\n"
+	"}\n"
+	"multipaths {\n"
+	"	multipath {\n"
+	"		wwid 3600a0b80001\n"
+	"		alias yellow\n"
+	"	}\n"
+	"}\n";
+
+static const char local_text[] =
+	"devices {\n"
+	"	device {\n"
+	"		vendor \"NETAPP\"\n"
+	"		product \"LUN.*\"\n"
+	"		no_path_retry 30\n"
+	"	}\n"
+	"}\n";
+
+static void set_mtime(const char *name, time_t mtime)
+{
+	struct timespec ts[2] = { { mtime, 0 }, { mtime, 0 } };
+
+	assert_int_equal(utimensat(AT_FDCWD, name, ts, 0), 0);
+}
+
+static void write_file(const char *name, const char *text, time_t mtime)
+{
+	FILE *f = fopen(name, "w");
+
+	assert_non_null(f);
+	fputs(text, f);
+	fclose(f);
+	set_mtime(name, mtime);
+}
+
+/* print @c the way "multipath -t" does, with @c as the current config */
+static char *print_config(struct config *c)
+{
+	struct strbuf buf = STRBUF_INIT;
+	struct config saved = conf;
+
+	conf = *c;
+	assert_true(snprint_config(c, &buf) > 0);
+	conf = saved;
+	return steal_strbuf_str(&buf);
+}
+
+/* the config files, and a snapshot of the config they make */
+static int setup_files(void **state)
+{
+	char text[sizeof(conf_text) + PATH_MAX];
+	struct config *c;
+
+	snprintf(text, sizeof(text), conf_text, conf_dir);
+	write_file(conf_file, text, OLD_MTIME);
+	write_file(local_conf, local_text, OLD_MTIME);
+	set_mtime(conf_dir, OLD_MTIME);
+
+	c = load_config(conf_file);
+	if (!c)
+		return -1;
+	if (write_config_snapshot(c, conf_file, snapshot, time(NULL))) {
+		free_config(c);
+		return -1;
+	}
+	*state = c;
+	return 0;
+}
+
+static int teardown_files(void **state)
+{
+	free_config(*state);
+	unlink(snapshot);
+	unlink(new_conf);
+	unlink(local_conf);
+	unlink(conf_file);
+	return 0;
+}
+
+static void test_roundtrip(void **state)
+{
+	struct config *c = *state, *s;
+	char *printed, *restored;
+
+	s = load_config_snapshot(conf_file, snapshot);
+	assert_non_null(s);
+	printed = print_config(c);
+	restored = print_config(s);
+	assert_string_equal(printed, restored);
+	free(printed);
+	free(restored);
+
+	/* the regexes are compiled again */
+	assert_int_equal(filter_devnode(s, "sda"), MATCH_DEVNODE_BLIST);
+	assert_int_equal(filter_devnode(s, "sdb"), MATCH_DEVNODE_BLIST_EXCEPT);
+	assert_non_null(find_hwe(s, "ACME", "Widget", "1"));
+	free_config(s);
+}
+
+static void test_other_file(void **state)
+{
+	char other[PATH_MAX];
+
+	snprintf(other, sizeof(other), "%s/other.conf", dir);
+	assert_null(load_config_snapshot(other, snapshot));
+}
+
+static void test_touched(void **state)
+{
+	set_mtime(local_conf, OLD_MTIME - 60);
+	assert_null(load_config_snapshot(conf_file, snapshot));
+}
+
+static void test_conf_added(void **state)
+{
+	write_file(new_conf, local_text, OLD_MTIME);
+	assert_null(load_config_snapshot(conf_file, snapshot));
+}
+
+static void test_removed(void **state)
+{
+	assert_int_equal(unlink(conf_file), 0);
+	assert_null(load_config_snapshot(conf_file, snapshot));
+}
+
+/* a file modified while loading may have been read before the change */
+static void test_recent(void **state)
+{
+	struct config *c = *state;
+
+	set_mtime(local_conf, time(NULL));
+	assert_int_not_equal(write_config_snapshot(c, conf_file, snapshot,
+						   time(NULL)), 0);
+	assert_int_not_equal(access(snapshot, F_OK), 0);
+}
+
+static void test_corrupt(void **state)
+{
+	struct stat st;
+	int fd;
+
+	assert_int_equal(stat(snapshot, &st), 0);
+	fd = open(snapshot, O_WRONLY);
+	assert_true(fd >= 0);
+	assert_int_equal(pwrite(fd, "x", 1, st.st_size - 2), 1);
+	close(fd);
+	assert_null(load_config_snapshot(conf_file, snapshot));
+}
+
+static int setup(void **state)
+{
+	conf.verbosity = 0;
+	if (!mkdtemp(dir))
+		return -1;
+	snprintf(conf_file, sizeof(conf_file), "%s/multipath.conf", dir);
+	snprintf(conf_dir, sizeof(conf_dir), "%s/conf.d", dir);
+	snprintf(local_conf, sizeof(local_conf), "%s/conf.d/local.conf", dir);
+	snprintf(new_conf, sizeof(new_conf), "%s/conf.d/new.conf", dir);
+	snprintf(snapshot, sizeof(snapshot), "%s/snapshot", dir);
+	return mkdir(conf_dir, 0755);
+}
+
+static int teardown(void **state)
+{
+	rmdir(conf_dir);
+	rmdir(dir);
+	return 0;
+}
+
+#define snapshot_test(f) \
+	cmocka_unit_test_setup_teardown(f, setup_files, teardown_files)
+
+int test_config_snapshot(void)
+{
+	const struct CMUnitTest tests[] = {
+		snapshot_test(test_roundtrip),
+		snapshot_test(test_other_file),
+		snapshot_test(test_touched),
+		snapshot_test(test_conf_added),
+		snapshot_test(test_removed),
+		snapshot_test(test_recent),
+		snapshot_test(test_corrupt),
+	};
+	return cmocka_run_group_tests(tests, setup, teardown);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_config_snapshot();
+	return ret;
+}
@@ -0,0 +1,160 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <cmocka.h>
+#include "memory.h"
+#include "strbuf.h"
+#include "parser.h"
+
+#include "globals.c"
+
+static void test_empty(void **state)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char *p;
+
+	assert_int_equal(get_strbuf_len(&buf), 0);
+	assert_string_equal(get_strbuf_str(&buf), "");
+	p = steal_strbuf_str(&buf);
+	assert_non_null(p);
+	assert_string_equal(p, "");
+	FREE(p);
+	reset_strbuf(&buf);
+	assert_null(buf.buf);
+}
+
+static void test_append(void **state)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char ref[2048];
+	int i;
+
+	ref[0] = '\0';
+	for (i = 0; i < 100; i++) {
+		assert_int_equal(append_strbuf_str(&buf, "0123456789"), 10);
+		strcat(ref, "0123456789");
+		assert_int_equal(get_strbuf_len(&buf), strlen(ref));
+		assert_string_equal(get_strbuf_str(&buf), ref);
+		assert_true(buf.size > buf.offs);
+	}
+	assert_int_equal(__append_strbuf_str(&buf, "abc", 2), 2);
+	assert_int_equal(get_strbuf_len(&buf), 1002);
+	assert_string_equal(get_strbuf_str(&buf) + 1000, "ab");
+	reset_strbuf(&buf);
+	assert_int_equal(get_strbuf_len(&buf), 0);
+}
+
+static void test_fill(void **state)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	assert_int_equal(fill_strbuf(&buf, 'x', 0), 0);
+	assert_int_equal(fill_strbuf(&buf, 'x', -1), 0);
+	assert_int_equal(fill_strbuf(&buf, 'x', 3), 3);
+	assert_int_equal(fill_strbuf(&buf, 'y', 1000), 1000);
+	assert_int_equal(get_strbuf_len(&buf), 1003);
+	assert_int_equal(strlen(get_strbuf_str(&buf)), 1003);
+	assert_memory_equal(get_strbuf_str(&buf), "xxxyy", 5);
+	reset_strbuf(&buf);
+}
+
+static void test_print(void **state)
+{
+	struct strbuf buf = STRBUF_INIT;
+	char ref[64], big[1000];
+	char *p;
+
+	assert_int_equal(print_strbuf(&buf, "%d-%s", 42, "foo"), 6);
+	assert_string_equal(get_strbuf_str(&buf), "42-foo");
+
+	/* doesn't fit into the space left, has to grow */
+	memset(big, 'a', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	assert_int_equal(print_strbuf(&buf, "%s", big), sizeof(big) - 1);
+	assert_int_equal(get_strbuf_len(&buf), 6 + sizeof(big) - 1);
+	assert_memory_equal(get_strbuf_str(&buf), "42-fooaaa", 9);
+	assert_int_equal(strlen(get_strbuf_str(&buf)), get_strbuf_len(&buf));
+
+	truncate_strbuf(&buf, 2);
+	assert_string_equal(get_strbuf_str(&buf), "42");
+	/* truncating beyond the end is a no-op */
+	truncate_strbuf(&buf, 10);
+	assert_string_equal(get_strbuf_str(&buf), "42");
+
+	snprintf(ref, sizeof(ref), "42%5s|%-5s|", "x", "y");
+	print_strbuf(&buf, "%5s|%-5s|", "x", "y");
+	assert_string_equal(get_strbuf_str(&buf), ref);
+
+	p = steal_strbuf_str(&buf);
+	assert_string_equal(p, ref);
+	assert_int_equal(get_strbuf_len(&buf), 0);
+	assert_null(buf.buf);
+	FREE(p);
+}
+
+static int print_long(struct config *conf, char *buf, int len,
+		      const void *data)
+{
+	return snprintf(buf, len, "%s", (const char *)data);
+}
+
+static void test_keyword(void **state)
+{
+	struct keyword kw = { .string = "key", .print = print_long };
+	struct strbuf buf = STRBUF_INIT;
+	char val[600];
+
+	append_strbuf_str(&buf, "x");
+	assert_int_equal(snprint_keyword(&buf, "\t%k %v\n", &kw, "val"), 9);
+	assert_string_equal(get_strbuf_str(&buf), "x\tkey val\n");
+
+	/* a keyword without value prints nothing at all */
+	assert_int_equal(snprint_keyword(&buf, "\t%k %v\n", &kw, ""), 0);
+	assert_string_equal(get_strbuf_str(&buf), "x\tkey val\n");
+
+	/* values longer than the scratch buffer */
+	memset(val, 'v', sizeof(val) - 1);
+	val[sizeof(val) - 1] = '\0';
+	truncate_strbuf(&buf, 0);
+	assert_int_equal(snprint_keyword(&buf, "%k=%v", &kw, val),
+			 4 + sizeof(val) - 1);
+	assert_string_equal(get_strbuf_str(&buf) + 4, val);
+	reset_strbuf(&buf);
+}
+
+int test_strbuf(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_empty),
+		cmocka_unit_test(test_append),
+		cmocka_unit_test(test_fill),
+		cmocka_unit_test(test_print),
+		cmocka_unit_test(test_keyword),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_strbuf();
+	return ret;
+}
@@ -21,15 +21,23 @@
 #include <stddef.h>
 #include <setjmp.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <cmocka.h>
 #include "list.h"
+#include "memory.h"
 #include "uevent.h"
+#include "bench.h"
 
 #include "globals.c"
 
 /* Private prototypes missing in uevent.h */
 struct uevent * alloc_uevent(void);
 void uevent_get_wwid(struct uevent *uev);
+void uevent_prepare(struct list_head *tmpq);
+void uevent_filter(struct uevent *later, struct list_head *tmpq);
+void uevent_merge(struct uevent *later, struct list_head *tmpq);
+bool uevent_need_merge(void);
+void merge_uevq(struct list_head *tmpq);
 
 /* Stringify helpers */
 #define _str_(x) #x
@@ -295,10 +303,193 @@ int test_uevent_get_XXX(void)
 	return cmocka_run_group_tests(tests, setup_uev, teardown);
 }
 
+/*
+ * Uevent bursts: path uevents for NR_KERNELS devices, which are
+ * NR_KERNELS / NR_LUNS paths of NR_LUNS LUNs, some without wwid,
+ * mixed with dm uevents. Storms are mostly path additions, which
+ * merge well.
+ */
+#define NR_KERNELS 64
+#define NR_LUNS 16
+
+static const char *actions[] = { "add", "change", "remove" };
+
+static struct uevent *make_uevent(unsigned int *seed, unsigned long seqnum,
+				  bool storm)
+{
+	struct uevent *uev = alloc_uevent();
+	int dev = rand_r(seed) % (NR_KERNELS + (storm ? 0 : 4));
+
+	assert_non_null(uev);
+	uev->seqnum = seqnum;
+	uev->kernel = uev->buffer;
+	uev->action = uev->buffer + 32;
+	if (dev >= NR_KERNELS)
+		snprintf(uev->kernel, 32, "dm-%d", dev - NR_KERNELS);
+	else
+		snprintf(uev->kernel, 32, "sd%c%c", 'a' + dev / 26,
+			 'a' + dev % 26);
+	if (storm)
+		strcpy(uev->action, rand_r(seed) % 16 ? "add" : "remove");
+	else
+		strcpy(uev->action, actions[rand_r(seed) % 3]);
+	if (dev >= NR_KERNELS || rand_r(seed) % 32) {
+		uev->envp[0] = uev->buffer + 64;
+		snprintf(uev->envp[0], 64, "ID_BOGUS=lun%d", dev % NR_LUNS);
+	}
+	return uev;
+}
+
+static void make_burst(struct list_head *q1, struct list_head *q2,
+		       unsigned int seed, int nr)
+{
+	unsigned int s1 = seed, s2 = seed;
+	bool storm = seed % 2;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		list_add_tail(&make_uevent(&s1, i, storm)->node, q1);
+		if (q2)
+			list_add_tail(&make_uevent(&s2, i, storm)->node, q2);
+	}
+}
+
+static void free_burst(struct list_head *q)
+{
+	struct uevent *uev, *tmp, *merged, *mtmp;
+
+	list_for_each_entry_safe(uev, tmp, q, node) {
+		list_for_each_entry_safe(merged, mtmp, &uev->merge_node, node)
+			FREE(merged);
+		FREE(uev);
+	}
+	INIT_LIST_HEAD(q);
+}
+
+/* merge_uevq() as it was: compare every uevent with all older ones */
+static void merge_uevq_ref(struct list_head *tmpq)
+{
+	struct uevent *later;
+
+	uevent_prepare(tmpq);
+	list_for_each_entry_reverse(later, tmpq, node) {
+		uevent_filter(later, tmpq);
+		if (uevent_need_merge())
+			uevent_merge(later, tmpq);
+	}
+}
+
+static void assert_same_list(struct list_head *l1, struct list_head *l2,
+			     bool merged)
+{
+	struct list_head *n1, *n2;
+	struct uevent *u1, *u2;
+
+	for (n1 = l1->next, n2 = l2->next; n1 != l1 && n2 != l2;
+	     n1 = n1->next, n2 = n2->next) {
+		u1 = list_entry(n1, struct uevent, node);
+		u2 = list_entry(n2, struct uevent, node);
+		assert_int_equal(u1->seqnum, u2->seqnum);
+		assert_string_equal(u1->kernel, u2->kernel);
+		assert_string_equal(u1->action, u2->action);
+		if (!merged)
+			assert_same_list(&u1->merge_node, &u2->merge_node,
+					 true);
+		else
+			assert_true(list_empty(&u1->merge_node));
+	}
+	assert_ptr_equal(n1, l1);
+	assert_ptr_equal(n2, l2);
+}
+
+static void test_merge_equivalence(void **state)
+{
+	LIST_HEAD(q1);
+	LIST_HEAD(q2);
+	unsigned int seed;
+	int nr;
+
+	for (seed = 1; seed <= 200; seed++) {
+		nr = 1 + seed * 7 % 500;
+		make_burst(&q1, &q2, seed, nr);
+		merge_uevq_ref(&q1);
+		merge_uevq(&q2);
+		assert_same_list(&q1, &q2, false);
+		free_burst(&q1);
+		free_burst(&q2);
+	}
+}
+
+static void test_merge_no_wwid(void **state)
+{
+	char *uid_attrs = conf.uid_attrs;
+	LIST_HEAD(q1);
+	LIST_HEAD(q2);
+
+	/* without uid_attrs, uevents are filtered, but not merged */
+	conf.uid_attrs = NULL;
+	make_burst(&q1, &q2, 42, 1000);
+	merge_uevq_ref(&q1);
+	merge_uevq(&q2);
+	assert_same_list(&q1, &q2, false);
+	free_burst(&q1);
+	free_burst(&q2);
+	conf.uid_attrs = uid_attrs;
+}
+
+/* Benchmark: bursts of the maximal accumulation size, and larger */
+static void test_merge_bench(void **state)
+{
+	static const int sizes[] = { 2048, 10000 };
+	struct timespec start;
+	double t_ref, t_pass;
+	LIST_HEAD(q);
+	unsigned int i, seed;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		/* odd seeds make storms */
+		for (seed = 1; seed <= 2; seed++) {
+			make_burst(&q, NULL, seed, sizes[i]);
+			bench_start(&start);
+			merge_uevq_ref(&q);
+			t_ref = bench_elapsed(&start);
+			free_burst(&q);
+
+			make_burst(&q, NULL, seed, sizes[i]);
+			bench_start(&start);
+			merge_uevq(&q);
+			t_pass = bench_elapsed(&start);
+			free_burst(&q);
+
+			printf("%d uevents (%s): pairwise %.6fs, "
+			       "single pass %.6fs\n", sizes[i],
+			       seed % 2 ? "storm" : "mixed", t_ref, t_pass);
+		}
+	}
+}
+
+static int setup_merge(void **state)
+{
+	/* keep the filter and merge messages quiet */
+	conf.verbosity = 0;
+	return 0;
+}
+
+int test_merge_uevq(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_merge_equivalence),
+		cmocka_unit_test(test_merge_no_wwid),
+		cmocka_unit_test(test_merge_bench),
+	};
+	return cmocka_run_group_tests(tests, setup_merge, NULL);
+}
+
 int main(void)
 {
 	int ret = 0;
 
 	ret += test_uevent_get_XXX();
+	ret += test_merge_uevq();
 	return ret;
 }
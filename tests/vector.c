@@ -0,0 +1,313 @@
+/*
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <cmocka.h>
+#include "memory.h"
+#include "vector.h"
+#include "bench.h"
+
+#include "globals.c"
+
+#define BENCH_ENTRIES 100000
+#define BENCH_OBJ_SIZE 64
+
+#define ptr(x) ((void *)(long)(x))
+
+static void test_alloc_slot(void **state)
+{
+	vector v = vector_alloc();
+	long i;
+	void *p;
+
+	assert_non_null(v);
+	for (i = 0; i < 100; i++) {
+		assert_non_null(vector_alloc_slot(v));
+		assert_null(VECTOR_LAST_SLOT(v));
+		vector_set_slot(v, ptr(i + 1));
+		assert_int_equal(VECTOR_SIZE(v), i + 1);
+		assert_true(v->capacity >= VECTOR_SIZE(v));
+	}
+	/* geometric growth */
+	assert_true(v->capacity < 2 * VECTOR_SIZE(v));
+	vector_foreach_slot(v, p, i)
+		assert_ptr_equal(p, ptr(i + 1));
+	assert_int_equal(i, 100);
+	vector_free(v);
+}
+
+static void test_reserve(void **state)
+{
+	vector v = vector_alloc();
+	void **slot;
+	int i;
+
+	assert_non_null(v);
+	assert_int_equal(vector_reserve(v, 64), 0);
+	assert_int_equal(v->capacity, 64);
+	assert_int_equal(VECTOR_SIZE(v), 0);
+	slot = v->slot;
+	for (i = 0; i < 64; i++) {
+		vector_alloc_slot(v);
+		vector_set_slot(v, ptr(i));
+	}
+	/* no reallocation while within the reserved capacity */
+	assert_ptr_equal(v->slot, slot);
+	/* reserving less is a no-op */
+	assert_int_equal(vector_reserve(v, 10), 0);
+	assert_int_equal(v->capacity, 64);
+	assert_int_equal(VECTOR_SIZE(v), 64);
+	assert_int_equal(vector_reserve(NULL, 10), -1);
+	vector_free(v);
+}
+
+static void test_del_slot(void **state)
+{
+	vector v = vector_alloc();
+	int i;
+
+	assert_non_null(v);
+	for (i = 0; i < 1000; i++) {
+		vector_alloc_slot(v);
+		vector_set_slot(v, ptr(i));
+	}
+	vector_del_slot(v, 0);
+	assert_int_equal(VECTOR_SIZE(v), 999);
+	assert_ptr_equal(VECTOR_SLOT(v, 0), ptr(1));
+	assert_ptr_equal(VECTOR_LAST_SLOT(v), ptr(999));
+	while (VECTOR_SIZE(v) > 1) {
+		vector_del_slot(v, VECTOR_SIZE(v) - 1);
+		assert_true(v->capacity >= VECTOR_SIZE(v));
+	}
+	/* the slot array shrinks with the vector */
+	assert_true(v->capacity <= 4);
+	assert_ptr_equal(VECTOR_SLOT(v, 0), ptr(1));
+	vector_del_slot(v, 0);
+	assert_int_equal(VECTOR_SIZE(v), 0);
+	assert_int_equal(v->capacity, 0);
+	assert_null(v->slot);
+	vector_free(v);
+}
+
+static void test_insert_slot(void **state)
+{
+	vector v = vector_alloc();
+	int i;
+
+	assert_non_null(v);
+	for (i = 0; i < 10; i++)
+		vector_insert_slot(v, 0, ptr(i));
+	for (i = 0; i < 10; i++)
+		assert_ptr_equal(VECTOR_SLOT(v, i), ptr(9 - i));
+	vector_free(v);
+}
+
+struct item {
+	char key[16];
+};
+
+static const char *item_key(const void *elem, char *buf, size_t len)
+{
+	return ((const struct item *)elem)->key;
+}
+
+static void *find_item(vector v, const char *key)
+{
+	void *elem = ptr(-1);
+
+	assert_int_equal(vector_index_find(v, item_key, key, &elem), 0);
+	return elem;
+}
+
+static void test_index(void **state)
+{
+	struct item items[200];
+	vector v = vector_alloc();
+	void *elem;
+	int i;
+
+	assert_non_null(v);
+	assert_int_equal(vector_index_find(v, item_key, "0", &elem), -1);
+	for (i = 0; i < 100; i++) {
+		snprintf(items[i].key, sizeof(items[i].key), "%d", i);
+		vector_alloc_slot(v);
+		vector_set_slot(v, &items[i]);
+	}
+	/* elements already in the vector are indexed */
+	assert_int_equal(vector_add_index(v, item_key), 0);
+	for (i = 100; i < 200; i++) {
+		snprintf(items[i].key, sizeof(items[i].key), "%d", i);
+		vector_insert_slot(v, 0, &items[i]);
+	}
+	for (i = 0; i < 200; i++) {
+		char key[16];
+
+		snprintf(key, sizeof(key), "%d", i);
+		assert_ptr_equal(find_item(v, key), &items[i]);
+	}
+	assert_null(find_item(v, "200"));
+	assert_null(find_item(v, ""));
+
+	/* removed elements can't be found anymore */
+	vector_del_slot(v, find_slot(v, &items[150]));
+	vector_del_slot(v, find_slot(v, &items[50]));
+	assert_null(find_item(v, "150"));
+	assert_null(find_item(v, "50"));
+	assert_ptr_equal(find_item(v, "151"), &items[151]);
+
+	/* elements without a key are found once they're rekeyed */
+	items[50].key[0] = '\0';
+	vector_alloc_slot(v);
+	vector_set_slot(v, &items[50]);
+	assert_null(find_item(v, "50"));
+	strcpy(items[50].key, "fifty");
+	assert_null(find_item(v, "fifty"));
+	vector_index_rekey(v, &items[50]);
+	assert_ptr_equal(find_item(v, "fifty"), &items[50]);
+
+	/* a stale entry doesn't match */
+	strcpy(items[10].key, "ten");
+	assert_null(find_item(v, "10"));
+	vector_free(v);
+}
+
+static void test_index_rekey(void **state)
+{
+	struct item items[10];
+	vector v = vector_alloc();
+	int i;
+
+	assert_non_null(v);
+	assert_int_equal(vector_add_index(v, item_key), 0);
+	for (i = 0; i < 10; i++) {
+		snprintf(items[i].key, sizeof(items[i].key), "%d", i);
+		vector_alloc_slot(v);
+		vector_set_slot(v, &items[i]);
+	}
+	strcpy(items[3].key, "three");
+	vector_index_rekey(v, &items[3]);
+	assert_null(find_item(v, "3"));
+	assert_ptr_equal(find_item(v, "three"), &items[3]);
+	assert_ptr_equal(find_item(v, "4"), &items[4]);
+
+	/* a key that's cleared goes back to the pending list */
+	items[4].key[0] = '\0';
+	vector_index_rekey(v, &items[4]);
+	assert_null(find_item(v, "4"));
+	strcpy(items[4].key, "four");
+	vector_index_rekey(v, &items[4]);
+	assert_ptr_equal(find_item(v, "four"), &items[4]);
+
+	/* rekeying an element that's not in the vector is a no-op */
+	vector_del_slot(v, find_slot(v, &items[5]));
+	vector_index_rekey(v, &items[5]);
+	assert_null(find_item(v, "5"));
+	vector_free(v);
+}
+
+/*
+ * Benchmark: build a BENCH_ENTRIES entry vector with the old
+ * one-slot-at-a-time growth, with geometric growth, and with
+ * vector_reserve(). Like pathvec, every entry is a separately
+ * allocated object, so realloc() can't simply extend the slot
+ * array in place.
+ */
+static void linear_alloc_slot(vector v)
+{
+	void *new_slot;
+
+	v->allocated++;
+	new_slot = REALLOC(v->slot, sizeof(void *) * v->allocated);
+	if (!new_slot)
+		v->allocated--;
+	else
+		v->slot = new_slot;
+}
+
+static void test_bench(void **state)
+{
+	struct timespec start;
+	struct _vector lin = { 0 };
+	vector v;
+	double t_lin, t_geo, t_res;
+	int i, cap, n_geo = 0;
+
+	bench_start(&start);
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		linear_alloc_slot(&lin);
+		lin.slot[i] = MALLOC(BENCH_OBJ_SIZE);
+	}
+	t_lin = bench_elapsed(&start);
+	assert_int_equal(lin.allocated, BENCH_ENTRIES);
+	for (i = 0; i < BENCH_ENTRIES; i++)
+		free(lin.slot[i]);
+	free(lin.slot);
+
+	v = vector_alloc();
+	assert_non_null(v);
+	bench_start(&start);
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		cap = v->capacity;
+		vector_alloc_slot(v);
+		vector_set_slot(v, MALLOC(BENCH_OBJ_SIZE));
+		if (v->capacity != cap)
+			n_geo++;
+	}
+	t_geo = bench_elapsed(&start);
+	assert_int_equal(VECTOR_SIZE(v), BENCH_ENTRIES);
+	free_strvec(v);
+
+	v = vector_alloc();
+	assert_non_null(v);
+	bench_start(&start);
+	vector_reserve(v, BENCH_ENTRIES);
+	for (i = 0; i < BENCH_ENTRIES; i++) {
+		vector_alloc_slot(v);
+		vector_set_slot(v, MALLOC(BENCH_OBJ_SIZE));
+	}
+	t_res = bench_elapsed(&start);
+	assert_int_equal(VECTOR_SIZE(v), BENCH_ENTRIES);
+	assert_int_equal(v->capacity, BENCH_ENTRIES);
+	free_strvec(v);
+
+	printf("%d entries: linear %.6fs (%d reallocs), "
+	       "geometric %.6fs (%d reallocs), reserved %.6fs (1 alloc)\n",
+	       BENCH_ENTRIES, t_lin, BENCH_ENTRIES, t_geo, n_geo, t_res);
+}
+
+int test_vector(void)
+{
+	const struct CMUnitTest tests[] = {
+		cmocka_unit_test(test_alloc_slot),
+		cmocka_unit_test(test_reserve),
+		cmocka_unit_test(test_del_slot),
+		cmocka_unit_test(test_insert_slot),
+		cmocka_unit_test(test_index),
+		cmocka_unit_test(test_index_rekey),
+		cmocka_unit_test(test_bench),
+	};
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += test_vector();
+	return ret;
+}